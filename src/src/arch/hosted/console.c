@@ -0,0 +1,89 @@
+/*
+ * console.c - ILIOS Hosted Console
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * The console of the hosted build is standard input and output. Output is
+ * buffered per line, so a chatty run doesn't turn into a system call per
+ * character.
+ *
+ */
+#include <sys/types.h>
+#include <md/console.h>
+#include "host.h"
+
+/* CONSOLE_BUF_SIZE is the number of output bytes we buffer */
+#define CONSOLE_BUF_SIZE	1024
+
+char		console_buf[CONSOLE_BUF_SIZE];
+size_t	console_len = 0;
+
+/* arch_console_flags are the CONSOLE_FLAG_xxx in effect; there is no serial
+ * port, so these don't matter */
+uint32_t arch_console_flags = 0;
+
+/*
+ * This will write out all buffered console output.
+ */
+void
+hosted_console_flush() {
+	if (console_len > 0)
+		host_write (1, console_buf, console_len);
+	console_len = 0;
+}
+
+/*
+ * This will initialize the console.
+ */
+void
+arch_console_init() {
+	console_len = 0;
+}
+
+/*
+ * This will put character [ch] on the console.
+ */
+void
+arch_console_putchar (uint8_t ch) {
+	console_buf[console_len++] = ch;
+	if ((ch == '\n') || (console_len == CONSOLE_BUF_SIZE))
+		hosted_console_flush();
+}
+
+/*
+ * This will put string [s] on the console.
+ */
+void
+arch_console_puts (const char* s) {
+	while (*s)
+		arch_console_putchar (*s++);
+}
+
+/*
+ * This will wait for a key and return it. End of input reads as a newline.
+ */
+uint8_t
+arch_console_readch() {
+	uint8_t ch;
+
+	hosted_console_flush();
+	if (host_read (0, &ch, 1) != 1)
+		return '\n';
+	return (ch == '\n') ? 0x0d : ch;
+}
+
+/*
+ * This will return whether a key is waiting. We never interrupt anything.
+ */
+uint8_t
+arch_console_peekch() {
+	return 0;
+}
+
+/*
+ * This will clear the console, which is a no-op for a stream.
+ */
+void
+arch_console_clear() {
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,51 @@
+/*
+ * cpu.c - ILIOS Hosted CPU feature detection
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * Linux has enabled everything already, so all we need to do is ask.
+ *
+ */
+#include <sys/types.h>
+#include <md/cpu.h>
+
+/* CPUID_xxx are the feature flags of CPUID function 1, in %edx */
+#define CPUID_TSC			(1 << 4)
+#define CPUID_MMX			(1 << 23)
+#define CPUID_SSE			(1 << 25)
+#define CPUID_SSE2		(1 << 26)
+
+/* CPUID_ERMS is the enhanced rep movsb/stosb flag of CPUID function 7, in %ebx */
+#define CPUID_ERMS		(1 << 9)
+
+/* arch_cpu_features are the CPU_FEATURE_xxx we may use */
+uint32_t arch_cpu_features = 0;
+
+/*
+ * This will figure out the processor features. Every processor Linux runs
+ * on in 32 bit mode knows cpuid.
+ */
+void
+arch_cpu_init() {
+	uint32_t a, b, c, d, max;
+
+	__asm __volatile ("cpuid" : "=a" (max), "=b" (b), "=c" (c), "=d" (d) : "0" (0));
+	__asm __volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "0" (1));
+	arch_cpu_features = 0;
+	if (d & CPUID_TSC)
+		arch_cpu_features |= CPU_FEATURE_TSC;
+	if (d & CPUID_MMX)
+		arch_cpu_features |= CPU_FEATURE_MMX;
+	if (d & CPUID_SSE)
+		arch_cpu_features |= CPU_FEATURE_SSE;
+	if (d & CPUID_SSE2)
+		arch_cpu_features |= CPU_FEATURE_SSE2;
+
+	/* newer processors copy faster with the string instructions */
+	if (max >= 7) {
+		__asm __volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "0" (7), "2" (0));
+		if (b & CPUID_ERMS)
+			arch_cpu_features |= CPU_FEATURE_ERMS;
+	}
+}
+
+/* vim:set ts=2 sw=2: */
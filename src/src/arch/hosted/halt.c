@@ -0,0 +1,29 @@
+/*
+ * halt.c - ILIOS Hosted Halting and rebooting code
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ */
+#include <sys/types.h>
+#include <md/reboot.h>
+#include "host.h"
+
+void hosted_console_flush();
+
+/*
+ * This will 'reboot' the machine, which ends the process.
+ */
+void
+arch_reboot() {
+	hosted_console_flush();
+	host_exit (1);
+}
+
+/*
+ * This instructs the processor to relax. There is nothing to wait for, as
+ * every device is polled.
+ */
+void
+arch_relax() {
+}
+
+/* vim:set ts=2 sw=2: */
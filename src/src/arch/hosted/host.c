@@ -0,0 +1,115 @@
+/*
+ * host.c - ILIOS Hosted Build System Calls
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This will call the Linux i386 kernel using 'int $0x80'.
+ *
+ */
+#include <sys/types.h>
+#include "host.h"
+
+#define SYS_exit					1
+#define SYS_read					3
+#define SYS_write					4
+#define SYS_open					5
+#define SYS_close					6
+#define SYS_lseek					19
+#define SYS_mmap					90
+#define SYS_clock_gettime	265
+
+#define CLOCK_MONOTONIC		1
+
+/*
+ * This will issue system call [nr] with arguments [a], [b] and [c], and
+ * return the result.
+ */
+static int
+host_syscall (int nr, uint32_t a, uint32_t b, uint32_t c) {
+	int ret;
+
+	__asm__ __volatile__ ("int $0x80"
+		: "=a" (ret)
+		: "0" (nr), "b" (a), "c" (b), "d" (c)
+		: "memory");
+	return ret;
+}
+
+/*
+ * This will terminate the process with exit code [code].
+ */
+void
+host_exit (int code) {
+	host_syscall (SYS_exit, code, 0, 0);
+	while (1);
+}
+
+/*
+ * This will open file [path] using [flags] and [mode]. It will return the
+ * descriptor, or a negative value on failure.
+ */
+int
+host_open (const char* path, int flags, int mode) {
+	return host_syscall (SYS_open, (uint32_t)path, flags, mode);
+}
+
+/*
+ * This will close descriptor [fd].
+ */
+int
+host_close (int fd) {
+	return host_syscall (SYS_close, fd, 0, 0);
+}
+
+/*
+ * This will read up to [len] bytes from [fd] to [buf].
+ */
+int
+host_read (int fd, void* buf, size_t len) {
+	return host_syscall (SYS_read, fd, (uint32_t)buf, len);
+}
+
+/*
+ * This will write [len] bytes of [buf] to [fd].
+ */
+int
+host_write (int fd, const void* buf, size_t len) {
+	return host_syscall (SYS_write, fd, (uint32_t)buf, len);
+}
+
+/*
+ * This will move the offset of [fd].
+ */
+int
+host_lseek (int fd, int offset, int whence) {
+	return host_syscall (SYS_lseek, fd, offset, whence);
+}
+
+/*
+ * This will map the first [len] bytes of [fd] read-only. It will return a
+ * pointer to the mapping, or NULL on failure.
+ */
+void*
+host_mmap (int fd, size_t len) {
+	uint32_t args[6];
+	uint32_t ret;
+
+	/* the old mmap call wants its arguments in memory */
+	args[0] = 0; args[1] = len;
+	args[2] = HOST_PROT_READ; args[3] = HOST_MAP_PRIVATE;
+	args[4] = fd; args[5] = 0;
+	ret = host_syscall (SYS_mmap, (uint32_t)args, 0, 0);
+	return (ret >= HOST_MAP_FAILED) ? NULL : (void*)ret;
+}
+
+/*
+ * This will fetch the monotonic clock into [sec] and [nsec].
+ */
+void
+host_clock (uint32_t* sec, uint32_t* nsec) {
+	uint32_t ts[2];
+
+	host_syscall (SYS_clock_gettime, CLOCK_MONOTONIC, (uint32_t)ts, 0);
+	*sec = ts[0]; *nsec = ts[1];
+}
+
+/* vim:set ts=2 sw=2: */
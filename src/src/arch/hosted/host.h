@@ -0,0 +1,38 @@
+/*
+ * host.h - ILIOS Hosted Build Host Interface
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This describes the few Linux system calls the hosted build needs. They are
+ * made directly, so no C library is involved.
+ *
+ */
+#include <sys/types.h>
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#define HOST_O_RDONLY		0
+#define HOST_O_WRONLY		1
+#define HOST_O_CREAT		0100
+#define HOST_O_TRUNC		01000
+
+#define HOST_SEEK_END		2
+
+#define HOST_PROT_READ	1
+#define HOST_MAP_PRIVATE	2
+
+/* HOST_MAP_FAILED is the largest value the kernel uses for an error */
+#define HOST_MAP_FAILED	((uint32_t)-4096)
+
+void   host_exit (int code);
+int    host_open (const char* path, int flags, int mode);
+int    host_close (int fd);
+int    host_read (int fd, void* buf, size_t len);
+int    host_write (int fd, const void* buf, size_t len);
+int    host_lseek (int fd, int offset, int whence);
+void*  host_mmap (int fd, size_t len);
+void   host_clock (uint32_t* sec, uint32_t* nsec);
+
+#endif /* __HOST_H__ */
+
+/* vim:set ts=2 sw=2: */
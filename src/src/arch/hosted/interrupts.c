@@ -0,0 +1,24 @@
+/*
+ * interrupts.c - ILIOS Hosted Interrupts
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * The hosted build has no interrupts; devices are only serviced from the main
+ * loop. We merely remember the state, so callers nest the same way.
+ *
+ */
+#include <md/interrupts.h>
+
+int arch_interrupt_state = DISABLE;
+
+/*
+ * This will turn the interrupts on or off, and return the previous state.
+ */
+int
+arch_interrupts (int state) {
+	int old = arch_interrupt_state;
+
+	arch_interrupt_state = state;
+	return old;
+}
+
+/* vim:set ts=2 sw=2: */
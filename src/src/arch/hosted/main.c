@@ -0,0 +1,223 @@
+/*
+ * main.c - ILIOS Hosted Main
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This runs the network stack as an ordinary Linux process, which makes it
+ * possible to benchmark and profile it against recorded traffic:
+ *
+ *   ilios-hosted [-c script] [-a script] [-r rounds] name=in.pcap[:out.pcap] ...
+ *
+ * Every name=in.pcap argument creates a device [name] that replays capture
+ * [in.pcap], [rounds] times over, and writes whatever the stack transmits on
+ * it to [out.pcap]. The commands in the -c script are run before the replay,
+ * for example to bind addresses and add routes, and the -a script is run
+ * afterwards, for example to show the statistics.
+ *
+ */
+#include <sys/types.h>
+#include <sys/kmalloc.h>
+#include <sys/network.h>
+#include <sys/device.h>
+#include <sys/prof.h>
+#include <sys/tty.h>
+#include <sys/irq.h>
+#include <sys/dispatch.h>
+#include <cli/cli.h>
+#include <netipv4/ipv4.h>
+#include <lib/lib.h>
+#include <md/cpu.h>
+#include <md/memory.h>
+#include <md/timer.h>
+#include <net/dhcp.h>
+#include <net/dns.h>
+#include "host.h"
+#include "pcap.h"
+#include "../../version.h"
+
+/* HOSTED_MAX_DEVICES is the number of capture devices we support */
+#define HOSTED_MAX_DEVICES	8
+
+void hosted_console_flush();
+void hosted_timer();
+
+struct DEVICE* hosted_dev[HOSTED_MAX_DEVICES];
+int hosted_numdevs = 0;
+
+/*
+ * This will run the commands in file [fname], one per line. Empty lines and
+ * lines starting with a '#' are skipped. It will return zero if a command
+ * failed, or non-zero if all went well.
+ */
+int
+hosted_run_script (char* fname) {
+	char* buf;
+	char* line;
+	char* ptr;
+	int fd, size, ok = 1;
+
+	/* read the entire file */
+	fd = host_open (fname, HOST_O_RDONLY, 0);
+	if (fd < 0) {
+		kprintf ("%s: cannot open\n", fname);
+		return 0;
+	}
+	size = host_lseek (fd, 0, HOST_SEEK_END);
+	host_lseek (fd, 0, 0);
+	buf = (char*)kmalloc (NULL, size + 1, 0);
+	if ((buf == NULL) || (host_read (fd, buf, size) != size)) {
+		kprintf ("%s: cannot read\n", fname);
+		if (buf != NULL)
+			kfree (buf);
+		host_close (fd);
+		return 0;
+	}
+	host_close (fd);
+	buf[size] = 0;
+
+	/* handle it line by line */
+	for (line = buf; ok && (*line != 0); line = ptr) {
+		ptr = kstrchr (line, '\n');
+		if (ptr != NULL)
+			*ptr++ = 0;
+		else
+			ptr = line + kstrlen (line);
+
+		if ((*line == 0) || (*line == '#'))
+			continue;
+		kprintf ("> %s\n", line);
+		ok = cli_handle_cmd (line);
+	}
+
+	kfree (buf);
+	return ok;
+}
+
+/*
+ * This will create a capture device as described by [spec], which is
+ * name=in.pcap[:out.pcap]. It will return zero on failure or non-zero on
+ * success.
+ */
+int
+hosted_attach (char* spec, int rounds) {
+	char* input;
+	char* output;
+	struct DEVICE* dev;
+
+	/* split the specification */
+	input = kstrchr (spec, '=');
+	if (input == NULL) {
+		kprintf ("%s: expected name=in.pcap[:out.pcap]\n", spec);
+		return 0;
+	}
+	*input++ = 0;
+	output = kstrchr (input, ':');
+	if (output != NULL)
+		*output++ = 0;
+
+	dev = pcap_attach (spec, input, output, rounds);
+	if (dev == NULL)
+		return 0;
+	hosted_dev[hosted_numdevs++] = dev;
+	return 1;
+}
+
+/*
+ * This will replay all captures, and report how long the stack took.
+ */
+void
+hosted_replay() {
+	unsigned long long start, now;
+	uint32_t ms, frames = 0;
+	int i, active;
+
+	start = arch_tsc_read();
+	do {
+		hosted_timer();
+
+		/* keep going until every device is done and nothing is left */
+		active = 0;
+		for (i = 0; i < hosted_numdevs; i++)
+			active |= pcap_active (hosted_dev[i]);
+	} while (network_handle_queue() || active);
+	now = arch_tsc_read();
+
+	for (i = 0; i < hosted_numdevs; i++)
+		frames += ((struct PCAP_DATA*)hosted_dev[i]->data)->replayed;
+
+	/* report */
+	ms = prof_div (now - start, arch_tsc_khz);
+	if (ms == 0)
+		ms = 1;
+	kprintf ("%u frames in %u ms: %u pps\n", frames, ms,
+		prof_div ((unsigned long long)frames * 1000, ms));
+	for (i = 0; i < hosted_numdevs; i++)
+		kprintf ("%s: %u frames in, %u frames out\n", hosted_dev[i]->name,
+			hosted_dev[i]->rx_frames, hosted_dev[i]->tx_frames);
+}
+
+/*
+ * This is the 'main' function of the hosted build.
+ */
+int
+hosted_main (int argc, char** argv) {
+	char* spec[HOSTED_MAX_DEVICES];
+	char* script = NULL;
+	char* after = NULL;
+	int i, numspecs = 0, rounds = 1, ok = 1;
+
+	/* bring everything up, just like kmain() does */
+	irq_init();
+	tty_init();
+	kmalloc_init();
+	arch_add_all_memory();
+	arch_cpu_init();
+	arch_tsc_init();
+	dispatch_init();
+	network_init();
+	ipv4_init();
+	dhcp_init();
+	dns_init();
+	kprintf (VERSION" (hosted)\n");
+
+	/* handle the arguments */
+	for (i = 1; ok && (i < argc); i++) {
+		if ((!kstrcmp (argv[i], "-c")) && (i + 1 < argc))
+			script = argv[++i];
+		else if ((!kstrcmp (argv[i], "-a")) && (i + 1 < argc))
+			after = argv[++i];
+		else if ((!kstrcmp (argv[i], "-r")) && (i + 1 < argc))
+			rounds = strtol (argv[++i], NULL, 10);
+		else if ((*argv[i] == '-') || (numspecs == HOSTED_MAX_DEVICES))
+			ok = 0;
+		else
+			spec[numspecs++] = argv[i];
+	}
+	if ((!ok) || (numspecs == 0) || (rounds < 1)) {
+		kprintf ("usage: %s [-c script] [-a script] [-r rounds] name=in.pcap[:out.pcap] ...\n", argv[0]);
+		hosted_console_flush();
+		return 1;
+	}
+
+	/* create the devices */
+	for (i = 0; i < numspecs; i++)
+		if (!hosted_attach (spec[i], rounds)) {
+			hosted_console_flush();
+			return 1;
+		}
+
+	/* set up, go and look back */
+	if ((script != NULL) && (!hosted_run_script (script)))
+		ok = 0;
+	if (ok)
+		hosted_replay();
+	if ((ok) && (after != NULL) && (!hosted_run_script (after)))
+		ok = 0;
+
+	/* write everything out */
+	for (i = 0; i < hosted_numdevs; i++)
+		pcap_flush (hosted_dev[i]);
+	hosted_console_flush();
+	return ok ? 0 : 1;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,26 @@
+/*
+ * memory.c - ILIOS Hosted Memory Add code
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * The hosted build hands kmalloc() a fixed arena in the process image.
+ *
+ */
+#include <sys/types.h>
+#include <sys/kmalloc.h>
+#include <md/config.h>
+#include <md/memory.h>
+
+/* HOSTED_MEMORY_SIZE is the number of bytes kmalloc() may hand out */
+#define HOSTED_MEMORY_SIZE	(64 * 1024 * 1024)
+
+uint8_t hosted_memory[HOSTED_MEMORY_SIZE] __attribute__((aligned (PAGESIZE)));
+
+/*
+ * This will add the arena using kmalloc_addregion().
+ */
+void
+arch_add_all_memory() {
+	kmalloc_addregion ((addr_t)hosted_memory, HOSTED_MEMORY_SIZE, 0);
+}
+
+/* vim:set ts=2 sw=2: */
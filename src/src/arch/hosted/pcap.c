@@ -0,0 +1,298 @@
+/*
+ * pcap.c - ILIOS Hosted Capture File Device
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This is a network device backed by capture files in the pcap format. It
+ * always polls: every pass of the main loop, it feeds as many frames of the
+ * input capture as the budget allows to the stack, exactly like a card whose
+ * receive interrupts are masked. Transmitted frames are written to the output
+ * capture.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/network.h>
+#include <sys/kmalloc.h>
+#include <lib/lib.h>
+#include "host.h"
+#include "pcap.h"
+
+/* pcap_devno is used to give every device its own ethernet address */
+uint8_t pcap_devno = 0;
+
+/*
+ * This will fetch the 32 bit value at [p] of the input of [pd].
+ */
+static uint32_t
+pcap_get32 (struct PCAP_DATA* pd, uint8_t* p) {
+	if (pd->swapped)
+		return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	return (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/*
+ * This will write all pending output of [pd] to the output capture.
+ */
+static void
+pcap_write_out (struct PCAP_DATA* pd) {
+	if (pd->out_len > 0)
+		host_write (pd->out_fd, pd->out_buf, pd->out_len);
+	pd->out_len = 0;
+}
+
+/*
+ * This will append [len] bytes of [data] to the output capture of [pd].
+ */
+static void
+pcap_append (struct PCAP_DATA* pd, void* data, size_t len) {
+	if (pd->out_len + len > PCAP_OUTBUF_SIZE)
+		pcap_write_out (pd);
+	kmemcpy (pd->out_buf + pd->out_len, data, len);
+	pd->out_len += len;
+}
+
+/*
+ * This will write all frames waiting on device [dev] to the output capture.
+ */
+void
+pcap_xmit (struct DEVICE* dev) {
+	struct PCAP_DATA* pd = (struct PCAP_DATA*)dev->data;
+	struct NETPACKET* pkt;
+	uint32_t hdr[4], sec, nsec;
+
+	for (;;) {
+		/* fetch the packet */
+		pkt = network_get_next_txbuf (dev);
+		if (pkt == NULL)
+			/* no packet. leave */
+			return;
+
+		/* store it, if we have somewhere to do so */
+		if (pd->out_fd >= 0) {
+			host_clock (&sec, &nsec);
+			hdr[0] = sec; hdr[1] = nsec / 1000;
+			hdr[2] = pkt->len + pkt->header_len; hdr[3] = hdr[2];
+			pcap_append (pd, hdr, sizeof (hdr));
+			pcap_append (pd, pkt->frame, hdr[2]);
+		}
+
+		/* update the statistics and get rid of the packet */
+		dev->tx_frames++; dev->tx_bytes += pkt->len + pkt->header_len;
+		network_free_packet (pkt);
+	}
+}
+
+/*
+ * This will feed at most [budget] frames of the input capture of [dev] to the
+ * stack, and return the number fed. Once the input is exhausted and no passes
+ * remain, the device stops polling.
+ */
+int
+pcap_poll (struct DEVICE* dev, int budget) {
+	struct PCAP_DATA* pd = (struct PCAP_DATA*)dev->data;
+	struct NETPACKET* pkt;
+	uint8_t* rec;
+	uint32_t len;
+	int num = 0;
+
+	while (num < budget) {
+		/* at the end of the input? */
+		if (pd->in_offs + PCAP_REC_HDR_LEN > pd->in_size) {
+			/* yes. start over if we need more passes, otherwise we are done */
+			if (--pd->rounds > 0) {
+				pd->in_offs = PCAP_FILE_HDR_LEN;
+				continue;
+			}
+			dev->flags &= ~DEVICE_FLAG_POLLING;
+			break;
+		}
+
+		/* fetch the record; a truncated or corrupt one ends the input */
+		rec = pd->in + pd->in_offs;
+		len = pcap_get32 (pd, rec + 8);
+		if ((len > pd->in_size - pd->in_offs - PCAP_REC_HDR_LEN) || (len > pd->snaplen)) {
+			pd->in_offs = pd->in_size;
+			continue;
+		}
+		pd->in_offs += PCAP_REC_HDR_LEN + len;
+
+		/* frames a card wouldn't hand us are dropped */
+		if ((len < sizeof (ETHERNET_HEADER)) || (len > NETWORK_MAX_PACKET_LEN)) {
+			network_drop (dev, NETWORK_DROP_RXERROR);
+			continue;
+		}
+
+		/* grab a buffer. if there is none, the frame is lost, as on the wire */
+		pkt = network_alloc_packet (dev);
+		if (pkt == NULL)
+			continue;
+
+		/* copy the frame over and hand it to the stack */
+		network_copy_frame (pkt, 0, rec + PCAP_REC_HDR_LEN, len);
+		pkt->len = len - sizeof (ETHERNET_HEADER);
+		dev->rx_frames++; dev->rx_bytes += len;
+		network_queue_packet (dev, pkt);
+		pd->replayed++; num++;
+	}
+
+	return num;
+}
+
+/*
+ * This will open capture [input], and set up [pd] to replay it. It will
+ * return zero on failure or non-zero on success.
+ */
+static int
+pcap_open_input (struct PCAP_DATA* pd, char* input) {
+	uint32_t magic, linktype;
+	int fd, size;
+
+	/* map the entire file */
+	fd = host_open (input, HOST_O_RDONLY, 0);
+	if (fd < 0) {
+		kprintf ("%s: cannot open\n", input);
+		return 0;
+	}
+	size = host_lseek (fd, 0, HOST_SEEK_END);
+	if (size < PCAP_FILE_HDR_LEN) {
+		kprintf ("%s: not a capture file\n", input);
+		host_close (fd);
+		return 0;
+	}
+	pd->in = (uint8_t*)host_mmap (fd, size);
+	host_close (fd);
+	if (pd->in == NULL) {
+		kprintf ("%s: cannot map\n", input);
+		return 0;
+	}
+	pd->in_size = size;
+
+	/* figure out the byte order; the timestamp resolution doesn't matter */
+	magic = pcap_get32 (pd, pd->in);
+	if ((magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NSEC)) {
+		pd->swapped = 1;
+		magic = pcap_get32 (pd, pd->in);
+		if ((magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NSEC)) {
+			kprintf ("%s: not a capture file\n", input);
+			return 0;
+		}
+	}
+
+	/* we only know ethernet */
+	linktype = pcap_get32 (pd, pd->in + 20);
+	if (linktype != PCAP_LINKTYPE_ETHERNET) {
+		kprintf ("%s: link type %u isn't ethernet\n", input, linktype);
+		return 0;
+	}
+
+	/* records can't be larger than the snapshot length */
+	pd->snaplen = pcap_get32 (pd, pd->in + 16);
+	if (pd->snaplen == 0)
+		pd->snaplen = PCAP_SNAPLEN;
+
+	pd->in_offs = PCAP_FILE_HDR_LEN;
+	return 1;
+}
+
+/*
+ * This will create capture [output] for [pd]. It will return zero on failure
+ * or non-zero on success.
+ */
+static int
+pcap_open_output (struct PCAP_DATA* pd, char* output) {
+	uint32_t hdr[6];
+
+	pd->out_buf = (uint8_t*)kmalloc (NULL, PCAP_OUTBUF_SIZE, 0);
+	if (pd->out_buf == NULL)
+		return 0;
+	pd->out_fd = host_open (output, HOST_O_WRONLY | HOST_O_CREAT | HOST_O_TRUNC, 0644);
+	if (pd->out_fd < 0) {
+		kprintf ("%s: cannot create\n", output);
+		kfree (pd->out_buf);
+		return 0;
+	}
+
+	/* write the file header */
+	hdr[0] = PCAP_MAGIC;
+	hdr[1] = PCAP_VERSION_MAJOR | (PCAP_VERSION_MINOR << 16);
+	hdr[2] = 0; hdr[3] = 0;
+	hdr[4] = PCAP_SNAPLEN; hdr[5] = PCAP_LINKTYPE_ETHERNET;
+	pcap_append (pd, hdr, sizeof (hdr));
+	return 1;
+}
+
+/*
+ * This will create device [name], which replays capture [input] [rounds]
+ * times and writes the frames it transmits to capture [output], if that isn't
+ * NULL. It will return the device on success or NULL on failure.
+ */
+struct DEVICE*
+pcap_attach (char* name, char* input, char* output, int rounds) {
+	struct DEVICE dev;
+	struct DEVICE* devptr;
+	struct PCAP_DATA* pd;
+
+	/* set up our data */
+	pd = (struct PCAP_DATA*)kmalloc (NULL, sizeof (struct PCAP_DATA), 0);
+	if (pd == NULL)
+		return NULL;
+	kmemset (pd, 0, sizeof (struct PCAP_DATA));
+	pd->out_fd = -1;
+	pd->rounds = rounds;
+	if (!pcap_open_input (pd, input)) {
+		kfree (pd);
+		return NULL;
+	}
+	if ((output != NULL) && (!pcap_open_output (pd, output))) {
+		kfree (pd);
+		return NULL;
+	}
+
+	/* register the device; it polls from the start */
+	kmemset (&dev, 0, sizeof (struct DEVICE));
+	dev.name = name;
+	dev.data = pd;
+	dev.xmit = pcap_xmit;
+	dev.poll = pcap_poll;
+	dev.flags = DEVICE_FLAG_POLLING;
+	dev.addr_len = ETHER_ADDR_LEN;
+	devptr = device_register (&dev);
+	if (devptr == NULL) {
+		kprintf ("%s: unable to register device!\n", name);
+		if (pd->out_fd >= 0) {
+			host_close (pd->out_fd);
+			kfree (pd->out_buf);
+		}
+		kfree (pd);
+		return NULL;
+	}
+
+	/* use a locally administered address */
+	kmemset (devptr->ether.hw_addr, 0, ETHER_ADDR_LEN);
+	devptr->ether.hw_addr[0] = 0x02;
+	devptr->ether.hw_addr[5] = ++pcap_devno;
+
+	return devptr;
+}
+
+/*
+ * This will write everything device [dev] has transmitted to its output
+ * capture.
+ */
+void
+pcap_flush (struct DEVICE* dev) {
+	struct PCAP_DATA* pd = (struct PCAP_DATA*)dev->data;
+
+	if (pd->out_fd >= 0)
+		pcap_write_out (pd);
+}
+
+/*
+ * This will return non-zero if device [dev] still has input to replay.
+ */
+int
+pcap_active (struct DEVICE* dev) {
+	return (dev->flags & DEVICE_FLAG_POLLING) ? 1 : 0;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,50 @@
+/*
+ * pcap.h - ILIOS Hosted Capture File Device
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+
+#ifndef __PCAP_H__
+#define __PCAP_H__
+
+#define PCAP_MAGIC				0xa1b2c3d4	/* microsecond timestamps */
+#define PCAP_MAGIC_NSEC		0xa1b23c4d	/* nanosecond timestamps */
+#define PCAP_VERSION_MAJOR	2
+#define PCAP_VERSION_MINOR	4
+#define PCAP_SNAPLEN			65535
+#define PCAP_LINKTYPE_ETHERNET	1
+
+#define PCAP_FILE_HDR_LEN	24
+#define PCAP_REC_HDR_LEN	16
+
+/* PCAP_OUTBUF_SIZE is the number of bytes we collect before writing */
+#define PCAP_OUTBUF_SIZE	(64 * 1024)
+
+/*
+ * PCAP_DATA is the device specific data of a capture file device. The input
+ * capture is mapped as a whole and fed to the stack by the poll function;
+ * everything the stack transmits is appended to the output capture.
+ */
+struct PCAP_DATA {
+	uint8_t*	in;					/* mapped input capture */
+	size_t		in_size;		/* its size in bytes */
+	size_t		in_offs;		/* offset of the next record */
+	uint32_t	snaplen;		/* no record of the input is larger */
+	int				swapped;		/* input was written on the other endianness */
+	int				rounds;			/* number of passes left over the input */
+	uint32_t	replayed;		/* frames fed to the stack */
+
+	int				out_fd;			/* output capture, or -1 */
+	uint8_t*	out_buf;		/* pending output */
+	size_t		out_len;		/* bytes of pending output */
+};
+
+struct DEVICE* pcap_attach (char* name, char* input, char* output, int rounds);
+void pcap_flush (struct DEVICE* dev);
+int  pcap_active (struct DEVICE* dev);
+
+#endif /* __PCAP_H__ */
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,67 @@
+/*
+ * pio.c - ILIOS Hosted I/O ports
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * A user process cannot touch I/O ports. Reads return all ones, as an empty
+ * ISA bus would, so probing drivers simply find nothing.
+ *
+ */
+#include <sys/types.h>
+#include <lib/lib.h>
+#include <md/pio.h>
+
+inline void
+outb (uint16_t port, uint8_t data) {
+}
+
+inline void
+outw (uint16_t port, uint16_t data) {
+}
+
+inline void
+outd (uint16_t port, uint32_t data) {
+}
+
+inline uint8_t
+inb (uint16_t port) {
+	return 0xff;
+}
+
+inline uint16_t
+inw (uint16_t port) {
+	return 0xffff;
+}
+
+inline uint32_t
+ind (uint16_t port) {
+	return 0xffffffff;
+}
+
+inline void
+insb (uint16_t port, void* addr, size_t cnt) {
+	kmemset (addr, 0xff, cnt);
+}
+
+inline void
+insw (uint16_t port, void* addr, size_t cnt) {
+	kmemset (addr, 0xff, cnt * 2);
+}
+
+inline void
+insd (uint16_t port, void* addr, size_t cnt) {
+	kmemset (addr, 0xff, cnt * 4);
+}
+
+inline void
+outsb (uint16_t port, void* addr, size_t cnt) {
+}
+
+inline void
+outsw (uint16_t port, void* addr, size_t cnt) {
+}
+
+inline void
+outsd (uint16_t port, void* addr, size_t cnt) {
+}
+
+/* vim:set ts=2 sw=2: */
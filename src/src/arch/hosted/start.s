@@ -0,0 +1,31 @@
+/*
+ * start.s - ILIOS Hosted Build Entry Point
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * Linux starts us with [argc] on top of the stack, followed by the [argv]
+ * pointers. This hands both to hosted_main() and exits with its result.
+ *
+ */
+.file		"start.s"
+
+.text
+.global _start
+
+_start:
+		/* eax = argv, -4(eax) = argc */
+		movl	%esp, %eax
+		addl	$4, %eax
+
+		/* keep the stack aligned, as gcc wants it */
+		andl	$0xfffffff0, %esp
+		subl	$8, %esp
+
+		/* hosted_main (argc, argv) */
+		pushl	%eax
+		pushl	-4(%eax)
+		call	hosted_main
+
+		/* host_exit (result) */
+		pushl	%eax
+		call	host_exit
+		hlt
@@ -0,0 +1,118 @@
+/*
+ * timer.c - ILIOS Hosted Timer Code
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * Time in the hosted build comes from the host's monotonic clock. Instead of
+ * a timer interrupt, the main loop calls hosted_timer() to run the periodic
+ * work.
+ *
+ */
+#include <sys/types.h>
+#include <md/config.h>
+#include <md/timer.h>
+#include <sys/shaper.h>
+#include <netipv4/ipv4.h>
+#include "host.h"
+
+/* arch_tsc_khz is the number of TSC cycles per millisecond, zero if none */
+uint32_t arch_tsc_khz = 0;
+
+/* timer_base is the host time at which we started, timecnt the seconds since */
+uint32_t timer_base = 0;
+uint32_t timecnt = 0;
+
+/* timer_tick_ms is the host time of the last timer tick, in milliseconds */
+uint32_t timer_tick_ms = 0;
+
+/*
+ * This will return the number of milliseconds the host clock is at.
+ */
+static uint32_t
+hosted_clock_ms() {
+	uint32_t sec, nsec;
+
+	host_clock (&sec, &nsec);
+	return (sec * 1000) + (nsec / 1000000);
+}
+
+/*
+ * This will call the IPv4 tick handler once for every second that passed since
+ * the last call, and the shaper tick handler once for every timer tick.
+ */
+void
+hosted_timer() {
+	uint32_t sec, nsec, ms;
+
+	host_clock (&sec, &nsec);
+	while (timecnt < sec - timer_base) {
+		timecnt++;
+		ipv4_tick();
+	}
+
+	ms = (sec * 1000) + (nsec / 1000000);
+	while ((int32_t)(ms - timer_tick_ms) >= 1000 / HZ) {
+		timer_tick_ms += 1000 / HZ;
+		shaper_tick();
+	}
+}
+
+/*
+ * This will retrieve the number of seconds since startup.
+ */
+uint32_t
+arch_timer_get() {
+	return timecnt;
+}
+
+/*
+ * This will delay [wait] ms.
+ */
+void
+arch_delay (int32_t wait) {
+	uint32_t start = hosted_clock_ms();
+
+	while ((int32_t)(hosted_clock_ms() - start) < wait);
+}
+
+/*
+ * This will return the current value of the time stamp counter.
+ */
+unsigned long long
+arch_tsc_read() {
+	unsigned long long tsc;
+
+	__asm __volatile ("rdtsc" : "=A" (tsc));
+	return tsc;
+}
+
+/*
+ * This will return the lower 32 bits of the time stamp counter.
+ */
+uint32_t
+arch_tsc_read32() {
+	uint32_t lo, hi;
+
+	__asm __volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return lo;
+}
+
+/*
+ * This will start the clock and figure out how fast the time stamp counter
+ * runs, by counting it over TSC_CALIBRATE_MS milliseconds of host time. Every
+ * CPU Linux runs on in 32 bit mode has one.
+ */
+void
+arch_tsc_init() {
+	uint32_t start, tsc, nsec;
+
+	host_clock (&timer_base, &nsec);
+	timecnt = 0;
+
+	start = hosted_clock_ms();
+	timer_tick_ms = start;
+	tsc = arch_tsc_read32();
+	while (hosted_clock_ms() - start < TSC_CALIBRATE_MS);
+	arch_tsc_khz = (arch_tsc_read32() - tsc) / TSC_CALIBRATE_MS;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -15,11 +15,16 @@
 #include <lib/lib.h>
 #include <md/memory.h>
 #include <md/pio.h>
+#include <md/console.h>
+#include <md/sio.h>
 
 addr_t tty_videobase = 0xb8000;
 uint32_t offs = 0;
 uint32_t tty_crtc_base;
 
+/* arch_console_flags are the CONSOLE_FLAG_xxx in effect */
+uint32_t arch_console_flags = 0;
+
 void i386_status(); /* XXX */
 
 #define CONSOLE_ATTR 0x07
@@ -284,6 +289,13 @@ arch_console_putch (uint8_t ch) {
  */
 void
 arch_console_putchar (uint8_t ch)  {
+	/* copy it to the serial port if needed; terminals want a CR before a LF */
+	if ((arch_console_flags & CONSOLE_FLAG_SERIAL) && (arch_sio_present)) {
+		if (ch == '\n')
+			arch_sio_send ('\r');
+		arch_sio_send (ch);
+	}
+
 	switch (ch) {
 		case '\n': /* newline */
 		           offs = offs - (offs % 160);
@@ -0,0 +1,99 @@
+/*
+ * cpu.c - ILIOS i386 CPU feature detection
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This will find out what the processor can do, and enable the SSE unit if
+ * there is one.
+ *
+ */
+#include <sys/types.h>
+#include <lib/lib.h>
+#include <md/cpu.h>
+
+/* CPUID_xxx are the feature flags of CPUID function 1, in %edx */
+#define CPUID_TSC			(1 << 4)
+#define CPUID_MMX			(1 << 23)
+#define CPUID_FXSR		(1 << 24)
+#define CPUID_SSE			(1 << 25)
+#define CPUID_SSE2		(1 << 26)
+
+/* CPUID_ERMS is the enhanced rep movsb/stosb flag of CPUID function 7, in %ebx */
+#define CPUID_ERMS		(1 << 9)
+
+/* CR0_xxx and CR4_xxx are the control register bits we touch */
+#define CR0_MP				(1 << 1)		/* monitor coprocessor */
+#define CR0_EM				(1 << 2)		/* emulate coprocessor */
+#define CR0_TS				(1 << 3)		/* task switched */
+#define CR4_OSFXSR		(1 << 9)		/* OS supports fxsave/fxrstor */
+#define CR4_OSXMMEXCPT	(1 << 10)	/* OS handles SIMD exceptions */
+
+/* arch_cpu_features are the CPU_FEATURE_xxx we may use */
+uint32_t arch_cpu_features = 0;
+
+/*
+ * This will return non-zero if the processor knows the cpuid instruction.
+ */
+static int
+arch_cpu_has_cpuid() {
+	uint32_t f1, f2;
+
+	/* see if we can flip the ID flag */
+	__asm __volatile ("pushfl\n\tpopl %0\n\tmovl %0, %1\n\txorl $0x200000, %0\n\t"
+	                  "pushl %0\n\tpopfl\n\tpushfl\n\tpopl %0\n\tpushl %1\n\tpopfl"
+	                  : "=&r" (f1), "=&r" (f2));
+	return ((f1 ^ f2) & 0x200000) ? 1 : 0;
+}
+
+/*
+ * This will turn the SSE unit on. Nothing saves its registers, so whoever
+ * uses it must keep interrupts disabled meanwhile.
+ */
+static void
+arch_cpu_enable_sse() {
+	uint32_t cr;
+
+	__asm __volatile ("movl %%cr0, %0" : "=r" (cr));
+	cr = (cr & ~(CR0_EM | CR0_TS)) | CR0_MP;
+	__asm __volatile ("movl %0, %%cr0" : : "r" (cr));
+
+	__asm __volatile ("movl %%cr4, %0" : "=r" (cr));
+	cr |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+	__asm __volatile ("movl %0, %%cr4" : : "r" (cr));
+}
+
+/*
+ * This will figure out the processor features.
+ */
+void
+arch_cpu_init() {
+	uint32_t a, b, c, d, max;
+
+	arch_cpu_features = 0;
+	if (!arch_cpu_has_cpuid())
+		return;
+
+	/* ask for the highest function and the feature flags */
+	__asm __volatile ("cpuid" : "=a" (max), "=b" (b), "=c" (c), "=d" (d) : "0" (0));
+	__asm __volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "0" (1));
+	if (d & CPUID_TSC)
+		arch_cpu_features |= CPU_FEATURE_TSC;
+	if (d & CPUID_MMX)
+		arch_cpu_features |= CPU_FEATURE_MMX;
+
+	/* SSE is only of use if we can turn it on */
+	if ((d & CPUID_FXSR) && (d & CPUID_SSE)) {
+		arch_cpu_enable_sse();
+		arch_cpu_features |= CPU_FEATURE_SSE;
+		if (d & CPUID_SSE2)
+			arch_cpu_features |= CPU_FEATURE_SSE2;
+	}
+
+	/* newer processors copy faster with the string instructions */
+	if (max >= 7) {
+		__asm __volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "0" (7), "2" (0));
+		if (b & CPUID_ERMS)
+			arch_cpu_features |= CPU_FEATURE_ERMS;
+	}
+}
+
+/* vim:set ts=2 sw=2: */
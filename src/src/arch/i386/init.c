@@ -9,9 +9,11 @@
  *
  */
 #include <md/config.h>
+#include <md/cpu.h>
 #include <md/gdt.h>
 #include <md/init.h>
 #include <md/interrupts.h>
+#include <md/timer.h>
 #include <lib/lib.h>
 #include <sys/kmalloc.h>
 #include <sys/irq.h>
@@ -251,6 +253,9 @@ timer_init () {
 	/* the timer is time-critical, so just call it at once, to avoid the IRQ
 	   manager bloat */
 	interrupts_set_entry (0x20, (void*)&timer_asm, KCODE32_SEL, I386_INT_GATE, 0);
+
+	/* now the timer runs, see how fast the time stamp counter goes */
+	arch_tsc_init();
 }
 
 #ifdef SUPPORT_GDB
@@ -265,6 +270,9 @@ exceptionHandler (int num, void* addr) {
  */
 void
 arch_init() {
+	/* find out what the processor can do */
+	arch_cpu_init();
+
 	/* initialize the GDT */
 	gdt_init();
 
@@ -15,29 +15,15 @@
 
 /*
  *  Add all memory regions using kmalloc_addregion().  On PC, we have some
- *  memory below 640KB, and then some memory above 1MB.  The memory above
- *  1MB is divided into DMA-capable memory (<16MB) and non-DMA-memory.
- *  To complicate things even further, there can be memory holes at 14-15MB
- *  and 15-16MB.
- *
- *  (NOTE:  We are already running in high memory now (paged), so we cannot
- *  actually detect memory.  We have to trust highest_addressable_byte etc
- *  set by code in jumpmain.c.)
+ *  memory below 640KB, and then some memory above 1MB, possibly with holes
+ *  in it.  __main() in startup.c already collected the usable ranges, with
+ *  the kernel image and the low tables cut out, so they can be added as-is.
  */
 void arch_add_all_memory() {
-	size_t first_addr, last_addr;
-
-	first_addr = first_addressable_high_byte;
-	last_addr = highest_addressable_byte + 1;
-
-#if 0
-	/* add the memory *before* the kernel 
-	 * FIXME: 0xA0000 shouldn't be hardcoded ... ???? */
-	kmalloc_addregion (PAGESIZE, 0xA0000 - PAGESIZE, 0);
-#endif
+	int i;
 
-	/* add memory after the kernel */
-	kmalloc_addregion (first_addr, (last_addr - first_addr), 0);
+	for (i = 0; i < memory_num_ranges; i++)
+		kmalloc_addregion (memory_range[i].addr, memory_range[i].len, 0);
 }
 
 /* vim:set ts=2 sw=2: */
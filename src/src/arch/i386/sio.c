@@ -17,6 +17,9 @@
 
 char* sio_type[] = { "8250", "16450", "16550", "16550A" };
 
+/* arch_sio_present is non-zero once the serial port has been found */
+int arch_sio_present = 0;
+
 /*
  * This will probe for a serial interface at [port]. It will return a 
  * SIO_TYPE_xxx on success or -1 on failure.
@@ -142,6 +145,7 @@ arch_sio_init() {
 
 	/* initialize the device */
 	arch_sio_initport (port);
+	arch_sio_present = 1;
 }
 
 /* vim:set ts=2 sw=2: */
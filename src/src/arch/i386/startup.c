@@ -5,88 +5,127 @@
  * This code is heavily based on YCX2 (src/ycx2/arch/i386/jumpmain.c), (c) 2001,
  * 2002 Anders Gavare.
  *
- * This code will create a paging table, so references are not messed up.
+ * This code will figure out which memory we can use before the kernel proper
+ * is started. The memory map handed to us by a Multiboot loader is used if we
+ * have one; otherwise, memory above the kernel is probed.
  *
  */
 #include <sys/types.h>
 #include <md/config.h>
 #include <md/memory.h>
+#include <md/multiboot.h>
 
 /* forward declaration to kernel main */
 void kmain();
 
+/* _end is the end of the kernel image, as placed by the linker */
+extern char _end[];
+
+/* LOW_MEMORY_START is the first byte of low memory we may use; everything
+ * below it holds the descriptor tables and the initial stack */
+#define LOW_MEMORY_START	0x10000
+
+/* MEMORY_TOP is the end of the memory we can address */
+#define MEMORY_TOP				0xfffff000
+
 /* our own stuff */
 size_t	highest_addressable_byte = 0;
-size_t	first_addressable_high_byte = 0;
-size_t	lowest_addressable_free_byte = 0;
-
-/*
- * This will scan [ptr] for 0xff bytes, to probe whether memory exists or not.
- * It will return 0 if [ptr] only has 0xff bytes, or 1 if it does not.
- */
-int
-i386_trymemory (uint8_t* ptr, size_t len) {
-	size_t i;
-
-	/* scan the range */
-	for (i = 0; i < len; i++)
-		/* 0xff byte here? */
-		if (ptr[i] != 0xff)
-			return 1;
-
-	/* only 0xff bytes here */
-	return 0;
-}
+struct MEMORY_RANGE memory_range[MEMORY_MAX_RANGES];
+int memory_num_ranges = 0;
 
 /*
  * This returns the size of the kernel.
  */
 size_t
 i386_getkernelsize() {
-	/* FIXME: how to calculate ELF sizes ??? */
-	return 300000;
+	return (size_t)_end - KERNEL_LOAD_ADDR;
 }
 
 /*
- * This will return where the kernel is loaded.
- *
- * FIXME: For now, this function only guesses...
+ * This will add the memory from [start] up to [end] to the usable ranges,
+ * leaving out the kernel image and anything below LOW_MEMORY_START.
  */
-size_t i386_getkernelloadaddr() {
-	int addr;
+static void
+i386_add_range (size_t start, size_t end) {
+	size_t kend = KERNEL_LOAD_ADDR + i386_getkernelsize();
+	int i;
+
+	/* keep away from the tables and the stack */
+	if (start < LOW_MEMORY_START)
+		start = LOW_MEMORY_START;
+
+	/* does this overlap the kernel? */
+	if ((start < kend) && (end > KERNEL_LOAD_ADDR)) {
+		/* yes. take whatever is below it and continue above it */
+		i386_add_range (start, KERNEL_LOAD_ADDR);
+		start = kend;
+	}
 
-	addr = (int) &i386_getkernelloadaddr;
-	addr &= 0x00ffffff;
+	/* only whole pages are of use */
+	start = (start + PAGESIZE - 1) & ~(PAGESIZE - 1);
+	end &= ~(PAGESIZE - 1);
+	if (start >= end)
+		return;
+
+	/* some BIOSes report ranges more than once. ignore any overlap */
+	for (i = 0; i < memory_num_ranges; i++)
+		if ((start < memory_range[i].addr + memory_range[i].len) &&
+				(end > memory_range[i].addr))
+			return;
+
+	/* got room for it? */
+	if (memory_num_ranges == MEMORY_MAX_RANGES)
+		/* no. too bad */
+		return;
+
+	memory_range[memory_num_ranges].addr = start;
+	memory_range[memory_num_ranges].len = end - start;
+	memory_num_ranges++;
+
+	if (end - 1 > highest_addressable_byte)
+		highest_addressable_byte = end - 1;
+}
 
-	if (addr >= 0x100000)
-		return 0x100000;
-	else
-		return 0x10000;
+/*
+ * This will add all usable ranges of the memory map described by [mbi].
+ */
+static void
+i386_parse_mmap (struct MULTIBOOT_INFO* mbi) {
+	uint32_t addr = mbi->mmap_addr;
+	struct MULTIBOOT_MMAP* mm;
+	size_t end;
+
+	while (addr < mbi->mmap_addr + mbi->mmap_length) {
+		mm = (struct MULTIBOOT_MMAP*)addr;
+
+		/* usable and within reach? */
+		if ((mm->type == MULTIBOOT_MEMORY_AVAILABLE) && (mm->base_high == 0) &&
+				(mm->base_low < MEMORY_TOP)) {
+			/* yes. clip it to what we can address */
+			end = mm->base_low + mm->length_low;
+			if ((mm->length_high != 0) || (end < mm->base_low) || (end > MEMORY_TOP))
+				end = MEMORY_TOP;
+			i386_add_range (mm->base_low, end);
+		}
+
+		/* next. [size] doesn't count itself */
+		addr += mm->size + sizeof (mm->size);
+	}
 }
 
 /*
- * This is the very evil main code, as directly called by the assembly stub.
+ * This will return the first address above the kernel which doesn't hold
+ * memory. Only used if the loader didn't tell us.
+ *
+ * since our memory allocator only knows pages, we try the very first byte
+ * of every page. if we can write 01010101 and then 10101010 to it and
+ * successfully read it back, we can assume the memory there exists.
  */
-void
-__main() {
-	size_t highest, try;
-	ssize_t trylen;
-	size_t top_of_memory, bottom_of_high_memory;
-	int kernel_image_size;
-	size_t low_memory_usage = 0;
-	size_t high_memory_usage = 0;
-
-	/* now, find the last byte of memory we can use */
-	try = i386_getkernelloadaddr() + i386_getkernelsize();
-	trylen = 0x100000;      /*  step size  */
-	highest = try;
-
-	/*
-	 * since our memory allocator only knows pages, we try the very first byte
-	 * of every page.   if we can write 01010101 and then 10101010 to it and
-	 * successfully read it back, we can assume the memory there exists.
-	 */
-	while (1) {
+static size_t
+i386_probe_memory() {
+	size_t try = (KERNEL_LOAD_ADDR + i386_getkernelsize() + PAGESIZE - 1) & ~(PAGESIZE - 1);
+
+	while (try < MEMORY_TOP) {
 		*(uint8_t*)try = 0x55;
 		if (*(uint8_t*)try != 0x55) break;
 		*(uint8_t*)try = 0xaa;
@@ -94,29 +133,28 @@ __main() {
 
 		try += (PAGESIZE);
 	}
-	highest = try - PAGESIZE;
-	top_of_memory = highest;
-
-	/* calculate the number of pagetables we need. each pagetable covers 4MB,
-	 * so it's just division really */
-	highest |= 0x3fffff;
-
-	/*  Estimate the size of the kernel image in memory:  */
-	kernel_image_size = i386_getkernelsize();
-	kernel_image_size = ((kernel_image_size - 1) | (PAGESIZE-1)) + 1;
-
-	if (i386_getkernelloadaddr() < 1048576)
-		low_memory_usage += kernel_image_size;
-	else
-		high_memory_usage += kernel_image_size;
-
-	bottom_of_high_memory = 0x100000 + high_memory_usage;
 
-	highest_addressable_byte = top_of_memory;
-	first_addressable_high_byte = bottom_of_high_memory;
+	return try;
+}
 
-	/*  0x10000 = above initial stack  */
-	lowest_addressable_free_byte = 0x10000 + low_memory_usage;
+/*
+ * This is the very evil main code, as directly called by the assembly stub.
+ * [magic] and [mbi] are what the loader left in %eax and %ebx.
+ */
+void
+__main (uint32_t magic, struct MULTIBOOT_INFO* mbi) {
+	/* did a Multiboot loader tell us about the memory? */
+	if ((magic == MULTIBOOT_BOOTLOADER_MAGIC) && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+		/* yes. use the BIOS memory map */
+		i386_parse_mmap (mbi);
+	} else if ((magic == MULTIBOOT_BOOTLOADER_MAGIC) && (mbi->flags & MULTIBOOT_INFO_MEMORY)) {
+		/* only the sizes. that's conventional and extended memory */
+		i386_add_range (0, mbi->mem_lower * 1024);
+		i386_add_range (0x100000, 0x100000 + mbi->mem_upper * 1024);
+	} else {
+		/* no. find out ourselves what there is above the kernel */
+		i386_add_range (0x100000, i386_probe_memory());
+	}
 
 	/* go to the main code */
 	kmain();
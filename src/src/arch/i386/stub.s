@@ -12,7 +12,18 @@
 .text
 .global __start
 
+		/* the Multiboot header; we want to know about the memory */
+		.align	4
+multiboot_header:
+		.long	0x1badb002		/* magic */
+		.long	0x00000002		/* flags: memory info */
+		.long	-(0x1badb002 + 0x00000002)	/* checksum */
+
 __start:
+		/* keep the loader's magic and information pointer */
+		mov	%eax, %esi
+		mov	%ebx, %edi
+
 		/* set up all descriptors */
 		mov	$0x10, %ax
 		mov	%ax, %ds
@@ -30,6 +41,8 @@ __start:
 		out	%al,%dx
 
 		/* go! */
-		jmp	__main
+		push	%edi
+		push	%esi
+		call	__main
 
 /* vim:set ts=2: */
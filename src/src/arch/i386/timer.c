@@ -10,7 +10,9 @@
  */
 #include <sys/kmalloc.h>
 #include <sys/irq.h>
+#include <sys/shaper.h>
 #include <md/config.h>
+#include <md/cpu.h>
 #include <md/gdt.h>
 #include <md/init.h>
 #include <md/interrupts.h>
@@ -22,7 +24,9 @@
 
 uint32_t timecnt = 0;
 int tmr = 0;
-int itick = 0;
+
+/* arch_tsc_khz is the number of TSC cycles per millisecond, zero if none */
+uint32_t arch_tsc_khz = 0;
 
 /*
  * This is the actual timer interrupt.
@@ -34,6 +38,9 @@ timer() {
 	network_handle_queue();
 #endif
 
+	/* the shapers get their tokens every tick */
+	shaper_tick();
+
 	/* one second passed? */
 	if (++tmr != 36)
 		/* no. leave */
@@ -43,11 +50,8 @@ timer() {
 	tmr = 0;
 	timecnt++;
 
-	/* call IPv4 tick stuff every 10 ticks */
-	if (++itick == 10) {
-		itick = 0;
-		ipv4_tick();
-	}
+	/* call IPv4 tick stuff */
+	ipv4_tick();
 }
 
 /*
@@ -104,4 +108,57 @@ arch_delay (int32_t wait) {
 	}
 }
 
+/*
+ * This will return the current value of the time stamp counter.
+ */
+unsigned long long
+arch_tsc_read() {
+	unsigned long long tsc;
+
+	__asm __volatile ("rdtsc" : "=A" (tsc));
+	return tsc;
+}
+
+/*
+ * This will return the lower 32 bits of the time stamp counter, which is
+ * plenty to measure short intervals with.
+ */
+uint32_t
+arch_tsc_read32() {
+	uint32_t lo, hi;
+
+	__asm __volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return lo;
+}
+
+/*
+ * This will figure out how fast the time stamp counter runs, by counting it
+ * over TSC_CALIBRATE_MS milliseconds of the timer. The timer must be
+ * programmed and the CPU features known already.
+ */
+void
+arch_tsc_init() {
+	int otick, tick, limit, wait;
+	uint32_t start;
+
+	if (!(arch_cpu_features & CPU_FEATURE_TSC))
+		return;
+
+	/* count the timer down, just like arch_delay() does */
+	wait = (TIMER_FREQ / 1000) * TSC_CALIBRATE_MS;
+	limit = TIMER_FREQ / HZ;
+	otick = arch_timer_gettick();
+	start = arch_tsc_read32();
+	while (wait > 0) {
+		tick = arch_timer_gettick();
+		if (tick > otick) {
+			wait -= limit - (tick - otick);
+		} else {
+			wait -= otick - tick;
+		}
+		otick = tick;
+	}
+	arch_tsc_khz = (arch_tsc_read32() - start) / TSC_CALIBRATE_MS;
+}
+
 /* vim:set ts=2 sw=2: */
@@ -25,10 +25,13 @@ int cmd_int_destroy  (struct CLI_ARGS* args);
 int cmd_int_bind     (struct CLI_ARGS* args);
 int cmd_int_unbind   (struct CLI_ARGS* args);
 int cmd_int_status   (struct CLI_ARGS* args);
+int cmd_int_reserve  (struct CLI_ARGS* args);
 int cmd_reboot       (struct CLI_ARGS* args);
 int cmd_set_hostname (struct CLI_ARGS* args);
 int cmd_show_memory  (struct CLI_ARGS* args);
 int cmd_show_version (struct CLI_ARGS* args);
+int cmd_show_drops   (struct CLI_ARGS* args);
+int cmd_show_profile (struct CLI_ARGS* args);
 int cmd_help         (struct CLI_ARGS* args);
 int cmd_arp_list     (struct CLI_ARGS* args);
 int cmd_arp_flush    (struct CLI_ARGS* args);
@@ -37,7 +40,34 @@ int cmd_route_list   (struct CLI_ARGS* args);
 int cmd_route_flush  (struct CLI_ARGS* args);
 int cmd_route_add    (struct CLI_ARGS* args);
 int cmd_route_delete (struct CLI_ARGS* args);
+int cmd_route_benchmark (struct CLI_ARGS* args);
 int cmd_set_routing  (struct CLI_ARGS* args);
+int cmd_set_poll_budget (struct CLI_ARGS* args);
+int cmd_pktgen_source (struct CLI_ARGS* args);
+int cmd_pktgen_destination (struct CLI_ARGS* args);
+int cmd_pktgen_size   (struct CLI_ARGS* args);
+int cmd_pktgen_rate   (struct CLI_ARGS* args);
+int cmd_pktgen_count  (struct CLI_ARGS* args);
+int cmd_pktgen_show   (struct CLI_ARGS* args);
+int cmd_pktgen_transmit (struct CLI_ARGS* args);
+int cmd_pktgen_inject (struct CLI_ARGS* args);
+int cmd_bench_addresses (struct CLI_ARGS* args);
+int cmd_bench_speed (struct CLI_ARGS* args);
+int cmd_bench_duration (struct CLI_ARGS* args);
+int cmd_bench_show (struct CLI_ARGS* args);
+int cmd_bench_run (struct CLI_ARGS* args);
+int cmd_shaper_rate (struct CLI_ARGS* args);
+int cmd_shaper_class (struct CLI_ARGS* args);
+int cmd_shaper_remove (struct CLI_ARGS* args);
+int cmd_shaper_map (struct CLI_ARGS* args);
+int cmd_shaper_default (struct CLI_ARGS* args);
+int cmd_shaper_show (struct CLI_ARGS* args);
+int cmd_acl_add (struct CLI_ARGS* args);
+int cmd_acl_delete (struct CLI_ARGS* args);
+int cmd_acl_flush (struct CLI_ARGS* args);
+int cmd_acl_commit (struct CLI_ARGS* args);
+int cmd_acl_list (struct CLI_ARGS* args);
+int cmd_acl_benchmark (struct CLI_ARGS* args);
 
 /*
  * syntax:
@@ -78,6 +108,12 @@ struct COMMAND commands[] = {
 		"%if{interface name} %ip{ip address}",
 		&cmd_int_unbind
 	},
+	{
+		"interface reserve",
+		"Reserves packet buffers for an interface",
+		"%if{interface name} %di{buffers}",
+		&cmd_int_reserve
+	},
 	{
 		"reboot",
 		"Reboots the machine",
@@ -108,6 +144,18 @@ struct COMMAND commands[] = {
 		"",
 		&cmd_show_version
 	},
+	{
+		"show drops",
+		"Dropped packets per reason",
+		"@bl{reset afterwards}",
+		&cmd_show_drops
+	},
+	{
+		"show profile",
+		"Cycles spent per stage of the packet path",
+		"@bl{reset afterwards}",
+		&cmd_show_profile
+	},
 	{
 		"help",
 		"Display available commands",
@@ -156,12 +204,174 @@ struct COMMAND commands[] = {
 		"%ip{network} %ip{netmask}",
 		&cmd_route_delete
 	},
+	{
+		"route benchmark",
+		"Measures the route lookup rate",
+		"@di{prefixes} @di{lookups}",
+		&cmd_route_benchmark
+	},
 	{
 		"set routing",
 		"Enable or disable router operation",
 		"%bl{yes/no]",
 		&cmd_set_routing
 	},
+	{
+		"set poll budget",
+		"Set the number of packets handled per pass",
+		"%di{packets}",
+		&cmd_set_poll_budget
+	},
+	{
+		"pktgen source",
+		"Sets the generated source addresses",
+		"%ip{first address} @ip{last address}",
+		&cmd_pktgen_source
+	},
+	{
+		"pktgen destination",
+		"Sets the generated destination addresses",
+		"%ip{first address} @ip{last address}",
+		&cmd_pktgen_destination
+	},
+	{
+		"pktgen size",
+		"Sets the generated frame size",
+		"%di{bytes}",
+		&cmd_pktgen_size
+	},
+	{
+		"pktgen rate",
+		"Sets the generated packet rate",
+		"%di{packets per second, 0 is unlimited}",
+		&cmd_pktgen_rate
+	},
+	{
+		"pktgen count",
+		"Sets the number of generated packets",
+		"%di{packets}",
+		&cmd_pktgen_count
+	},
+	{
+		"pktgen show",
+		"Shows the packet generator settings",
+		"",
+		&cmd_pktgen_show
+	},
+	{
+		"pktgen transmit",
+		"Generates packets out of an interface",
+		"%if{interface name}",
+		&cmd_pktgen_transmit
+	},
+	{
+		"pktgen inject",
+		"Generates packets as if an interface received them",
+		"%if{interface name}",
+		&cmd_pktgen_inject
+	},
+	{
+		"benchmark addresses",
+		"Sets the addresses of the benchmark test frames",
+		"%ip{source address} %ip{destination address}",
+		&cmd_bench_addresses
+	},
+	{
+		"benchmark speed",
+		"Sets the link speed the benchmark assumes",
+		"%di{Mbit/s}",
+		&cmd_bench_speed
+	},
+	{
+		"benchmark duration",
+		"Sets the length of a benchmark trial",
+		"%di{ms}",
+		&cmd_bench_duration
+	},
+	{
+		"benchmark show",
+		"Shows the benchmark settings",
+		"",
+		&cmd_bench_show
+	},
+	{
+		"benchmark run",
+		"Runs the RFC 2544 benchmark; press a key to abort",
+		"%if{transmit interface} %if{receive interface} @di{frame size, all if omitted}",
+		&cmd_bench_run
+	},
+	{
+		"shaper rate",
+		"Limits the transmit rate of an interface",
+		"%if{interface name} %di{kbit/s, 0 removes the shaper}",
+		&cmd_shaper_rate
+	},
+	{
+		"shaper class",
+		"Sets up a class of the shaper",
+		"%if{interface name} %di{class} %di{rate in kbit/s} %di{ceiling in kbit/s} %di{priority, 0 goes first} @di{weight}",
+		&cmd_shaper_class
+	},
+	{
+		"shaper remove",
+		"Removes a class of the shaper",
+		"%if{interface name} %di{class}",
+		&cmd_shaper_remove
+	},
+	{
+		"shaper map",
+		"Sends packets with a DSCP to a class",
+		"%if{interface name} %di{DSCP} %di{class}",
+		&cmd_shaper_map
+	},
+	{
+		"shaper default",
+		"Sets the class of all unmapped packets",
+		"%if{interface name} %di{class}",
+		&cmd_shaper_default
+	},
+	{
+		"shaper show",
+		"Shows the shaper of an interface",
+		"%if{interface name}",
+		&cmd_shaper_show
+	},
+	{
+		"acl add",
+		"Adds or replaces a rule for forwarded packets",
+		"%di{rule number, lowest matches first} %st{in or out} %st{permit or deny} %st{interface name or any} %st{source prefix or any} %st{destination prefix or any} @st{icmp, tcp, udp, number or any} @st{[source ports:]destination ports}",
+		&cmd_acl_add
+	},
+	{
+		"acl delete",
+		"Deletes a rule",
+		"%di{rule number}",
+		&cmd_acl_delete
+	},
+	{
+		"acl flush",
+		"Deletes all rules",
+		"",
+		&cmd_acl_flush
+	},
+	{
+		"acl commit",
+		"Activates the rules as they are now",
+		"",
+		&cmd_acl_commit
+	},
+	{
+		"acl list",
+		"Lists the rules and how many packets they matched",
+		"@bl{reset the counters}",
+		&cmd_acl_list
+	},
+	{
+		"acl benchmark",
+		"Measures the lookup speed of a pseudo-random rule set",
+		"@di{number of rules} @di{number of lookups}",
+		&cmd_acl_benchmark
+	},
 	{ NULL, NULL, NULL, NULL } 
 };
 
@@ -731,11 +941,10 @@ cli_go() {
 			/* fetch a key */
 			ch = 0;
 			while (!ch) {
-				/* save the processor, we only need to act on interrupts anyway */
-				arch_relax();
-
-				/* handle network packets */
-				network_handle_queue();
+				/* handle network packets. if there were none, save the processor as
+				 * we only need to act on interrupts anyway */
+				if (!network_handle_queue())
+					arch_relax();
 
 				/* fetch the key */
 				ch = arch_console_readch();
@@ -9,16 +9,24 @@
 #include <sys/irq.h>
 #include <sys/kmalloc.h>
 #include <sys/network.h>
+#include <sys/prof.h>
+#include <sys/qdisc.h>
+#include <sys/shaper.h>
+#include <sys/slab.h>
 #include <lib/lib.h>
 #include <net/dns.h>
 #include <net/socket.h>
 #include <netipv4/ipv4.h>
+#include <netipv4/acl.h>
 #include <netipv4/arp.h>
 #include <netipv4/route.h>
 #include <netipv4/udp.h>
 #include <md/console.h>
 #include <md/reboot.h>
+#include <md/timer.h>
 #include <net/dhcp.h>
+#include <net/pktgen.h>
+#include <net/bench.h>
 #include <assert.h>
 #include <config.h>
 #include <cli/cli.h>
@@ -74,6 +82,9 @@ cmd_int_destroy (struct CLI_ARGS* args) {
 	/* free the associated IRQ */
 	irq_unregister (ARG_INTERFACE(0));
 
+	/* its access lists go as well */
+	acl_flush_device (ARG_INTERFACE(0));
+
 	/* zap the device */
 	device_unregister (ARG_INTERFACE(0));
 
@@ -125,6 +136,37 @@ cmd_int_unbind (struct CLI_ARGS* args) {
 	return 1;
 }
 
+/* Reserve buffers for an interface */
+int
+cmd_int_reserve (struct CLI_ARGS* args) {
+	struct DEVICE* dev;
+	struct NETPOOL* pool;
+	uint32_t i, reserved = 0;
+
+	/* safety first */
+	ASSERT (args->num_args == 2);
+	dev = ARG_INTERFACE(0);
+
+	/* leave at least half of the buffers for everyone */
+	for (i = 1; i < NETWORK_MAX_POOLS; i++)
+		if ((network_pool[i].device != NULL) && (&network_pool[i] != dev->pool))
+			reserved += network_pool[i].reserve;
+	if (reserved + ARG_INTEGER(1) > network_maxbuffers / 2) {
+		kprintf ("at most %u buffers can be reserved\n",
+			(network_maxbuffers / 2 > reserved) ? (network_maxbuffers / 2 - reserved) : 0);
+		return 0;
+	}
+
+	/* update it */
+	pool = dev->pool;
+	network_pool_reserve (pool, ARG_INTEGER(1));
+	if (pool->avail < pool->reserve)
+		kprintf ("%u buffers reserved now, the rest will follow as they are freed\n", pool->avail);
+
+	/* all done */
+	return 1;
+}
+
 /* Reboot */
 int
 cmd_reboot (struct CLI_ARGS* args) {
@@ -189,6 +231,19 @@ cmd_int_status (struct CLI_ARGS* args) {
 		kprintf ("    received: %lu frames, %lu bytes\n", dev->rx_frames, dev->rx_bytes);
 		kprintf ("    transmitted: %lu frames, %lu bytes\n", dev->tx_frames, dev->tx_bytes);
 
+		/* show the buffers */
+		kprintf ("    buffers: %u reserved, %u available, %u allocation failures\n",
+			dev->pool->reserve, dev->pool->avail, dev->pool->failures);
+
+		/* show the queues */
+		kprintf ("    receive queue: %u packets, %u dropped\n",
+			network_ring_count (&dev->rx_ring), dev->rx_ring.drops);
+		kprintf ("    transmit queue: %u packets, %u dropped\n",
+			network_ring_count (&dev->tx_ring), dev->tx_ring.drops);
+		kprintf ("    fq_codel: %u packets queued (max %u), %u delay drops, %u overlimit drops\n",
+			dev->qdisc->backlog, dev->qdisc->max_backlog, dev->qdisc->delay_drops,
+			dev->qdisc->limit_drops);
+
 		/* next */
 		dev = dev->next;
 	}
@@ -200,13 +255,34 @@ cmd_int_status (struct CLI_ARGS* args) {
 /* Displays memory information */
 int
 cmd_show_memory (struct CLI_ARGS* args) {
-	size_t total, avail;
+	size_t total, avail, largest;
+	size_t blocks[KMALLOC_MAX_ORDER + 1];
 	uint32_t i, count = 0, free_count = 0, todo_count = 0;
 	struct NETPACKET* pkt = network_netpacket;
+	struct DEVICE* dev;
+	struct KMEM_CACHE* cache;
 
 	kmemstats (&total, &avail);
 	kprintf ("memory: %u KB total, %u KB available\n", (total / 1024), (avail / 1024));
 
+	/* show how the free memory is split up */
+	kmemfrag (blocks, &largest);
+	kprintf ("free blocks:");
+	for (i = 0; i <= KMALLOC_MAX_ORDER; i++)
+		if (blocks[i])
+			kprintf (" %ux%u KB", blocks[i], (PAGESIZE << i) / 1024);
+	kprintf ("\n");
+	kprintf ("largest free block: %u KB", largest / 1024);
+	if (avail > 0)
+		kprintf (", %u%% fragmented", 100 - (largest / PAGESIZE) * 100 / (avail / PAGESIZE));
+	kprintf ("\n");
+
+	/* show the object caches */
+	kprintf ("object caches:\n");
+	for (cache = kmem_caches; cache != NULL; cache = cache->next)
+		kprintf ("%s: %u bytes, %u in use, %u free, %u slabs\n",
+			cache->name, cache->size, cache->inuse, cache->avail, cache->slabs);
+
 	/* count the number of free packets */
 	for (i = 0; i < network_numbuffers; i++) {
 		if (pkt->device != NULL) {
@@ -218,19 +294,21 @@ cmd_show_memory (struct CLI_ARGS* args) {
 		pkt++;
 	}
 
-	/* count the number of free packets according to the chain */
-	pkt = netpacket_first_avail;
-	while (pkt) { free_count++; pkt = pkt->next; }
+	/* count the number of free packets according to the pools */
+	for (i = 0; i < NETWORK_MAX_POOLS; i++)
+		free_count += network_pool[i].avail;
 
 	/* count the number of packets to handle */
-	pkt = netpacket_todo_first;
-	while (pkt) { todo_count++; pkt = pkt->next; }
+	for (dev = coredevice; dev != NULL; dev = dev->next)
+		todo_count += network_ring_count (&dev->rx_ring);
 
 	kprintf ("netpackets:\n");
-	kprintf ("%u total\n", network_numbuffers);
+	kprintf ("%u total, %u set up\n", network_maxbuffers, network_numbuffers);
 	kprintf ("%u in use\n", count);
 	kprintf ("%u in queue to handle\n", todo_count);
 	kprintf ("%u marked as available\n", free_count);
+	kprintf ("%u available to all interfaces, %u allocation failures\n",
+		NETWORK_SHARED_POOL->avail, NETWORK_SHARED_POOL->failures);
 
 	/* NOTICE: the results given are never accurate; this is because the network
 	 * system happily frees and allocates buffers while we're counting.
@@ -241,6 +319,74 @@ cmd_show_memory (struct CLI_ARGS* args) {
 	return 1;
 }
 
+/* Displays dropped packets */
+int
+cmd_show_drops (struct CLI_ARGS* args) {
+	struct DEVICE* dev;
+	uint32_t i, total;
+
+	/* walk through all devices */
+	for (dev = coredevice; dev != NULL; dev = dev->next) {
+		total = 0;
+		for (i = 0; i < NETWORK_DROP_MAX; i++)
+			total += dev->drops[i];
+		kprintf ("%s: %u dropped\n", dev->name, total);
+
+		/* only show the reasons that actually occured */
+		for (i = 0; i < NETWORK_DROP_MAX; i++)
+			if (dev->drops[i])
+				kprintf ("    %s: %u\n", network_drop_reason[i], dev->drops[i]);
+	}
+
+	/* anything we couldn't blame a device for? */
+	for (i = 0; i < NETWORK_DROP_MAX; i++)
+		if (network_drops[i])
+			kprintf ("other %s: %u\n", network_drop_reason[i], network_drops[i]);
+
+	/* start over if asked to */
+	if ((args->num_args > 0) && (ARG_BOOLEAN (0)))
+		network_drop_reset();
+
+	return 1;
+}
+
+/* Displays the packet path profile */
+int
+cmd_show_profile (struct CLI_ARGS* args) {
+	struct PROF_STAGE* ps;
+	int i;
+
+#ifndef SUPPORT_PROFILING
+	kprintf ("profiling support is not compiled in\n");
+	return 0;
+#endif
+
+	/* can we count at all? */
+	if (arch_tsc_khz == 0) {
+		/* no. complain */
+		kprintf ("no time stamp counter available\n");
+		return 0;
+	}
+	kprintf ("time stamp counter runs at %u kHz\n", arch_tsc_khz);
+
+	/* show them all */
+	for (i = 0; i < PROF_MAX; i++) {
+		ps = &prof_stage[i];
+		kprintf ("%s: %u times", ps->name, ps->count);
+		if (ps->count > 0)
+			kprintf (", %u cycles each, %u ms total",
+				prof_div (ps->cycles, ps->count),
+				prof_div (ps->cycles, arch_tsc_khz));
+		kprintf ("\n");
+	}
+
+	/* start over if asked to */
+	if ((args->num_args > 0) && (ARG_BOOLEAN (0)))
+		prof_reset();
+
+	return 1;
+}
+
 /* Displays version information */
 int
 cmd_show_version (struct CLI_ARGS* args) {
@@ -278,22 +424,22 @@ cmd_help (struct CLI_ARGS* args) {
  */
 int
 cmd_arp_list (struct CLI_ARGS* args) {
-	int i;
+	struct ARP_RECORD* arp;
 
 	/* just list the table */
 	kprintf ("ARP table:\n");
 
 	/* wade through the entire table */
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
-		/* address here? */
-		if (arp_cache[i].address)
-			/* yes. display it */
-			kprintf ("%I     %x:%x:%x:%x:%x:%x   %s\n",
-					arp_cache[i].address,
-					arp_cache[i].hw_addr[0], arp_cache[i].hw_addr[1],	
-					arp_cache[i].hw_addr[2], arp_cache[i].hw_addr[3],	
-					arp_cache[i].hw_addr[4], arp_cache[i].hw_addr[5],
-					arp_cache[i].device->name);
+	for (arp = arp_records; arp != NULL; arp = arp->list_next)
+		/* display it */
+		kprintf ("%I     %x:%x:%x:%x:%x:%x   %s   %s\n",
+				arp->address,
+				arp->hw_addr[0], arp->hw_addr[1],	
+				arp->hw_addr[2], arp->hw_addr[3],	
+				arp->hw_addr[4], arp->hw_addr[5],
+				arp->device->name,
+				(arp->flags & ARP_FLAGS_PERMANENT) ? "permanent" :
+				(arp->flags & ARP_FLAGS_INCOMPLETE) ? "incomplete" : "");
 
 	/* all done */
 	return 1;
@@ -315,7 +461,7 @@ cmd_arp_query (struct CLI_ARGS* args) {
 	ASSERT (args->num_args == 1);
 
 	/* send the query and begone with it */
-	if (arp_send_request (ARG_IPV4ADDR(0), NULL)) {
+	if (!arp_send_request (ARG_IPV4ADDR(0), NULL)) {
 		/* this failed. complain */
 		kprintf ("unable to query address\n");
 		return 0;
@@ -328,18 +474,16 @@ cmd_arp_query (struct CLI_ARGS* args) {
 /* Displays the routing table */
 int
 cmd_route_list (struct CLI_ARGS* args) {
-	int i;
+	struct ROUTE_ENTRY* re;
 
 	/* wade through the entire table */
-	for (i = 0; i < ROUTE_MAX_ENTRIES; i++)
-		/* route here? */
-		if (routes[i].flags)
-			/* yes. display it */
-			kprintf ("%I     %I     %I     %s\n",
-					routes[i].network,
-					routes[i].mask,
-					routes[i].gateway,
-					routes[i].device->name);
+	for (re = routes; re != NULL; re = re->next)
+		/* display it */
+		kprintf ("%I     %I     %I     %s\n",
+				re->network,
+				re->mask,
+				re->gateway,
+				re->device->name);
 
 	/* all done */
 	return 1;
@@ -376,7 +520,11 @@ cmd_route_add (struct CLI_ARGS* args) {
 	}
 
 	/* looks fine, add it */
-	route_add (dev, ARG_IPV4ADDR(0), ARG_IPV4ADDR(1), ARG_IPV4ADDR(2), ROUTE_FLAG_GATEWAY);
+	if (!route_add (dev, ARG_IPV4ADDR(0), ARG_IPV4ADDR(1), ARG_IPV4ADDR(2), ROUTE_FLAG_GATEWAY)) {
+		/* this failed. complain */
+		kprintf ("unable to add route\n");
+		return 0;
+	}
 	return 1;
 }
 
@@ -396,6 +544,25 @@ cmd_route_delete (struct CLI_ARGS* args) {
 	return 1;
 }
 
+/* Measures the route lookup rate */
+int
+cmd_route_benchmark (struct CLI_ARGS* args) {
+	uint32_t prefixes = 100000;
+	uint32_t lookups = 10000000;
+
+	/* override the defaults if needed */
+	if (args->num_args >= 1) prefixes = ARG_INTEGER(0);
+	if (args->num_args >= 2) lookups  = ARG_INTEGER(1);
+
+	/* need something to look up */
+	if (prefixes == 0) {
+		kprintf ("need at least one prefix\n");
+		return 0;
+	}
+
+	return route_benchmark (prefixes, lookups);
+}
+
 int
 cmd_set_routing  (struct CLI_ARGS* args) {
 	/* safety first */
@@ -408,4 +575,519 @@ cmd_set_routing  (struct CLI_ARGS* args) {
 	return 1;
 }
 
+int
+cmd_set_poll_budget (struct CLI_ARGS* args) {
+	/* safety first */
+	ASSERT (args->num_args == 1);
+
+	/* we need to do at least something */
+	if (ARG_INTEGER (0) == 0) {
+		/* no. complain */
+		kprintf ("budget must be at least one packet\n");
+		return 0;
+	}
+
+	/* set it */
+	network_poll_budget = ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_pktgen_source (struct CLI_ARGS* args) {
+	pktgen_config.src_first = ARG_INTEGER (0);
+	pktgen_config.src_last = (args->num_args > 1) ? ARG_INTEGER (1) : ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_pktgen_destination (struct CLI_ARGS* args) {
+	pktgen_config.dst_first = ARG_INTEGER (0);
+	pktgen_config.dst_last = (args->num_args > 1) ? ARG_INTEGER (1) : ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_pktgen_size (struct CLI_ARGS* args) {
+	/* safety first */
+	ASSERT (args->num_args == 1);
+
+	/* will it fit on the wire? */
+	if ((ARG_INTEGER (0) < PKTGEN_MIN_SIZE) || (ARG_INTEGER (0) > PKTGEN_MAX_SIZE)) {
+		/* no. complain */
+		kprintf ("frame size must be between %u and %u bytes\n", PKTGEN_MIN_SIZE, PKTGEN_MAX_SIZE);
+		return 0;
+	}
+
+	pktgen_config.size = ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_pktgen_rate (struct CLI_ARGS* args) {
+	pktgen_config.rate = ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_pktgen_count (struct CLI_ARGS* args) {
+	pktgen_config.count = ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_pktgen_show (struct CLI_ARGS* args) {
+	struct PKTGEN_CONFIG* pc = &pktgen_config;
+
+	kprintf ("source %I - %I\n", pc->src_first, pc->src_last);
+	kprintf ("destination %I - %I\n", pc->dst_first, pc->dst_last);
+	kprintf ("%u packets of %u bytes, ", pc->count, pc->size);
+	if (pc->rate)
+		kprintf ("%u per second\n", pc->rate);
+	else
+		kprintf ("as fast as possible\n");
+	return 1;
+}
+
+int
+cmd_pktgen_transmit (struct CLI_ARGS* args) {
+	return pktgen_run (ARG_INTERFACE (0), PKTGEN_MODE_XMIT);
+}
+
+int
+cmd_pktgen_inject (struct CLI_ARGS* args) {
+	return pktgen_run (ARG_INTERFACE (0), PKTGEN_MODE_INJECT);
+}
+
+int
+cmd_bench_addresses (struct CLI_ARGS* args) {
+	bench_config.source = ARG_IPV4ADDR (0);
+	bench_config.dest = ARG_IPV4ADDR (1);
+	return 1;
+}
+
+int
+cmd_bench_speed (struct CLI_ARGS* args) {
+	bench_config.speed = ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_bench_duration (struct CLI_ARGS* args) {
+	bench_config.duration = ARG_INTEGER (0);
+	return 1;
+}
+
+int
+cmd_bench_show (struct CLI_ARGS* args) {
+	struct BENCH_CONFIG* bc = &bench_config;
+
+	kprintf ("test frames from %I to %I\n", bc->source, bc->dest);
+	kprintf ("link speed %u Mbit/s, %u ms per trial\n", bc->speed, bc->duration);
+	return 1;
+}
+
+int
+cmd_bench_run (struct CLI_ARGS* args) {
+	return bench_run (ARG_INTERFACE (0), ARG_INTERFACE (1), (args->num_args > 2) ? ARG_INTEGER (2) : 0);
+}
+
+/*
+ * This will return the shaper of interface [dev], complaining if it has none.
+ */
+static struct SHAPER*
+cmd_get_shaper (struct DEVICE* dev) {
+	if (dev->shaper == NULL)
+		kprintf ("%s isn't shaped; set a rate first\n", dev->name);
+	return dev->shaper;
+}
+
+/*
+ * This will return non-zero if [num] is a class in use by shaper [s],
+ * complaining if it isn't.
+ */
+static int
+cmd_check_class (struct SHAPER* s, uint32_t num) {
+	if ((num >= SHAPER_CLASSES) || (s->class[num].qdisc == NULL)) {
+		kprintf ("no such class\n");
+		return 0;
+	}
+	return 1;
+}
+
+int
+cmd_shaper_rate (struct CLI_ARGS* args) {
+	if (ARG_INTEGER (1) > SHAPER_MAX_RATE) {
+		kprintf ("at most %u kbit/s can be shaped\n", SHAPER_MAX_RATE);
+		return 0;
+	}
+
+	if (!shaper_set_rate (ARG_INTERFACE (0), ARG_INTEGER (1))) {
+		kprintf ("out of memory\n");
+		return 0;
+	}
+	return 1;
+}
+
+int
+cmd_shaper_class (struct CLI_ARGS* args) {
+	struct SHAPER* s = cmd_get_shaper (ARG_INTERFACE (0));
+	uint32_t weight = (args->num_args > 5) ? ARG_INTEGER (5) : 1;
+
+	if (s == NULL)
+		return 0;
+
+	/* check everything */
+	if (ARG_INTEGER (1) >= SHAPER_CLASSES) {
+		kprintf ("classes are numbered 0 to %u\n", SHAPER_CLASSES - 1);
+		return 0;
+	}
+	if ((ARG_INTEGER (2) == 0) || (ARG_INTEGER (3) < ARG_INTEGER (2)) ||
+	    (ARG_INTEGER (3) > SHAPER_MAX_RATE)) {
+		kprintf ("the rate must be non-zero, and the ceiling between the rate and %u kbit/s\n",
+			SHAPER_MAX_RATE);
+		return 0;
+	}
+	if (ARG_INTEGER (4) >= SHAPER_PRIOS) {
+		kprintf ("priorities are numbered 0 to %u\n", SHAPER_PRIOS - 1);
+		return 0;
+	}
+	if ((weight == 0) || (weight > 100)) {
+		kprintf ("the weight must be 1 to 100\n");
+		return 0;
+	}
+
+	if (!shaper_set_class (ARG_INTERFACE (0), ARG_INTEGER (1), ARG_INTEGER (2),
+	                       ARG_INTEGER (3), ARG_INTEGER (4), weight)) {
+		kprintf ("out of memory\n");
+		return 0;
+	}
+	return 1;
+}
+
+int
+cmd_shaper_remove (struct CLI_ARGS* args) {
+	struct SHAPER* s = cmd_get_shaper (ARG_INTERFACE (0));
+
+	if ((s == NULL) || (!cmd_check_class (s, ARG_INTEGER (1))))
+		return 0;
+
+	if (ARG_INTEGER (1) == s->defclass) {
+		kprintf ("the default class can't be removed\n");
+		return 0;
+	}
+
+	shaper_remove_class (ARG_INTERFACE (0), ARG_INTEGER (1));
+	return 1;
+}
+
+int
+cmd_shaper_map (struct CLI_ARGS* args) {
+	struct SHAPER* s = cmd_get_shaper (ARG_INTERFACE (0));
+
+	if ((s == NULL) || (!cmd_check_class (s, ARG_INTEGER (2))))
+		return 0;
+
+	if (ARG_INTEGER (1) >= SHAPER_DSCPS) {
+		kprintf ("code points are numbered 0 to %u\n", SHAPER_DSCPS - 1);
+		return 0;
+	}
+
+	s->dscp[ARG_INTEGER (1)] = ARG_INTEGER (2);
+	return 1;
+}
+
+int
+cmd_shaper_default (struct CLI_ARGS* args) {
+	struct SHAPER* s = cmd_get_shaper (ARG_INTERFACE (0));
+
+	if ((s == NULL) || (!cmd_check_class (s, ARG_INTEGER (1))))
+		return 0;
+
+	s->defclass = ARG_INTEGER (1);
+	return 1;
+}
+
+int
+cmd_shaper_show (struct CLI_ARGS* args) {
+	struct SHAPER* s = cmd_get_shaper (ARG_INTERFACE (0));
+	struct SHAPER_CLASS* cl;
+	int i, j, n;
+
+	if (s == NULL)
+		return 0;
+
+	kprintf ("%u kbit/s, %u packets queued\n", s->root.rate, s->backlog);
+	for (i = 0; i < SHAPER_CLASSES; i++) {
+		cl = &s->class[i];
+		if (cl->qdisc == NULL)
+			continue;
+
+		kprintf ("class %u: rate %u ceiling %u kbit/s, priority %u, weight %u%s\n",
+			i, cl->rate.rate, cl->ceil.rate, cl->prio, cl->quantum / SHAPER_QUANTUM,
+			(i == s->defclass) ? ", default" : "");
+		kprintf ("    %u packets queued, %u frames sent (%u borrowed), %lu bytes, %u dropped\n",
+			cl->qdisc->backlog, cl->frames, cl->borrowed, cl->bytes,
+			cl->qdisc->delay_drops + cl->qdisc->limit_drops);
+
+		/* show the code points that go here */
+		for (j = 0, n = 0; j < SHAPER_DSCPS; j++)
+			if (s->dscp[j] == i)
+				kprintf ("%s %u", (n++ == 0) ? "    dscp" : "", j);
+		if (n > 0)
+			kprintf ("\n");
+	}
+	return 1;
+}
+
+/*
+ * This will parse prefix [s], which is 'any' or an address with an optional
+ * '/length', into the addresses from [lo] to [hi] and prefix length [len].
+ * It will return zero if [s] makes no sense.
+ */
+static int
+cmd_acl_prefix (char* s, uint32_t* lo, uint32_t* hi, uint8_t* len) {
+	uint32_t addr, l = 32;
+
+	if (!kstrcmp (s, "any")) {
+		*lo = 0; *hi = 0xffffffff; *len = 0;
+		return 1;
+	}
+
+	if (!ip_fetch_addr (&s, &addr))
+		return 0;
+	if (*s == '/') {
+		l = strtol (s + 1, &s, 10);
+		if (l > 32)
+			return 0;
+	}
+	if (*s)
+		return 0;
+
+	*lo = (l == 0) ? 0 : addr & (0xffffffff << (32 - l));
+	*hi = (l == 0) ? 0xffffffff : *lo | ~(0xffffffff << (32 - l));
+	*len = l;
+	return 1;
+}
+
+/*
+ * This will parse port range [*s], which is 'any', a port or 'first-last',
+ * into [lo] and [hi], and update [*s] past it. It will return zero if [*s]
+ * makes no sense.
+ */
+static int
+cmd_acl_ports (char** s, uint32_t* lo, uint32_t* hi) {
+	char* ptr = *s;
+
+	if (!kstrncmp (ptr, "any", 3)) {
+		*lo = 0; *hi = 65535;
+		*s = ptr + 3;
+		return 1;
+	}
+
+	if ((*ptr < '0') || (*ptr > '9'))
+		return 0;
+	*lo = strtol (ptr, &ptr, 10); *hi = *lo;
+	if (*ptr == '-') {
+		ptr++;
+		if ((*ptr < '0') || (*ptr > '9'))
+			return 0;
+		*hi = strtol (ptr, &ptr, 10);
+	}
+	if ((*hi > 65535) || (*lo > *hi))
+		return 0;
+
+	*s = ptr;
+	return 1;
+}
+
+int
+cmd_acl_add (struct CLI_ARGS* args) {
+	struct ACL_RULE rule;
+	char* s;
+	int ok;
+
+	kmemset (&rule, 0, sizeof (struct ACL_RULE));
+	rule.number = ARG_INTEGER (0);
+
+	/* where and what */
+	if (!kstrcmp (ARG_STRING (1), "in"))
+		rule.dir = ACL_DIR_IN;
+	else if (!kstrcmp (ARG_STRING (1), "out"))
+		rule.dir = ACL_DIR_OUT;
+	else {
+		kprintf ("rules are either in or out\n");
+		return 0;
+	}
+	if (!kstrcmp (ARG_STRING (2), "permit"))
+		rule.action = ACL_PERMIT;
+	else if (!kstrcmp (ARG_STRING (2), "deny"))
+		rule.action = ACL_DENY;
+	else {
+		kprintf ("rules either permit or deny\n");
+		return 0;
+	}
+	if (kstrcmp (ARG_STRING (3), "any")) {
+		rule.device = device_find (ARG_STRING (3));
+		if (rule.device == NULL) {
+			kprintf ("no such interface [%s]\n", ARG_STRING (3));
+			return 0;
+		}
+	}
+
+	/* the addresses */
+	if (!cmd_acl_prefix (ARG_STRING (4), &rule.lo[ACL_DIM_SRC], &rule.hi[ACL_DIM_SRC], &rule.srclen) ||
+	    !cmd_acl_prefix (ARG_STRING (5), &rule.lo[ACL_DIM_DST], &rule.hi[ACL_DIM_DST], &rule.dstlen)) {
+		kprintf ("prefixes are any, a.b.c.d or a.b.c.d/len\n");
+		return 0;
+	}
+
+	/* the protocol */
+	rule.hi[ACL_DIM_PROTO] = 255;
+	if ((args->num_args > 6) && (kstrcmp (ARG_STRING (6), "any"))) {
+		if (!kstrcmp (ARG_STRING (6), "icmp"))
+			rule.lo[ACL_DIM_PROTO] = IP_PROTO_ICMP;
+		else if (!kstrcmp (ARG_STRING (6), "tcp"))
+			rule.lo[ACL_DIM_PROTO] = IP_PROTO_TCP;
+		else if (!kstrcmp (ARG_STRING (6), "udp"))
+			rule.lo[ACL_DIM_PROTO] = IP_PROTO_UDP;
+		else {
+			rule.lo[ACL_DIM_PROTO] = strtol (ARG_STRING (6), &s, 10);
+			if ((*s) || (rule.lo[ACL_DIM_PROTO] > 255)) {
+				kprintf ("protocols are icmp, tcp, udp, any or 0 to 255\n");
+				return 0;
+			}
+		}
+		rule.hi[ACL_DIM_PROTO] = rule.lo[ACL_DIM_PROTO];
+	}
+
+	/* the ports; without a colon, it's the destination ports */
+	rule.hi[ACL_DIM_SPORT] = 65535; rule.hi[ACL_DIM_DPORT] = 65535;
+	if (args->num_args > 7) {
+		if ((rule.lo[ACL_DIM_PROTO] != rule.hi[ACL_DIM_PROTO]) ||
+		    ((rule.lo[ACL_DIM_PROTO] != IP_PROTO_TCP) && (rule.lo[ACL_DIM_PROTO] != IP_PROTO_UDP))) {
+			kprintf ("only tcp and udp have ports\n");
+			return 0;
+		}
+		s = ARG_STRING (7);
+		ok = cmd_acl_ports (&s, &rule.lo[ACL_DIM_DPORT], &rule.hi[ACL_DIM_DPORT]);
+		if ((ok) && (*s == ':')) {
+			/* those were the source ports */
+			rule.lo[ACL_DIM_SPORT] = rule.lo[ACL_DIM_DPORT];
+			rule.hi[ACL_DIM_SPORT] = rule.hi[ACL_DIM_DPORT];
+			s++;
+			ok = cmd_acl_ports (&s, &rule.lo[ACL_DIM_DPORT], &rule.hi[ACL_DIM_DPORT]);
+		}
+		if ((!ok) || (*s)) {
+			kprintf ("ports are any, a port or first-last, as source:destination or destination\n");
+			return 0;
+		}
+	}
+
+	if (!acl_add (&rule)) {
+		kprintf ("out of memory\n");
+		return 0;
+	}
+	return 1;
+}
+
+int
+cmd_acl_delete (struct CLI_ARGS* args) {
+	if (!acl_delete (ARG_INTEGER (0))) {
+		kprintf ("no such rule\n");
+		return 0;
+	}
+	return 1;
+}
+
+int
+cmd_acl_flush (struct CLI_ARGS* args) {
+	acl_flush();
+	return 1;
+}
+
+int
+cmd_acl_commit (struct CLI_ARGS* args) {
+	if (!acl_commit()) {
+		kprintf ("out of memory; the previous rules stay active\n");
+		return 0;
+	}
+
+	if (acl_policy != NULL)
+		kprintf ("%u rules active: %u nodes, %u bytes, depth %u\n", acl_policy->num_rules,
+			acl_policy->num_nodes, acl_policy->size, acl_policy->depth);
+	return 1;
+}
+
+/*
+ * This will print the port range from [lo] to [hi].
+ */
+static void
+cmd_acl_show_ports (uint32_t lo, uint32_t hi) {
+	if ((lo == 0) && (hi == 65535))
+		kprintf ("any");
+	else if (lo == hi)
+		kprintf ("%u", lo);
+	else
+		kprintf ("%u-%u", lo, hi);
+}
+
+int
+cmd_acl_list (struct CLI_ARGS* args) {
+	struct ACL_RULE* r;
+	uint32_t n;
+
+	for (r = acl_rules; r != NULL; r = r->next) {
+		kprintf ("%u %s %s %s ", r->number, (r->dir == ACL_DIR_IN) ? "in" : "out",
+			(r->action == ACL_PERMIT) ? "permit" : "deny",
+			(r->device != NULL) ? r->device->name : "any");
+		if (r->srclen == 0)
+			kprintf ("any ");
+		else
+			kprintf ("%I/%u ", r->lo[ACL_DIM_SRC], r->srclen);
+		if (r->dstlen == 0)
+			kprintf ("any");
+		else
+			kprintf ("%I/%u", r->lo[ACL_DIM_DST], r->dstlen);
+		if (r->lo[ACL_DIM_PROTO] == r->hi[ACL_DIM_PROTO])
+			kprintf (" proto %u", r->lo[ACL_DIM_PROTO]);
+		if ((r->lo[ACL_DIM_SPORT] != 0) || (r->hi[ACL_DIM_SPORT] != 65535) ||
+		    (r->lo[ACL_DIM_DPORT] != 0) || (r->hi[ACL_DIM_DPORT] != 65535)) {
+			kprintf (" ports ");
+			cmd_acl_show_ports (r->lo[ACL_DIM_SPORT], r->hi[ACL_DIM_SPORT]);
+			kprintf (":");
+			cmd_acl_show_ports (r->lo[ACL_DIM_DPORT], r->hi[ACL_DIM_DPORT]);
+		}
+		if (r->committed)
+			kprintf (": %u hits\n", r->hits);
+		else
+			kprintf (": not committed\n");
+
+		if ((args->num_args > 0) && (ARG_BOOLEAN (0)))
+			r->hits = 0;
+	}
+
+	n = acl_pending();
+	if (n > 0)
+		kprintf ("%u changes not committed yet\n", n);
+	return 1;
+}
+
+int
+cmd_acl_benchmark (struct CLI_ARGS* args) {
+	uint32_t rules = 1000;
+	uint32_t lookups = 1000000;
+
+	/* override the defaults if needed */
+	if (args->num_args >= 1) rules   = ARG_INTEGER(0);
+	if (args->num_args >= 2) lookups = ARG_INTEGER(1);
+
+	/* need something to look up */
+	if (rules == 0) {
+		kprintf ("need at least one rule\n");
+		return 0;
+	}
+
+	return acl_benchmark (rules, lookups);
+}
+
 /* vim:set ts=2 sw=2: */
@@ -10,6 +10,7 @@
  */
 #include <sys/device.h>
 #include <sys/network.h>
+#include <sys/prof.h>
 #include <sys/kmalloc.h>
 #include <sys/irq.h>
 #include <sys/types.h>
@@ -413,10 +414,9 @@ ep_get (struct DEVICE* dev, int len) {
 	addr_t offset = 0;
 	int rxreg/*, i*/;
 
-	if (pkt == NULL) {
-		kprintf ("%s: out of network buffers!\n", dev->name);
+	if (pkt == NULL)
+		/* out of network buffers. this was accounted for already */
 		return NULL;
-	}
 
 	rxreg = ep_w1_reg (dev, ELINK_W1_RX_PIO_RD_1);
 
@@ -491,7 +491,7 @@ again:
 	len &= RX_BYTES_MASK;
 
 	/* fetch */
-	pkt = ep_get (dev, len);
+	PROF (PROF_DRV_RX, pkt = ep_get (dev, len));
 	if (pkt == NULL)
 		goto abort;
 
@@ -507,7 +507,7 @@ again:
 
 	/* handle the input */
 	pkt->len = len - sizeof (ETHERNET_HEADER); 
-	network_queue_packet (pkt);
+	network_queue_packet (dev, pkt);
 
 	/* fix overflow */
 	if (ep_status (dev)) {
@@ -596,8 +596,11 @@ readcheck:
 		status = inw (dev->resources.port + ELINK_STATUS);
 
 		if ((status & INTR_LATCH) == 0) {
-			/* got a packet without an IRQ [huh?]. handle it */
+			/* got a packet without an IRQ [huh?]. handle it, but keep the IRQ
+			 * handler out as it may be queueing packets as well */
+			i = arch_interrupts (DISABLE);
 			ep_read (dev);
+			arch_interrupts (i);
 		} else {
 			return;
 		}
@@ -651,16 +654,13 @@ ep_irq (struct DEVICE* dev) {
 
 		if (status & RX_COMPLETE)
 			ep_read (dev);
-		if (status & TX_AVAIL)
-			ep_start (dev);
+		/* the main loop will send more packets once there is room */
 		if (status & CARD_FAILURE) {
 			kprintf ("%s: adapter failure (%x)\n", dev->name, status);
 			ep_init (dev);
 		}
-		if (status & TX_COMPLETE) {
+		if (status & TX_COMPLETE)
 			ep_txstat (dev);
-			ep_start (dev);
-		}
 	}
 }
 
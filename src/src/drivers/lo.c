@@ -35,7 +35,7 @@ lo_xmit_frame(struct DEVICE* dev) {
 		dev->rx_frames++; dev->rx_bytes += pkt->len;
 
 		/* queue the packet for handling */
-		network_queue_packet (pkt);
+		network_queue_packet (dev, pkt);
 	}
 }
 
@@ -10,6 +10,7 @@
  */
 #include <sys/device.h>
 #include <sys/network.h>
+#include <sys/prof.h>
 #include <sys/kmalloc.h>
 #include <sys/irq.h>
 #include <sys/types.h>
@@ -355,24 +356,33 @@ ne_get (struct DEVICE* dev, uint16_t src, uint16_t len, uint8_t* ptr) {
 void
 ne_read (struct DEVICE* dev, int buf, int len) {
 	struct NETPACKET* pkt = network_alloc_packet (dev);
-	if (pkt == NULL) {
-		kprintf ("%s: out of network buffers!\n", dev->name);
+	int ok;
+
+	if (pkt == NULL)
+		/* out of network buffers. this was accounted for already */
 		return;
-	}
 
 	/* fetch the packet from the card */
-	if (!ne_get (dev, buf, len, pkt->frame))
-		/* this failed, return */
+	PROF (PROF_DRV_RX, ok = ne_get (dev, buf, len, pkt->frame));
+	if (!ok) {
+		/* this failed, drop it */
+		network_drop (dev, NETWORK_DROP_RXERROR);
+		network_free_packet (pkt);
 		return;
+	}
 
-	/* don't pass the ethernet header */
+	/*
+	 * Don't pass the ethernet header. The frame came in through port I/O,
+	 * which leaves nothing to fuse the checksum with, so there is no partial
+	 * checksum; TCP and UDP sum their own data, and nothing else pays for it.
+	 */
 	pkt->len = len - sizeof (ETHERNET_HEADER);
 
 	/* update statistics */
 	dev->rx_frames++; dev->rx_bytes += len;
 
 	/* handle the packet! */
-	network_queue_packet (pkt);
+	network_queue_packet (dev, pkt);
 }
 
 /*
@@ -626,11 +636,8 @@ ne_irq (struct DEVICE* dev) {
 			if (isr & NE_ISR_TXE) {
 				kprintf ("%s: transmitter error\n", dev->name);
 			} else {
-				/* done with the buffer */
+				/* done with the buffer; the main loop will send more */
 				nc->txb_inuse--;
-
-				/* transmit more data if needed */
-				ne_start (dev);
 			}
 		}
 
@@ -11,6 +11,7 @@
 #include <sys/device.h>
 #include <sys/irq.h>
 #include <sys/network.h>
+#include <sys/prof.h>
 #include <sys/kmalloc.h>
 #include <sys/types.h>
 #include <lib/lib.h>
@@ -285,14 +286,19 @@ rl_list_tx_init (struct DEVICE* dev) {
 	return 0;
 }
 
-void
-rl_rxeof (struct DEVICE* dev) {
-	int total_len = 0;
+/*
+ * This will fetch at most [budget] frames from the receive ring of [dev]. It
+ * will return the number of frames fetched.
+ */
+int
+rl_rxeof (struct DEVICE* dev, int budget) {
+	int total_len = 0, count = 0;
 	uint32_t rx_stat, rxbufpos;
 	int wrap = 0;
 	uint16_t cur_rx, limit, rx_bytes = 0, max_bytes;
 	struct RL_DATA* rld = (struct RL_DATA*)dev->data;
 	struct NETPACKET* pkt;
+	int oldints;
 
 	cur_rx = (CSR_READ_2 (dev, RL_CURRXADDR) + 16) % RL_RXBUFLEN;
 	limit = CSR_READ_2 (dev, RL_CURRXBUF) % RL_RXBUFLEN;
@@ -302,7 +308,8 @@ rl_rxeof (struct DEVICE* dev) {
 	else
 		max_bytes = limit - cur_rx;
 
-	while ((CSR_READ_1 (dev, RL_COMMAND) & RL_CMD_EMPTY_RXBUF) == 0) {
+	while ((count < budget) &&
+	       ((CSR_READ_1 (dev, RL_COMMAND) & RL_CMD_EMPTY_RXBUF) == 0)) {
 		rxbufpos = rld->rx_buf + cur_rx;
 		rx_stat = *(uint32_t*)rxbufpos;
 
@@ -310,16 +317,24 @@ rl_rxeof (struct DEVICE* dev) {
 			break;
 
 		if (!(rx_stat & RL_RXSTAT_RXOK)) {
-			/* error! */
+			/*
+			 * Error! Start over. This frees the frames in flight and resets the
+			 * descriptors, so keep rl_txeof() and the IRQ recovery out meanwhile.
+			 */
+			oldints = arch_interrupts (DISABLE);
 			rl_init (dev);
-			return;
+			arch_interrupts (oldints);
+			return count;
 		}
 
 		/* no errors, receive the header */
 		total_len = rx_stat >> 16;
 		rx_bytes += total_len + 4;
 
-		/* discard the checksum */
+		/*
+		 * Discard the CRC: it is neither copied nor checksummed, so what the
+		 * copy sums up covers exactly the frame past the ethernet header.
+		 */
 		total_len -= ETHER_CRC_LEN;
 		
 		/* avoid reading more data than the chip has prepared for us */
@@ -335,7 +350,7 @@ rl_rxeof (struct DEVICE* dev) {
 		kprintf ("cur_rx=%x,total_len=%x,rx_bytes=%x,maxbytes=%x,wrap=%x,rx_buf=%x,rxbufpos=%x\n", cur_rx, total_len, rx_bytes, max_bytes, wrap, rld->rx_buf, rxbufpos);
 #endif
 
-		/* fetch the packet */
+		/* fetch a buffer; if there is none, the frame is skipped */
 		pkt = network_alloc_packet (dev);
 
 		/* update statistics */
@@ -355,10 +370,12 @@ rl_rxeof (struct DEVICE* dev) {
 			 * </openbsd>
 			 */
 
-			/* <EVIL> */
-			kmemcpy (pkt->frame, (char*)(rxbufpos), wrap);
-			pkt->len = wrap - 4;
-			/* </EVIL> */
+			/* the frame continues at the start of the ring */
+			if (pkt != NULL) {
+				PROF (PROF_DRV_RX, network_copy_frame (pkt, 0, (char*)(rxbufpos), wrap));
+				PROF (PROF_DRV_RX, network_copy_frame (pkt, wrap, (char*)(rld->rx_buf), total_len - wrap));
+				pkt->len = total_len - sizeof (ETHERNET_HEADER);
+			}
 
 			cur_rx = (total_len - wrap + ETHER_CRC_LEN);
 		} else {
@@ -370,8 +387,10 @@ rl_rxeof (struct DEVICE* dev) {
 			 * </openbsd>
 			 */
 			/* <EVIL> */
-			kmemcpy (pkt->frame, (char*)(rxbufpos), total_len);
-			pkt->len = total_len - 4;
+			if (pkt != NULL) {
+				PROF (PROF_DRV_RX, network_copy_frame (pkt, 0, (char*)(rxbufpos), total_len));
+				pkt->len = total_len - sizeof (ETHERNET_HEADER);
+			}
 			/* </EVIL> */
 
 			cur_rx += total_len + 4 + ETHER_CRC_LEN;
@@ -381,9 +400,40 @@ rl_rxeof (struct DEVICE* dev) {
 		cur_rx = (cur_rx + 3) & ~3;
 		CSR_WRITE_2 (dev, RL_CURRXADDR, cur_rx - 16);
 
-		/* handle the packet! */
-		network_queue_packet (pkt);
+		/* handle the packet, if we had room for it */
+		if (pkt != NULL)
+			network_queue_packet (dev, pkt);
+		count++;
 	}
+
+	return count;
+}
+
+/*
+ * This will poll [dev] for at most [budget] frames. Once the receiver runs
+ * dry, the device leaves polling mode and receive interrupts are unmasked. It
+ * will return the number of frames fetched.
+ */
+int
+rl_poll (struct DEVICE* dev, int budget) {
+	int count, oldints;
+
+	/* fetch what we can */
+	count = rl_rxeof (dev, budget);
+	if (count == budget)
+		/* there may be more. keep polling */
+		return count;
+
+	/*
+	 * We ran dry. Anything arriving after this will raise an interrupt again,
+	 * so there is no window in which a frame can get stuck.
+	 */
+	oldints = arch_interrupts (DISABLE);
+	dev->flags &= ~DEVICE_FLAG_POLLING;
+	CSR_WRITE_2 (dev, RL_IMR, RL_INTRS);
+	arch_interrupts (oldints);
+
+	return count;
 }
 
 /* A frame was downloaded to the chip. It's safe for us to clean up the
@@ -391,34 +441,49 @@ rl_rxeof (struct DEVICE* dev) {
 void
 rl_txeof (struct DEVICE* dev) {
 	struct RL_DATA* rld = (struct RL_DATA*)dev->data;
+	struct NETPACKET* done_first = NULL;
+	struct NETPACKET* done_last = NULL;
+	struct NETPACKET* pkt;
 	uint32_t txstat;
+	int oldthresh;
 
-	/* go through our TX list */
-	do {
+	/* go through our TX list, as long as there are frames in flight */
+	while ((pkt = RL_LAST_TXMBUF (rld)) != NULL) {
 		txstat = CSR_READ_4 (dev, RL_LAST_TXSTAT (rld));
 		if (!(txstat & (RL_TXSTAT_TX_OK | RL_TXSTAT_TX_UNDERRUN | RL_TXSTAT_TXABRT)))
 				break;
 
-		if (!(txstat & RL_TXSTAT_TX_OK)) {
-			int oldthresh;
+		/* the chip is done with this buffer; collect it */
+		RL_LAST_TXMBUF (rld) = NULL;
+		pkt->next = NULL;
+		if (done_first == NULL)
+			done_first = pkt;
+		else
+			done_last->next = pkt;
+		done_last = pkt;
 
+		if (!(txstat & RL_TXSTAT_TX_OK)) {
 			if ((txstat & RL_TXSTAT_TXABRT) ||
 					(txstat & RL_TXSTAT_OUTOFWIN)) {
 				CSR_WRITE_4 (dev, RL_TXCFG, RL_TXCFG_CONFIG);
 				oldthresh = rld->tx_thresh;
 
-				/* error recovery */
+				/* error recovery. this frees whatever is still in flight */
 				rl_reset (dev);
 				rl_init (dev);
 
 				/* if there was a transmit underrun, bump the TX threshold */
 				if (txstat & RL_TXSTAT_TX_UNDERRUN)
 					rld->tx_thresh = oldthresh + 32;
-				return;
+				break;
 			}
 		}
 		RL_INC (rld->last_tx);
-	} while (rld->last_tx != rld->cur_tx);
+	}
+
+	/* free all completed buffers in one go */
+	if (done_first != NULL)
+		network_free_chain (done_first, done_last);
 }
 
 void
@@ -436,10 +501,9 @@ rl_irq (struct DEVICE* dev) {
 		if ((status & RL_INTRS) == 0)
 			break;
 
-		if (status & RL_ISR_RX_OK)
-			rl_rxeof (dev);
-		if (status & RL_ISR_RX_ERR)
-			rl_rxeof (dev);
+		if (status & (RL_ISR_RX_OK | RL_ISR_RX_ERR))
+			/* leave the frames to the poll loop */
+			dev->flags |= DEVICE_FLAG_POLLING;
 		if ((status & RL_ISR_TX_OK) || (status & RL_ISR_TX_ERR))
 			rl_txeof (dev);
 		if (status & RL_ISR_SYSTEM_ERR) {
@@ -448,11 +512,10 @@ rl_irq (struct DEVICE* dev) {
 		}
 	}
 	
-	/* re-enable interrupts */
-	CSR_WRITE_2 (dev, RL_IMR, RL_INTRS);
+	/* re-enable interrupts, but keep receive quiet while we are polled */
+	CSR_WRITE_2 (dev, RL_IMR, (dev->flags & DEVICE_FLAG_POLLING) ? RL_INTRS_POLLING : RL_INTRS);
 
-	/* send new packets */
-	rl_start (dev);
+	/* the main loop will fill the descriptors we freed */
 }
 
 /*
@@ -463,43 +526,45 @@ rl_start (struct DEVICE* dev) {
 	struct NETPACKET* pkt;
 	struct RL_DATA* rld = (struct RL_DATA*)dev->data;
 	size_t len;
+	int oldints;
 
 	/*
-	 * Fetch the next packet to send
-	 *
-	 * the IRQ will acknowledge when we are done so we can send more
-	 *
+	 * Fill all free descriptors. The buffers remain ours until rl_txeof()
+	 * sees the chip is done with them. We are only called from the main loop,
+	 * whereas rl_txeof() and the error recovery, which resets [cur_tx] and
+	 * the descriptors, run from the IRQ or with interrupts off: interrupts are
+	 * off while a descriptor is handed over, so they never see one half set
+	 * up.
 	 */
-/*startagain:*/
-	pkt = network_get_next_txbuf (dev);
-	if (pkt == NULL)
-		/* none, so bail out */
-		return;
-
-	/* ensure we don't send packets too tiny */
-	len = (pkt->len + pkt->header_len);
-	if (len < 60)
-		len = 60;
-
-	/* transmit this frame */
-	CSR_WRITE_4 (dev, RL_CUR_TXADDR (rld), (uint32_t)(pkt->frame));
-	CSR_WRITE_4 (dev, RL_CUR_TXSTAT (rld),
-			(RL_TXTHRESH (rld->tx_thresh) |
-			len));
-
-	/* update counters */
-	dev->tx_frames++; dev->tx_bytes += pkt->len;
+	while (RL_CUR_TXMBUF (rld) == NULL) {
+		/* fetch the next packet to send */
+		pkt = network_get_next_txbuf (dev);
+		if (pkt == NULL)
+			/* none, so bail out */
+			break;
 
-	/* free the buffer */
-	network_free_packet (pkt);
+		/* ensure we don't send packets too tiny */
+		len = (pkt->len + pkt->header_len);
+		if (len < RL_MIN_FRAMELEN)
+			len = RL_MIN_FRAMELEN;
 
-	/* next */
-	RL_INC (rld->cur_tx);
+		/*
+		 * Update the counters while the packet is still ours; once the IRQ may
+		 * run again, rl_txeof() can already have freed it.
+		 */
+		dev->tx_frames++; dev->tx_bytes += pkt->len;
 
-#if 0
-	/* do it again, do it again! */
-	goto startagain;
-#endif
+		/* transmit this frame */
+		oldints = arch_interrupts (DISABLE);
+		RL_CUR_TXMBUF (rld) = pkt;
+		CSR_WRITE_4 (dev, RL_CUR_TXADDR (rld), (uint32_t)(pkt->frame));
+		arch_barrier();
+		CSR_WRITE_4 (dev, RL_CUR_TXSTAT (rld),
+				(RL_TXTHRESH (rld->tx_thresh) |
+				len));
+		RL_INC (rld->cur_tx);
+		arch_interrupts (oldints);
+	}
 
 #if 0
 	struct DEVICE_CONFIG* cf = (struct DEVICE_CONFIG*)dev->config;
@@ -541,8 +606,9 @@ rl_stop (struct DEVICE* dev) {
 	/* free the TX list buffers */
 	for (i = 0; i < RL_TX_LIST_CNT; i++) {
 		if (rld->tx_chain[i] != NULL) {
+			network_free_packet (rld->tx_chain[i]);
 			rld->tx_chain[i] = NULL;
-			CSR_WRITE_4 (dev, RL_TXADDR0 + i, 0);
+			CSR_WRITE_4 (dev, RL_TXADDR0 + (i * sizeof (uint32_t)), 0);
 		}
 	}
 }
@@ -645,8 +711,15 @@ rtl8139_init (char* name, struct DEVICE_RESOURCES* res) {
 	rdev.addr_len = ETHER_ADDR_LEN;
 	rdev.data = rld;
 	rdev.xmit = rl_start;
+	rdev.poll = rl_poll;
 	kmemcpy (&rdev.resources, res, sizeof (struct DEVICE_RESOURCES));
 	dev = device_register (&rdev);
+	if (dev == NULL) {
+		/* this failed. complain */
+		kprintf ("%s: unable to register device!\n", name);
+		kfree (rld);
+		return 0;
+	}
 
 	/* register the IRQ */
 	if (!irq_register (res->irq, &rl_irq, dev)) {
@@ -683,7 +756,8 @@ rtl8139_init (char* name, struct DEVICE_RESOURCES* res) {
 
 	/* set the buffers up */
 	rld->rx_buf = (addr_t)kmalloc (NULL, RL_RXBUFLEN + 32, 0);
-	kmemset ((void*)rld->rx_buf, 0, RL_RXBUFLEN + 32);
+	/* the card fills the ring, so don't waste the caches on clearing it */
+	kmemset_nt ((void*)rld->rx_buf, 0, RL_RXBUFLEN + 32);
 	rld->rx_buf += /*rld->rx_buf + */sizeof (uint64_t);
 
 	/* initialize the card */
@@ -244,7 +244,7 @@ struct RL_DATA {
 	addr_t                 rx_buf_ptr;
 
 	char									 buffer[2048];
-	addr_t                 tx_chain[RL_TX_LIST_CNT];
+	struct NETPACKET*      tx_chain[RL_TX_LIST_CNT];
 	size_t                 tx_len[RL_TX_LIST_CNT];
 	uint8_t                last_tx;
 	uint8_t                cur_tx;
@@ -332,7 +332,7 @@ struct RL_MII_FRAME {
 #define RL_CUR_TXMBUF(x)        (x->tx_chain[x->cur_tx])
 #define RL_LAST_TXADDR(x)       ((x->last_tx * 4) + RL_TXADDR0)
 #define RL_LAST_TXSTAT(x)       ((x->last_tx * 4) + RL_TXSTAT0)
-#define RL_LAST_TXMBUF(x)       (x->tx_chain[x->rl_cdata.last_tx])
+#define RL_LAST_TXMBUF(x)       (x->tx_chain[x->last_tx])
 #define RL_LAST_TXMLEN(x)       (x->tx_len[x->rl_cdata.last_tx])
 
 /*
@@ -353,6 +353,9 @@ struct RL_MII_FRAME {
 	 RL_ISR_RX_OVERRUN|RL_ISR_PKT_UNDERRUN|RL_ISR_FIFO_OFLOW|      \
 	 RL_ISR_PCS_TIMEOUT|RL_ISR_SYSTEM_ERR)
 
+/* RL_INTRS_POLLING are the interrupts we want while the receiver is polled */
+#define RL_INTRS_POLLING	(RL_INTRS & ~(RL_ISR_RX_OK|RL_ISR_RX_ERR))
+
 #define vtophys
 
 
@@ -10,7 +10,12 @@
 
 #include <sys/types.h>
 
+/* CONSOLE_FLAG_SERIAL copies all output to the serial port, if there is one */
+#define CONSOLE_FLAG_SERIAL	1
+
 #ifdef __KERNEL
+extern uint32_t arch_console_flags;
+
 void arch_console_init();
 void arch_console_putchar (uint8_t ch);
 uint8_t arch_console_readch();
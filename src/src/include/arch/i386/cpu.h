@@ -0,0 +1,26 @@
+/*
+ * cpu.h - ILIOS i386 CPU features
+ * (c) 2003 Rink Springer, BSD
+ *
+ */
+#include <sys/types.h>
+
+#ifndef __MD_CPU_H__
+#define __MD_CPU_H__
+
+/* CPU_FEATURE_xxx are the features in arch_cpu_features */
+#define CPU_FEATURE_TSC		0x01			/* time stamp counter */
+#define CPU_FEATURE_MMX		0x02			/* MMX */
+#define CPU_FEATURE_SSE		0x04			/* SSE, enabled */
+#define CPU_FEATURE_SSE2	0x08			/* SSE2, enabled */
+#define CPU_FEATURE_ERMS	0x10			/* enhanced rep movsb/stosb */
+
+#ifdef __KERNEL
+extern uint32_t arch_cpu_features;
+
+void arch_cpu_init();
+#endif /* __KERNEL */
+
+#endif /* __MD_CPU_H__ */
+
+/* vim:set ts=2 sw=2: */
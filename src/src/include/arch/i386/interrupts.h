@@ -19,6 +19,13 @@
 
 int	arch_interrupts (int enable);
 
+/*
+ * arch_barrier() prevents the compiler from moving memory accesses across it.
+ * The i386 doesn't reorder stores with respect to other stores, so this is
+ * all that is needed to publish data to an interrupt handler or vice versa.
+ */
+#define arch_barrier() __asm__ __volatile__ ("" : : : "memory")
+
 #endif /* __KERNEL */
 
 #endif /* __INTERRUPTS_H__ */
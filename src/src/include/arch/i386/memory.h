@@ -10,10 +10,21 @@
 
 #include <sys/types.h>
 
+/* MEMORY_MAX_RANGES is the number of usable memory ranges we keep track of */
+#define MEMORY_MAX_RANGES	32
+
+/*
+ * MEMORY_RANGE is a page aligned range of memory which is free for use.
+ */
+struct MEMORY_RANGE {
+	size_t	addr;
+	size_t	len;
+};
+
 #ifdef __KERNEL
 extern size_t highest_addressable_byte;
-extern size_t first_addressable_high_byte;
-extern size_t lowest_addressable_free_byte;
+extern struct MEMORY_RANGE memory_range[MEMORY_MAX_RANGES];
+extern int memory_num_ranges;
 
 void arch_add_all_memory();
 #endif /* __KERNEL */
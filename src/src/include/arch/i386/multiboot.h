@@ -0,0 +1,58 @@
+/*
+ * multiboot.h - XeOS i386 Multiboot Information
+ * (c) 2003 Rink Springer, BSD
+ *
+ * This describes what a Multiboot compliant loader like GRUB hands the
+ * kernel. Only the parts we care about are listed.
+ *
+ */
+#ifndef __MULTIBOOT_H__
+#define __MULTIBOOT_H__
+
+#include <sys/types.h>
+
+/* MULTIBOOT_BOOTLOADER_MAGIC is passed in %eax by a Multiboot loader */
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2badb002
+
+/* MULTIBOOT_INFO_MEMORY means [mem_lower] and [mem_upper] are valid */
+#define MULTIBOOT_INFO_MEMORY		0x01
+
+/* MULTIBOOT_INFO_MEM_MAP means [mmap_addr] and [mmap_length] are valid */
+#define MULTIBOOT_INFO_MEM_MAP	0x40
+
+/* MULTIBOOT_MEMORY_AVAILABLE is the type of usable memory map entries */
+#define MULTIBOOT_MEMORY_AVAILABLE	1
+
+/*
+ * MULTIBOOT_INFO is the information structure whose address is passed in
+ * %ebx. The memory sizes are in KB.
+ */
+struct MULTIBOOT_INFO {
+	uint32_t	flags;
+	uint32_t	mem_lower;
+	uint32_t	mem_upper;
+	uint32_t	boot_device;
+	uint32_t	cmdline;
+	uint32_t	mods_count;
+	uint32_t	mods_addr;
+	uint32_t	syms[4];
+	uint32_t	mmap_length;
+	uint32_t	mmap_addr;
+} __attribute__((packed));
+
+/*
+ * MULTIBOOT_MMAP is a single entry of the BIOS (E820) memory map. [size] is
+ * the size of the rest of the entry, so it doesn't count itself.
+ */
+struct MULTIBOOT_MMAP {
+	uint32_t	size;
+	uint32_t	base_low;
+	uint32_t	base_high;
+	uint32_t	length_low;
+	uint32_t	length_high;
+	uint32_t	type;
+} __attribute__((packed));
+
+#endif /* __MULTIBOOT_H__ */
+
+/* vim:set ts=2 sw=2: */
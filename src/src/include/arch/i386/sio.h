@@ -72,5 +72,7 @@
 #define SIO_TYPE_16550	2			/* 16550 */
 #define SIO_TYPE_16550A	3			/* 16550A */
 
+extern int arch_sio_present;
+
 void arch_sio_init();
 void arch_sio_send (uint8_t ch);
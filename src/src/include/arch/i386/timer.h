@@ -19,12 +19,21 @@
 #define	TIMER_SEL0      0x00    /* select counter 0 */
 #define TIMER_LATCH     0x00    /* latch counter for reading */
 
+/* TSC_CALIBRATE_MS is how long we count the TSC to figure out its speed */
+#define TSC_CALIBRATE_MS	50
+
 
 void timer_asm();
 
 uint32_t arch_timer_get();
 void arch_delay (int32_t wait);
 
+extern uint32_t arch_tsc_khz;
+
+void arch_tsc_init();
+unsigned long long arch_tsc_read();
+uint32_t arch_tsc_read32();
+
 #endif
 
 /* vim:set ts=2: */
@@ -62,7 +62,9 @@ extern char hostname[HOSTNAME_LEN];
 extern struct COMMAND commands[];
 
 void cli_go();
+int  cli_handle_cmd (char* buf);
 void cli_launch_script (char** script);
+int  ip_fetch_addr (char** buf, uint32_t* addr);
 
 #endif /* __CLI_H__ */
 
@@ -25,6 +25,22 @@ int kstrncmp (const char* s1, const char* s2, size_t len);
 char* kstrchr (const char* s1, char ch);
 int kstrcpy (char* dst, const char* src);
 
+/* i386/copy.c */
+extern void (*kmemcpy_fn)(void* dst, const void* src, size_t len);
+extern void (*kmemset_fn)(void* dst, const char c, size_t len);
+void kmemcpy_generic (void* dst, const void* src, size_t len);
+void kmemcpy_erms (void* dst, const void* src, size_t len);
+void kmemcpy_mmx (void* dst, const void* src, size_t len);
+void kmemcpy_sse2 (void* dst, const void* src, size_t len);
+void kmemcpy_nt (void* dst, const void* src, size_t len);
+void kmemset_generic (void* dst, const char c, size_t len);
+void kmemset_erms (void* dst, const char c, size_t len);
+void kmemset_sse2 (void* dst, const char c, size_t len);
+void kmemset_nt (void* dst, const char c, size_t len);
+
+/* bits.c */
+int klowbit (uint32_t word);
+
 /* kprint.c */
 void vaprintf (char* fmt, va_list ap);
 void kprintf (char* fmt, ...);
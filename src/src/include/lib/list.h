@@ -0,0 +1,37 @@
+/*
+ * list.h - ILIOS Doubly Linked Lists
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * These work on any structure with [next] and [prev] pointers to its own
+ * type; a list is a pointer to its first entry, and the first entry has no
+ * [prev]. The arguments are evaluated more than once.
+ *
+ */
+
+#ifndef __KLIST_H__
+#define __KLIST_H__
+
+/* KLIST_LINK(list,item) will add [item] to the head of list [*list] */
+#define KLIST_LINK(list,item) \
+	do { \
+		(item)->prev = NULL; \
+		(item)->next = *(list); \
+		if (*(list) != NULL) \
+			(*(list))->prev = (item); \
+		*(list) = (item); \
+	} while (0)
+
+/* KLIST_UNLINK(list,item) will remove [item] from list [*list] */
+#define KLIST_UNLINK(list,item) \
+	do { \
+		if ((item)->prev != NULL) \
+			(item)->prev->next = (item)->next; \
+		else \
+			*(list) = (item)->next; \
+		if ((item)->next != NULL) \
+			(item)->next->prev = (item)->prev; \
+	} while (0)
+
+#endif /* __KLIST_H__ */
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,75 @@
+/*
+ * bench.h - ILIOS RFC 2544 Benchmark
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/network.h>
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/* BENCH_PORT is the UDP port test frames are sent to and from (echo) */
+#define BENCH_PORT				7
+
+/* BENCH_MAGIC marks the payload of a test frame */
+#define BENCH_MAGIC				0x32353434
+
+/* BENCH_NUM_SIZES is the number of standard frame sizes */
+#define BENCH_NUM_SIZES		7
+
+/* BENCH_OVERHEAD is the number of bytes a frame takes on the wire besides its
+ * contents: preamble, start of frame delimiter, CRC and inter frame gap */
+#define BENCH_OVERHEAD		(7 + 1 + 4 + 12)
+
+/* BENCH_RESOLUTION is the fraction of the maximum rate the throughput search
+ * stops at, so 100 is 1% */
+#define BENCH_RESOLUTION	100
+
+/* BENCH_SETTLE_MS is the time we wait for frames still underway after a trial */
+#define BENCH_SETTLE_MS		500
+
+/* BENCH_BATCH is the number of frames after which we let the network run */
+#define BENCH_BATCH				16
+
+/*
+ * BENCH_CONFIG is how the benchmark is run.
+ */
+struct BENCH_CONFIG {
+	uint32_t	source;							/* source address of the test frames */
+	uint32_t	dest;								/* destination address of the test frames */
+	uint32_t	speed;							/* link speed in Mbit/s */
+	uint32_t	duration;						/* length of a trial in ms */
+};
+
+/*
+ * BENCH_PAYLOAD is what follows the UDP header of a test frame. It must fit in
+ * a minimum sized frame.
+ */
+struct BENCH_PAYLOAD {
+	uint32_t	magic;							/* BENCH_MAGIC */
+	uint32_t	trial;							/* trial the frame belongs to */
+	uint32_t	tsc_lo, tsc_hi;			/* time stamp counter at transmission */
+} __attribute__((packed));
+
+/*
+ * BENCH_RESULT is the outcome of a single trial.
+ */
+struct BENCH_RESULT {
+	uint32_t	sent;								/* frames transmitted */
+	uint32_t	received;						/* frames received back */
+	uint32_t	ms;									/* time it took to transmit them */
+	uint32_t	lat_min, lat_max;		/* latency extremes in cycles */
+	unsigned long long lat_sum;		/* sum of all latencies in cycles */
+};
+
+extern struct BENCH_CONFIG bench_config;
+extern struct DEVICE* bench_rxdev;
+
+int  bench_run (struct DEVICE* txdev, struct DEVICE* rxdev, uint32_t size);
+int  bench_receive (struct NETPACKET* pkt);
+
+#endif /* __BENCH_H__ */
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,47 @@
+/*
+ * pktgen.h - ILIOS Packet Generator
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+
+#ifndef __PKTGEN_H__
+#define __PKTGEN_H__
+
+/* PKTGEN_PORT is the UDP port we send to and from (discard) */
+#define PKTGEN_PORT		9
+
+/* PKTGEN_MIN_SIZE and PKTGEN_MAX_SIZE limit the frame size, excluding CRC */
+#define PKTGEN_MIN_SIZE		60
+#define PKTGEN_MAX_SIZE		1514
+
+/* PKTGEN_BATCH is the number of packets after which we let the network run */
+#define PKTGEN_BATCH		32
+
+/* PKTGEN_STALL_MS is how long we wait for buffers or the device before giving up */
+#define PKTGEN_STALL_MS		2000
+
+/* PKTGEN_MODE_xxx is where the packets go */
+#define PKTGEN_MODE_XMIT	0				/* out of the device */
+#define PKTGEN_MODE_INJECT	1				/* handled as if the device received them */
+
+/*
+ * PKTGEN_CONFIG is what the packet generator will send.
+ */
+struct PKTGEN_CONFIG {
+	uint32_t	src_first, src_last;			/* source addresses */
+	uint32_t	dst_first, dst_last;			/* destination addresses */
+	uint32_t	size;										/* frame size */
+	uint32_t	rate;										/* packets per second, 0 is unlimited */
+	uint32_t	count;										/* packets to send */
+};
+
+extern struct PKTGEN_CONFIG pktgen_config;
+
+void pktgen_build (uint8_t* frame, uint32_t size, uint8_t* src, uint8_t* dst, uint32_t ipsrc, uint32_t ipdst, uint16_t port);
+int  pktgen_run (struct DEVICE* dev, int mode);
+
+#endif /* __PKTGEN_H__ */
+
+/* vim:set ts=2 sw=2: */
@@ -13,9 +13,6 @@
 #ifndef __SOCKET_H__
 #define __SOCKET_H__
 
-/* SOCKET_NUM_SOCKS is the number of sockets supported */
-#define SOCKET_NUM_SOCKS 1024
-
 /* SOCKET_TYPE_xxx are the supported socket types */
 #define SOCKET_TYPE_UNUSED 0
 #define SOCKET_TYPE_UDP4 1
@@ -33,9 +30,11 @@ struct SOCKET {
 	void (*callback)(struct SOCKET* s, struct DEVICE* dev, uint32_t addr, void* data, uint32_t len);
 
 	uint8_t	sockdata[64];
+
+	struct SOCKET* next;
 };
 
-extern struct SOCKET* socket;
+extern struct SOCKET* sockets;
 
 void socket_init();
 struct SOCKET* socket_alloc (int type);
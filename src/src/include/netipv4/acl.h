@@ -0,0 +1,152 @@
+/*
+ *
+ * ILIOS IPv4 TCP/IP network stack
+ * (c) 2003 Rink Springer
+ *
+ * This is the access list include file.
+ *
+ */
+#include <sys/types.h>
+#include <sys/network.h>
+#include <sys/device.h>
+
+#ifndef __ACL_H__
+#define __ACL_H__
+
+/* ACL_DIM_xxx are the fields rules match on */
+#define ACL_DIM_SRC				0			/* source address */
+#define ACL_DIM_DST				1			/* destination address */
+#define ACL_DIM_PROTO			2			/* protocol */
+#define ACL_DIM_SPORT			3			/* TCP/UDP source port */
+#define ACL_DIM_DPORT			4			/* TCP/UDP destination port */
+#define ACL_DIMS					5
+
+/* ACL_DIR_xxx is where a rule applies */
+#define ACL_DIR_IN				0			/* as packets to forward come in */
+#define ACL_DIR_OUT				1			/* as forwarded packets go out */
+#define ACL_DIRS					2
+
+/* ACL_PERMIT and ACL_DENY are what a rule does with a packet */
+#define ACL_PERMIT				0
+#define ACL_DENY					1
+
+/* ACL_LEAF_RULES is the number of rules a node may hold without being cut */
+#define ACL_LEAF_RULES		4
+
+/* ACL_MAX_CUT_BITS is the most bits a node cuts, so it has at most
+ * 1 << ACL_MAX_CUT_BITS children */
+#define ACL_MAX_CUT_BITS	8
+
+/* ACL_SPACE_FACTOR limits how many copies of its rules the children of a
+ * node may hold, relative to the node itself */
+#define ACL_SPACE_FACTOR	16
+
+/* ACL_MAX_DEPTH is the deepest the tree gets */
+#define ACL_MAX_DEPTH			8
+
+/* ACL_WIDE_BITS is the number of bits beyond which a rule's address is wide;
+ * rules are kept in separate trees by which of their addresses are wide, so
+ * wildcards don't have to be copied into every corner of the tree */
+#define ACL_WIDE_BITS			16
+
+/* ACL_TREES is the number of trees per direction, one per combination of
+ * wide source and destination */
+#define ACL_TREES					4
+
+/* ACL_CHUNK_SIZE is the size of the blocks a compiled policy is carved from */
+#define ACL_CHUNK_SIZE		65536
+
+/* ACL_BENCH_KEYS is the number of packets acl_benchmark() cycles through */
+#define ACL_BENCH_KEYS		4096
+
+/* ACL_CHECK_LOOKUPS is the number of lookups acl_benchmark() checks against
+ * a linear scan of the rules */
+#define ACL_CHECK_LOOKUPS	10000
+
+/* ACL_LEAF is the [dim] of a leaf node */
+#define ACL_LEAF					0xff
+
+/*
+ * ACL_RULE is a single rule. Packets whose fields are all within [lo] to [hi]
+ * match; the rule with the lowest number wins. Rules are kept by number.
+ */
+struct ACL_RULE {
+	struct ACL_RULE* next;
+	uint32_t         number;
+	uint8_t          dir;					/* ACL_DIR_xxx */
+	uint8_t          action;			/* ACL_PERMIT or ACL_DENY */
+	uint8_t          srclen;			/* source prefix length */
+	uint8_t          dstlen;			/* destination prefix length */
+	uint8_t          committed;		/* part of the active policy */
+	struct DEVICE*   device;			/* NULL for any interface */
+	uint32_t         lo[ACL_DIMS];
+	uint32_t         hi[ACL_DIMS];
+	uint32_t         hits;				/* packets matched */
+};
+
+/*
+ * ACL_NODE is a node of a compiled rule set. An inner node cuts the part of
+ * field [dim] its rules use, from [base] on, into [mask] + 1 equal pieces of
+ * 1 << [shift] values; a leaf holds the rules overlapping its part, by number.
+ */
+struct ACL_NODE {
+	uint8_t            dim;				/* field we cut, ACL_LEAF for a leaf */
+	uint8_t            shift;
+	uint32_t           base;				/* first value of the first piece */
+	uint32_t           mask;
+	uint32_t           num_rules;	/* leaf only */
+	struct ACL_NODE**  child;			/* inner node only */
+	struct ACL_RULE**  rule;			/* leaf only */
+};
+
+/*
+ * ACL_CHUNK is a block of memory a compiled policy is carved from; the data
+ * follows the header.
+ */
+struct ACL_CHUNK {
+	struct ACL_CHUNK*  next;
+	size_t             size;
+	size_t             used;
+};
+
+/*
+ * ACL_TABLE is the compiled rule set of a device, per direction and tree; NULL
+ * if there are no rules.
+ */
+struct ACL_TABLE {
+	struct DEVICE*     device;			/* NULL for all other devices */
+	struct ACL_NODE*   root[ACL_DIRS][ACL_TREES];
+	uint32_t           num_rules[ACL_DIRS];
+};
+
+/*
+ * ACL_POLICY is a compiled set of rules. The packet path only ever looks at
+ * [acl_policy], which is replaced in one go when the rules are committed, so
+ * it never sees a half-updated policy.
+ */
+struct ACL_POLICY {
+	struct ACL_CHUNK*  chunk;			/* memory in use */
+	struct ACL_TABLE*  table;			/* the last one is for other devices */
+	uint32_t           num_tables;
+	uint32_t           num_rules;
+	uint32_t           num_nodes;
+	uint32_t           depth;				/* deepest leaf */
+	size_t             size;				/* bytes in use */
+	int                failed;			/* out of memory while compiling */
+};
+
+extern struct ACL_RULE* acl_rules;
+extern struct ACL_POLICY* acl_policy;
+
+int  acl_add (struct ACL_RULE* rule);
+int  acl_delete (uint32_t number);
+void acl_flush();
+void acl_flush_device (struct DEVICE* dev);
+int  acl_commit();
+uint32_t acl_pending();
+int  acl_filter (struct NETPACKET* np, struct DEVICE* dev, int dir);
+int  acl_benchmark (uint32_t num_rules, uint32_t num_lookups);
+
+#endif /* __ACL_H__ */
+
+/* vim:set ts=2 sw=2: */
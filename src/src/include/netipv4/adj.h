@@ -0,0 +1,59 @@
+/*
+ *
+ * ILIOS IPv4 TCP/IP network stack
+ * (c) 2003 Rink Springer
+ *
+ * This is the adjacency include file.
+ *
+ */
+#include <sys/types.h>
+#include <sys/network.h>
+#include <sys/device.h>
+
+#ifndef __ADJ_H__
+#define __ADJ_H__
+
+/* ADJ_MAX_ENTRIES is the number of next hops we can keep track of */
+#define ADJ_MAX_ENTRIES		256
+
+/* ADJ_HASH_BITS is the number of bits used to index the adjacency hash */
+#define ADJ_HASH_BITS			8
+
+/* ADJ_HASH_SIZE is the number of buckets in the adjacency hash */
+#define ADJ_HASH_SIZE			(1 << ADJ_HASH_BITS)
+
+/* ADJ_FLAG_xxx defines various adjacency flags */
+#define ADJ_FLAG_INUSE		1
+#define ADJ_FLAG_VALID		2
+
+/*
+ * ADJACENCY is a next hop on a device. Once the hardware address is known,
+ * [header] holds the complete Ethernet header to put in front of packets
+ * going there. The gateways routes point to live in the adjacency table,
+ * hashed by address and device and chained by [next]; directly connected
+ * neighbours have one in their ARP record instead.
+ */
+struct ADJACENCY {
+	ETHERNET_HEADER	header;
+	struct DEVICE*	device;
+	uint32_t				address;
+	uint32_t				flags;
+	uint32_t				refcount;
+	struct ADJACENCY* next;
+};
+
+struct ARP_RECORD;
+
+extern struct ADJACENCY* adjacencies;
+
+void adj_init();
+struct ADJACENCY* adj_find (struct DEVICE* dev, uint32_t addr);
+struct ADJACENCY* adj_get (struct DEVICE* dev, uint32_t addr);
+void adj_put (struct ADJACENCY* adj);
+void adj_update (struct ARP_RECORD* arp);
+void adj_invalidate (struct DEVICE* dev, uint32_t addr);
+void adj_flush_device (struct DEVICE* dev);
+void adj_xmit (struct ADJACENCY* adj, struct NETPACKET* pkt);
+
+
+#endif /* __ADJ_H__ */
@@ -11,8 +11,33 @@
 
 #include <sys/types.h>
 #include <sys/device.h>
+#include <netipv4/adj.h>
 
 #define ARP_FLAGS_PERMANENT 1
+#define ARP_FLAGS_INCOMPLETE 2
+
+/* ARP_HASH_BITS is the number of bits used to index the ARP hash table */
+#define ARP_HASH_BITS	14
+
+/* ARP_HASH_SIZE is the number of buckets in the ARP hash table */
+#define ARP_HASH_SIZE	(1 << ARP_HASH_BITS)
+
+/* ARP_MAX_AGE is the number of seconds a learned record is kept after it was
+ * last confirmed */
+#define ARP_MAX_AGE		1200
+
+/* ARP_AGE_INTERVAL is the number of seconds between aging runs */
+#define ARP_AGE_INTERVAL	10
+
+/* ARP_HOLD_MAX is the number of packets queued for an incomplete record */
+#define ARP_HOLD_MAX		3
+
+/* ARP_REQUEST_INTERVAL is the number of seconds between requests for the same
+ * address */
+#define ARP_REQUEST_INTERVAL	1
+
+/* ARP_MAX_RETRIES is the number of requests resent before giving up */
+#define ARP_MAX_RETRIES		3
 
 #define ARP_HWTYPE_ETH		1
 
@@ -31,27 +56,60 @@ struct ARP_PACKET {
 	uint8_t dest_addr[4];
 } __attribute__((packed));
 
+/*
+ * ARP_RECORD is a single neighbour. Records are hashed by address and keyed
+ * by (device, address); [next] chains them within a bucket and [list_next]
+ * and [list_prev] chain all records together. All but permanent records are
+ * also queued by [timestamp], the second (by ipv4_ticks) they were last
+ * confirmed, using [age_next] and [age_prev]; incomplete records have a queue
+ * of their own. While a record is incomplete, [timestamp] is the time of the
+ * last request and packets for it are held in [hold_first]. Once complete,
+ * [adj] is how packets reach the neighbour.
+ */
 struct ARP_RECORD {
 	uint32_t       address;
 	uint8_t        hw_addr[ETHER_ADDR_LEN];
 	uint32_t       timestamp;
 	uint8_t        flags;
+	uint8_t        retries;
+	uint8_t        hold_count;
 	struct DEVICE* device;
+	struct ARP_RECORD* next;
+	struct ARP_RECORD* list_next;
+	struct ARP_RECORD* list_prev;
+	struct ARP_RECORD* age_next;
+	struct ARP_RECORD* age_prev;
+	struct NETPACKET*  hold_first;
+	struct NETPACKET*  hold_last;
+	struct ADJACENCY   adj;					/* valid once the record is complete */
+};
+
+/*
+ * ARP_QUEUE is a queue of records by [timestamp]; [first] is the oldest.
+ */
+struct ARP_QUEUE {
+	struct ARP_RECORD* first;
+	struct ARP_RECORD* last;
 };
 
-extern struct ARP_RECORD* arp_cache;
+extern struct ARP_RECORD* arp_records;
+extern int arp_num_records;
 
 void arp_init();
 int arp_handle_packet (struct NETPACKET* pkt);
 void arp_flush();
 void arp_flush_device(struct DEVICE* dev);
+void arp_age();
+void arp_retry();
 
 int arp_add_record (uint32_t h, char* hw, struct DEVICE* dev, uint8_t fl);
 int arp_remove_record (uint32_t h, struct DEVICE* dev);
 struct ARP_RECORD* arp_find_record (uint32_t h);
+struct ARP_RECORD* arp_lookup (uint32_t h, struct DEVICE* dev);
 int arp_update_record (uint32_t h, char* hw, struct DEVICE* dev);
 
 int arp_send_request (uint32_t addr, struct DEVICE* fdev);
 struct ARP_RECORD* arp_fetch_address (uint32_t addr);
+int arp_hold (uint32_t addr, struct DEVICE* dev, struct NETPACKET* pkt);
 
 #endif /* __ARP_H__ */
@@ -12,7 +12,16 @@
 #ifndef __CKSUM_H__
 #define __CKSUM_H__
 
-uint16_t ipv4_cksum (char* data, int len, int cksum);
+void     ipv4_cksum_init();
+uint16_t ipv4_cksum (char* data, int len, uint32_t cksum);
+uint32_t ipv4_cksum_partial (const void* data, int len, uint32_t sum);
+uint32_t ipv4_cksum_copy (void* dst, const void* src, int len, uint32_t sum);
+uint32_t ipv4_cksum_combine (uint32_t sum, uint32_t sum2, int offset);
+uint16_t ipv4_cksum_fold (uint32_t sum);
+uint32_t ipv4_cksum_pseudo (uint32_t source, uint32_t dest, uint8_t proto, uint16_t len);
+uint16_t ipv4_cksum_transport (struct NETPACKET* np, uint8_t proto, uint16_t len);
 unsigned short ip_fast_csum(unsigned char * iph, unsigned int ihl);
+uint16_t ipv4_cksum_adjust16 (uint16_t cksum, uint16_t old, uint16_t new);
+uint16_t ipv4_cksum_adjust32 (uint16_t cksum, uint32_t old, uint32_t new);
 
 #endif /* __CKSUM_H__ */
@@ -34,7 +34,11 @@ struct IP_HEADER {
 	uint8_t			dest[4];
 } __attribute__((packed));
 
+struct ADJACENCY;
+
 int ip_handle_packet (struct NETPACKET* np);
+struct DEVICE* ip_nexthop (uint32_t dest, uint32_t* nexthop);
+struct ADJACENCY* ip_resolve (uint32_t dest, struct NETPACKET* pkt);
 struct NETPACKET* ip_build_packet (uint8_t proto, uint32_t dest, uint16_t pktlen, uint8_t* data);
 int ip_transmit_packet (uint8_t proto, uint32_t dest, uint16_t pktlen, uint8_t* data);
 int ip_transmit (uint32_t dest, struct NETPACKET* pkt);
@@ -12,8 +12,8 @@
 #ifndef __INET4_H__
 #define __INET4_H__
 
-/* ARP_CACHE_SIZE is the size of our ARP cache, in records */
-#define ARP_CACHE_SIZE 128
+/* ARP_CACHE_SIZE is the maximum size of our ARP cache, in records */
+#define ARP_CACHE_SIZE 16384
 
 /* IPV4_MAX_ADDR is the number of IPv4 addresses a single NIC can have */
 #define IPV4_MAX_ADDR 16
@@ -28,6 +28,7 @@ struct IPV4_CONFIG {
 };
 
 extern int ipv4_routing;
+extern volatile uint32_t ipv4_ticks;
 
 int ipv4_handle_packet (struct NETPACKET* pkt);
 uint32_t ipv4_conv_addr (uint8_t* addr);
@@ -38,6 +39,7 @@ int ipv4_is_valid (uint32_t addr, struct IPV4_ADDR* ap);
 
 void ipv4_init();
 void ipv4_tick();
+void ipv4_timers();
 int ipv4_add_address (struct DEVICE* dev, uint32_t addr, uint32_t mask);
 int ipv4_remove_address (struct DEVICE* dev, uint32_t addr);
 void ipv4_purge_device (struct DEVICE* dev);
@@ -12,20 +12,92 @@
 #ifndef __ROUTE_H__
 #define __ROUTE_H__
 
-/* ROUTE_MAX_ENTRIES defines the number of entries in the routing table */
-#define ROUTE_MAX_ENTRIES	1024
+/* ROUTE_STRIDE is the number of address bits resolved per FIB node */
+#define ROUTE_STRIDE		8
+
+/* ROUTE_NODE_SLOTS is the number of slots within a single FIB node */
+#define ROUTE_NODE_SLOTS	(1 << ROUTE_STRIDE)
+
+/* ROUTE_SLOT_CHILD tags a FIB slot which points to a child node rather than
+ * a route */
+#define ROUTE_SLOT_CHILD	1
+
+/* ROUTE_SLOT_xxx tell what a FIB slot holds, and take it apart */
+#define ROUTE_SLOT_IS_CHILD(s)	((s) & ROUTE_SLOT_CHILD)
+#define ROUTE_SLOT_NODE(s)		((struct ROUTE_NODE*)((s) & ~ROUTE_SLOT_CHILD))
+#define ROUTE_SLOT_ROUTE(s)		((struct ROUTE_ENTRY*)(s))
+
+/* ROUTE_BATCH_NODES is the number of FIB nodes allocated at a time */
+#define ROUTE_BATCH_NODES	15
+
+/* ROUTE_FIB_BUDGET is the memory kept out of the packet pool for the FIB, which
+ * grows with the routes long after the pool has been sized */
+#define ROUTE_FIB_BUDGET	(2048 * 1024)
+
+/* ROUTE_BENCH_ADDRS is the number of addresses the benchmark cycles through */
+#define ROUTE_BENCH_ADDRS	16384
 
 /* ROUTE_FLAG_xxx defines various routing entry flags */
 #define ROUTE_FLAG_INUSE	1
 #define ROUTE_FLAG_PERM		2
 #define ROUTE_FLAG_GATEWAY	4
+#define ROUTE_FLAG_HOST		8
 
+struct ADJACENCY;
+
+/*
+ * ROUTE_ENTRY is a single route. Gateway and host routes point to the
+ * adjacency of their next hop; routes to directly connected networks have
+ * none, as their neighbours are found through ARP. [next] and [prev] chain
+ * all routes together.
+ */
 struct ROUTE_ENTRY {
 	struct DEVICE*	device;
 	uint32_t	network;
 	uint32_t	mask;
 	uint32_t	gateway;
 	uint32_t	flags;
+	uint32_t	prefixlen;
+	struct ADJACENCY* adj;
+	struct ROUTE_ENTRY* next;
+	struct ROUTE_ENTRY* prev;
+};
+
+/*
+ * ROUTE_NODE is a single node of the multibit FIB trie. Every node resolves
+ * ROUTE_STRIDE bits of the destination address. A slot holds either a child
+ * node for longer prefixes, tagged with ROUTE_SLOT_CHILD, or the most
+ * specific route for all addresses within it: routes are pushed down into
+ * the children of the slots they cover, so a lookup takes a single access per
+ * node and at most 32 / ROUTE_STRIDE of them, no matter how many routes there
+ * are. The prefix lengths needed to do so are those of the routes.
+ */
+struct ROUTE_NODE {
+	addr_t							slot[ROUTE_NODE_SLOTS];
+};
+
+/*
+ * ROUTE_BATCH is a number of FIB nodes allocated in one go; fifteen of them
+ * and the link fit a block of four pages.
+ */
+struct ROUTE_BATCH {
+	struct ROUTE_BATCH*	next;
+	struct ROUTE_NODE		node[ROUTE_BATCH_NODES];
+};
+
+/*
+ * ROUTE_FIB is the forwarding information base; the nodes are allocated a
+ * batch at a time as the routes need them, so the table can grow as long as
+ * there is memory. Nodes which are no longer needed are kept on the free
+ * list for reuse.
+ */
+struct ROUTE_FIB {
+	struct ROUTE_ENTRY*	default_route;
+	struct ROUTE_NODE*	root;
+	struct ROUTE_NODE*	free_node;
+	struct ROUTE_BATCH*	batch;
+	size_t							num_nodes;
+	size_t							max_nodes;
 };
 
 void route_init();
@@ -35,6 +107,15 @@ struct IPV4_ADDR* route_find_ip (struct DEVICE* dev, uint32_t dest);
 void route_flush();
 
 struct DEVICE* route_find_device (uint32_t dest);
+struct ROUTE_ENTRY* route_lookup (uint32_t dest);
+
+int route_fib_init (struct ROUTE_FIB* fib);
+void route_fib_destroy (struct ROUTE_FIB* fib);
+int route_fib_insert (struct ROUTE_FIB* fib, uint32_t network, int len, struct ROUTE_ENTRY* re);
+void route_fib_delete (struct ROUTE_FIB* fib, uint32_t network, int len, struct ROUTE_ENTRY* re, struct ROUTE_ENTRY* cover, int coverlen);
+struct ROUTE_ENTRY* route_fib_lookup (struct ROUTE_FIB* fib, uint32_t dest);
+
+int route_benchmark (uint32_t num_prefixes, uint32_t num_lookups);
 
 extern struct ROUTE_ENTRY* routes;
 
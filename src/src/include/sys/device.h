@@ -21,6 +21,10 @@ struct DEVICE;
 /* DEVICE_NUM_TXBUFS is the number of buffers a device has */
 #define DEVICE_NUM_TXBUFS	32
 
+/* DEVICE_FLAG_POLLING means the device has its receive interrupts masked and
+ * wants to be polled by the main loop */
+#define DEVICE_FLAG_POLLING	1
+
 /*
  * DEVICE_RESOURCES is the resources of the device.
  *
@@ -41,6 +45,8 @@ struct DEVICE_NETDATA {
 };
 
 struct NETPACKET;
+struct QDISC;
+struct SHAPER;
 
 /*
  * DEVICE is a structure which covers about any device in the system.
@@ -57,13 +63,22 @@ struct DEVICE {
 	uint8_t					       addr_len;
 	struct IPV4_CONFIG     ipv4conf;
 
-	struct NETPACKET*      xmit_packet_first;
-	struct NETPACKET*      xmit_packet_last;
+	struct NETRING         rx_ring;   /* received, to be handled */
+	struct NETRING         tx_ring;   /* to be transmitted */
+	struct QDISC*          qdisc;     /* waiting for the transmit ring */
+	struct SHAPER*         shaper;    /* rate limits, NULL if none */
+	struct NETPOOL*        pool;      /* reserved buffers */
 
 	uint64_t               rx_bytes, rx_frames;
 	uint64_t               tx_bytes, tx_frames;
+	uint32_t               drops[NETWORK_DROP_MAX];
+
+	uint32_t               flags;
 
   void (*xmit)(struct DEVICE* dev);
+
+	/* poll will fetch at most [budget] frames, and return the number fetched */
+	int  (*poll)(struct DEVICE* dev, int budget);
 };
 
 #ifdef __KERNEL
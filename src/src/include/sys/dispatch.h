@@ -0,0 +1,38 @@
+/*
+ * dispatch.h - ILIOS Processor Specific Routine Selection
+ * (c) 2003 Rink Springer, BSD
+ *
+ * This include file describes how the fastest of a number of equivalent
+ * routines is picked at boot.
+ *
+ */
+#include <sys/types.h>
+
+#ifndef __DISPATCH_H__
+#define __DISPATCH_H__
+
+/* DISPATCH_BENCH_LEN is the number of bytes the routines are timed with */
+#define DISPATCH_BENCH_LEN		1514
+
+/*
+ * DISPATCH_IMPL is an implementation of a routine. Tables of these end with
+ * an entry without a name.
+ */
+struct DISPATCH_IMPL {
+	char*    name;
+	uint32_t features;				/* CPU_FEATURE_xxx it needs */
+	void*    fn;							/* the routine itself */
+};
+
+/*
+ * DISPATCH_RUN is a function which calls routine [fn] once, on [len] bytes
+ * at [dst] and/or [src].
+ */
+typedef void (*DISPATCH_RUN)(void* fn, void* dst, void* src, int len);
+
+void dispatch_init();
+struct DISPATCH_IMPL* dispatch_select (char* what, struct DISPATCH_IMPL* impl, DISPATCH_RUN run);
+
+#endif /* __DISPATCH_H__ */
+
+/* vim:set ts=2 sw=2: */
@@ -14,6 +14,12 @@
  * (PAGESIZE % KMALLOC_BITMAPSIZE) must be zero */
 #define KMALLOC_BITMAPSIZE	16
 
+/* KMALLOC_BITMAP_SLOTS is the number of entries in a bitmap chunk */
+#define KMALLOC_BITMAP_SLOTS	(PAGESIZE / KMALLOC_BITMAPSIZE)
+
+/* KMALLOC_BITMAP_WORDS is the number of 32-bit words needed to map them */
+#define KMALLOC_BITMAP_WORDS	(KMALLOC_BITMAP_SLOTS / 32)
+
 /* KMALLOC_CFLAGS_USED means a chunk is in use */
 #define KMALLOC_CFLAGS_USED	1
 
@@ -23,6 +29,13 @@
 /* KMALLOC_CFLAGS_CHAIN means a chunk is in a chain of chunks */
 #define KMALLOC_CFLAGS_CHAIN 4
 
+/* KMALLOC_CFLAGS_FREE means a chunk heads a block on a free list */
+#define KMALLOC_CFLAGS_FREE	8
+
+/* KMALLOC_MAX_ORDER is the largest order of blocks; a block of order n spans
+ * 2^n pages */
+#define KMALLOC_MAX_ORDER	20
+
 /*
  * KMALLOC_REGION describes a region of memory which can be allocated.
  *
@@ -43,6 +56,17 @@ struct KMALLOC_REGION {
 	/* flags are possible region flags */
 	uint32_t	flags;
 
+	/* chunk is the first chunk of the region */
+	struct KMALLOC_CHUNK* chunk;
+
+	/* pad is added to chunk numbers to align the blocks to the end of the
+	 * region, so the small ones are at the start and the large ones stay in a
+	 * row */
+	size_t	pad;
+
+	/* free are the lists of free blocks, by order */
+	struct KMALLOC_CHUNK* free[KMALLOC_MAX_ORDER + 1];
+
 	/* next is a pointer to the next region */
 	struct KMALLOC_REGION* next;
 };
@@ -65,10 +89,28 @@ struct KMALLOC_CHUNK {
 
 		/* bitmap_left is the number of bitmap-chunks left */
 		size_t	bitmap_left;
+
+		/* order is the order of the free block this chunk heads */
+		size_t	order;
 	} chain_bitmap;
 
 	/* t is the thread which owns this chunk */
 	struct THREAD* thread;
+
+	/* next and prev link free blocks of an order, or bitmap chunks */
+	struct KMALLOC_CHUNK* next;
+	struct KMALLOC_CHUNK* prev;
+};
+
+/*
+ * KMALLOC_BITMAP sits at the start of a bitmap chunk. Every entry of the
+ * chunk has a bit in [used] if it is allocated, and a bit in [last] if it is
+ * the final entry of an allocation. The entries covered by the bitmaps
+ * themselves are always in use.
+ */
+struct KMALLOC_BITMAP {
+	uint32_t	used[KMALLOC_BITMAP_WORDS];
+	uint32_t	last[KMALLOC_BITMAP_WORDS];
 };
 
 #ifdef __KERNEL
@@ -77,6 +119,7 @@ void* kmalloc (struct THREAD* t, size_t size, uint32_t flags);
 void  kmalloc_addregion (addr_t addr, size_t size, uint32_t flags);
 void  kfree (void* ptr);
 void	kmemstats(size_t* total, size_t* avail);
+void	kmemfrag (size_t* blocks, size_t* largest);
 #endif /* __KERNEL */
 
 #endif /* __KMALLOC_H__ */
@@ -14,11 +14,68 @@
 #define NETWORK_MAX_PACKET_LEN	2048
 #define NETWORK_MTU             NETWORK_MAX_PACKET_LEN
 #define NETWORK_TXBUFFER_SIZE		64
+
+/* NETWORK_CACHE_LINE is the size of a cache line */
+#define NETWORK_CACHE_LINE			64
+
+/* NETWORK_FRAME_STRIDE is the distance between two frames. The extra cache
+ * line makes sure frames are spread over all cache sets */
+#define NETWORK_FRAME_STRIDE		(NETWORK_MAX_PACKET_LEN + NETWORK_CACHE_LINE)
+
+/* NETWORK_RX_RING_SIZE is the number of received packets a device may queue,
+ * must be a power of two */
+#define NETWORK_RX_RING_SIZE		256
+
+/* NETWORK_TX_RING_SIZE is the number of packets a device may have waiting for
+ * transmission, must be a power of two */
+#define NETWORK_TX_RING_SIZE		128
+
+/* NETWORK_MAX_POOLS is the number of buffer pools, one is shared */
+#define NETWORK_MAX_POOLS				16
+
+/* NETWORK_POOL_RESERVE is the default number of buffers reserved per device */
+#define NETWORK_POOL_RESERVE		64
+
+/* NETWORK_POOL_INITIAL is the number of buffers set up at boot */
+#define NETWORK_POOL_INITIAL		2048
+
+/* NETWORK_POOL_GROW is the number of buffers set up at a time afterwards */
+#define NETWORK_POOL_GROW				2048
+
+/* NETWORK_POOL_LOW is the number of free shared buffers below which more
+ * buffers are set up, as long as there is room for them */
+#define NETWORK_POOL_LOW				512
+
+/* NETWORK_RESERVE is the memory the pool leaves for the rest of the system */
+#define NETWORK_RESERVE					(2048 * 1024)
+
+/* NETWORK_SHARED_POOL is the pool every device may allocate from */
+#define NETWORK_SHARED_POOL			(&network_pool[0])
+
+/* NETWORK_POLL_BUDGET is the default number of packets handled per pass */
+#define NETWORK_POLL_BUDGET			64
 #define ETHER_ADDR_LEN					6
 
 #define ETHERTYPE_IP            0x0800
 #define ETHERTYPE_ARP           0x0806
 
+/* NETWORK_DROP_xxx are the reasons for which packets are dropped */
+#define NETWORK_DROP_NOBUF			0			/* out of buffers */
+#define NETWORK_DROP_RXQUEUE		1			/* receive queue full */
+#define NETWORK_DROP_TXQUEUE		2			/* transmit queue full */
+#define NETWORK_DROP_RXERROR		3			/* device couldn't receive the frame */
+#define NETWORK_DROP_PROTO			4			/* unsupported protocol */
+#define NETWORK_DROP_HEADER			5			/* malformed header */
+#define NETWORK_DROP_CKSUM			6			/* bad checksum */
+#define NETWORK_DROP_NOTLOCAL		7			/* not for us and not routing */
+#define NETWORK_DROP_TTL				8			/* time to live expired */
+#define NETWORK_DROP_NOROUTE		9			/* no route to destination */
+#define NETWORK_DROP_NOARP			10		/* next hop could not be resolved */
+#define NETWORK_DROP_NOPORT			11		/* no socket bound to the port */
+#define NETWORK_DROP_DELAY			12		/* waited too long for transmission */
+#define NETWORK_DROP_FILTER			13		/* denied by an access list */
+#define NETWORK_DROP_MAX				14
+
 #define NETPACKET_TYPE_RECV			0
 #define NETPACKET_TYPE_XMIT			0x80
 
@@ -32,31 +89,83 @@ typedef struct {
 	uint8_t			hw_addr[ETHER_ADDR_LEN];
 } ETHERNET_OPTIONS;
 
+struct NETPOOL;
+
 struct NETPACKET {
 	struct NETPACKET* next;
 
 	struct DEVICE*	device;
+	struct NETPOOL* pool;			/* pool to refill once freed */
 	uint8_t	type;
 	size_t len;
 	size_t header_len;
-	char	 frame[NETWORK_MAX_PACKET_LEN] __attribute__((aligned(16)));
+	char*	 frame;						/* NETWORK_MAX_PACKET_LEN bytes */
 	char*	 data;
+	uint32_t cksum;						/* partial checksum of the frame past the ethernet header */
+	uint16_t cksum_len;				/* bytes [cksum] covers, zero if none */
+	uint32_t tstamp;					/* when it was queued for transmission */
+};
+
+/*
+ * NETRING is a ring of packets between exactly one producer and one consumer,
+ * for example an interrupt handler and the main loop. Neither side needs to
+ * disable interrupts: [head] is only written by the producer and [tail] only
+ * by the consumer. Both are free running; the slot is found by masking.
+ */
+struct NETRING {
+	volatile uint32_t  head;			/* next slot to fill */
+	volatile uint32_t  tail;			/* next slot to drain */
+	uint32_t           mask;			/* number of slots minus one */
+	struct NETPACKET** slot;			/* packets */
+	uint32_t           drops;			/* packets dropped because the ring was full */
+};
+
+/*
+ * NETPOOL is a list of available packet buffers. Every device has one with
+ * [reserve] buffers that only it may use, so that a flood on one device cannot
+ * starve the others. Buffers beyond that are kept in the shared pool.
+ */
+struct NETPOOL {
+	struct NETPACKET* first;			/* most recently freed */
+	uint32_t          avail;			/* buffers on the list */
+	uint32_t          reserve;		/* buffers we want to keep on the list */
+	uint32_t          failures;		/* failed allocations */
+	struct DEVICE*    device;			/* owner, NULL if unused or shared */
 };
 
 extern struct NETPACKET* network_netpacket;
-extern struct NETPACKET* netpacket_first_avail;
-extern struct NETPACKET* netpacket_todo_first;
-extern struct NETPACKET* netpacket_todo_last;
+extern char* network_payload;
+extern struct NETPOOL network_pool[NETWORK_MAX_POOLS];
+extern uint32_t network_drops[NETWORK_DROP_MAX];
+extern char* network_drop_reason[NETWORK_DROP_MAX];
 extern int network_numbuffers;
+extern int network_maxbuffers;
+extern int network_poll_budget;
 
 #ifdef __KERNEL
 void network_init();
 struct NETPACKET* network_alloc_packet (struct DEVICE* dev);
 void network_free_packet (struct NETPACKET* pkt);
+void network_free_chain (struct NETPACKET* first, struct NETPACKET* last);
+int  network_pool_attach (struct DEVICE* dev);
+void network_pool_detach (struct DEVICE* dev);
+void network_pool_reserve (struct NETPOOL* pool, uint32_t num);
+void network_pool_grow();
+
+int  network_ring_init (struct NETRING* ring, uint32_t size);
+void network_ring_destroy (struct NETRING* ring);
+int  network_ring_put (struct NETRING* ring, struct NETPACKET* pkt);
+struct NETPACKET* network_ring_get (struct NETRING* ring);
+uint32_t network_ring_count (struct NETRING* ring);
+
+void network_drop (struct DEVICE* dev, int reason);
+void network_drop_reset();
 
-void network_queue_packet (struct NETPACKET* pkt);
-void network_handle_queue();
+void network_copy_frame (struct NETPACKET* pkt, int offset, const void* src, int len);
+void network_queue_packet (struct DEVICE* dev, struct NETPACKET* pkt);
+int  network_handle_queue();
 void network_xmit_frame (struct DEVICE* dev, struct NETPACKET* nb);
+uint32_t network_xmit_backlog (struct DEVICE* dev);
 void network_xmit_packet (struct DEVICE* dev, struct NETPACKET* pkt, void* addr);
 struct NETPACKET* network_get_next_txbuf (struct DEVICE* dev);
 #endif /* __KERNEL */
@@ -0,0 +1,63 @@
+/*
+ * prof.h - ILIOS Packet Path Profiling
+ * (c) 2003 Rink Springer, BSD
+ *
+ * This include file describes the cycle accounting of the packet path.
+ *
+ */
+#include <sys/types.h>
+#include <md/timer.h>
+
+#ifndef __PROF_H__
+#define __PROF_H__
+
+/* PROF_xxx are the stages of the packet path cycles are accounted to */
+#define PROF_DRV_RX			0			/* driver copying a received frame */
+#define PROF_NET_HANDLE	1			/* network_handle_packet() */
+#define PROF_IP_HANDLE	2			/* ip_handle_packet() */
+#define PROF_ROUTE			3			/* route lookup */
+#define PROF_ARP				4			/* ARP handling and lookup */
+#define PROF_NET_XMIT		5			/* queueing a frame for transmission */
+#define PROF_DRV_TX			6			/* driver transmit */
+#define PROF_ACL				7			/* packet filtering */
+#define PROF_MAX				8
+
+/*
+ * PROF_STAGE is the accounting of a single stage. Stages include the time
+ * spent in the stages they call.
+ */
+struct PROF_STAGE {
+	char*              name;
+	uint32_t           count;			/* number of times we went through */
+	unsigned long long cycles;		/* total number of cycles spent */
+};
+
+/*
+ * PROF (stage, stmt) will run statement [stmt], accounting the cycles it
+ * takes to stage [stage]. Without SUPPORT_PROFILING, this just runs [stmt].
+ */
+#ifdef SUPPORT_PROFILING
+#define PROF(stage,stmt) \
+	do { \
+		uint32_t prof_start = arch_tsc_read32(); \
+		stmt; \
+		prof_account ((stage), prof_start); \
+	} while (0)
+#else
+#define PROF(stage,stmt) \
+	do { \
+		stmt; \
+	} while (0)
+#endif /* SUPPORT_PROFILING */
+
+extern struct PROF_STAGE prof_stage[PROF_MAX];
+
+#ifdef __KERNEL
+void prof_account (int stage, uint32_t start);
+void prof_reset();
+uint32_t prof_div (unsigned long long n, uint32_t d);
+#endif /* __KERNEL */
+
+#endif /* __PROF_H__ */
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,92 @@
+/*
+ * qdisc.h - ILIOS Transmit Queueing
+ * (c) 2003 Rink Springer, BSD
+ *
+ * This include file describes the queues packets wait in before they are
+ * handed to a device for transmission.
+ *
+ */
+#include <sys/types.h>
+
+#ifndef __QDISC_H__
+#define __QDISC_H__
+
+/* QDISC_FLOW_BITS is the number of bits of the flow hash used */
+#define QDISC_FLOW_BITS				6
+
+/* QDISC_FLOWS is the number of flow queues per device */
+#define QDISC_FLOWS						(1 << QDISC_FLOW_BITS)
+
+/* QDISC_LIMIT is the maximum number of packets queued per device */
+#define QDISC_LIMIT						1024
+
+/* QDISC_QUANTUM is the number of bytes a flow may send per round */
+#define QDISC_QUANTUM					1514
+
+/* QDISC_TARGET is the queueing delay we aim for, in milliseconds */
+#define QDISC_TARGET					5
+
+/* QDISC_INTERVAL is the time the delay may stay above target before we start
+ * dropping, in milliseconds */
+#define QDISC_INTERVAL				100
+
+/* QDISC_TX_FILL is the number of packets kept on the transmit ring of a
+ * device; anything beyond waits here, where the flows are kept apart */
+#define QDISC_TX_FILL					4
+
+struct DEVICE;
+struct NETPACKET;
+
+/*
+ * QDISC_FLOW is a single flow queue. Besides the packets, it carries the
+ * CoDel state of the flow; [count], [lastcount] and [drop_next] steer how
+ * fast we drop while the delay stays above target.
+ */
+struct QDISC_FLOW {
+	struct NETPACKET*  first;
+	struct NETPACKET*  last;
+	struct QDISC_FLOW* next;				/* on the new or old flows list */
+	uint32_t           backlog;			/* bytes queued */
+	int32_t            deficit;			/* bytes we may still send this round */
+	uint8_t            active;			/* on one of the lists */
+	uint8_t            dropping;		/* in the dropping state */
+	uint32_t           count;				/* packets dropped in this dropping state */
+	uint32_t           lastcount;		/* [count] of the previous dropping state */
+	uint32_t           first_above;	/* when the delay went above target, or 0 */
+	uint32_t           drop_next;		/* when to drop next */
+};
+
+/*
+ * QDISC is the transmit queue of a device. Flows which just became active are
+ * on the new flows list, which is served before the old flows list, so
+ * sparse flows (DNS, ARP, interactive traffic) get through quickly even if
+ * bulk flows saturate the device. Times are in units of 1024 TSC cycles.
+ */
+struct QDISC {
+	struct QDISC_FLOW  flow[QDISC_FLOWS];
+	struct QDISC_FLOW* new_first;
+	struct QDISC_FLOW* new_last;
+	struct QDISC_FLOW* old_first;
+	struct QDISC_FLOW* old_last;
+	uint32_t           limit;				/* maximum number of packets */
+	uint32_t           target;			/* QDISC_TARGET, in time units */
+	uint32_t           interval;		/* QDISC_INTERVAL, in time units */
+	uint32_t           perturb;			/* mixed into the flow hash */
+
+	/* statistics */
+	uint32_t           backlog;			/* packets queued */
+	uint32_t           max_backlog;	/* most packets ever queued */
+	uint32_t           delay_drops;	/* dropped because of the delay */
+	uint32_t           limit_drops;	/* dropped because we were full */
+};
+
+#ifdef __KERNEL
+struct QDISC* qdisc_create (uint32_t limit);
+void qdisc_destroy (struct QDISC* qd);
+void qdisc_enqueue (struct DEVICE* dev, struct QDISC* qd, struct NETPACKET* pkt);
+struct NETPACKET* qdisc_dequeue (struct DEVICE* dev, struct QDISC* qd);
+#endif /* __KERNEL */
+
+#endif /* __QDISC_H__ */
+
+/* vim:set ts=2 sw=2: */
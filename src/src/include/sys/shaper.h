@@ -0,0 +1,117 @@
+/*
+ * shaper.h - ILIOS Transmit Shaping
+ * (c) 2003 Rink Springer, BSD
+ *
+ * This include file describes the token bucket shaper which can be put in
+ * front of a device to send at less than the link speed.
+ *
+ */
+#include <sys/types.h>
+
+#ifndef __SHAPER_H__
+#define __SHAPER_H__
+
+/* SHAPER_CLASSES is the number of classes per shaper */
+#define SHAPER_CLASSES				8
+
+/* SHAPER_PRIOS is the number of priority levels; 0 is served first */
+#define SHAPER_PRIOS					8
+
+/* SHAPER_DSCPS is the number of DSCP code points */
+#define SHAPER_DSCPS					64
+
+/* SHAPER_DSCP_DEFAULT in the DSCP map means the packet goes to the default
+ * class */
+#define SHAPER_DSCP_DEFAULT		0xff
+
+/* SHAPER_QUANTUM is the number of bytes a class of weight 1 sends per round */
+#define SHAPER_QUANTUM				1514
+
+/* SHAPER_MAX_RATE is the highest rate we handle, in kbit/s */
+#define SHAPER_MAX_RATE				10000000
+
+/* SHAPER_BURST_TICKS is the number of ticks worth of tokens a bucket holds */
+#define SHAPER_BURST_TICKS		2
+
+/* SHAPER_MIN_BURST is the least number of bytes a bucket holds */
+#define SHAPER_MIN_BURST			3028
+
+/* SHAPER_MODE_xxx is what a class may do at the moment */
+#define SHAPER_MODE_SEND			0			/* within its rate */
+#define SHAPER_MODE_BORROW		1			/* over its rate, within its ceiling */
+#define SHAPER_MODE_HOLD			2			/* over its ceiling */
+
+struct DEVICE;
+struct NETPACKET;
+struct QDISC;
+
+/*
+ * SHAPER_BUCKET is a token bucket. Tokens are bytes; they are added every
+ * timer tick, [step] at a time plus [frac] / HZ bytes carried in [credit].
+ */
+struct SHAPER_BUCKET {
+	int32_t            tokens;			/* bytes we may send, may be negative */
+	uint32_t           rate;				/* kbit/s */
+	uint32_t           burst;				/* most tokens we may have */
+	uint32_t           step;				/* bytes added every tick */
+	uint32_t           frac;				/* remainder of the above, times HZ */
+	uint32_t           credit;			/* fraction carried over, times HZ */
+};
+
+/*
+ * SHAPER_CLASS is a class of traffic. It may always send at [rate], and may
+ * borrow unused bandwidth of the device up to [ceil]. Packets of the class
+ * wait in a queue of their own.
+ */
+struct SHAPER_CLASS {
+	struct SHAPER_CLASS* next;			/* on the list of our mode and priority */
+	struct SHAPER_CLASS* prev;
+	struct QDISC*        qdisc;			/* our packets, NULL if the class is unused */
+	struct SHAPER_BUCKET rate;
+	struct SHAPER_BUCKET ceil;
+	uint32_t             want_rate;		/* rate as set, zero for the device rate */
+	uint32_t             want_ceil;		/* ceiling as set, zero for the device rate */
+	uint8_t              prio;			/* priority level */
+	uint8_t              mode;			/* SHAPER_MODE_xxx when we were listed */
+	uint8_t              listed;		/* on one of the lists */
+	uint32_t             quantum;		/* bytes per round, set by the weight */
+	int32_t              deficit;		/* bytes we may still send this round */
+
+	/* statistics */
+	uint32_t             frames;			/* frames sent */
+	uint64_t             bytes;				/* bytes sent */
+	uint32_t             borrowed;		/* frames sent over our rate */
+};
+
+/*
+ * SHAPER is the shaper of a device. The device as a whole sends at most at
+ * the rate of [root]. Classes with packets waiting are on the list of their
+ * mode and priority, and [mask] has a bit set for every non-empty list, so the
+ * next class to send is found in constant time: the first one of the lowest
+ * priority within its rate, or failing that, the first one of the lowest
+ * priority that may borrow, if the device has tokens to spare. Classes of the
+ * same priority take turns by their weight.
+ */
+struct SHAPER {
+	struct SHAPER_BUCKET root;
+	struct SHAPER_CLASS  class[SHAPER_CLASSES];
+	struct SHAPER_CLASS* list[SHAPER_MODE_HOLD][SHAPER_PRIOS];
+	uint32_t             mask[SHAPER_MODE_HOLD];
+	uint8_t              dscp[SHAPER_DSCPS];	/* class per code point */
+	uint8_t              defclass;	/* class of everything else */
+	uint32_t             backlog;		/* packets queued in all classes */
+};
+
+#ifdef __KERNEL
+int  shaper_set_rate (struct DEVICE* dev, uint32_t rate);
+int  shaper_set_class (struct DEVICE* dev, int num, uint32_t rate, uint32_t ceil, int prio, int weight);
+void shaper_remove_class (struct DEVICE* dev, int num);
+void shaper_enqueue (struct DEVICE* dev, struct NETPACKET* pkt);
+struct NETPACKET* shaper_dequeue (struct DEVICE* dev);
+void shaper_tick();
+void shaper_timers();
+#endif /* __KERNEL */
+
+#endif /* __SHAPER_H__ */
+
+/* vim:set ts=2 sw=2: */
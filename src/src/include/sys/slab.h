@@ -0,0 +1,54 @@
+/*
+ * slab.h - ILIOS Kernel Object Caches
+ * (c) 2003 Rink Springer, BSD
+ *
+ * This include file describes the caches handing out fixed size objects.
+ *
+ */
+#include <sys/types.h>
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+/*
+ * KMEM_SLAB is a page of objects of a single cache. It lives at the start of
+ * the page, so the slab of any object is found by rounding its address down.
+ */
+struct KMEM_SLAB {
+	struct KMEM_SLAB*  next;
+	struct KMEM_SLAB*  prev;
+	struct KMEM_CACHE* cache;
+	void*              free;				/* first free object */
+	uint32_t           inuse;				/* number of objects handed out */
+};
+
+/*
+ * KMEM_CACHE is a cache of objects of [size] bytes. Slabs with free objects
+ * are on the [partial] list, the others on the [full] list.
+ */
+struct KMEM_CACHE {
+	char*              name;
+	size_t             size;				/* object size, as asked for */
+	size_t             stride;			/* distance between objects */
+	size_t             offset;			/* offset of the first object in a slab */
+	uint32_t           perslab;			/* objects per slab */
+	void               (*ctor)(void* obj);
+	struct KMEM_SLAB*  partial;
+	struct KMEM_SLAB*  full;
+	uint32_t           slabs;				/* number of slabs */
+	uint32_t           inuse;				/* number of objects handed out */
+	uint32_t           avail;				/* number of free objects */
+	struct KMEM_CACHE* next;
+};
+
+#ifdef __KERNEL
+extern struct KMEM_CACHE* kmem_caches;
+
+struct KMEM_CACHE* kmem_cache_create (char* name, size_t size, size_t align, void (*ctor)(void* obj));
+void* kmem_cache_alloc (struct KMEM_CACHE* cache);
+void  kmem_cache_free (struct KMEM_CACHE* cache, void* obj);
+#endif /* __KERNEL */
+
+#endif /* __SLAB_H__ */
+
+/* vim:set ts=2 sw=2: */
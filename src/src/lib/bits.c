@@ -0,0 +1,24 @@
+/*
+ * bits.c - ILIOS bit scanning
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This code will find bits in words, for the bitmaps of the memory manager
+ * and the shaper.
+ *
+ */
+#include <sys/types.h>
+#include <lib/lib.h>
+
+/*
+ * This will return the number of the lowest set bit in [word], which must
+ * not be zero.
+ */
+int
+klowbit (uint32_t word) {
+	int bit;
+
+	__asm__ ("bsfl %1, %0" : "=r" (bit) : "rm" (word) : "cc");
+	return bit;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,262 @@
+/*
+ * copy.c - ILIOS i386 copy and fill routines
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * These are the kmemcpy() and kmemset() flavours for processors which can do
+ * better than the plain string instructions. Which ones are used is decided
+ * at boot by dispatch_init().
+ *
+ */
+#include <sys/types.h>
+#include <lib/lib.h>
+#include <md/cpu.h>
+#include <md/interrupts.h>
+
+/* COPY_SIMD_MIN is the length from which the MMX and SSE2 routines pay off */
+#define COPY_SIMD_MIN		128
+
+/* COPY_NT_MIN is the length from which non-temporal stores pay off */
+#define COPY_NT_MIN			4096
+
+/* kmemcpy_fn and kmemset_fn are the routines kmemcpy() and kmemset() use */
+void (*kmemcpy_fn)(void* dst, const void* src, size_t len) = kmemcpy_generic;
+void (*kmemset_fn)(void* dst, const char c, size_t len) = kmemset_generic;
+
+/*
+ * This will return non-zero if copying [len] bytes from [src] to [dst]
+ * forwards would overwrite source bytes before they are read.
+ */
+static int
+copy_overlaps (void* dst, const void* src, size_t len) {
+	return ((uint32_t)dst - (uint32_t)src) < len;
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst] using rep movsb, which
+ * processors with enhanced rep movsb run a cache line at a time.
+ */
+void
+kmemcpy_erms (void* dst, const void* src, size_t len) {
+	if (copy_overlaps (dst, src, len)) {
+		kmemcpy_generic (dst, src, len);
+		return;
+	}
+
+	__asm__ __volatile__ ("cld\n\trep movsb"
+		: "+D" (dst), "+S" (src), "+c" (len)
+		:
+		: "memory");
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst], 64 bytes at a time through
+ * the MMX registers. These are the FPU registers, which nothing saves, so
+ * interrupts are kept out.
+ */
+void
+kmemcpy_mmx (void* dst, const void* src, size_t len) {
+	int n, oldints;
+
+	if ((len < COPY_SIMD_MIN) || copy_overlaps (dst, src, len)) {
+		kmemcpy_generic (dst, src, len);
+		return;
+	}
+
+	n = len >> 6;
+	oldints = arch_interrupts (DISABLE);
+	__asm__ __volatile__ (
+		"1:\n\t"
+		"movq (%1), %%mm0\n\t"
+		"movq 8(%1), %%mm1\n\t"
+		"movq 16(%1), %%mm2\n\t"
+		"movq 24(%1), %%mm3\n\t"
+		"movq 32(%1), %%mm4\n\t"
+		"movq 40(%1), %%mm5\n\t"
+		"movq 48(%1), %%mm6\n\t"
+		"movq 56(%1), %%mm7\n\t"
+		"movq %%mm0, (%0)\n\t"
+		"movq %%mm1, 8(%0)\n\t"
+		"movq %%mm2, 16(%0)\n\t"
+		"movq %%mm3, 24(%0)\n\t"
+		"movq %%mm4, 32(%0)\n\t"
+		"movq %%mm5, 40(%0)\n\t"
+		"movq %%mm6, 48(%0)\n\t"
+		"movq %%mm7, 56(%0)\n\t"
+		"addl $64, %1\n\t"
+		"addl $64, %0\n\t"
+		"decl %2\n\t"
+		"jnz 1b\n\t"
+		"emms"
+		: "+r" (dst), "+r" (src), "+r" (n)
+		:
+		: "cc", "memory");
+	arch_interrupts (oldints);
+
+	kmemcpy_generic (dst, src, len & 63);
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst], 64 bytes at a time through
+ * the SSE registers, with interrupts kept out.
+ */
+void
+kmemcpy_sse2 (void* dst, const void* src, size_t len) {
+	int n, oldints;
+
+	if ((len < COPY_SIMD_MIN) || copy_overlaps (dst, src, len)) {
+		kmemcpy_generic (dst, src, len);
+		return;
+	}
+
+	n = len >> 6;
+	oldints = arch_interrupts (DISABLE);
+	__asm__ __volatile__ (
+		"1:\n\t"
+		"movdqu (%1), %%xmm0\n\t"
+		"movdqu 16(%1), %%xmm1\n\t"
+		"movdqu 32(%1), %%xmm2\n\t"
+		"movdqu 48(%1), %%xmm3\n\t"
+		"movdqu %%xmm0, (%0)\n\t"
+		"movdqu %%xmm1, 16(%0)\n\t"
+		"movdqu %%xmm2, 32(%0)\n\t"
+		"movdqu %%xmm3, 48(%0)\n\t"
+		"addl $64, %1\n\t"
+		"addl $64, %0\n\t"
+		"decl %2\n\t"
+		"jnz 1b"
+		: "+r" (dst), "+r" (src), "+r" (n)
+		:
+		: "cc", "memory");
+	arch_interrupts (oldints);
+
+	kmemcpy_generic (dst, src, len & 63);
+}
+
+/*
+ * This will fill [len] bytes of [dst] with [c] using rep stosb.
+ */
+void
+kmemset_erms (void* dst, const char c, size_t len) {
+	__asm__ __volatile__ ("cld\n\trep stosb"
+		: "+D" (dst), "+c" (len)
+		: "a" (c)
+		: "memory");
+}
+
+/*
+ * This will fill [len] bytes of [dst] with [c], 64 bytes at a time through
+ * the SSE registers, with interrupts kept out.
+ */
+void
+kmemset_sse2 (void* dst, const char c, size_t len) {
+	uint32_t pattern = (uint8_t)c * 0x01010101;
+	int n, oldints;
+
+	if (len < COPY_SIMD_MIN) {
+		kmemset_generic (dst, c, len);
+		return;
+	}
+
+	n = len >> 6;
+	oldints = arch_interrupts (DISABLE);
+	__asm__ __volatile__ (
+		"movd %2, %%xmm0\n\t"
+		"pshufd $0, %%xmm0, %%xmm0\n"
+		"1:\n\t"
+		"movdqu %%xmm0, (%0)\n\t"
+		"movdqu %%xmm0, 16(%0)\n\t"
+		"movdqu %%xmm0, 32(%0)\n\t"
+		"movdqu %%xmm0, 48(%0)\n\t"
+		"addl $64, %0\n\t"
+		"decl %1\n\t"
+		"jnz 1b"
+		: "+r" (dst), "+r" (n)
+		: "r" (pattern)
+		: "cc", "memory");
+	arch_interrupts (oldints);
+
+	kmemset_generic (dst, c, len & 63);
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst] like kmemcpy(), but the
+ * copy bypasses the caches if it is large enough. Use this for data which
+ * won't be looked at again soon, so it doesn't push out what will.
+ */
+void
+kmemcpy_nt (void* dst, const void* src, size_t len) {
+	int n;
+
+	if ((len < COPY_NT_MIN) || (!(arch_cpu_features & CPU_FEATURE_SSE2)) ||
+	    copy_overlaps (dst, src, len)) {
+		kmemcpy (dst, src, len);
+		return;
+	}
+
+	/* movnti needs an aligned destination */
+	n = -(uint32_t)dst & 3;
+	kmemcpy_generic (dst, src, n);
+	dst = (uint8_t*)dst + n; src = (const uint8_t*)src + n; len -= n;
+
+	/* 16 bytes per round; movnti doesn't touch the SSE registers */
+	n = len >> 4;
+	__asm__ __volatile__ (
+		"1:\n\t"
+		"movl (%1), %%eax\n\t"
+		"movl 4(%1), %%edx\n\t"
+		"movnti %%eax, (%0)\n\t"
+		"movnti %%edx, 4(%0)\n\t"
+		"movl 8(%1), %%eax\n\t"
+		"movl 12(%1), %%edx\n\t"
+		"movnti %%eax, 8(%0)\n\t"
+		"movnti %%edx, 12(%0)\n\t"
+		"addl $16, %1\n\t"
+		"addl $16, %0\n\t"
+		"decl %2\n\t"
+		"jnz 1b\n\t"
+		"sfence"
+		: "+r" (dst), "+r" (src), "+r" (n)
+		:
+		: "eax", "edx", "cc", "memory");
+
+	kmemcpy_generic (dst, src, len & 15);
+}
+
+/*
+ * This will fill [len] bytes of [dst] with [c] like kmemset(), but bypassing
+ * the caches if it is large enough.
+ */
+void
+kmemset_nt (void* dst, const char c, size_t len) {
+	uint32_t pattern = (uint8_t)c * 0x01010101;
+	int n;
+
+	if ((len < COPY_NT_MIN) || (!(arch_cpu_features & CPU_FEATURE_SSE2))) {
+		kmemset (dst, c, len);
+		return;
+	}
+
+	/* movnti needs an aligned destination */
+	n = -(uint32_t)dst & 3;
+	kmemset_generic (dst, c, n);
+	dst = (uint8_t*)dst + n; len -= n;
+
+	n = len >> 4;
+	__asm__ __volatile__ (
+		"1:\n\t"
+		"movnti %2, (%0)\n\t"
+		"movnti %2, 4(%0)\n\t"
+		"movnti %2, 8(%0)\n\t"
+		"movnti %2, 12(%0)\n\t"
+		"addl $16, %0\n\t"
+		"decl %1\n\t"
+		"jnz 1b\n\t"
+		"sfence"
+		: "+r" (dst), "+r" (n)
+		: "r" (pattern)
+		: "cc", "memory");
+
+	kmemset_generic (dst, c, len & 15);
+}
+
+/* vim:set ts=2 sw=2: */
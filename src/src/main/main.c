@@ -10,6 +10,7 @@
 #include <sys/device.h>
 #include <sys/tty.h>
 #include <sys/irq.h>
+#include <sys/dispatch.h>
 #include <cli/cli.h>
 #include <netipv4/ipv4.h>
 #include <lib/lib.h>
@@ -59,6 +60,9 @@ kmain() {
 	/* initialize machine dependant stuff */
 	arch_init();
 
+	/* pick the routines that suit the processor best */
+	dispatch_init();
+
 	/* initialize the network */
 	network_init();
 
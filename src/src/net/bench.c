@@ -0,0 +1,329 @@
+/*
+ * ILIOS RFC 2544 Benchmark
+ * (c) 2003 Rink Springer
+ *
+ * This will run the RFC 2544 test series between two interfaces: test frames
+ * leave through one, cross the device under test and come back on the other.
+ * For every standard frame size, the throughput is found by a binary search
+ * for the highest rate without loss, the latency is measured at that rate
+ * using time stamps in the frames, and the frame loss is measured from the
+ * maximum rate downwards.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/network.h>
+#include <sys/prof.h>
+#include <lib/lib.h>
+#include <md/console.h>
+#include <md/reboot.h>
+#include <md/timer.h>
+#include <net/bench.h>
+#include <net/pktgen.h>
+#include <netipv4/adj.h>
+#include <netipv4/ip.h>
+#include <netipv4/udp.h>
+
+/* BENCH_SLACK is the percentage a trial may take longer than configured */
+#define BENCH_SLACK				10
+
+/* bench_config defaults to one second trials on a 100 Mbit/s link */
+struct BENCH_CONFIG bench_config = { 0, 0, 100, 1000 };
+
+/* bench_size are the standard frame sizes, including the CRC */
+uint32_t bench_size[BENCH_NUM_SIZES] = { 64, 128, 256, 512, 1024, 1280, 1518 };
+
+/* bench_rxdev is the device test frames come back on, NULL if not running */
+struct DEVICE* bench_rxdev = NULL;
+
+/* bench_trial is the number of the trial in progress; bench_result its result */
+uint32_t bench_trial = 0;
+struct BENCH_RESULT bench_result;
+
+/* bench_template is the frame every test frame is copied from */
+uint8_t bench_template[PKTGEN_MAX_SIZE];
+
+/* bench_nexthop is the hardware address test frames are sent to */
+uint8_t bench_nexthop[ETHER_ADDR_LEN];
+
+/*
+ * This will print [value] right aligned in [width] characters.
+ */
+static void
+bench_print (uint32_t value, int width) {
+	uint32_t i;
+
+	for (i = value; i >= 10; i /= 10)
+		width--;
+	while (--width > 0)
+		kprintf (" ");
+	kprintf ("%u", value);
+}
+
+/*
+ * This will print [num] per mille as a percentage with one decimal.
+ */
+static void
+bench_print_pm (uint32_t num) {
+	bench_print (num / 10, 4);
+	kprintf (".%u%%", num % 10);
+}
+
+/*
+ * This will handle packet [pkt] if it is a test frame, in which case it will
+ * return non-zero. Frames of earlier trials are discarded.
+ */
+int
+bench_receive (struct NETPACKET* pkt) {
+	ETHERNET_HEADER* eh = (ETHERNET_HEADER*)pkt->frame;
+	struct IP_HEADER* iphdr = (struct IP_HEADER*)pkt->data;
+	struct UDP_HEADER* udphdr = (struct UDP_HEADER*)(pkt->data + sizeof (struct IP_HEADER));
+	struct BENCH_PAYLOAD* bp = (struct BENCH_PAYLOAD*)(pkt->data + sizeof (struct IP_HEADER) + sizeof (struct UDP_HEADER));
+	struct BENCH_RESULT* br = &bench_result;
+	unsigned long long lat;
+
+	/* is this one of ours? */
+	if ((pkt->device != bench_rxdev) ||
+	    (pkt->len < sizeof (struct IP_HEADER) + sizeof (struct UDP_HEADER) + sizeof (struct BENCH_PAYLOAD)) ||
+	    (eh->type[0] != (ETHERTYPE_IP >> 8)) || (eh->type[1] != (ETHERTYPE_IP & 0xff)) ||
+	    (iphdr->version_ihl != 0x45) || (iphdr->proto != IP_PROTO_UDP) ||
+	    (udphdr->dest[0] != (BENCH_PORT >> 8)) || (udphdr->dest[1] != (BENCH_PORT & 0xff)) ||
+	    (bp->magic != BENCH_MAGIC))
+		return 0;
+
+	/* account for it if it belongs to the current trial */
+	if (bp->trial == bench_trial) {
+		lat = arch_tsc_read() - (((unsigned long long)bp->tsc_hi << 32) | bp->tsc_lo);
+		if (lat > 0xffffffff)
+			lat = 0xffffffff;
+		if ((uint32_t)lat < br->lat_min)
+			br->lat_min = (uint32_t)lat;
+		if ((uint32_t)lat > br->lat_max)
+			br->lat_max = (uint32_t)lat;
+		br->lat_sum += lat;
+		br->received++;
+	}
+
+	network_free_packet (pkt);
+	return 1;
+}
+
+/*
+ * This will send test frames of [size] bytes at [rate] frames per second out
+ * of [dev] for the configured duration, and wait for them to come back. The
+ * outcome is stored in [res]. Sending stops once the trial has taken too long
+ * to pass anyway. It will return zero if the user aborted or non-zero if the
+ * trial ran.
+ */
+static int
+bench_trial_run (struct DEVICE* dev, uint32_t size, uint32_t rate, struct BENCH_RESULT* res) {
+	struct NETPACKET* pkt;
+	struct BENCH_PAYLOAD* bp;
+	uint32_t count, sent = 0;
+	unsigned long long start, now, next, gap, deadline;
+
+	/* start a new trial */
+	kmemset (&bench_result, 0, sizeof (struct BENCH_RESULT));
+	bench_result.lat_min = 0xffffffff;
+	bench_trial++;
+
+	count = prof_div ((unsigned long long)rate * bench_config.duration, 1000);
+	gap = prof_div ((unsigned long long)arch_tsc_khz * 1000, rate);
+
+	start = arch_tsc_read(); next = start;
+	deadline = start + (unsigned long long)arch_tsc_khz *
+	           (bench_config.duration + (bench_config.duration * BENCH_SLACK) / 100 + 1);
+	while (sent < count) {
+		/* keep the pace */
+		while ((now = arch_tsc_read()) < next)
+			network_handle_queue();
+		next += gap;
+
+		/* too late to pass? */
+		if (now > deadline)
+			/* yes. no use going on */
+			break;
+
+		/* let the network catch up every now and then */
+		if ((sent % BENCH_BATCH) == 0) {
+			if (arch_console_peekch())
+				return 0;
+			network_handle_queue();
+		}
+
+		pkt = network_alloc_packet (dev);
+		if (pkt == NULL) {
+			/* out of buffers. wait for some to come back */
+			if (arch_console_peekch())
+				return 0;
+			network_handle_queue();
+			continue;
+		}
+
+		/* copy the template and stamp it */
+		kmemcpy (pkt->frame, bench_template, size);
+		bp = (struct BENCH_PAYLOAD*)(pkt->frame + sizeof (ETHERNET_HEADER) + sizeof (struct IP_HEADER) + sizeof (struct UDP_HEADER));
+		bp->magic = BENCH_MAGIC;
+		bp->trial = bench_trial;
+		now = arch_tsc_read();
+		bp->tsc_lo = (uint32_t)now; bp->tsc_hi = (uint32_t)(now >> 32);
+		pkt->header_len = sizeof (ETHERNET_HEADER);
+		pkt->len = size - sizeof (ETHERNET_HEADER);
+
+		/* off it goes */
+		network_xmit_frame (dev, pkt);
+		sent++;
+	}
+	now = arch_tsc_read();
+	bench_result.ms = prof_div (now - start, arch_tsc_khz);
+
+	/* give the stragglers time to arrive */
+	next = now + (unsigned long long)arch_tsc_khz * BENCH_SETTLE_MS;
+	while (arch_tsc_read() < next)
+		if (!network_handle_queue())
+			arch_relax();
+
+	bench_result.sent = sent;
+	kmemcpy (res, &bench_result, sizeof (struct BENCH_RESULT));
+	return 1;
+}
+
+/*
+ * This will return non-zero if trial [res] passed: nothing was lost and the
+ * frames were sent at the rate asked for.
+ */
+static int
+bench_passed (struct BENCH_RESULT* res) {
+	return (res->received == res->sent) &&
+	       (res->ms <= bench_config.duration + (bench_config.duration * BENCH_SLACK) / 100);
+}
+
+/*
+ * This will run the test series for frames of [size] bytes, including the CRC,
+ * from [txdev] to [rxdev], and print a line of results. It will return zero if
+ * the user aborted or non-zero if all went well.
+ */
+static int
+bench_size_run (struct DEVICE* txdev, struct DEVICE* rxdev, uint32_t size) {
+	struct BENCH_RESULT res;
+	uint32_t max, lo, hi, rate, best = 0, pct, clean = 0, lat;
+
+	/* the frame we build excludes the CRC; the payload won't change the headers */
+	size -= 4;
+	pktgen_build (bench_template, size, txdev->ether.hw_addr, bench_nexthop,
+	              bench_config.source, bench_config.dest, BENCH_PORT);
+
+	/* the maximum rate the link can carry at this size */
+	max = prof_div ((unsigned long long)bench_config.speed * 1000000, (size + BENCH_OVERHEAD) * 8);
+
+	/* throughput: find the highest rate without loss */
+	lo = 0; hi = max; rate = max;
+	while (rate > 0) {
+		if (!bench_trial_run (txdev, size, rate, &res))
+			return 0;
+		if (bench_passed (&res)) {
+			best = rate; lo = rate;
+		} else
+			hi = rate;
+		if (hi - lo <= max / BENCH_RESOLUTION)
+			break;
+		rate = (lo + hi) / 2;
+	}
+	bench_print (size + 4, 5);
+	bench_print (best, 9);
+	bench_print (prof_div ((unsigned long long)best * (size + 4) * 8, 1000000), 7);
+
+	/* latency: at the throughput rate */
+	if (best > 0) {
+		if (!bench_trial_run (txdev, size, best, &res))
+			return 0;
+		if (res.received > 0) {
+			lat = prof_div ((unsigned long long)res.lat_min * 1000, arch_tsc_khz);
+			bench_print (lat, 8);
+			lat = prof_div (prof_div (res.lat_sum, res.received) * 1000ULL, arch_tsc_khz);
+			bench_print (lat, 8);
+			lat = prof_div ((unsigned long long)res.lat_max * 1000, arch_tsc_khz);
+			bench_print (lat, 8);
+		} else
+			kprintf ("       -       -       -");
+	} else
+		kprintf ("       -       -       -");
+	kprintf ("\n");
+
+	/* frame loss: from the maximum rate down, until two trials lose nothing */
+	kprintf ("      loss:");
+	for (pct = 100; (pct > 0) && (clean < 2); pct -= 10) {
+		if (!bench_trial_run (txdev, size, prof_div ((unsigned long long)max * pct, 100), &res))
+			return 0;
+		clean = (res.received >= res.sent) ? clean + 1 : 0;
+		kprintf (" %u%%:", pct);
+		bench_print_pm ((res.sent == 0) ? 0 :
+			prof_div ((unsigned long long)(res.sent - res.received) * 1000, res.sent));
+	}
+	kprintf ("\n");
+	return 1;
+}
+
+/*
+ * This will run the test series from [txdev] to [rxdev] for frames of [size]
+ * bytes, or for all standard sizes if [size] is zero. Results are also sent
+ * to the serial port. It will return zero on failure or non-zero on success.
+ */
+int
+bench_run (struct DEVICE* txdev, struct DEVICE* rxdev, uint32_t size) {
+	struct BENCH_CONFIG* bc = &bench_config;
+	struct ADJACENCY* adj;
+	uint32_t old_flags;
+	int i, ok = 1;
+
+	/* sanity checks */
+	if ((size != 0) && ((size < PKTGEN_MIN_SIZE + 4) || (size > PKTGEN_MAX_SIZE + 4))) {
+		kprintf ("frame size must be between %u and %u bytes\n", PKTGEN_MIN_SIZE + 4, PKTGEN_MAX_SIZE + 4);
+		return 0;
+	}
+	if ((bc->speed == 0) || (bc->duration == 0)) {
+		kprintf ("speed and duration must be set\n");
+		return 0;
+	}
+	if (arch_tsc_khz == 0) {
+		kprintf ("no time stamp counter available\n");
+		return 0;
+	}
+
+	/* send to the next hop of the destination */
+	adj = ip_resolve (bc->dest, NULL);
+	if (adj == NULL) {
+		kprintf ("next hop of %I is not resolved yet, try again\n", bc->dest);
+		return 0;
+	}
+	if (adj->device != txdev) {
+		kprintf ("%I is not reached through %s\n", bc->dest, txdev->name);
+		return 0;
+	}
+
+	kmemcpy (bench_nexthop, adj->header.dest, ETHER_ADDR_LEN);
+
+	/* copy everything to the serial port from here */
+	old_flags = arch_console_flags;
+	arch_console_flags |= CONSOLE_FLAG_SERIAL;
+	kprintf ("RFC 2544: %s to %s, %I to %I, %u Mbit/s, %u ms trials\n",
+		txdev->name, rxdev->name, bc->source, bc->dest, bc->speed, bc->duration);
+	kprintf (" size   throughput      latency (us)\n");
+	kprintf ("bytes      fps  Mbit/s     min     avg     max\n");
+
+	/* go */
+	bench_rxdev = rxdev;
+	if (size != 0)
+		ok = bench_size_run (txdev, rxdev, size);
+	else
+		for (i = 0; ok && (i < BENCH_NUM_SIZES); i++)
+			ok = bench_size_run (txdev, rxdev, bench_size[i]);
+	bench_rxdev = NULL;
+
+	if (!ok)
+		kprintf ("\naborted\n");
+	arch_console_flags = old_flags;
+	return ok;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,223 @@
+/*
+ * ILIOS Packet Generator
+ * (c) 2003 Rink Springer
+ *
+ * This will blast UDP packets out of a device, or feed them to the stack as
+ * if they were received, to measure how fast we can forward.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/network.h>
+#include <sys/prof.h>
+#include <lib/lib.h>
+#include <md/console.h>
+#include <md/interrupts.h>
+#include <md/timer.h>
+#include <net/pktgen.h>
+#include <netipv4/adj.h>
+#include <netipv4/cksum.h>
+#include <netipv4/ip.h>
+#include <netipv4/udp.h>
+
+/* pktgen_config defaults to a thousand minimum sized frames */
+struct PKTGEN_CONFIG pktgen_config = { 0, 0, 0, 0, PKTGEN_MIN_SIZE, 0, 1000 };
+
+/* pktgen_template is the frame every packet is copied from */
+uint8_t pktgen_template[PKTGEN_MAX_SIZE];
+
+/* pktgen_fake_source is the hardware address injected packets come from */
+uint8_t pktgen_fake_source[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+/*
+ * This will build a UDP frame of [size] bytes in [frame], going from hardware
+ * address [src] to [dst], from address [ipsrc] to [ipdst] and port [port] to
+ * the same port. The payload is zeroed and there is no UDP checksum.
+ */
+void
+pktgen_build (uint8_t* frame, uint32_t size, uint8_t* src, uint8_t* dst, uint32_t ipsrc, uint32_t ipdst, uint16_t port) {
+	ETHERNET_HEADER* eh = (ETHERNET_HEADER*)frame;
+	struct IP_HEADER* iphdr = (struct IP_HEADER*)(frame + sizeof (ETHERNET_HEADER));
+	struct UDP_HEADER* udphdr = (struct UDP_HEADER*)((uint8_t*)iphdr + sizeof (struct IP_HEADER));
+	uint16_t len = size - sizeof (ETHERNET_HEADER);
+
+	kmemset (frame, 0, size);
+
+	/* ethernet header */
+	kmemcpy (eh->dest, dst, ETHER_ADDR_LEN);
+	kmemcpy (eh->source, src, ETHER_ADDR_LEN);
+	eh->type[0] = (ETHERTYPE_IP >> 8); eh->type[1] = (ETHERTYPE_IP & 0xff);
+
+	/* ip header */
+	iphdr->version_ihl = 0x40 | (sizeof (struct IP_HEADER) / 4);
+	iphdr->len = htons (len);
+	iphdr->ttl = 64;
+	iphdr->proto = IP_PROTO_UDP;
+	*(uint32_t*)iphdr->source = htonl (ipsrc);
+	*(uint32_t*)iphdr->dest = htonl (ipdst);
+	iphdr->cksum = ipv4_cksum ((void*)iphdr, sizeof (struct IP_HEADER), 0);
+
+	/* udp header, without checksum */
+	len -= sizeof (struct IP_HEADER);
+	udphdr->source[0] = port >> 8; udphdr->source[1] = port & 0xff;
+	udphdr->dest[0] = port >> 8; udphdr->dest[1] = port & 0xff;
+	udphdr->length[0] = len >> 8; udphdr->length[1] = len & 0xff;
+}
+
+/*
+ * This will send [pktgen_config.count] packets using device [dev]. If [mode]
+ * is PKTGEN_MODE_XMIT, they are transmitted, otherwise they are handled as if
+ * [dev] received them. It will return zero on failure or non-zero on success.
+ */
+int
+pktgen_run (struct DEVICE* dev, int mode) {
+	struct PKTGEN_CONFIG* pc = &pktgen_config;
+	struct ADJACENCY* adj;
+	struct NETPACKET* pkt;
+	struct IP_HEADER* iphdr;
+	uint16_t cksum;
+	uint32_t tmpl_src, tmpl_dst, src, dst, sent = 0, nobuf = 0, ms, backlog, left;
+	int oldints;
+	unsigned long long start, now, next, gap = 0, bytes, stall, waiting = 0;
+	char* why = NULL;
+
+	/* sanity checks */
+	if ((pc->size < PKTGEN_MIN_SIZE) || (pc->size > PKTGEN_MAX_SIZE)) {
+		kprintf ("frame size must be between %u and %u bytes\n", PKTGEN_MIN_SIZE, PKTGEN_MAX_SIZE);
+		return 0;
+	}
+	if ((pc->src_last < pc->src_first) || (pc->dst_last < pc->dst_first)) {
+		kprintf ("address ranges are backwards\n");
+		return 0;
+	}
+	if (arch_tsc_khz == 0) {
+		kprintf ("no time stamp counter available\n");
+		return 0;
+	}
+
+	/* figure out the hardware addresses */
+	if (mode == PKTGEN_MODE_XMIT) {
+		/* send to the next hop of the first destination */
+		adj = ip_resolve (pc->dst_first, NULL);
+		if (adj == NULL) {
+			kprintf ("next hop of %I is not resolved yet, try again\n", pc->dst_first);
+			return 0;
+		}
+		pktgen_build (pktgen_template, pc->size, dev->ether.hw_addr, adj->header.dest,
+		             pc->src_first, pc->dst_first, PKTGEN_PORT);
+	} else
+		pktgen_build (pktgen_template, pc->size, pktgen_fake_source, dev->ether.hw_addr,
+		             pc->src_first, pc->dst_first, PKTGEN_PORT);
+	iphdr = (struct IP_HEADER*)(pktgen_template + sizeof (ETHERNET_HEADER));
+	tmpl_src = *(uint32_t*)iphdr->source;
+	tmpl_dst = *(uint32_t*)iphdr->dest;
+	cksum = iphdr->cksum;
+
+	/* how many cycles between packets? */
+	if (pc->rate != 0)
+		gap = prof_div ((unsigned long long)arch_tsc_khz * 1000, pc->rate);
+
+	/* how long may we go without getting anywhere? */
+	stall = (unsigned long long)arch_tsc_khz * PKTGEN_STALL_MS;
+
+	src = pc->src_first; dst = pc->dst_first;
+	start = arch_tsc_read(); next = start;
+	while (sent < pc->count) {
+		/* keep the pace */
+		if (gap != 0) {
+			while ((now = arch_tsc_read()) < next)
+				network_handle_queue();
+			next += gap;
+		}
+
+		/* let the network catch up every now and then */
+		if ((sent % PKTGEN_BATCH) == 0) {
+			if (arch_console_peekch()) {
+				why = "aborted";
+				break;
+			}
+			network_handle_queue();
+		}
+
+		pkt = network_alloc_packet (dev);
+		if (pkt == NULL) {
+			/* out of buffers. wait for some to come back, but not forever */
+			now = arch_tsc_read();
+			if (waiting == 0)
+				waiting = now;
+			else if (now - waiting > stall) {
+				why = "no buffers came back";
+				break;
+			}
+			if (arch_console_peekch()) {
+				why = "aborted";
+				break;
+			}
+			nobuf++;
+			network_handle_queue();
+			continue;
+		}
+		waiting = 0;
+
+		/* copy the template and patch the addresses in */
+		kmemcpy (pkt->frame, pktgen_template, pc->size);
+		iphdr = (struct IP_HEADER*)(pkt->frame + sizeof (ETHERNET_HEADER));
+		*(uint32_t*)iphdr->source = htonl (src);
+		*(uint32_t*)iphdr->dest = htonl (dst);
+		iphdr->cksum = ipv4_cksum_adjust32 (ipv4_cksum_adjust32 (cksum, tmpl_src, *(uint32_t*)iphdr->source), tmpl_dst, *(uint32_t*)iphdr->dest);
+		pkt->header_len = sizeof (ETHERNET_HEADER);
+		pkt->len = pc->size - sizeof (ETHERNET_HEADER);
+
+		/* off it goes */
+		if (mode == PKTGEN_MODE_XMIT)
+			network_xmit_frame (dev, pkt);
+		else {
+			/* the device may be queueing packets from its IRQ; keep it out */
+			oldints = arch_interrupts (DISABLE);
+			network_queue_packet (dev, pkt);
+			arch_interrupts (oldints);
+		}
+		sent++;
+
+		/* next addresses */
+		src = (src == pc->src_last) ? pc->src_first : src + 1;
+		dst = (dst == pc->dst_last) ? pc->dst_first : dst + 1;
+	}
+
+	/* wait until the device has taken everything, as long as it takes some */
+	backlog = network_xmit_backlog (dev);
+	waiting = arch_tsc_read();
+	while ((why == NULL) && ((left = network_xmit_backlog (dev)) != 0)) {
+		if (left < backlog) {
+			backlog = left;
+			waiting = arch_tsc_read();
+		} else if (arch_tsc_read() - waiting > stall)
+			why = "the device stopped sending";
+		else if (arch_console_peekch())
+			why = "aborted";
+		network_handle_queue();
+	}
+	now = arch_tsc_read();
+
+	/* report */
+	ms = prof_div (now - start, arch_tsc_khz);
+	if (ms == 0)
+		ms = 1;
+	bytes = (unsigned long long)sent * pc->size;
+	kprintf ("%u packets in %u ms: %u pps, %u kbit/s", sent, ms,
+		prof_div ((unsigned long long)sent * 1000, ms),
+		prof_div (bytes * 8, ms));
+	if (nobuf != 0)
+		kprintf (", waited %u times for buffers", nobuf);
+	kprintf ("\n");
+
+	/* did we get to the end? */
+	if (why != NULL) {
+		/* no. say why */
+		kprintf ("%s after %u of %u packets\n", why, sent, pc->count);
+		return 0;
+	}
+	return 1;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -8,33 +8,36 @@
 #include <sys/types.h>
 #include <sys/device.h>
 #include <sys/kmalloc.h>
+#include <sys/slab.h>
 #include <net/socket.h>
 #include <lib/lib.h>
 #include <netipv4/tcp.h>
 
-struct SOCKET* socket;
+/* sockets are all sockets in use */
+struct SOCKET* sockets = NULL;
+
+/* socket_cache hands out the sockets */
+static struct KMEM_CACHE* socket_cache;
 
 /*
  * This will return an available socket structure, or NULL on failure.
  */
 struct SOCKET*
 socket_alloc (int type) {
-	int i;
+	struct SOCKET* s = (struct SOCKET*)kmem_cache_alloc (socket_cache);
 
-	/* wade through the sockets */
-	for (i = 0; i < SOCKET_NUM_SOCKS; i++)
-		/* available socket? */
-		if (socket[i].type == SOCKET_TYPE_UNUSED) {
-			/* yes. set the socket up */
-			kmemset (&socket[i], 0, sizeof (struct SOCKET));
-			socket[i].type = type;
-
-			/* all done */
-			return &socket[i];
-		}
-
-	/* no sockets available */
-	return NULL;
+	/* got one? */
+	if (s == NULL)
+		/* no. too bad */
+		return NULL;
+
+	/* set the socket up */
+	s->type = type;
+	s->next = sockets;
+	sockets = s;
+
+	/* all done */
+	return s;
 }
 
 /*
@@ -43,14 +46,14 @@ socket_alloc (int type) {
  */
 struct SOCKET*
 socket_find (int type, int port) {
-	int i;
+	struct SOCKET* s;
 
 	/* wade through the sockets */
-	for (i = 0; i < SOCKET_NUM_SOCKS; i++)
+	for (s = sockets; s != NULL; s = s->next)
 		/* match? */
-		if ((socket[i].type == type) && (socket[i].port == port))
+		if ((s->type == type) && (s->port == port))
 			/* yes. return the socket */
-			return &socket[i];
+			return s;
 
 	/* not bound */
 	return NULL;
@@ -81,12 +84,20 @@ socket_bind (struct SOCKET* s, int port) {
 }
 
 /*
- * This will close socket [s].
+ * This will close socket [s]. The socket is gone afterwards.
  */
 void
 socket_close (struct SOCKET* s) {
-	s->state = SOCKET_STATE_UNUSED;
-	s->port = 0;
+	struct SOCKET** prev = &sockets;
+
+	/* unhook it */
+	while (*prev != s)
+		prev = &(*prev)->next;
+	*prev = s->next;
+
+	/* and give it back */
+	kmemset (s, 0, sizeof (struct SOCKET));
+	kmem_cache_free (socket_cache, s);
 }
 
 /*
@@ -102,11 +113,9 @@ socket_set_callback (struct SOCKET* s, void (*callback)(struct SOCKET* s, struct
  */
 void
 socket_init() {
-	/* allocate memory for the socket administration */
-	socket = (struct SOCKET*)kmalloc (NULL, sizeof (struct SOCKET) * SOCKET_NUM_SOCKS, 0);
-
-	/* reset the sockets */
-	kmemset (socket, 0, sizeof (struct SOCKET) * SOCKET_NUM_SOCKS);
+	socket_cache = kmem_cache_create ("socket", sizeof (struct SOCKET), sizeof (uint32_t), NULL);
+	if (socket_cache == NULL)
+		panic ("socket_init(): cannot create the socket cache");
 }
 
 /* vim:set ts=2 sw=2 tw=78: */
@@ -26,6 +26,7 @@ void
 i386_status() {
 	addr_t base = tty_videobase + 4000;
 	int oldints = arch_interrupts (DISABLE);
+	struct ARP_RECORD* arp;
 	int i, oldoffs = offs;
 	struct DEVICE* dev = coredevice;
 
@@ -74,21 +75,18 @@ i386_status() {
 	/* ARP table */
 	kprintf ("ARP table:\n");
 		/* wade through the entire table */
-		for (i = 0; i < ARP_CACHE_SIZE; i++)
-			/* address here? */
-			if (arp_cache[i].address) {
-				/* yes. display it */
-				kprintf ("%I     %x:%x:%x:%x:%x:%x   %s  %s\n",
-						arp_cache[i].address,
-						arp_cache[i].hw_addr[0],	
-						arp_cache[i].hw_addr[1],	
-						arp_cache[i].hw_addr[2],	
-						arp_cache[i].hw_addr[3],	
-						arp_cache[i].hw_addr[4],	
-						arp_cache[i].hw_addr[5],
-						arp_cache[i].device->name,
-						/*(arp_cache[i].flags & ARP_FLAG_PERM) ? "[permanent]" : */"");
-			}
+		for (arp = arp_records; arp != NULL; arp = arp->list_next)
+			/* display it */
+			kprintf ("%I     %x:%x:%x:%x:%x:%x   %s  %s\n",
+					arp->address,
+					arp->hw_addr[0],	
+					arp->hw_addr[1],	
+					arp->hw_addr[2],	
+					arp->hw_addr[3],	
+					arp->hw_addr[4],	
+					arp->hw_addr[5],
+					arp->device->name,
+					/*(arp->flags & ARP_FLAG_PERM) ? "[permanent]" : */"");
 		
 	/* restore interrupts and offset */
 	offs = oldoffs; tty_videobase = (base - 4000);
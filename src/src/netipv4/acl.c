@@ -0,0 +1,872 @@
+/*
+ * ILIOS IPv4 TCP/IP network stack
+ * (c) 2003 Rink Springer
+ *
+ * This handles the access lists of forwarded traffic. Rules are compiled into
+ * a decision tree in the manner of HiCuts: every node cuts its part of the
+ * field space into equal pieces along the field which separates its rules
+ * best, until few enough rules are left to try them one by one. A lookup
+ * takes a few steps down the tree and a few rule checks, whether there are
+ * ten rules or ten thousand. Rules with wide addresses, which would be copied
+ * into every piece, get trees of their own.
+ *
+ * Changes to the rules only take effect once they are committed, at which
+ * point a new tree is built next to the old one and swapped in.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/kmalloc.h>
+#include <sys/network.h>
+#include <sys/prof.h>
+#include <lib/lib.h>
+#include <md/timer.h>
+#include <netipv4/acl.h>
+#include <netipv4/ip.h>
+#include <netipv4/ipv4.h>
+
+/* acl_rules are the configured rules, acl_policy the compiled active ones */
+struct ACL_RULE* acl_rules = NULL;
+struct ACL_POLICY* acl_policy = NULL;
+
+/* acl_dead are the rules deleted since the last commit */
+static struct ACL_RULE* acl_dead = NULL;
+
+/* acl_max is the highest value of every field */
+static const uint32_t acl_max[ACL_DIMS] = { 0xffffffff, 0xffffffff, 255, 65535, 65535 };
+
+/*
+ * This will return the last value of the part of a field which starts at
+ * [lo] and spans [bits] bits.
+ */
+static uint32_t
+acl_region_hi (uint32_t lo, int bits) {
+	return (bits == 32) ? 0xffffffff : lo + ((1U << bits) - 1);
+}
+
+/*
+ * This will return [len] bytes of the memory of policy [p], or NULL if we
+ * are out of memory.
+ */
+static void*
+acl_alloc (struct ACL_POLICY* p, size_t len) {
+	struct ACL_CHUNK* c = p->chunk;
+	size_t size;
+	void* ptr;
+
+	/* keep everything aligned */
+	len = (len + 3) & ~3;
+
+	/* room left in the current chunk? */
+	if ((c == NULL) || (c->used + len > c->size)) {
+		/* no. grab a new one */
+		size = ACL_CHUNK_SIZE;
+		if (len + sizeof (struct ACL_CHUNK) > size)
+			size = len + sizeof (struct ACL_CHUNK);
+		c = (struct ACL_CHUNK*)kmalloc (NULL, size, 0);
+		if (c == NULL) {
+			p->failed = 1;
+			return NULL;
+		}
+		c->size = size - sizeof (struct ACL_CHUNK);
+		c->used = 0;
+		c->next = p->chunk;
+		p->chunk = c;
+	}
+
+	ptr = (char*)(c + 1) + c->used;
+	c->used += len;
+	p->size += len;
+	return ptr;
+}
+
+/*
+ * This will free policy [p].
+ */
+static void
+acl_free_policy (struct ACL_POLICY* p) {
+	struct ACL_CHUNK* c;
+
+	while (p->chunk != NULL) {
+		c = p->chunk;
+		p->chunk = c->next;
+		kfree (c);
+	}
+	kfree (p);
+}
+
+/*
+ * This will return the tree rule [r] goes in, by which of its addresses are
+ * wide.
+ */
+static int
+acl_tree (struct ACL_RULE* r) {
+	int tree = 0;
+
+	if ((r->hi[ACL_DIM_SRC] - r->lo[ACL_DIM_SRC]) >> ACL_WIDE_BITS)
+		tree |= 1;
+	if ((r->hi[ACL_DIM_DST] - r->lo[ACL_DIM_DST]) >> ACL_WIDE_BITS)
+		tree |= 2;
+	return tree;
+}
+
+/*
+ * This will return non-zero if rule [r] covers the whole part of the field
+ * space from [lo] to [hi].
+ */
+static int
+acl_covers (struct ACL_RULE* r, uint32_t* lo, uint32_t* hi) {
+	int d;
+
+	for (d = 0; d < ACL_DIMS; d++)
+		if ((r->lo[d] > lo[d]) || (r->hi[d] < hi[d]))
+			return 0;
+	return 1;
+}
+
+/*
+ * This will return a leaf of policy [p] holding the [n] rules [rule], or
+ * NULL if we are out of memory.
+ */
+static struct ACL_NODE*
+acl_leaf (struct ACL_POLICY* p, struct ACL_RULE** rule, uint32_t n) {
+	struct ACL_NODE* node = (struct ACL_NODE*)acl_alloc (p, sizeof (struct ACL_NODE));
+
+	if (node == NULL)
+		return NULL;
+	node->dim = ACL_LEAF;
+	node->num_rules = n;
+	node->child = NULL;
+	node->rule = (struct ACL_RULE**)acl_alloc (p, n * sizeof (struct ACL_RULE*));
+	if (node->rule == NULL)
+		return NULL;
+	kmemcpy (node->rule, rule, n * sizeof (struct ACL_RULE*));
+
+	p->num_nodes++;
+	return node;
+}
+
+/*
+ * This will return the number of bits needed to count from [lo] to [hi].
+ */
+static int
+acl_span_bits (uint32_t lo, uint32_t hi) {
+	uint32_t span = hi - lo;
+	int bits = 0;
+
+	while ((bits < 32) && ((span >> bits) != 0))
+		bits++;
+	return bits;
+}
+
+/*
+ * This will figure out how to cut the part of the field space from [lo] to
+ * [hi] between the [n] rules [rule], which overlap it. The cut that leaves
+ * the fewest rules in the fullest piece wins, as long as the pieces don't
+ * hold more than ACL_SPACE_FACTOR times the rules between them. It will store
+ * the field in [dim] and the number of bits to cut by in [cut], and return
+ * zero if no cut separates the rules.
+ */
+static int
+acl_choose_cut (struct ACL_RULE** rule, uint32_t n, uint32_t* lo, uint32_t* hi, int* dim, int* cut) {
+	static int count[(1 << ACL_MAX_CUT_BITS) + 1];
+	uint32_t i, l, h, max, sum, best_max = n, best_sum = 0, best_cuts = 1;
+	int d, b, c, bits, run, shift, ncuts, found = 0;
+
+	for (d = 0; d < ACL_DIMS; d++) {
+		bits = acl_span_bits (lo[d], hi[d]);
+		for (b = 1; (b <= ACL_MAX_CUT_BITS) && (b <= bits); b++) {
+			shift = bits - b; ncuts = 1 << b;
+
+			/* count the rules per piece; [count] holds where they start and end */
+			kmemset (count, 0, (ncuts + 1) * sizeof (int));
+			sum = 0;
+			for (i = 0; i < n; i++) {
+				l = (((rule[i]->lo[d] > lo[d]) ? rule[i]->lo[d] : lo[d]) - lo[d]) >> shift;
+				h = (((rule[i]->hi[d] < hi[d]) ? rule[i]->hi[d] : hi[d]) - lo[d]) >> shift;
+				count[l]++; count[h + 1]--;
+				sum += h - l + 1;
+			}
+
+			/* too many copies? cutting finer will only make more */
+			if (sum + ncuts > ACL_SPACE_FACTOR * n)
+				break;
+
+			/* no use if every piece gets every rule */
+			if (sum == ncuts * n)
+				continue;
+
+			/* find the fullest piece */
+			max = 0; run = 0;
+			for (c = 0; c < ncuts; c++) {
+				run += count[c];
+				if (run > max)
+					max = run;
+			}
+
+			/* better? on a tie, go for the fewest rules per piece */
+			if ((!found) || (max < best_max) ||
+			    ((max == best_max) && (sum * best_cuts < best_sum * ncuts))) {
+				best_max = max; best_sum = sum; best_cuts = ncuts;
+				*dim = d; *cut = b;
+				found = 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+/*
+ * This will shrink the part of the field space from [lo] to [hi] to what the
+ * [n] rules [rule] actually use of it.
+ */
+static void
+acl_shrink (struct ACL_RULE** rule, uint32_t n, uint32_t* lo, uint32_t* hi) {
+	uint32_t min[ACL_DIMS], max[ACL_DIMS];
+	uint32_t i;
+	int d;
+
+	for (d = 0; d < ACL_DIMS; d++) {
+		min[d] = hi[d]; max[d] = lo[d];
+		for (i = 0; i < n; i++) {
+			if (rule[i]->lo[d] < min[d]) min[d] = rule[i]->lo[d];
+			if (rule[i]->hi[d] > max[d]) max[d] = rule[i]->hi[d];
+		}
+		if (min[d] > lo[d]) lo[d] = min[d];
+		if (max[d] < hi[d]) hi[d] = max[d];
+	}
+}
+
+/*
+ * This will gather those of the [n] rules [rule] which overlap piece [c] of
+ * the part of the field space from [lo] to [hi], cut along field [dim] into
+ * pieces of 1 << [shift] values, in [cur]. The piece is stored in [clo] to
+ * [chi]; the last one may be cut short. It will return the number of rules.
+ */
+static uint32_t
+acl_piece (struct ACL_RULE** rule, uint32_t n, uint32_t* lo, uint32_t* hi, int dim, int shift, uint32_t c, uint32_t* clo, uint32_t* chi, struct ACL_RULE** cur) {
+	uint32_t i, ncur = 0;
+
+	kmemcpy (clo, lo, ACL_DIMS * sizeof (uint32_t));
+	kmemcpy (chi, hi, ACL_DIMS * sizeof (uint32_t));
+	clo[dim] = lo[dim] + (c << shift);
+	chi[dim] = clo[dim] + ((1 << shift) - 1);
+	if ((chi[dim] < clo[dim]) || (chi[dim] > hi[dim]))
+		chi[dim] = hi[dim];
+	if ((clo[dim] < lo[dim]) || (clo[dim] > hi[dim]))
+		/* beyond what the rules use */
+		return 0;
+
+	for (i = 0; i < n; i++)
+		if ((rule[i]->lo[dim] <= chi[dim]) && (rule[i]->hi[dim] >= clo[dim]))
+			cur[ncur++] = rule[i];
+	return ncur;
+}
+
+/*
+ * This will build the part of the tree of policy [p] for the [n] rules
+ * [rule], which overlap the part of the field space from [lo] to [hi]. It
+ * will return NULL if we are out of memory.
+ */
+static struct ACL_NODE*
+acl_build (struct ACL_POLICY* p, struct ACL_RULE** rule, uint32_t n, uint32_t* region_lo, uint32_t* region_hi, uint32_t depth) {
+	struct ACL_NODE* node;
+	struct ACL_RULE** cur;
+	struct ACL_RULE** prev;
+	struct ACL_RULE** tmp;
+	struct ACL_RULE** swap;
+	struct ACL_NODE* child;
+	uint32_t lo[ACL_DIMS], hi[ACL_DIMS], clo[ACL_DIMS], chi[ACL_DIMS];
+	uint32_t rlo[ACL_DIMS], rhi[ACL_DIMS];
+	uint32_t i, c, ncur, nprev, first;
+	int d = 0, cut = 0, shift;
+
+	if (depth > p->depth)
+		p->depth = depth;
+
+	/* only look at the part our rules use */
+	kmemcpy (lo, region_lo, sizeof (lo));
+	kmemcpy (hi, region_hi, sizeof (hi));
+	acl_shrink (rule, n, lo, hi);
+
+	/* a rule covering all of that hides the rules after it */
+	for (i = 0; i < n; i++)
+		if (acl_covers (rule[i], lo, hi)) {
+			n = i + 1;
+			acl_shrink (rule, n, lo, hi);
+			break;
+		}
+
+	/* few enough rules, or no way to tell them apart? */
+	if ((n <= ACL_LEAF_RULES) || (depth == ACL_MAX_DEPTH) ||
+	    (!acl_choose_cut (rule, n, lo, hi, &d, &cut)))
+		/* yes. they'll be tried one by one */
+		return acl_leaf (p, rule, n);
+
+	/* set the node up */
+	shift = acl_span_bits (lo[d], hi[d]) - cut;
+	node = (struct ACL_NODE*)acl_alloc (p, sizeof (struct ACL_NODE));
+	if (node == NULL)
+		return NULL;
+	node->dim = d;
+	node->shift = shift;
+	node->base = lo[d];
+	node->mask = (1 << cut) - 1;
+	node->num_rules = 0;
+	node->rule = NULL;
+	node->child = (struct ACL_NODE**)acl_alloc (p, (1 << cut) * sizeof (struct ACL_NODE*));
+	if (node->child == NULL)
+		return NULL;
+	p->num_nodes++;
+
+	/* room to sort the rules out per piece, and to remember the previous ones */
+	tmp = (struct ACL_RULE**)kmalloc (NULL, 2 * n * sizeof (struct ACL_RULE*), 0);
+	if (tmp == NULL) {
+		p->failed = 1;
+		return NULL;
+	}
+	prev = tmp; cur = tmp + n;
+
+	/*
+	 * Pieces next to each other with the same rules share a child, which is
+	 * built for all of them at once: the child only knows about the part of
+	 * the field space it was built for. [prev] holds the rules of the run of
+	 * pieces from [first] on, which spans [rlo] to [rhi].
+	 */
+	first = 0;
+	nprev = acl_piece (rule, n, lo, hi, d, shift, 0, rlo, rhi, prev);
+	for (c = 1; c <= node->mask + 1; c++) {
+		ncur = 0;
+		if (c <= node->mask) {
+			/* same rules as the run so far? */
+			ncur = acl_piece (rule, n, lo, hi, d, shift, c, clo, chi, cur);
+			if ((ncur == nprev) &&
+			    (kmemcmp ((char*)cur, (char*)prev, ncur * sizeof (struct ACL_RULE*)) == 0)) {
+				/* yes. it joins the run */
+				if (chi[d] > rhi[d])
+					rhi[d] = chi[d];
+				continue;
+			}
+		}
+
+		/* the run ends here; build its child */
+		child = acl_build (p, prev, nprev, rlo, rhi, depth + 1);
+		if (child == NULL) {
+			kfree (tmp);
+			return NULL;
+		}
+		while (first < c)
+			node->child[first++] = child;
+		if (c > node->mask)
+			break;
+
+		/* this piece starts the next run */
+		swap = prev; prev = cur; cur = swap;
+		nprev = ncur;
+		kmemcpy (rlo, clo, sizeof (rlo));
+		kmemcpy (rhi, chi, sizeof (rhi));
+	}
+
+	kfree (tmp);
+	return node;
+}
+
+/*
+ * This will compile rules [rules] into a new policy. It will return NULL if
+ * we are out of memory.
+ */
+static struct ACL_POLICY*
+acl_compile (struct ACL_RULE* rules) {
+	struct ACL_POLICY* p;
+	struct ACL_RULE** tmp;
+	struct ACL_RULE* r;
+	struct ACL_TABLE* t;
+	struct DEVICE* dev;
+	uint32_t lo[ACL_DIMS], hi[ACL_DIMS];
+	uint32_t n = 0, i;
+	int dir, tree;
+
+	p = (struct ACL_POLICY*)kmalloc (NULL, sizeof (struct ACL_POLICY), 0);
+	if (p == NULL)
+		return NULL;
+	kmemset (p, 0, sizeof (struct ACL_POLICY));
+	kmemset (lo, 0, sizeof (lo));
+	kmemcpy (hi, acl_max, sizeof (hi));
+
+	/* count the rules, and the devices that have rules of their own */
+	for (r = rules; r != NULL; r = r->next)
+		n++;
+	p->num_rules = n;
+	p->num_tables = 1;
+	for (dev = coredevice; dev != NULL; dev = dev->next)
+		for (r = rules; r != NULL; r = r->next)
+			if (r->device == dev) {
+				p->num_tables++;
+				break;
+			}
+
+	/* those get a table of their own; the last is for everyone else */
+	p->table = (struct ACL_TABLE*)acl_alloc (p, p->num_tables * sizeof (struct ACL_TABLE));
+	tmp = (struct ACL_RULE**)kmalloc (NULL, n * sizeof (struct ACL_RULE*), 0);
+	if ((p->table == NULL) || (tmp == NULL)) {
+		if (tmp != NULL) kfree (tmp);
+		acl_free_policy (p);
+		return NULL;
+	}
+	kmemset (p->table, 0, p->num_tables * sizeof (struct ACL_TABLE));
+	t = p->table;
+	for (dev = coredevice; dev != NULL; dev = dev->next)
+		for (r = rules; r != NULL; r = r->next)
+			if (r->device == dev) {
+				(t++)->device = dev;
+				break;
+			}
+
+	/* build the trees */
+	for (t = p->table; (t < p->table + p->num_tables) && (!p->failed); t++)
+		for (dir = 0; dir < ACL_DIRS; dir++)
+			for (tree = 0; tree < ACL_TREES; tree++) {
+				i = 0;
+				for (r = rules; r != NULL; r = r->next)
+					if ((r->dir == dir) && ((r->device == NULL) || (r->device == t->device)) &&
+					    (acl_tree (r) == tree))
+						tmp[i++] = r;
+				t->num_rules[dir] += i;
+				if (i > 0)
+					t->root[dir][tree] = acl_build (p, tmp, i, lo, hi, 0);
+			}
+
+	kfree (tmp);
+	if (p->failed) {
+		acl_free_policy (p);
+		return NULL;
+	}
+	return p;
+}
+
+/*
+ * This will return the rule in leaf [node] numbered below [limit] which
+ * matches the fields [key], or NULL if there is none.
+ */
+static struct ACL_RULE*
+acl_lookup_leaf (struct ACL_NODE* node, uint32_t* key, uint32_t limit) {
+	struct ACL_RULE* r;
+	uint32_t i;
+
+	for (i = 0; (i < node->num_rules) && (node->rule[i]->number < limit); i++) {
+		r = node->rule[i];
+		if ((key[0] >= r->lo[0]) && (key[0] <= r->hi[0]) &&
+		    (key[1] >= r->lo[1]) && (key[1] <= r->hi[1]) &&
+		    (key[2] >= r->lo[2]) && (key[2] <= r->hi[2]) &&
+		    (key[3] >= r->lo[3]) && (key[3] <= r->hi[3]) &&
+		    (key[4] >= r->lo[4]) && (key[4] <= r->hi[4]))
+			return r;
+	}
+	return NULL;
+}
+
+/*
+ * This will return the first rule in the trees [root] which matches the
+ * fields [key], or NULL if there is none. The trees are walked down side by
+ * side, a level at a time, so their nodes are fetched together rather than
+ * one tree after the other.
+ */
+static struct ACL_RULE*
+acl_lookup (struct ACL_NODE** root, uint32_t* key) {
+	struct ACL_NODE* node[ACL_TREES];
+	struct ACL_NODE* n;
+	struct ACL_RULE* best = NULL;
+	struct ACL_RULE* r;
+	uint32_t i;
+	int tree, more;
+
+	for (tree = 0; tree < ACL_TREES; tree++)
+		node[tree] = root[tree];
+
+	do {
+		more = 0;
+		for (tree = 0; tree < ACL_TREES; tree++) {
+			n = node[tree];
+			if ((n == NULL) || (n->dim == ACL_LEAF))
+				continue;
+			i = (key[n->dim] - n->base) >> n->shift;
+			/* beyond what the rules use, there's nothing to find */
+			node[tree] = (i <= n->mask) ? n->child[i] : NULL;
+			more = 1;
+		}
+	} while (more);
+
+	for (tree = 0; tree < ACL_TREES; tree++) {
+		if (node[tree] == NULL)
+			continue;
+		r = acl_lookup_leaf (node[tree], key, (best != NULL) ? best->number : 0xffffffff);
+		if (r != NULL)
+			best = r;
+	}
+	return best;
+}
+
+/*
+ * This will add rule [rule] to the configured rules, replacing any rule with
+ * the same number. It will return zero on failure or non-zero on success.
+ */
+int
+acl_add (struct ACL_RULE* rule) {
+	struct ACL_RULE** prev;
+	struct ACL_RULE* r;
+
+	r = (struct ACL_RULE*)kmalloc (NULL, sizeof (struct ACL_RULE), 0);
+	if (r == NULL)
+		return 0;
+	kmemcpy (r, rule, sizeof (struct ACL_RULE));
+	r->hits = 0;
+	r->committed = 0;
+
+	/* find its place */
+	for (prev = &acl_rules; (*prev != NULL) && ((*prev)->number < r->number); prev = &(*prev)->next);
+
+	/* replacing one? */
+	if ((*prev != NULL) && ((*prev)->number == r->number)) {
+		/* yes. the old one may still be in use until we commit */
+		r->next = (*prev)->next;
+		(*prev)->next = acl_dead;
+		acl_dead = *prev;
+	} else
+		r->next = *prev;
+	*prev = r;
+	return 1;
+}
+
+/*
+ * This will delete the rule numbered [number]. It will return zero if there
+ * is no such rule.
+ */
+int
+acl_delete (uint32_t number) {
+	struct ACL_RULE** prev;
+	struct ACL_RULE* r;
+
+	for (prev = &acl_rules; *prev != NULL; prev = &(*prev)->next)
+		if ((*prev)->number == number) {
+			/* got it. it may still be in use until we commit */
+			r = *prev;
+			*prev = r->next;
+			r->next = acl_dead; acl_dead = r;
+			return 1;
+		}
+
+	return 0;
+}
+
+/*
+ * This will delete all rules.
+ */
+void
+acl_flush() {
+	while (acl_rules != NULL)
+		acl_delete (acl_rules->number);
+}
+
+/*
+ * This will delete all rules of device [dev], which is going away, and
+ * commit the change.
+ */
+void
+acl_flush_device (struct DEVICE* dev) {
+	struct ACL_RULE* r;
+	struct ACL_RULE* next;
+
+	for (r = acl_rules; r != NULL; r = next) {
+		next = r->next;
+		if (r->device == dev)
+			acl_delete (r->number);
+	}
+
+	/* deleted rules must not refer to it either */
+	for (r = acl_dead; r != NULL; r = r->next)
+		if (r->device == dev)
+			r->device = NULL;
+
+	acl_commit();
+}
+
+/*
+ * This will make the configured rules the active ones. It will return zero
+ * on failure, in which case the old rules stay active.
+ */
+int
+acl_commit() {
+	struct ACL_POLICY* p = NULL;
+	struct ACL_POLICY* old;
+	struct ACL_RULE* r;
+
+	/* build the new policy next to the old one */
+	if (acl_rules != NULL) {
+		p = acl_compile (acl_rules);
+		if (p == NULL)
+			return 0;
+	}
+
+	/*
+	 * Switch over. Packets are only filtered from the main loop, and we are
+	 * called from it between packets, so nothing is using the old policy
+	 * anymore, nor the rules which were deleted.
+	 */
+	old = acl_policy;
+	acl_policy = p;
+	if (old != NULL)
+		acl_free_policy (old);
+
+	while (acl_dead != NULL) {
+		r = acl_dead;
+		acl_dead = r->next;
+		kfree (r);
+	}
+	for (r = acl_rules; r != NULL; r = r->next)
+		r->committed = 1;
+
+	return 1;
+}
+
+/*
+ * This will return the number of changes to the rules which haven't been
+ * committed yet.
+ */
+uint32_t
+acl_pending() {
+	struct ACL_RULE* r;
+	uint32_t n = 0;
+
+	for (r = acl_rules; r != NULL; r = r->next)
+		if (!r->committed)
+			n++;
+	for (r = acl_dead; r != NULL; r = r->next)
+		if (r->committed)
+			n++;
+	return n;
+}
+
+/*
+ * This will check IP packet [np] against the rules of device [dev] for
+ * direction [dir]. It will return zero if the packet must be dropped or
+ * non-zero if it may pass. Ports of packets other than TCP and UDP, and of
+ * fragments other than the first, count as zero.
+ */
+int
+acl_filter (struct NETPACKET* np, struct DEVICE* dev, int dir) {
+	struct ACL_POLICY* p = acl_policy;
+	struct IP_HEADER* iphdr = (struct IP_HEADER*)np->data;
+	uint8_t* len = (uint8_t*)&iphdr->len;
+	uint8_t* frag = (uint8_t*)&iphdr->flag_frags;
+	struct ACL_TABLE* t;
+	struct ACL_RULE* r;
+	uint32_t key[ACL_DIMS];
+	uint8_t* ports;
+	uint32_t hlen;
+
+	/* any rules at all? */
+	if (p == NULL)
+		return 1;
+
+	/* find the rules of the device */
+	for (t = p->table; (t->device != NULL) && (t->device != dev); t++);
+	if (t->num_rules[dir] == 0)
+		return 1;
+
+	/* fetch the fields */
+	key[ACL_DIM_SRC] = ipv4_conv_addr (iphdr->source);
+	key[ACL_DIM_DST] = ipv4_conv_addr (iphdr->dest);
+	key[ACL_DIM_PROTO] = iphdr->proto;
+	key[ACL_DIM_SPORT] = 0; key[ACL_DIM_DPORT] = 0;
+	hlen = (iphdr->version_ihl & 0x0f) * 4;
+	if (((iphdr->proto == IP_PROTO_TCP) || (iphdr->proto == IP_PROTO_UDP)) &&
+	    ((frag[0] & 0x1f) == 0) && (frag[1] == 0) && (((len[0] << 8) | len[1]) >= hlen + 4)) {
+		ports = (uint8_t*)np->data + hlen;
+		key[ACL_DIM_SPORT] = (ports[0] << 8) | ports[1];
+		key[ACL_DIM_DPORT] = (ports[2] << 8) | ports[3];
+	}
+
+	/* no rule matching means the packet may pass */
+	r = acl_lookup (t->root[dir], key);
+	if (r == NULL)
+		return 1;
+
+	r->hits++;
+	return (r->action == ACL_PERMIT);
+}
+
+/*
+ * This will return a pseudo-random number of 15 bits, using and updating
+ * [seed].
+ */
+static uint32_t
+acl_random (uint32_t* seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7fff;
+}
+
+/*
+ * This will build a policy of [num_rules] pseudo-random rules, and report how
+ * long [num_lookups] lookups in it take. The lookups are then checked against
+ * a linear scan of the rules. It will return zero on failure or if the check
+ * fails, or non-zero on success.
+ */
+int
+acl_benchmark (uint32_t num_rules, uint32_t num_lookups) {
+	struct ACL_RULE* rule;
+	struct ACL_RULE* r;
+	struct ACL_POLICY* p;
+	unsigned long long start, cycles;
+	uint32_t key[ACL_DIMS];
+	uint32_t* keys;
+	uint32_t i, len, seed, hits = 0, bad = 0;
+	int d;
+
+	rule = (struct ACL_RULE*)kmalloc (NULL, num_rules * sizeof (struct ACL_RULE), 0);
+	keys = (uint32_t*)kmalloc (NULL, ACL_BENCH_KEYS * ACL_DIMS * sizeof (uint32_t), 0);
+	if ((rule == NULL) || (keys == NULL)) {
+		kprintf ("out of memory\n");
+		if (rule != NULL) kfree (rule);
+		if (keys != NULL) kfree (keys);
+		return 0;
+	}
+	kmemset (rule, 0, num_rules * sizeof (struct ACL_RULE));
+
+	/*
+	 * Make up the rules: prefixes of /8 to /32 within 10.0.0.0/8, TCP or UDP
+	 * to a single port or a range of them, now and then from a single port,
+	 * and the odd rule that leaves a field open.
+	 */
+	seed = 1;
+	for (i = 0; i < num_rules; i++) {
+		r = &rule[i];
+		r->number = i;
+		r->next = (i + 1 < num_rules) ? &rule[i + 1] : NULL;
+		r->action = (i & 1) ? ACL_PERMIT : ACL_DENY;
+		for (d = 0; d < ACL_DIMS; d++) {
+			r->lo[d] = 0;
+			r->hi[d] = acl_max[d];
+		}
+
+		for (d = ACL_DIM_SRC; d <= ACL_DIM_DST; d++) {
+			len = 8 + (acl_random (&seed) % 25);
+			if ((acl_random (&seed) & 7) == 0)
+				continue;
+			r->lo[d] = (0x0a000000 | (acl_random (&seed) << 9) | acl_random (&seed)) &
+			           (0xffffffff << (32 - len));
+			r->hi[d] = acl_region_hi (r->lo[d], 32 - len);
+		}
+		if ((acl_random (&seed) & 7) == 0)
+			continue;
+		r->lo[ACL_DIM_PROTO] = (acl_random (&seed) & 1) ? IP_PROTO_TCP : IP_PROTO_UDP;
+		r->hi[ACL_DIM_PROTO] = r->lo[ACL_DIM_PROTO];
+		len = acl_random (&seed) & 3;
+		if (len == 0)
+			/* anything above 1024 */
+			r->lo[ACL_DIM_DPORT] = 1024;
+		else if (len == 1) {
+			/* some range */
+			r->lo[ACL_DIM_DPORT] = acl_random (&seed) << 1;
+			r->hi[ACL_DIM_DPORT] = r->lo[ACL_DIM_DPORT] + (acl_random (&seed) & 0xfff);
+			if (r->hi[ACL_DIM_DPORT] > 65535)
+				r->hi[ACL_DIM_DPORT] = 65535;
+		} else {
+			/* a well-known port */
+			r->lo[ACL_DIM_DPORT] = acl_random (&seed) & 0x3ff;
+			r->hi[ACL_DIM_DPORT] = r->lo[ACL_DIM_DPORT];
+		}
+		if ((acl_random (&seed) & 7) == 0) {
+			/* replies from a server */
+			r->lo[ACL_DIM_SPORT] = acl_random (&seed) & 0x3ff;
+			r->hi[ACL_DIM_SPORT] = r->lo[ACL_DIM_SPORT];
+		}
+	}
+
+	/* compile them */
+	start = arch_tsc_read();
+	p = acl_compile (rule);
+	cycles = arch_tsc_read() - start;
+	if (p == NULL) {
+		kprintf ("out of memory\n");
+		kfree (keys);
+		kfree (rule);
+		return 0;
+	}
+	kprintf ("%u rules: %u nodes, %u bytes, depth %u", num_rules, p->num_nodes, p->size, p->depth);
+	if (arch_tsc_khz != 0)
+		kprintf (", compiled in %u ms", prof_div (cycles, arch_tsc_khz));
+	kprintf ("\n");
+
+	/*
+	 * Make up the packets to look up beforehand, so the timing is about the
+	 * policy only: half of them match some rule.
+	 */
+	seed = 1;
+	for (i = 0; i < ACL_BENCH_KEYS; i++) {
+		r = &rule[acl_random (&seed) % num_rules];
+		for (d = 0; d < ACL_DIMS; d++)
+			keys[i * ACL_DIMS + d] = r->lo[d];
+		if (i & 1) {
+			keys[i * ACL_DIMS + ACL_DIM_SRC] ^= acl_random (&seed);
+			keys[i * ACL_DIMS + ACL_DIM_DPORT] = acl_random (&seed);
+		}
+	}
+
+	start = arch_tsc_read();
+	for (i = 0; i < num_lookups; i++)
+		if (acl_lookup (p->table->root[ACL_DIR_IN], &keys[(i & (ACL_BENCH_KEYS - 1)) * ACL_DIMS]) != NULL)
+			hits++;
+	cycles = arch_tsc_read() - start;
+
+	kprintf ("%u lookups, %u hits, %u cycles per lookup\n", num_lookups, hits,
+		(num_lookups > 0) ? prof_div (cycles, num_lookups) : 0);
+
+	/* make sure the tree agrees with trying every rule in turn */
+	for (i = 0; i < ACL_CHECK_LOOKUPS; i++) {
+		if (i & 1) {
+			/* anything at all */
+			key[ACL_DIM_SRC] = (acl_random (&seed) << 17) ^ (acl_random (&seed) << 8) ^ acl_random (&seed);
+			key[ACL_DIM_DST] = (acl_random (&seed) << 17) ^ (acl_random (&seed) << 8) ^ acl_random (&seed);
+			if (i & 2) {
+				/* but mostly where the rules are */
+				key[ACL_DIM_SRC] = 0x0a000000 | (key[ACL_DIM_SRC] & 0xffffff);
+				key[ACL_DIM_DST] = 0x0a000000 | (key[ACL_DIM_DST] & 0xffffff);
+			}
+			key[ACL_DIM_PROTO] = acl_random (&seed) & 0x1f;
+			key[ACL_DIM_SPORT] = (acl_random (&seed) << 1) & 0xffff;
+			key[ACL_DIM_DPORT] = acl_random (&seed) & 0x7ff;
+		} else {
+			/* on or just beyond the edges of a rule */
+			r = &rule[acl_random (&seed) % num_rules];
+			for (d = 0; d < ACL_DIMS; d++) {
+				len = acl_random (&seed);
+				key[d] = (len & 1) ? r->hi[d] : r->lo[d];
+				if ((len & 6) == 2)
+					key[d] += (len & 1) ? 1 : -1;
+				key[d] &= acl_max[d];
+			}
+		}
+
+		for (r = rule; r != NULL; r = r->next) {
+			for (d = 0; d < ACL_DIMS; d++)
+				if ((key[d] < r->lo[d]) || (key[d] > r->hi[d]))
+					break;
+			if (d == ACL_DIMS)
+				break;
+		}
+		if (acl_lookup (p->table->root[ACL_DIR_IN], key) != r)
+			bad++;
+	}
+	if (bad > 0)
+		kprintf ("%u of %u lookups disagree with a linear scan!\n", bad, ACL_CHECK_LOOKUPS);
+	else
+		kprintf ("%u lookups agree with a linear scan\n", ACL_CHECK_LOOKUPS);
+
+	acl_free_policy (p);
+	kfree (keys);
+	kfree (rule);
+	return (bad == 0);
+}
+
+/* vim:set ts=2 sw=2: */
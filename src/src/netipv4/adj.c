@@ -0,0 +1,219 @@
+/*
+ * ILIOS IPv4 TCP/IP network stack
+ * (c) 2003 Rink Springer
+ *
+ * This will handle adjacencies, the next hops routes point to. Every
+ * adjacency carries a prebuilt Ethernet header, so sending a packet to a
+ * next hop only takes a single header store. The ARP code keeps the headers
+ * up to date. Directly connected neighbours need no routes of their own:
+ * their ARP record carries the adjacency, and is found through the ARP hash.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/network.h>
+#include <sys/kmalloc.h>
+#include <lib/lib.h>
+#include <netipv4/adj.h>
+#include <netipv4/arp.h>
+
+struct ADJACENCY* adjacencies;
+struct ADJACENCY** adj_hash;
+struct ADJACENCY* adj_free;
+
+/*
+ * This will return the hash bucket for [addr] on device [dev].
+ */
+static struct ADJACENCY**
+adj_bucket (struct DEVICE* dev, uint32_t addr) {
+	return &adj_hash[((addr ^ (addr_t)dev) * 2654435761U) >> (32 - ADJ_HASH_BITS)];
+}
+
+/*
+ * This will build the Ethernet header of adjacency [adj] for hardware
+ * address [hw], and mark it as valid.
+ */
+static void
+adj_build (struct ADJACENCY* adj, uint8_t* hw) {
+	kmemcpy (adj->header.dest, hw, ETHER_ADDR_LEN);
+	kmemcpy (adj->header.source, adj->device->ether.hw_addr, ETHER_ADDR_LEN);
+	adj->header.type[0] = (ETHERTYPE_IP >> 8) & 0xff;
+	adj->header.type[1] = (ETHERTYPE_IP & 0xff);
+	adj->flags |= ADJ_FLAG_VALID;
+}
+
+/*
+ * This will return the adjacency for [addr] on device [dev], or NULL if there
+ * is none.
+ */
+struct ADJACENCY*
+adj_find (struct DEVICE* dev, uint32_t addr) {
+	struct ADJACENCY* adj = *adj_bucket (dev, addr);
+
+	/* walk the chain */
+	while (adj != NULL) {
+		/* match? */
+		if ((adj->address == addr) && (adj->device == dev))
+			/* yes. got it */
+			return adj;
+		adj = adj->next;
+	}
+
+	/* no such adjacency */
+	return NULL;
+}
+
+/*
+ * This will return a reference to the adjacency for [addr] on device [dev],
+ * creating it if needed. It will return NULL if the table is full.
+ */
+struct ADJACENCY*
+adj_get (struct DEVICE* dev, uint32_t addr) {
+	struct ADJACENCY** bucket;
+	struct ADJACENCY* adj = adj_find (dev, addr);
+	struct ARP_RECORD* arp;
+
+	/* already there? */
+	if (adj != NULL) {
+		/* yes. just reference it */
+		adj->refcount++;
+		return adj;
+	}
+
+	/* anything left? */
+	adj = adj_free;
+	if (adj == NULL)
+		/* no. out of entries! */
+		return NULL;
+	adj_free = adj->next;
+
+	/* set it up */
+	kmemset (adj, 0, sizeof (struct ADJACENCY));
+	adj->device = dev;
+	adj->address = addr;
+	adj->flags = ADJ_FLAG_INUSE;
+	adj->refcount = 1;
+
+	/* hook it in the hash */
+	bucket = adj_bucket (dev, addr);
+	adj->next = *bucket;
+	*bucket = adj;
+
+	/* if we already know the neighbour, we are complete */
+	arp = arp_lookup (addr, dev);
+	if ((arp != NULL) && !(arp->flags & ARP_FLAGS_INCOMPLETE))
+		adj_build (adj, arp->hw_addr);
+
+	return adj;
+}
+
+/*
+ * This will drop a reference to adjacency [adj], freeing it if it was the
+ * last one.
+ */
+void
+adj_put (struct ADJACENCY* adj) {
+	struct ADJACENCY** prev;
+
+	/* last reference? */
+	if (--adj->refcount > 0)
+		/* no. all done */
+		return;
+
+	/* find the pointer pointing to us */
+	prev = adj_bucket (adj->device, adj->address);
+	while (*prev != adj)
+		prev = &(*prev)->next;
+	*prev = adj->next;
+
+	/* zap it and hand it back */
+	kmemset (adj, 0, sizeof (struct ADJACENCY));
+	adj->next = adj_free;
+	adj_free = adj;
+}
+
+/*
+ * This will be called by ARP whenever it learns the hardware address of the
+ * neighbour of record [arp].
+ */
+void
+adj_update (struct ARP_RECORD* arp) {
+	struct ADJACENCY* adj;
+
+	/* the record's own adjacency, for directly connected traffic */
+	arp->adj.device = arp->device;
+	arp->adj.address = arp->address;
+	adj_build (&arp->adj, arp->hw_addr);
+
+	/* refresh the header of the adjacency routes use, if there is one */
+	adj = adj_find (arp->device, arp->address);
+	if (adj != NULL)
+		adj_build (adj, arp->hw_addr);
+}
+
+/*
+ * This will be called by ARP whenever it forgets about [addr] on device
+ * [dev].
+ */
+void
+adj_invalidate (struct DEVICE* dev, uint32_t addr) {
+	struct ADJACENCY* adj = adj_find (dev, addr);
+
+	/* got an adjacency? */
+	if (adj != NULL)
+		/* yes. it needs resolving again before use */
+		adj->flags &= ~ADJ_FLAG_VALID;
+}
+
+/*
+ * This will invalidate all adjacencies of device [dev].
+ */
+void
+adj_flush_device (struct DEVICE* dev) {
+	int i;
+
+	/* wade through the entire table */
+	for (i = 0; i < ADJ_MAX_ENTRIES; i++)
+		/* is it for this device? */
+		if ((adjacencies[i].flags & ADJ_FLAG_INUSE) &&
+				(adjacencies[i].device == dev))
+			/* yes. invalidate it */
+			adjacencies[i].flags &= ~ADJ_FLAG_VALID;
+}
+
+/*
+ * This will send packet [pkt] to the next hop of adjacency [adj], which must
+ * be valid.
+ */
+void
+adj_xmit (struct ADJACENCY* adj, struct NETPACKET* pkt) {
+	/* store the prebuilt header */
+	*(ETHERNET_HEADER*)pkt->frame = adj->header;
+	pkt->header_len = sizeof (ETHERNET_HEADER);
+
+	/* off it goes */
+	network_xmit_frame (adj->device, pkt);
+}
+
+/*
+ * This will initialize the adjacency table.
+ */
+void
+adj_init() {
+	int i;
+
+	/* allocate memory for the table and the hash */
+	adjacencies = (struct ADJACENCY*)kmalloc (NULL, sizeof (struct ADJACENCY) * ADJ_MAX_ENTRIES, 0);
+	adj_hash = (struct ADJACENCY**)kmalloc (NULL, sizeof (struct ADJACENCY*) * ADJ_HASH_SIZE, 0);
+
+	/* clear them, and put all entries on the free list */
+	kmemset (adjacencies, 0, sizeof (struct ADJACENCY) * ADJ_MAX_ENTRIES);
+	kmemset (adj_hash, 0, sizeof (struct ADJACENCY*) * ADJ_HASH_SIZE);
+	adj_free = NULL;
+	for (i = ADJ_MAX_ENTRIES - 1; i >= 0; i--) {
+		adjacencies[i].next = adj_free;
+		adj_free = &adjacencies[i];
+	}
+}
+
+/* vim:set ts=2 sw=2 tw=78: */
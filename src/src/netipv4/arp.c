@@ -8,17 +8,27 @@
 #include <sys/types.h>
 #include <sys/device.h>
 #include <sys/kmalloc.h>
+#include <sys/slab.h>
+#include <netipv4/adj.h>
 #include <netipv4/arp.h>
 #include <netipv4/ipv4.h>
 #include <netipv4/route.h>
 #include <lib/lib.h>
 
-struct ARP_RECORD* arp_cache;
+struct ARP_RECORD* arp_records = NULL;
+struct ARP_RECORD** arp_hash;
+struct KMEM_CACHE* arp_record_cache;
+int arp_num_records = 0;
+
+/* arp_learned are the complete records that age, arp_pending the incomplete ones */
+static struct ARP_QUEUE arp_learned = { NULL, NULL };
+static struct ARP_QUEUE arp_pending = { NULL, NULL };
 
 /*
  * This will send an ARP Request Packet for IP [addr]. If [fdev] is NULL, a
  * suitable device will be found to search for the address, otherwise [fdev]
- * will be used. It will return zero on failure or non-zero on success.
+ * will be used. When asking for one of our own addresses, the request
+ * doesn't claim it. It will return zero on failure or non-zero on success.
  */
 int
 arp_send_request (uint32_t addr, struct DEVICE* fdev) {
@@ -49,8 +59,9 @@ arp_send_request (uint32_t addr, struct DEVICE* fdev) {
 		/* yes. use this device */
 		dev = fdev;
 
-		/* no query address */
-		qaddr = 0;
+		/* ask from our address on that network, unless it's the one we ask for */
+		ia = route_find_ip (dev, addr);
+		qaddr = ((ia != NULL) && (ia->addr != addr)) ? ia->addr : 0;
 	}
 
 	/* got a network packet? */
@@ -225,17 +236,186 @@ arp_handle_packet (struct NETPACKET* np) {
 	return 0;
 }
 
+/*
+ * This will return the hash bucket for address [h].
+ */
+static struct ARP_RECORD**
+arp_bucket (uint32_t h) {
+	return &arp_hash[(h * 2654435761U) >> (32 - ARP_HASH_BITS)];
+}
+
 /*
  * This will initialize the ARP cache.
  *
  */
 void
 arp_init() {
-	/* allocate memory for the ARP cache */
-	arp_cache = (struct ARP_RECORD*)kmalloc (NULL, sizeof (struct ARP_RECORD) * ARP_CACHE_SIZE, 0);
+	/* create the record cache and the hash table */
+	arp_record_cache = kmem_cache_create ("arp", sizeof (struct ARP_RECORD), sizeof (uint32_t), NULL);
+	if (arp_record_cache == NULL)
+		panic ("arp_init(): cannot create the record cache");
+	arp_hash = (struct ARP_RECORD**)kmalloc (NULL, sizeof (struct ARP_RECORD*) * ARP_HASH_SIZE, 0);
+
+	/* clear the hash table */
+	kmemset (arp_hash, 0, sizeof (struct ARP_RECORD*) * ARP_HASH_SIZE);
+}
 
-	/* clear the cache */
-	kmemset (arp_cache, 0, sizeof (struct ARP_RECORD) * ARP_CACHE_SIZE);
+/*
+ * This will return the queue record [arp] belongs in by its flags, or NULL
+ * if it is permanent and never ages.
+ */
+static struct ARP_QUEUE*
+arp_queue_of (struct ARP_RECORD* arp) {
+	if (arp->flags & ARP_FLAGS_PERMANENT)
+		return NULL;
+	return (arp->flags & ARP_FLAGS_INCOMPLETE) ? &arp_pending : &arp_learned;
+}
+
+/*
+ * This will stamp record [arp] with the current time and put it at the end
+ * of its queue.
+ */
+static void
+arp_queue (struct ARP_RECORD* arp) {
+	struct ARP_QUEUE* q = arp_queue_of (arp);
+
+	arp->timestamp = ipv4_ticks;
+	if (q == NULL)
+		return;
+
+	arp->age_next = NULL;
+	arp->age_prev = q->last;
+	if (q->last != NULL)
+		q->last->age_next = arp;
+	else
+		q->first = arp;
+	q->last = arp;
+}
+
+/*
+ * This will take record [arp] off its queue. This must be done before its
+ * flags change.
+ */
+static void
+arp_unqueue (struct ARP_RECORD* arp) {
+	struct ARP_QUEUE* q = arp_queue_of (arp);
+
+	if (q == NULL)
+		return;
+
+	if (arp->age_prev != NULL)
+		arp->age_prev->age_next = arp->age_next;
+	else
+		q->first = arp->age_next;
+	if (arp->age_next != NULL)
+		arp->age_next->age_prev = arp->age_prev;
+	else
+		q->last = arp->age_prev;
+}
+
+/*
+ * This will unlink record [arp] from its hash chain and the record list, zap
+ * it and hand it back to the record cache.
+ */
+static void
+arp_zap (struct ARP_RECORD* arp) {
+	struct ARP_RECORD** prev = arp_bucket (arp->address);
+	struct NETPACKET* pkt;
+
+	/* find the pointer pointing to us */
+	while (*prev != arp)
+		prev = &(*prev)->next;
+	*prev = arp->next;
+
+	/* off the record list */
+	if (arp->list_prev != NULL)
+		arp->list_prev->list_next = arp->list_next;
+	else
+		arp_records = arp->list_next;
+	if (arp->list_next != NULL)
+		arp->list_next->list_prev = arp->list_prev;
+	arp_unqueue (arp);
+	arp_num_records--;
+
+	/* the next hop is gone */
+	adj_invalidate (arp->device, arp->address);
+
+	/* drop anything we were holding */
+	while (arp->hold_first != NULL) {
+		pkt = arp->hold_first;
+		arp->hold_first = pkt->next;
+		network_drop (pkt->device, NETWORK_DROP_NOARP);
+		network_free_packet (pkt);
+	}
+
+	/* back to the cache */
+	kmemset (arp, 0, sizeof (struct ARP_RECORD));
+	kmem_cache_free (arp_record_cache, arp);
+}
+
+/*
+ * This will throw out the oldest learned record, which is first in its
+ * queue, or failing that the oldest incomplete one. It will return zero if
+ * all records are permanent or non-zero on success.
+ */
+static int
+arp_evict() {
+	struct ARP_RECORD* arp = arp_learned.first;
+
+	/* got a record that isn't permanent? */
+	if (arp == NULL)
+		arp = arp_pending.first;
+	if (arp == NULL)
+		/* no. too bad */
+		return 0;
+
+	/* yes. get rid of it */
+	arp_zap (arp);
+	return 1;
+}
+
+/*
+ * This will return a fresh record for address [h] on device [dev], hooked in
+ * the hash and the record list; it is up to the caller to set the flags and
+ * queue it. If we're full, the oldest learned record is thrown out. It will
+ * return NULL if all records are permanent.
+ */
+static struct ARP_RECORD*
+arp_alloc_record (uint32_t h, struct DEVICE* dev) {
+	struct ARP_RECORD** bucket = arp_bucket (h);
+	struct ARP_RECORD* arp = NULL;
+
+	/* are we allowed to grow? */
+	if (arp_num_records < ARP_CACHE_SIZE)
+		/* yes. try to get a record */
+		arp = (struct ARP_RECORD*)kmem_cache_alloc (arp_record_cache);
+
+	/* got one? */
+	if (arp == NULL) {
+		/* no. make room and try again */
+		if (!arp_evict())
+			return NULL;
+		arp = (struct ARP_RECORD*)kmem_cache_alloc (arp_record_cache);
+		if (arp == NULL)
+			return NULL;
+	}
+
+	/* set it up */
+	arp->address = h;
+	arp->device = dev;
+
+	/* hook it in the hash */
+	arp->next = *bucket;
+	*bucket = arp;
+
+	/* and in the record list */
+	arp->list_prev = NULL;
+	arp->list_next = arp_records;
+	if (arp_records != NULL)
+		arp_records->list_prev = arp;
+	arp_records = arp;
+	arp_num_records++;
+	return arp;
 }
 
 /*
@@ -246,25 +426,28 @@ arp_init() {
  */
 int
 arp_add_record (uint32_t h, char* hw, struct DEVICE* dev, uint8_t fl) {
-	int i;
+	struct ARP_RECORD* arp = arp_lookup (h, dev);
 
-	/* wade through the entire ARP table */
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
-		/* available? */
-		if (arp_cache[i].device == NULL) {
-			/* yes. modify this record */
-			arp_cache[i].address = h;
-			arp_cache[i].flags = fl;
-			arp_cache[i].device = dev;
-			arp_cache[i].timestamp = 0; /* TODO */
-			kmemcpy (&arp_cache[i].hw_addr, hw, ETHER_ADDR_LEN);
-
-			/* all done */
-			return 1;
-		}
+	/* replace any record we already have */
+	if (arp != NULL)
+		arp_zap (arp);
 
-	/* out of entries! */
-	return 0;
+	/* got a record? */
+	arp = arp_alloc_record (h, dev);
+	if (arp == NULL)
+		/* no. out of entries! */
+		return 0;
+
+	/* set it up */
+	arp->flags = fl;
+	kmemcpy (&arp->hw_addr, hw, ETHER_ADDR_LEN);
+	arp_queue (arp);
+
+	/* tell the next hops */
+	adj_update (arp);
+
+	/* all done */
+	return 1;
 }
 
 /*
@@ -274,52 +457,98 @@ arp_add_record (uint32_t h, char* hw, struct DEVICE* dev, uint8_t fl) {
  */
 int
 arp_remove_record (uint32_t h, struct DEVICE* dev) {
-	int i;
+	struct ARP_RECORD* arp = arp_lookup (h, dev);
 
-	/* wade through the entire ARP table */
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
+	/* got it? */
+	if (arp == NULL)
+		/* no such entry */
+		return 0;
+
+	/* zap it */
+	arp_zap (arp);
+	return 1;
+}
+
+/*
+ * This will return the host entry for [h] on device [dev], or NULL if it
+ * doesn't exist. The entry may be incomplete.
+ */
+struct ARP_RECORD*
+arp_lookup (uint32_t h, struct DEVICE* dev) {
+	struct ARP_RECORD* arp = *arp_bucket (h);
+
+	/* walk the chain */
+	while (arp != NULL) {
 		/* match? */
-		if ((arp_cache[i].address == h) && (arp_cache[i].device == dev)) {
-			/* yes. zap it */
-			kmemset (&arp_cache[i], 0, sizeof (struct ARP_RECORD));
-			return 1;
-		}
+		if ((arp->address == h) && (arp->device == dev))
+			/* yes. got it */
+			return arp;
+		arp = arp->next;
+	}
 
 	/* no such entry */
-	return 0;
+	return NULL;
 }
 
 /*
- * This will return the host entry for [h], or NULL if is doesn't exist.
+ * This will return the complete host entry for [h] on any device, or NULL if
+ * is doesn't exist.
  */
 struct ARP_RECORD*
 arp_find_record (uint32_t h) {
-	int i;
+	struct ARP_RECORD* arp = *arp_bucket (h);
 
-	/* wade through the entire ARP table */
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
+	/* walk the chain */
+	while (arp != NULL) {
 		/* match? */
-		if (arp_cache[i].address == h)
+		if ((arp->address == h) && !(arp->flags & ARP_FLAGS_INCOMPLETE))
 			/* yes. got it */
-			return &arp_cache[i];
+			return arp;
+		arp = arp->next;
+	}
 
 	/* no such entry */
 	return NULL;
 }
 
 /*
- * This will update record [h] with hardware address [hw], or create it if
- * it doesn't exist. It will return zero on failure or non-zero on success.
+ * This will update record [h] on device [dev] with hardware address [hw], or
+ * create it if it doesn't exist. It will return zero on failure or non-zero
+ * on success.
  */
 int
 arp_update_record (uint32_t h, char* hw, struct DEVICE* dev) {
-	struct ARP_RECORD* arp = arp_find_record (h);
+	struct ARP_RECORD* arp = arp_lookup (h, dev);
+	struct NETPACKET* pkt;
 
 	/* does the record exist? */
 	if (arp != NULL) {
-		/* yes. update it */
+		/* yes. never touch our own addresses */
+		if (arp->flags & ARP_FLAGS_PERMANENT)
+			return 0;
+
+		/* update it; it goes to the back of the learned queue */
 		kmemcpy (arp->hw_addr, hw, ETHER_ADDR_LEN);
-		arp->device = dev;
+		arp_unqueue (arp);
+
+		/* were we waiting for this? */
+		if (arp->flags & ARP_FLAGS_INCOMPLETE) {
+			/* yes. we're complete now */
+			arp->flags &= ~ARP_FLAGS_INCOMPLETE;
+			arp->retries = 0;
+		}
+		arp_queue (arp);
+
+		/* tell the next hops */
+		adj_update (arp);
+
+		/* send everything we held back */
+		while (arp->hold_first != NULL) {
+			pkt = arp->hold_first;
+			arp->hold_first = pkt->next;
+			network_xmit_packet (dev, pkt, arp->hw_addr);
+		}
+		arp->hold_count = 0;
 	
 		/* all done */
 		return 1;
@@ -334,32 +563,149 @@ arp_update_record (uint32_t h, char* hw, struct DEVICE* dev) {
  */
 void
 arp_flush() {
-	int i;
+	struct ARP_RECORD* arp;
+	struct ARP_RECORD* next;
 
 	/* wade through the entire ARP table */
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
+	for (arp = arp_records; arp != NULL; arp = next) {
+		next = arp->list_next;
+
 		/* not permanent? */
-		if (!(arp_cache[i].flags & ARP_FLAGS_PERMANENT))
+		if (!(arp->flags & ARP_FLAGS_PERMANENT))
 			/* yes. zap it */
-			kmemset (&arp_cache[i], 0, sizeof (struct ARP_RECORD));
+			arp_zap (arp);
+	}
+}
+
+/*
+ * This will expire all learned records older than ARP_MAX_AGE seconds.
+ */
+void
+arp_age() {
+	uint32_t now = ipv4_ticks;
+	struct ARP_RECORD* arp;
+	struct ARP_RECORD* next;
+
+	/* the oldest records come first; stop at the first one young enough */
+	for (arp = arp_learned.first; (arp != NULL) && (now - arp->timestamp > ARP_MAX_AGE); arp = next) {
+		next = arp->age_next;
+		arp_zap (arp);
+	}
+}
+
+/*
+ * This will resend requests for all incomplete records which are due, and
+ * give up on records which ran out of retries.
+ */
+void
+arp_retry() {
+	uint32_t now = ipv4_ticks;
+	struct ARP_RECORD* arp;
+	struct ARP_RECORD* next;
+
+	/*
+	 * The records asked for longest ago come first; stop at the first one
+	 * that isn't due. Those we ask again go to the back of the queue.
+	 */
+	for (arp = arp_pending.first; (arp != NULL) && (now - arp->timestamp >= ARP_REQUEST_INTERVAL); arp = next) {
+		next = arp->age_next;
+
+		/* out of retries? */
+		if (arp->retries >= ARP_MAX_RETRIES) {
+			/* yes. give up, along with the packets */
+			arp_zap (arp);
+			continue;
+		}
+
+		/* ask again */
+		arp->retries++;
+		arp_unqueue (arp);
+		arp_queue (arp);
+		arp_send_request (arp->address, arp->device);
+	}
+}
+
+/*
+ * This will hold packet [pkt] until the hardware address of [addr] on device
+ * [dev] is known, querying for it if we're not doing so already. [pkt] may
+ * be NULL to only get the query going. The packet will always be taken
+ * over; it is freed if it cannot be held. This will return zero if the
+ * packet was dropped or non-zero if it was held or sent.
+ */
+int
+arp_hold (uint32_t addr, struct DEVICE* dev, struct NETPACKET* pkt) {
+	struct ARP_RECORD* arp = arp_lookup (addr, dev);
+	struct NETPACKET* old;
+
+	/* do we know about this address? */
+	if (arp == NULL) {
+		/* no. create an incomplete record */
+		arp = arp_alloc_record (addr, dev);
+		if (arp == NULL) {
+			/* out of records. drop the packet */
+			if (pkt != NULL) {
+				network_drop (pkt->device, NETWORK_DROP_NOARP);
+				network_free_packet (pkt);
+			}
+			return 0;
+		}
+		arp->flags = ARP_FLAGS_INCOMPLETE;
+		arp_queue (arp);
+
+		/* ask for it. any retries are up to arp_retry() */
+		arp_send_request (addr, dev);
+	} else if (!(arp->flags & ARP_FLAGS_INCOMPLETE)) {
+		/* we already know it. just send the packet */
+		if (pkt != NULL)
+			network_xmit_packet (dev, pkt, arp->hw_addr);
+		return 1;
+	}
+
+	/* anything to hold? */
+	if (pkt == NULL)
+		/* no. all done */
+		return 1;
+
+	/* queue full? */
+	if (arp->hold_count == ARP_HOLD_MAX) {
+		/* yes. make room by dropping the oldest packet */
+		old = arp->hold_first;
+		arp->hold_first = old->next;
+		network_drop (old->device, NETWORK_DROP_NOARP);
+		network_free_packet (old);
+		arp->hold_count--;
+	}
+
+	/* append the packet */
+	pkt->next = NULL;
+	if (arp->hold_first == NULL)
+		arp->hold_first = pkt;
+	else
+		arp->hold_last->next = pkt;
+	arp->hold_last = pkt;
+	arp->hold_count++;
+	return 1;
 }
 
 /*
  * This will return the hardware address for [addr]. If it does not
- * exist, an ARP query will be emitted and NULL will be returned. On
- * success, the address is returned.
+ * exist, an ARP query will be emitted (unless one is already pending) and
+ * NULL will be returned. On success, the address is returned.
  */
 struct ARP_RECORD*
 arp_fetch_address (uint32_t addr) {
 	struct ARP_RECORD* rec = arp_find_record (addr);
+	struct DEVICE* dev;
 
 	/* got a match? */
 	if (rec != NULL)
 		/* yes. return that */
 		return rec;
 
-	/* do an ARP query and fail */
-	arp_send_request (addr, NULL);
+	/* get an ARP query going and fail */
+	dev = route_find_device (addr);
+	if (dev != NULL)
+		arp_hold (addr, dev, NULL);
 	return NULL;
 }
 
@@ -368,14 +714,21 @@ arp_fetch_address (uint32_t addr) {
  */
 void
 arp_flush_device(struct DEVICE* dev) {
-	int i;
+	struct ARP_RECORD* arp;
+	struct ARP_RECORD* next;
 
 	/* wade through the entire ARP table */
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
+	for (arp = arp_records; arp != NULL; arp = next) {
+		next = arp->list_next;
+
 		/* is it for this device? */
-		if (arp_cache[i].device == dev)
+		if (arp->device == dev)
 			/* yes. zap it */
-			kmemset (&arp_cache[i], 0, sizeof (struct ARP_RECORD));
+			arp_zap (arp);
+	}
+
+	/* the next hops are gone as well */
+	adj_flush_device (dev);
 }
 
 /* vim:set ts=2 sw=2 tw=78: */
@@ -6,85 +6,396 @@
  *
  */
 #include <sys/types.h>
+#include <sys/network.h>
+#include <sys/dispatch.h>
+#include <lib/lib.h>
+#include <md/cpu.h>
+#include <md/interrupts.h>
 #include <netipv4/ipv4.h>
+#include <netipv4/ip.h>
+#include <netipv4/cksum.h>
 
-#if 0
 /*
- * ipv4_cksum (char* pkt, int size)
- *
- * This will calculate the IP header checksum of [pkt]
- *
- * From http://www.netfor2.com/ipsum.htm
- *
+ * All routines here work on partial sums: 32 bit one's complement sums of the
+ * data as it is in memory, with the carries added back in. Any number of them
+ * can be added up, and folding the total to 16 bits yields the checksum. As
+ * the byte order only swaps the halves of every 16 bit word, the result is in
+ * network order without further ado.
  */
-uint16_t
-ipv4_cksum (char* data, int len) {
-	uint8_t* b = (uint8_t*)data;
-	uint32_t sum = 0;
-	uint16_t i;
-	uint16_t word16;
-    
-	/* make 16 bit words out of every two adjacent 8 bit words in the packet
-	   and add them up */
-	for (i=0;i<len;i=i+2){
-		word16 =((b[i]<<8)&0xFF00)+(b[i+1]&0xFF);
-		sum = sum + (uint32_t) word16;	
-	}
-	
-	/* take only 16 bits out of the 32 bit sum and add up the carries */
-	while (sum>>16)
-	  sum = (sum & 0xFFFF)+(sum >> 16);
 
-	/* one's complement the result*/
-	sum = ~sum;
+/* CKSUM_SSE2_MIN is the length from which the SSE2 routines pay off */
+#define CKSUM_SSE2_MIN		128
+
+/* CKSUM_SSE2_BLOCK is the most the SSE2 routines add up before folding; the 8
+ * lanes of 32 bits receive a 16 bit word every 16 bytes, so they can't
+ * overflow */
+#define CKSUM_SSE2_BLOCK	32768
+
+static uint32_t cksum_partial_generic (const void* data, int len, uint32_t sum);
+static uint32_t cksum_copy_generic (void* dst, const void* src, int len, uint32_t sum);
 
-	/* swap em */
-	sum = ((sum & 0xff00) >> 8) | ((sum & 0xff) << 8);
+/* cksum_partial_fn and cksum_copy_fn are the routines in use */
+uint32_t (*cksum_partial_fn)(const void* data, int len, uint32_t sum) = cksum_partial_generic;
+uint32_t (*cksum_copy_fn)(void* dst, const void* src, int len, uint32_t sum) = cksum_copy_generic;
+
+/*
+ * This will return the one's complement sum of partial sums [a] and [b].
+ */
+static uint32_t
+cksum_add (uint32_t a, uint32_t b) {
+	a += b;
+	return a + (a < b);
+}
+
+/*
+ * This will add the [len] bytes, less than 32, at [p] to partial sum [sum].
+ */
+static uint32_t
+cksum_tail (const uint8_t* p, int len, uint32_t sum) {
+	for (; len >= 4; p += 4, len -= 4)
+		sum = cksum_add (sum, *(uint32_t*)p);
+	if (len >= 2) {
+		sum = cksum_add (sum, *(uint16_t*)p);
+		p += 2; len -= 2;
+	}
+	if (len)
+		/* the last byte is the high order byte of a word padded with zero */
+		sum = cksum_add (sum, *p);
 	return sum;
 }
-#else
+
 /*
- * ipv4_cksum (char* pkt, int size)
- *
- * This will calculate the IP header checksum of [pkt]
- *
- * From tcpdump
- *
+ * This will add [len] bytes of [data] to partial sum [sum], 32 bits at a time
+ * using the carry flag.
  */
-uint16_t
-ipv4_cksum (char* data, int len, int csum) {
-  int nleft = len;
-  const uint16_t *w = (uint16_t*)data;
-  uint16_t answer;
-	int sum = csum;
-
-	/*
-	 *  Our algorithm is simple, using a 32 bit accumulator (sum),
-	 *  we add sequential 16 bit words to it, and at the end, fold
- 	 *  back all the carry bits from the top 16 bits into the lower
-	 *  16 bits.
-	 */
-	while (nleft > 1)  {
-		sum += *w++;
-		nleft -= 2;
+static uint32_t
+cksum_partial_generic (const void* data, int len, uint32_t sum) {
+	const uint8_t* p = (const uint8_t*)data;
+	int n = len >> 5;
+
+	/* 32 bytes per round; lea and dec leave the carry alone */
+	if (n > 0)
+		__asm__ __volatile__ (
+			"clc\n"
+			"1:\n\t"
+			"adcl (%1), %0\n\t"
+			"adcl 4(%1), %0\n\t"
+			"adcl 8(%1), %0\n\t"
+			"adcl 12(%1), %0\n\t"
+			"adcl 16(%1), %0\n\t"
+			"adcl 20(%1), %0\n\t"
+			"adcl 24(%1), %0\n\t"
+			"adcl 28(%1), %0\n\t"
+			"leal 32(%1), %1\n\t"
+			"decl %2\n\t"
+			"jnz 1b\n\t"
+			"adcl $0, %0"
+			: "+r" (sum), "+r" (p), "+r" (n)
+			:
+			: "cc", "memory");
+
+	return cksum_tail (p, len & 31, sum);
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst], adding them to partial sum
+ * [sum] on the way.
+ */
+static uint32_t
+cksum_copy_generic (void* dst, const void* src, int len, uint32_t sum) {
+	const uint8_t* s = (const uint8_t*)src;
+	uint8_t* d = (uint8_t*)dst;
+	int n = len >> 4;
+
+	/* 16 bytes per round */
+	if (n > 0)
+		__asm__ __volatile__ (
+			"clc\n"
+			"1:\n\t"
+			"movl (%1), %%eax\n\t"
+			"movl 4(%1), %%edx\n\t"
+			"adcl %%eax, %0\n\t"
+			"movl %%eax, (%2)\n\t"
+			"adcl %%edx, %0\n\t"
+			"movl %%edx, 4(%2)\n\t"
+			"movl 8(%1), %%eax\n\t"
+			"movl 12(%1), %%edx\n\t"
+			"adcl %%eax, %0\n\t"
+			"movl %%eax, 8(%2)\n\t"
+			"adcl %%edx, %0\n\t"
+			"movl %%edx, 12(%2)\n\t"
+			"leal 16(%1), %1\n\t"
+			"leal 16(%2), %2\n\t"
+			"decl %3\n\t"
+			"jnz 1b\n\t"
+			"adcl $0, %0"
+			: "+r" (sum), "+r" (s), "+r" (d), "+r" (n)
+			:
+			: "eax", "edx", "cc", "memory");
+
+	/* the rest is copied and summed separately */
+	len &= 15;
+	kmemcpy (d, s, len);
+	return cksum_tail (s, len, sum);
+}
+
+/*
+ * This will add [len] bytes of [data] to partial sum [sum], 16 bytes at a
+ * time using SSE2. Every word is widened to 32 bits, so no carries get lost.
+ * Nothing saves the SSE registers, so interrupts are kept out.
+ */
+static uint32_t
+cksum_partial_sse2 (const void* data, int len, uint32_t sum) {
+	const uint8_t* p = (const uint8_t*)data;
+	uint32_t s;
+	int n, oldints;
+
+	if (len < CKSUM_SSE2_MIN)
+		return cksum_partial_generic (data, len, sum);
+
+	oldints = arch_interrupts (DISABLE);
+	while (len >= 16) {
+		n = ((len > CKSUM_SSE2_BLOCK) ? CKSUM_SSE2_BLOCK : len) >> 4;
+		len -= n << 4;
+		__asm__ __volatile__ (
+			"pxor %%xmm0, %%xmm0\n\t"
+			"pxor %%xmm1, %%xmm1\n\t"
+			"pxor %%xmm7, %%xmm7\n"
+			"1:\n\t"
+			"movdqu (%1), %%xmm2\n\t"
+			"movdqa %%xmm2, %%xmm3\n\t"
+			"punpcklwd %%xmm7, %%xmm2\n\t"
+			"punpckhwd %%xmm7, %%xmm3\n\t"
+			"paddd %%xmm2, %%xmm0\n\t"
+			"paddd %%xmm3, %%xmm1\n\t"
+			"addl $16, %1\n\t"
+			"decl %2\n\t"
+			"jnz 1b\n\t"
+			/* add the lanes together */
+			"paddd %%xmm1, %%xmm0\n\t"
+			"pshufd $0x4e, %%xmm0, %%xmm1\n\t"
+			"paddd %%xmm1, %%xmm0\n\t"
+			"pshufd $0xb1, %%xmm0, %%xmm1\n\t"
+			"paddd %%xmm1, %%xmm0\n\t"
+			"movd %%xmm0, %0"
+			: "=r" (s), "+r" (p), "+r" (n)
+			:
+			: "cc", "memory");
+		sum = cksum_add (sum, s);
 	}
+	arch_interrupts (oldints);
+
+	return cksum_partial_generic (p, len, sum);
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst], adding them to partial sum
+ * [sum] on the way, 16 bytes at a time using SSE2.
+ */
+static uint32_t
+cksum_copy_sse2 (void* dst, const void* src, int len, uint32_t sum) {
+	const uint8_t* s = (const uint8_t*)src;
+	uint8_t* d = (uint8_t*)dst;
+	uint32_t t;
+	int n, oldints;
+
+	if (len < CKSUM_SSE2_MIN)
+		return cksum_copy_generic (dst, src, len, sum);
+
+	oldints = arch_interrupts (DISABLE);
+	while (len >= 16) {
+		n = ((len > CKSUM_SSE2_BLOCK) ? CKSUM_SSE2_BLOCK : len) >> 4;
+		len -= n << 4;
+		__asm__ __volatile__ (
+			"pxor %%xmm0, %%xmm0\n\t"
+			"pxor %%xmm1, %%xmm1\n\t"
+			"pxor %%xmm7, %%xmm7\n"
+			"1:\n\t"
+			"movdqu (%1), %%xmm2\n\t"
+			"movdqu %%xmm2, (%2)\n\t"
+			"movdqa %%xmm2, %%xmm3\n\t"
+			"punpcklwd %%xmm7, %%xmm2\n\t"
+			"punpckhwd %%xmm7, %%xmm3\n\t"
+			"paddd %%xmm2, %%xmm0\n\t"
+			"paddd %%xmm3, %%xmm1\n\t"
+			"addl $16, %1\n\t"
+			"addl $16, %2\n\t"
+			"decl %3\n\t"
+			"jnz 1b\n\t"
+			/* add the lanes together */
+			"paddd %%xmm1, %%xmm0\n\t"
+			"pshufd $0x4e, %%xmm0, %%xmm1\n\t"
+			"paddd %%xmm1, %%xmm0\n\t"
+			"pshufd $0xb1, %%xmm0, %%xmm1\n\t"
+			"paddd %%xmm1, %%xmm0\n\t"
+			"movd %%xmm0, %0"
+			: "=r" (t), "+r" (s), "+r" (d), "+r" (n)
+			:
+			: "cc", "memory");
+		sum = cksum_add (sum, t);
+	}
+	arch_interrupts (oldints);
+
+	return cksum_copy_generic (d, s, len, sum);
+}
+
+/* cksum_partial_impl are the ipv4_cksum_partial() flavours */
+static struct DISPATCH_IMPL cksum_partial_impl[] = {
+	{ "generic", 0, cksum_partial_generic },
+	{ "sse2", CPU_FEATURE_SSE2, cksum_partial_sse2 },
+	{ NULL, 0, NULL }
+};
+
+/* cksum_copy_impl are the ipv4_cksum_copy() flavours */
+static struct DISPATCH_IMPL cksum_copy_impl[] = {
+	{ "generic", 0, cksum_copy_generic },
+	{ "sse2", CPU_FEATURE_SSE2, cksum_copy_sse2 },
+	{ NULL, 0, NULL }
+};
+
+/*
+ * This will run ipv4_cksum_partial() flavour [fn].
+ */
+static void
+cksum_run_partial (void* fn, void* dst, void* src, int len) {
+	((uint32_t (*)(const void*, int, uint32_t))fn) (src, len, 0);
+}
 
-	if (nleft == 1)
-		sum += ((
-		/*	((((*(uint8_t*)w & 0xff) << 8) |*/
-			(*(uint8_t*)w & 0xff)) << 8);
+/*
+ * This will run ipv4_cksum_copy() flavour [fn].
+ */
+static void
+cksum_run_copy (void* fn, void* dst, void* src, int len) {
+	((uint32_t (*)(void*, const void*, int, uint32_t))fn) (dst, src, len, 0);
+}
+
+/*
+ * This will pick the fastest checksum routines the processor can run.
+ */
+void
+ipv4_cksum_init() {
+	struct DISPATCH_IMPL* impl;
+
+	impl = dispatch_select ("checksum", cksum_partial_impl, cksum_run_partial);
+	cksum_partial_fn = impl->fn;
+	impl = dispatch_select ("checksum and copy", cksum_copy_impl, cksum_run_copy);
+	cksum_copy_fn = impl->fn;
+}
+
+/*
+ * This will add [len] bytes of [data] to partial sum [sum], and return the
+ * new partial sum.
+ */
+uint32_t
+ipv4_cksum_partial (const void* data, int len, uint32_t sum) {
+	return cksum_partial_fn (data, len, sum);
+}
+
+/*
+ * This will copy [len] bytes from [src] to [dst] and return partial sum [sum]
+ * with the bytes added. This costs hardly more than the copy alone.
+ */
+uint32_t
+ipv4_cksum_copy (void* dst, const void* src, int len, uint32_t sum) {
+	return cksum_copy_fn (dst, src, len, sum);
+}
+
+/*
+ * This will return partial sum [sum] with partial sum [sum2] of the data
+ * starting [offset] bytes further added. If the offset is odd, the bytes of
+ * [sum2] are on the wrong side of their words and need to be swapped.
+ */
+uint32_t
+ipv4_cksum_combine (uint32_t sum, uint32_t sum2, int offset) {
+	if (offset & 1)
+		sum2 = (sum2 >> 8) | (sum2 << 24);
+	return cksum_add (sum, sum2);
+}
+
+/*
+ * This will fold partial sum [sum] into 16 bits.
+ */
+uint16_t
+ipv4_cksum_fold (uint32_t sum) {
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return (uint16_t)sum;
+}
 
-	/*
-	 * add back carry outs from top 16 bits to low 16 bits
-	 *
-	 */
-	sum = (sum >> 16) + (sum & 0xffff);     /* add hi 16 to low 16 */
-	sum += (sum >> 16);                     /* add carry */
-	answer = ~sum;                          /* truncate to 16 bits */
+/*
+ * This will return the partial sum of the pseudo header TCP and UDP checksums
+ * cover, for [len] bytes of protocol [proto] from [source] to [dest]. The
+ * addresses must be in network byte order.
+ */
+uint32_t
+ipv4_cksum_pseudo (uint32_t source, uint32_t dest, uint8_t proto, uint16_t len) {
+	return cksum_add (cksum_add (source, dest), (proto << 8) + htons (len));
+}
+
+/*
+ * This will calculate the checksum of [len] bytes of [data], starting with
+ * partial sum [csum]. The result is in network byte order.
+ */
+uint16_t
+ipv4_cksum (char* data, int len, uint32_t csum) {
+	return ~ipv4_cksum_fold (ipv4_cksum_partial (data, len, csum));
+}
+
+/*
+ * This will calculate the checksum of the [len] bytes of protocol [proto]
+ * following the IP header of received packet [np], including the pseudo
+ * header. If the checksum field was filled out correctly, this yields zero.
+ * Whatever the driver summed while copying the frame is used if it covers
+ * exactly the IP packet.
+ */
+uint16_t
+ipv4_cksum_transport (struct NETPACKET* np, uint8_t proto, uint16_t len) {
+	struct IP_HEADER* iphdr = (struct IP_HEADER*)np->data;
+	int hlen = (iphdr->version_ihl & 0x0f) * 4;
+	uint32_t sum;
+
+	if (np->cksum_len == hlen + len)
+		/* take the IP header out of what the driver did */
+		sum = cksum_add (np->cksum, ~ipv4_cksum_partial (iphdr, hlen, 0));
+	else
+		sum = ipv4_cksum_partial (np->data + hlen, len, 0);
+
+	sum = cksum_add (sum, ipv4_cksum_pseudo (*(uint32_t*)iphdr->source, *(uint32_t*)iphdr->dest, proto, len));
+	return ~ipv4_cksum_fold (sum);
+}
+
+/*
+ * This will return checksum [cksum] adjusted for a 16 bit field which changed
+ * from [old] to [new], as per RFC 1624. All values must be in the byte order
+ * in which they appear in the packet.
+ */
+uint16_t
+ipv4_cksum_adjust16 (uint16_t cksum, uint16_t old, uint16_t new) {
+	uint32_t sum;
+
+	/* HC' = ~(~HC + ~m + m') */
+	sum = (uint16_t)~cksum + (uint16_t)~old + new;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return ~sum;
+}
+
+/*
+ * This will return checksum [cksum] adjusted for a 32 bit field which changed
+ * from [old] to [new], as per RFC 1624. All values must be in the byte order
+ * in which they appear in the packet.
+ */
+uint16_t
+ipv4_cksum_adjust32 (uint16_t cksum, uint32_t old, uint32_t new) {
+	uint32_t sum;
 
-	return answer;
+	/* like the 16 bit version, but for both halves at once */
+	sum = (uint16_t)~cksum + (uint16_t)~old + (uint16_t)~(old >> 16) +
+	      (new & 0xffff) + (new >> 16);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return ~sum;
 }
-#endif
 
 /*
  *	This is a version of ip_compute_csum() optimized for IP headers,
@@ -22,7 +22,7 @@ icmp_handle_echorequest (struct NETPACKET* np) {
 	struct ICMP_HEADER* ihdr = (struct ICMP_HEADER*)(np->data + sizeof (struct IP_HEADER));
 	struct IP_HEADER* iphdr = (struct IP_HEADER*)(np->data);
 	uint32_t src, dst;
-	uint16_t c;
+	uint16_t old;
 
 #if 0
 	/* are we bound to this address? */
@@ -37,18 +37,13 @@ icmp_handle_echorequest (struct NETPACKET* np) {
 	*(uint32_t*)iphdr->source = dst;
 	*(uint32_t*)iphdr->dest = src;
 
-	/* update the ICMP header */
-	ihdr->type = ICMP_TYPE_ECHORESPONSE;
-
 	/*
-	 * update the ICMP checksum
-	 *
-	 * XXX: since the only real difference is a change from 0 to 8 (ICMP type)
-	 * this could be done much faster ...
+	 * update the ICMP header. the swapped addresses don't affect any checksum,
+	 * so all that needs patching up is the ICMP type.
 	 */
-	ihdr->cksum = 0;
-	c = ipv4_cksum ((char*)ihdr, np->len - sizeof (struct ICMP_HEADER), 0);
-	ihdr->cksum = c;
+	old = *(uint16_t*)&ihdr->type;
+	ihdr->type = ICMP_TYPE_ECHORESPONSE;
+	ihdr->cksum = ipv4_cksum_adjust16 (ihdr->cksum, old, *(uint16_t*)&ihdr->type);
 
 	/* go */
 	network_xmit_packet (np->device, np, (char*)((ETHERNET_HEADER*)np->frame)->source);
@@ -87,6 +82,7 @@ icmp_handle_packet (struct NETPACKET* np) {
 #endif
 
 	/* unknown/unsupported type. discard it (XXX) */
+	network_drop (np->device, NETWORK_DROP_PROTO);
 	return 0;
 }
 
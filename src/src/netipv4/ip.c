@@ -7,8 +7,11 @@
  */
 #include <sys/types.h>
 #include <sys/device.h>
+#include <sys/prof.h>
 #include <lib/lib.h>
 #include <md/timer.h>
+#include <netipv4/acl.h>
+#include <netipv4/adj.h>
 #include <netipv4/arp.h>
 #include <netipv4/cksum.h>
 #include <netipv4/ip.h>
@@ -17,22 +20,93 @@
 #include <netipv4/tcp.h>
 #include <netipv4/udp.h>
 
+/*
+ * This will return the device through which [dest] can be reached, and store
+ * the address of the next hop in [nexthop]. It will return NULL if there is
+ * no route.
+ */
+struct DEVICE*
+ip_nexthop (uint32_t dest, uint32_t* nexthop) {
+	struct ROUTE_ENTRY* re;
+
+	PROF (PROF_ROUTE, re = route_lookup (dest));
+
+	/* got a route? */
+	if (re == NULL)
+		/* no. too bad */
+		return NULL;
+
+	/* through a next hop? */
+	if (re->adj != NULL) {
+		/* yes. use that */
+		*nexthop = re->adj->address;
+		return re->adj->device;
+	}
+
+	/* directly connected */
+	*nexthop = dest;
+	return re->device;
+}
+
+/*
+ * This will return the resolved adjacency through which [dest] can be
+ * reached. If there is none, NULL is returned and packet [pkt] is taken
+ * over: it is held until ARP resolves the next hop, or freed if there is no
+ * route. [pkt] may be NULL, in which case only the resolution is started.
+ */
+struct ADJACENCY*
+ip_resolve (uint32_t dest, struct NETPACKET* pkt) {
+	struct ROUTE_ENTRY* re;
+	struct ARP_RECORD* arp;
+	struct DEVICE* dev;
+	uint32_t nexthop;
+
+	PROF (PROF_ROUTE, re = route_lookup (dest));
+
+	/* do we have a route at all? */
+	if (re == NULL) {
+		/* no. drop the packet */
+		if (pkt != NULL) {
+			network_drop (pkt->device, NETWORK_DROP_NOROUTE);
+			network_free_packet (pkt);
+		}
+		return NULL;
+	}
+
+	/* through a next hop? */
+	if (re->adj != NULL) {
+		/* yes. resolved? */
+		if (re->adj->flags & ADJ_FLAG_VALID)
+			/* yes. that was easy */
+			return re->adj;
+		dev = re->adj->device;
+		nexthop = re->adj->address;
+	} else {
+		/* no. directly connected; is the neighbour known? */
+		PROF (PROF_ARP, arp = arp_lookup (dest, re->device));
+		if ((arp != NULL) && (arp->adj.flags & ADJ_FLAG_VALID))
+			/* yes. use its adjacency */
+			return &arp->adj;
+		dev = re->device;
+		nexthop = dest;
+	}
+
+	/* have ARP go find the next hop */
+	PROF (PROF_ARP, arp_hold (nexthop, dev, pkt));
+	return NULL;
+}
+
 /*
  * This will route IP packet [np] as needed.
  */
 int
 ip_route (struct NETPACKET* np) {
-	struct DEVICE* dev;
 	struct IP_HEADER* iphdr = (struct IP_HEADER*)(np->data);
-	struct ARP_RECORD* arp;
-	uint32_t dest = ipv4_conv_addr (iphdr->dest);
-	uint32_t chk;
-
-	/* look up the destination */
-	dev = route_find_device (dest);
-	if (dev == NULL)
-		/* this failed. (XXX: send ICMP message?) */
-		return 0;
+	struct ADJACENCY* adj;
+	struct DEVICE* dev;
+	uint32_t nexthop;
+	uint16_t old;
+	int ok;
 
 #if 0
 	/* broadcast? */
@@ -41,27 +115,48 @@ ip_route (struct NETPACKET* np) {
 		return 0;
 #endif
 
-	/* fetch the hardware address */
-	arp = arp_fetch_address (dest);
-	if (arp == NULL)
-		/* this failed. drop the packet (XXX) */
+	/* may it come in here? */
+	PROF (PROF_ACL, ok = acl_filter (np, np->device, ACL_DIR_IN));
+	if (!ok) {
+		/* no. drop it */
+		network_drop (np->device, NETWORK_DROP_FILTER);
 		return 0;
+	}
 
-	/* decrement the TTL */
-	iphdr->ttl--;
-
-	/* TTL of zero or one ? */
-	if ((iphdr->ttl == 0) || (iphdr->ttl == 1))
+	/* would the TTL expire here? */
+	if (iphdr->ttl <= 1) {
 		/* yes. drop the packet (XXX: send ICMP message) */
+		network_drop (np->device, NETWORK_DROP_TTL);
 		return 0;
+	}
+
+	/* any rules at all? */
+	if (acl_policy != NULL) {
+		/* yes. may it go out where it's headed? */
+		dev = ip_nexthop (ipv4_conv_addr (iphdr->dest), &nexthop);
+		if (dev != NULL) {
+			PROF (PROF_ACL, ok = acl_filter (np, dev, ACL_DIR_OUT));
+			if (!ok) {
+				/* no. drop it */
+				network_drop (np->device, NETWORK_DROP_FILTER);
+				return 0;
+			}
+		}
+	}
+
+	/* decrement the TTL and patch up the checksum */
+	old = *(uint16_t*)&iphdr->ttl;
+	iphdr->ttl--;
+	iphdr->cksum = ipv4_cksum_adjust16 (iphdr->cksum, old, *(uint16_t*)&iphdr->ttl);
 
-	/* update the checksum */
-	iphdr->cksum = 0; chk = ipv4_cksum ((char*)iphdr, ((iphdr->version_ihl) &
-0x0f) * 4, 0);
-	iphdr->cksum = chk;
+	/* look up the next hop */
+	adj = ip_resolve (ipv4_conv_addr (iphdr->dest), np);
+	if (adj == NULL)
+		/* not there (yet). the packet was held or dropped for us */
+		return 1;
 
 	/* got it! send it out */
-	network_xmit_packet (dev, np, arp->hw_addr);
+	adj_xmit (adj, np);
 
 	/* don't drop the packet! */
 	return 1;
@@ -86,6 +181,7 @@ ip_handle_incoming (struct NETPACKET* np) {
 		return udp_handle_packet (np);
 
 	/* we discard incoming packets */
+	network_drop (np->device, NETWORK_DROP_PROTO);
 	return 0;
 }
 
@@ -100,26 +196,21 @@ ip_build_packet (uint8_t proto, uint32_t dest, uint16_t pktlen, uint8_t* data) {
 	struct IP_HEADER* iphdr;
 	uint16_t cksum;
 	struct IPV4_ADDR* addr;
-	struct ARP_RECORD* ar;
-	struct DEVICE* dev = route_find_device (dest);
+	struct DEVICE* dev;
+	uint32_t nexthop;
 
-	/* do we have a device to route ? */
+	/* can we reach the destination? */
+	dev = ip_nexthop (dest, &nexthop);
 	if (dev == NULL)
 		/* no. drop the packet */
 		return 0;
 
-	/* fetch the IP address from which we can reach this address */
-	addr = route_find_ip (dev, dest);
+	/* fetch the IP address from which we can reach the next hop */
+	addr = route_find_ip (dev, nexthop);
 	if (addr == NULL)
 		/* this failed. drop the packet */
 		return 0;
 
-	/* fetch the address of the destination */
-	ar = arp_fetch_address (dest);
-	if (ar == NULL)
-		/* it's not yet in the cache. bail out */
-		return 0;
-
 	/* allocate a network packet */
 	pkt = network_alloc_packet (dev);
 	if (pkt == NULL)
@@ -165,22 +256,15 @@ ip_build_packet (uint8_t proto, uint32_t dest, uint16_t pktlen, uint8_t* data) {
  */
 int
 ip_transmit (uint32_t dest, struct NETPACKET* pkt) {
-	struct ARP_RECORD* ar;
-	struct DEVICE* dev = route_find_device (dest);
+	struct ADJACENCY* adj = ip_resolve (dest, pkt);
 
-	/* do we have a device to route ? */
-	if (dev == NULL)
-		/* no. drop the packet */
-		return 0;
-
-	/* fetch the address of the destination */
-	ar = arp_fetch_address (dest);
-	if (ar == NULL)
-		/* it's not yet in the cache. bail out */
+	/* can we reach the destination right now? */
+	if (adj == NULL)
+		/* no. the packet was held or dropped */
 		return 0;
 
 	/* send the packet */
-	network_xmit_packet (dev, pkt, ar->hw_addr);
+	adj_xmit (adj, pkt);
 
 	/* victory */
 	return 1;
@@ -215,14 +299,18 @@ ip_handle_packet (struct NETPACKET* np) {
 	struct IP_HEADER* iphdr = (struct IP_HEADER*)(np->data);
 
 	/* IPv4 thing? */
-	if ((iphdr->version_ihl >> 4) != 4)
+	if ((iphdr->version_ihl >> 4) != 4) {
 		/* no. not our cup of tea */
+		network_drop (np->device, NETWORK_DROP_HEADER);
 		return 0;
+	}
 
 	/* do we have a valid header? */
-	if (ip_fast_csum (np->data, iphdr->version_ihl & 0x0f) != 0)
-		/* no. silently drop it */
+	if (ip_fast_csum (np->data, iphdr->version_ihl & 0x0f) != 0) {
+		/* no. drop it */
+		network_drop (np->device, NETWORK_DROP_CKSUM);
 		return 0;
+	}
 
 	/* ICMP thing? */
 	if (iphdr->proto == IP_PROTO_ICMP)
@@ -235,9 +323,11 @@ ip_handle_packet (struct NETPACKET* np) {
 		return ip_handle_incoming (np);
 
 	/* need to route the packet? */
-	if (!ipv4_routing)
+	if (!ipv4_routing) {
 		/* no. drop it */
+		network_drop (np->device, NETWORK_DROP_NOTLOCAL);
 		return 0;
+	}
 
 	/* route the packet */
 	return ip_route (np);
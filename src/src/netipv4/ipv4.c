@@ -7,8 +7,11 @@
  */
 #include <sys/types.h>
 #include <sys/device.h>
+#include <sys/prof.h>
 #include <net/socket.h>
+#include <netipv4/adj.h>
 #include <netipv4/arp.h>
+#include <netipv4/cksum.h>
 #include <netipv4/ipv4.h>
 #include <netipv4/ip.h>
 #include <netipv4/icmp.h>
@@ -17,6 +20,13 @@
 
 int ipv4_routing = 0;
 
+/* ipv4_ticks is bumped by the timer, ipv4_ticks_done by ipv4_timers() */
+volatile uint32_t ipv4_ticks = 0;
+uint32_t ipv4_ticks_done = 0;
+
+/* ipv4_next_age is the tick at which the ARP cache is aged next */
+uint32_t ipv4_next_age = ARP_AGE_INTERVAL;
+
 /*
  * This will handle IPv4 packet [np]. It will return
  * zero on failure or non-zero on success.
@@ -26,16 +36,20 @@ int
 ipv4_handle_packet (struct NETPACKET* np) {
 	ETHERNET_HEADER* eh = (ETHERNET_HEADER*)np->frame;
 	uint16_t type = (eh->type[0] << 8) | eh->type[1];
+	int handled;
 
 	/* figure out the packet type */
 	switch (type) {
 		case ETHERTYPE_IP: /* IP packet */
-		                   return ip_handle_packet (np);
+		                   PROF (PROF_IP_HANDLE, handled = ip_handle_packet (np));
+		                   return handled;
 	 case ETHERTYPE_ARP: /* ARP packet */
-		                   return arp_handle_packet (np);
+		                   PROF (PROF_ARP, handled = arp_handle_packet (np));
+		                   return handled;
 	}
 
 	/* what's this? */
+	network_drop (np->device, NETWORK_DROP_PROTO);
 	return 0;
 }
 
@@ -180,10 +194,34 @@ ipv4_purge_device (struct DEVICE* dev) {
 }
 
 /*
- * This will be called periodically to sync IPv4.
+ * This will be called every second from the timer interrupt to sync IPv4.
+ * The actual work is left to ipv4_timers(), outside interrupt context.
  */
 void
 ipv4_tick() {
+	ipv4_ticks++;
+}
+
+/*
+ * This will be called from the main loop, and handle any pending periodic
+ * work.
+ */
+void
+ipv4_timers() {
+	/* did we tick since the last time? */
+	if (ipv4_ticks == ipv4_ticks_done)
+		/* no. nothing to do */
+		return;
+	ipv4_ticks_done = ipv4_ticks;
+
+	/* retry pending ARP queries */
+	arp_retry();
+
+	/* expire old neighbours every now and then; we may skip ticks */
+	if (ipv4_ticks_done >= ipv4_next_age) {
+		ipv4_next_age = ipv4_ticks_done + ARP_AGE_INTERVAL;
+		arp_age();
+	}
 }
 
 /*
@@ -220,8 +258,10 @@ ipv4_set_routing (int val) {
  */
 void
 ipv4_init() {
+	ipv4_cksum_init();
 	socket_init();
 	arp_init();
+	adj_init();
 	route_init();
 }
 
@@ -5,16 +5,357 @@
  *
  * This will handle routing.
  *
+ * Lookups are done using a multibit trie with a fixed stride of ROUTE_STRIDE
+ * bits; prefixes which do not end on a stride boundary are expanded over all
+ * slots they cover, and pushed down to the nodes below them. This bounds a
+ * lookup to 32 / ROUTE_STRIDE node accesses, independent of the number of
+ * routes. The routes list is kept as the authoritative list of routes; the
+ * trie only points into it.
+ *
  */
 #include <sys/types.h>
 #include <sys/device.h>
 #include <sys/network.h>
 #include <sys/kmalloc.h>
+#include <sys/prof.h>
+#include <sys/slab.h>
 #include <lib/lib.h>
+#include <md/timer.h>
+#include <netipv4/adj.h>
 #include <netipv4/ipv4.h>
 #include <netipv4/route.h>
 
-struct ROUTE_ENTRY* routes;
+struct ROUTE_ENTRY* routes = NULL;
+struct ROUTE_FIB route_fib;
+struct KMEM_CACHE* route_cache;
+
+/*
+ * This will return [node] to the free list of [fib].
+ */
+static void
+route_fib_free_node (struct ROUTE_FIB* fib, struct ROUTE_NODE* node) {
+	node->slot[0] = (addr_t)fib->free_node;
+	fib->free_node = node;
+	fib->num_nodes--;
+}
+
+/*
+ * This will hand out a fresh node of [fib], with every slot set to [fill].
+ * It will return NULL if we're out of memory.
+ */
+static struct ROUTE_NODE*
+route_fib_alloc_node (struct ROUTE_FIB* fib, addr_t fill) {
+	struct ROUTE_BATCH* batch;
+	struct ROUTE_NODE* node;
+	int i;
+
+	/* anything left? */
+	if (fib->free_node == NULL) {
+		/* no. get a new batch */
+		batch = (struct ROUTE_BATCH*)kmalloc (NULL, sizeof (struct ROUTE_BATCH), 0);
+		if (batch == NULL)
+			/* out of memory. too bad */
+			return NULL;
+		batch->next = fib->batch;
+		fib->batch = batch;
+		fib->max_nodes += ROUTE_BATCH_NODES;
+
+		/* put all its nodes on the free list */
+		fib->num_nodes += ROUTE_BATCH_NODES;
+		for (i = ROUTE_BATCH_NODES - 1; i >= 0; i--)
+			route_fib_free_node (fib, &batch->node[i]);
+	}
+
+	/* unlink it and fill it */
+	node = fib->free_node;
+	fib->free_node = (struct ROUTE_NODE*)node->slot[0];
+	for (i = 0; i < ROUTE_NODE_SLOTS; i++)
+		node->slot[i] = fill;
+	fib->num_nodes++;
+	return node;
+}
+
+/*
+ * This will return non-zero if all slots of [node] hold the same route, so
+ * that the node tells nothing apart.
+ */
+static int
+route_fib_node_uniform (struct ROUTE_NODE* node) {
+	int i;
+
+	if (ROUTE_SLOT_IS_CHILD (node->slot[0]))
+		return 0;
+	for (i = 1; i < ROUTE_NODE_SLOTS; i++)
+		if (node->slot[i] != node->slot[0])
+			return 0;
+
+	return 1;
+}
+
+/*
+ * This will hand the [count] slots of [node] from [first] on, and those of
+ * the nodes below them, to route [re] of length [len], unless they hold a
+ * more specific route.
+ */
+static void
+route_fib_fill (struct ROUTE_NODE* node, int first, int count, struct ROUTE_ENTRY* re, int len) {
+	struct ROUTE_ENTRY* r;
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		/* a child? */
+		if (ROUTE_SLOT_IS_CHILD (node->slot[i])) {
+			/* yes. all of it is covered */
+			route_fib_fill (ROUTE_SLOT_NODE (node->slot[i]), 0, ROUTE_NODE_SLOTS, re, len);
+			continue;
+		}
+
+		/* not overriding a more specific prefix? */
+		r = ROUTE_SLOT_ROUTE (node->slot[i]);
+		if ((r == NULL) || (r->prefixlen <= len))
+			/* yes. take the slot */
+			node->slot[i] = (addr_t)re;
+	}
+}
+
+/*
+ * This will hand the [count] slots of [node] from [first] on, and those of
+ * the nodes below them, that hold route [re] to route [cover].
+ */
+static void
+route_fib_replace (struct ROUTE_NODE* node, int first, int count, struct ROUTE_ENTRY* re, struct ROUTE_ENTRY* cover) {
+	int i;
+
+	for (i = first; i < first + count; i++)
+		if (ROUTE_SLOT_IS_CHILD (node->slot[i]))
+			route_fib_replace (ROUTE_SLOT_NODE (node->slot[i]), 0, ROUTE_NODE_SLOTS, re, cover);
+		else if (ROUTE_SLOT_ROUTE (node->slot[i]) == re)
+			node->slot[i] = (addr_t)cover;
+}
+
+/*
+ * This will initialize FIB [fib], which will be empty. It will return zero
+ * on failure (out of memory) or non-zero on success.
+ */
+int
+route_fib_init (struct ROUTE_FIB* fib) {
+	kmemset (fib, 0, sizeof (struct ROUTE_FIB));
+	fib->root = route_fib_alloc_node (fib, 0);
+	return (fib->root != NULL);
+}
+
+/*
+ * This will free all nodes of FIB [fib]. The routes it points to are left
+ * alone.
+ */
+void
+route_fib_destroy (struct ROUTE_FIB* fib) {
+	struct ROUTE_BATCH* batch;
+
+	while (fib->batch != NULL) {
+		batch = fib->batch;
+		fib->batch = batch->next;
+		kfree (batch);
+	}
+	kmemset (fib, 0, sizeof (struct ROUTE_FIB));
+}
+
+/*
+ * This will insert route [re] for [network] / [len] in [fib]; [len] must be
+ * the prefix length of [re]. It will return zero on failure (out of memory)
+ * or non-zero on success.
+ */
+int
+route_fib_insert (struct ROUTE_FIB* fib, uint32_t network, int len, struct ROUTE_ENTRY* re) {
+	struct ROUTE_NODE* node = fib->root;
+	struct ROUTE_NODE* child;
+	int shift = 32 - ROUTE_STRIDE;
+	int i, count;
+
+	/* default route? */
+	if (len == 0) {
+		/* yes. this lives outside the trie */
+		fib->default_route = re;
+		return 1;
+	}
+
+	/* walk down to the node in which this prefix ends */
+	while (len > 32 - shift) {
+		i = (network >> shift) & (ROUTE_NODE_SLOTS - 1);
+		if (!ROUTE_SLOT_IS_CHILD (node->slot[i])) {
+			/* need a new node; it inherits the route of the slot */
+			child = route_fib_alloc_node (fib, node->slot[i]);
+			if (child == NULL)
+				/* no more nodes. too bad */
+				return 0;
+			node->slot[i] = (addr_t)child | ROUTE_SLOT_CHILD;
+		}
+		node = ROUTE_SLOT_NODE (node->slot[i]);
+		shift -= ROUTE_STRIDE;
+	}
+
+	/* expand the prefix over all slots it covers, and push it below them */
+	count = 1 << (32 - shift - len);
+	route_fib_fill (node, (network >> shift) & (ROUTE_NODE_SLOTS - 1) & ~(count - 1), count, re, len);
+
+	/* all done */
+	return 1;
+}
+
+/*
+ * This will remove route [re] for [network] / [len] from [fib]. Slots which
+ * were taken by [re] will be handed to [cover] with length [coverlen], which
+ * must be the most specific remaining route covering [network] / [len] (or
+ * NULL if there is none). Nodes which no longer tell their slots apart are
+ * reclaimed.
+ */
+void
+route_fib_delete (struct ROUTE_FIB* fib, uint32_t network, int len, struct ROUTE_ENTRY* re, struct ROUTE_ENTRY* cover, int coverlen) {
+	struct ROUTE_NODE* path[32 / ROUTE_STRIDE];
+	struct ROUTE_NODE* node = fib->root;
+	int shift = 32 - ROUTE_STRIDE;
+	int level = 0;
+	int i, count;
+
+	/* default route? */
+	if (len == 0) {
+		/* yes. only another default route can replace it */
+		if (fib->default_route == re)
+			fib->default_route = (coverlen == 0) ? cover : NULL;
+		return;
+	}
+
+	/* a default route covering us is found by the lookup itself */
+	if (coverlen == 0)
+		cover = NULL;
+
+	/* walk down to the node in which this prefix ends */
+	while (len > 32 - shift) {
+		i = (network >> shift) & (ROUTE_NODE_SLOTS - 1);
+		if (!ROUTE_SLOT_IS_CHILD (node->slot[i]))
+			/* not there. only prune what a failed insert left behind */
+			break;
+		path[level++] = node;
+		node = ROUTE_SLOT_NODE (node->slot[i]);
+		shift -= ROUTE_STRIDE;
+	}
+
+	/* did we reach the node? */
+	if (len <= 32 - shift) {
+		/* yes. give all slots we own, here and below, to the cover */
+		count = 1 << (32 - shift - len);
+		route_fib_replace (node, (network >> shift) & (ROUTE_NODE_SLOTS - 1) & ~(count - 1), count, re, cover);
+	}
+
+	/* fold nodes that tell nothing apart back into their parent, bottom-up */
+	while ((level > 0) && route_fib_node_uniform (node)) {
+		shift += ROUTE_STRIDE;
+		path[--level]->slot[(network >> shift) & (ROUTE_NODE_SLOTS - 1)] = node->slot[0];
+		route_fib_free_node (fib, node);
+		node = path[level];
+	}
+}
+
+/*
+ * This will look up the most specific route to [dest] in [fib]. It will
+ * return NULL if there is no route.
+ */
+struct ROUTE_ENTRY*
+route_fib_lookup (struct ROUTE_FIB* fib, uint32_t dest) {
+	struct ROUTE_NODE* node = fib->root;
+	int shift = 32 - ROUTE_STRIDE;
+	addr_t s;
+
+	/* follow the children down to the slot of the route */
+	while (ROUTE_SLOT_IS_CHILD (s = node->slot[(dest >> shift) & (ROUTE_NODE_SLOTS - 1)])) {
+		node = ROUTE_SLOT_NODE (s);
+		shift -= ROUTE_STRIDE;
+	}
+
+	/* nothing more specific than the default route? */
+	return (s != 0) ? ROUTE_SLOT_ROUTE (s) : fib->default_route;
+}
+
+/*
+ * This will return the prefix length of [mask], or -1 if [mask] is not
+ * contiguous.
+ */
+static int
+route_masklen (uint32_t mask) {
+	int len = 0;
+
+	while ((len < 32) && (mask & (0x80000000 >> len)))
+		len++;
+
+	/* any bits left after the prefix? */
+	if ((len < 32) && (mask & (0xffffffff >> len)))
+		/* yes. we can't handle that */
+		return -1;
+
+	return len;
+}
+
+/*
+ * This will return the most specific route, other than [re], that covers
+ * the prefix of [re], or NULL if there is none.
+ */
+static struct ROUTE_ENTRY*
+route_find_cover (struct ROUTE_ENTRY* re) {
+	struct ROUTE_ENTRY* cover = NULL;
+	struct ROUTE_ENTRY* r;
+
+	/* scan all routes */
+	for (r = routes; r != NULL; r = r->next) {
+		/* the same or more specific? */
+		if ((r == re) || (r->prefixlen > re->prefixlen))
+			/* yes. skip it */
+			continue;
+
+		/* does this cover us, and better than what we have? */
+		if (((re->network & r->mask) == r->network) &&
+				((cover == NULL) || (r->prefixlen > cover->prefixlen)))
+			/* yes. remember it */
+			cover = r;
+	}
+
+	return cover;
+}
+
+/*
+ * This will unhook route entry [re] from the FIB and the routes list, zap it
+ * and hand it back to the route cache.
+ */
+static void
+route_zap (struct ROUTE_ENTRY* re) {
+	struct ROUTE_ENTRY* cover = route_find_cover (re);
+
+	route_fib_delete (&route_fib, re->network, re->prefixlen, re, cover,
+	                  (cover != NULL) ? cover->prefixlen : 0);
+
+	/* let go of the next hop */
+	if (re->adj != NULL)
+		adj_put (re->adj);
+
+	/* off the list */
+	if (re->prev != NULL)
+		re->prev->next = re->next;
+	else
+		routes = re->next;
+	if (re->next != NULL)
+		re->next->prev = re->prev;
+
+	kmemset (re, 0, sizeof (struct ROUTE_ENTRY));
+	kmem_cache_free (route_cache, re);
+}
+
+/*
+ * This will return the most specific route to [dest], or NULL if there is
+ * no route.
+ */
+struct ROUTE_ENTRY*
+route_lookup (uint32_t dest) {
+	return route_fib_lookup (&route_fib, dest);
+}
 
 /*
  * This will return the device which to use for sending packets to [dest]. It
@@ -23,17 +364,15 @@ struct ROUTE_ENTRY* routes;
  */
 struct DEVICE*
 route_find_device (uint32_t dest) {
-	int i;
+	struct ROUTE_ENTRY* re = route_fib_lookup (&route_fib, dest);
 
-	/* scan all routes */
-	for (i = 0; i < ROUTE_MAX_ENTRIES; i++)
-		/* got a route? */
-		if (routes[i].network == (dest & routes[i].mask))
-			/* yes. return the device */
-			return routes[i].device;
+	/* got a route? */
+	if (re == NULL)
+		/* no. too bad */
+		return NULL;
 
-	/* not found. too bad */
-	return NULL;
+	/* yes. return the device */
+	return re->device;
 }
 
 /*
@@ -49,8 +388,9 @@ route_find_ip (struct DEVICE* dev, uint32_t dest) {
 
 	/* scan all routes */
 	for (i = 0; i < IPV4_MAX_ADDR; i++)
-		if ((dev->ipv4conf.address[i].addr & dev->ipv4conf.address[i].netmask) ==
-				(dest & dev->ipv4conf.address[i].netmask))
+		if ((dev->ipv4conf.address[i].addr) &&
+				((dev->ipv4conf.address[i].addr & dev->ipv4conf.address[i].netmask) ==
+				 (dest & dev->ipv4conf.address[i].netmask)))
 			/* got it! */
 			return &dev->ipv4conf.address[i];
 
@@ -68,25 +408,58 @@ route_find_ip (struct DEVICE* dev, uint32_t dest) {
  */
 int
 route_add (struct DEVICE* dev, uint32_t dest, uint32_t mask, uint32_t gateway, uint32_t flags) {
-	int i;
+	struct ROUTE_ENTRY* re;
+	int len;
 
-	/* scan all routes */
-	for (i = 0; i < ROUTE_MAX_ENTRIES; i++)
-		/* got an unused route? */
-		if (!routes[i].flags) {
-			/* yes. set the route up */
-			routes[i].device = dev;
-			routes[i].network = (dest & mask);
-			routes[i].mask = mask;
-			routes[i].gateway = gateway;
-			routes[i].flags = flags | ROUTE_FLAG_INUSE;
-
-			/* all done */
-			return 1;
+	/* we can only handle contiguous netmasks */
+	len = route_masklen (mask);
+	if (len < 0)
+		return 0;
+
+	/* got an entry? */
+	re = (struct ROUTE_ENTRY*)kmem_cache_alloc (route_cache);
+	if (re == NULL)
+		/* no. too bad */
+		return 0;
+
+	/* set the route up */
+	re->device = dev;
+	re->network = (dest & mask);
+	re->mask = mask;
+	re->gateway = gateway;
+	re->flags = flags | ROUTE_FLAG_INUSE;
+	re->prefixlen = len;
+	re->adj = NULL;
+
+	/* gateway and host routes need to know where to go */
+	if (flags & (ROUTE_FLAG_GATEWAY | ROUTE_FLAG_HOST)) {
+		re->adj = adj_get (dev, (flags & ROUTE_FLAG_GATEWAY) ? gateway : dest);
+		if (re->adj == NULL) {
+			/* out of adjacencies. back out */
+			kmemset (re, 0, sizeof (struct ROUTE_ENTRY));
+			kmem_cache_free (route_cache, re);
+			return 0;
 		}
+	}
 
-	/* too bad */
-	return 0;
+	/* hook it in the list */
+	re->prev = NULL;
+	re->next = routes;
+	if (routes != NULL)
+		routes->prev = re;
+	routes = re;
+
+	/* hook it in the FIB */
+	if (!route_fib_insert (&route_fib, re->network, len, re)) {
+		/* out of memory. say so, as not every caller will */
+		kprintf ("route: no memory for the route to %I/%u, %u nodes in use\n",
+		         re->network, len, route_fib.num_nodes);
+		route_zap (re);
+		return 0;
+	}
+
+	/* all done */
+	return 1;
 }
 
 /*
@@ -96,14 +469,14 @@ route_add (struct DEVICE* dev, uint32_t dest, uint32_t mask, uint32_t gateway, u
  */
 int
 route_remove (uint32_t dest, uint32_t mask) {
-	int i;
+	struct ROUTE_ENTRY* re;
 
 	/* scan all routes */
-	for (i = 0; i < ROUTE_MAX_ENTRIES; i++)
+	for (re = routes; re != NULL; re = re->next)
 		/* got the route? */
-		if (routes[i].network == (dest & routes[i].mask)) {
+		if ((re->mask == mask) && (re->network == (dest & mask))) {
 			/* yes. zap it */
-			kmemset (&routes[i], 0, sizeof (struct ROUTE_ENTRY));
+			route_zap (re);
 			return 1;
 		}
 
@@ -119,15 +492,140 @@ route_remove (uint32_t dest, uint32_t mask) {
  */
 void
 route_flush() {
-	int i;
+	struct ROUTE_ENTRY* re;
+	struct ROUTE_ENTRY* next;
 
 	/* scan all routes */
-	for (i = 0; i < ROUTE_MAX_ENTRIES; i++)
-		/* used but not permanent? */
-		if ((routes[i].flags & ROUTE_FLAG_INUSE) &&
-				!(routes[i].flags & ROUTE_FLAG_PERM))
+	for (re = routes; re != NULL; re = next) {
+		next = re->next;
+
+		/* not permanent? */
+		if (!(re->flags & ROUTE_FLAG_PERM))
 			/* yes. zap it */
-			kmemset (&routes[i], 0, sizeof (struct ROUTE_ENTRY));
+			route_zap (re);
+	}
+}
+
+/*
+ * This will return a well mixed hash of [x].
+ */
+static uint32_t
+route_hash (uint32_t x) {
+	x ^= x >> 16; x *= 0x7feb352d;
+	x ^= x >> 15; x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/*
+ * This will make up prefix [i] of the benchmark, which puts its prefixes in
+ * [num_blocks] /16's, and store it in [network] / [len].
+ */
+static void
+route_bench_prefix (uint32_t i, uint32_t num_blocks, uint32_t* network, uint32_t* len) {
+	uint32_t h = route_hash (i);
+	uint32_t block = route_hash ((h % num_blocks) | 0x80000000);
+
+	/* pick a unicast /16 */
+	block = ((1 + ((block >> 16) % 223)) << 24) | ((block & 0xff) << 16);
+
+	/* mostly /24's, with some shorter aggregates and the odd host route */
+	h = route_hash (h);
+	if ((h & 1023) == 0)
+		*len = 32;
+	else if ((h & 15) == 0)
+		*len = 16 + ((h >> 4) & 7);
+	else
+		*len = 24;
+	*network = (block | (route_hash (h) & 0xffff)) & (0xffffffff << (32 - *len));
+}
+
+/*
+ * This will build a private FIB of [num_prefixes] synthetic prefixes and time
+ * [num_lookups] lookups in it. The prefixes are scattered over the unicast
+ * space, but clustered in /16's like those of a real table. It will return
+ * zero on failure or non-zero on success.
+ */
+int
+route_benchmark (uint32_t num_prefixes, uint32_t num_lookups) {
+	struct ROUTE_FIB fib;
+	struct ROUTE_ENTRY* nexthop;
+	unsigned long long start, cycles;
+	size_t num_nodes, total, avail;
+	uint32_t* addr;
+	uint32_t i, h, network, len, num_blocks, ms, hits = 0;
+
+	/* figure out how many nodes this may take */
+	num_blocks = (num_prefixes / 128) + 1;
+	num_nodes = 1 + ((num_blocks < 223) ? num_blocks : 223) + num_blocks + (num_prefixes >> 10);
+
+	/* enough memory for this? */
+	kmemstats (&total, &avail);
+	if ((num_nodes * sizeof (struct ROUTE_NODE)) + (ROUTE_BENCH_ADDRS * sizeof (uint32_t)) +
+	    (33 * sizeof (struct ROUTE_ENTRY)) + (8 * PAGESIZE) > avail) {
+		/* no. complain */
+		kprintf ("not enough memory for %u prefixes\n", num_prefixes);
+		return 0;
+	}
+	nexthop = (struct ROUTE_ENTRY*)kmalloc (NULL, 33 * sizeof (struct ROUTE_ENTRY), 0);
+	addr = (uint32_t*)kmalloc (NULL, ROUTE_BENCH_ADDRS * sizeof (uint32_t), 0);
+	if ((nexthop == NULL) || (addr == NULL) || !route_fib_init (&fib)) {
+		kprintf ("out of memory\n");
+		if (nexthop != NULL) kfree (nexthop);
+		if (addr != NULL) kfree (addr);
+		return 0;
+	}
+
+	/* one next hop per prefix length will do */
+	kmemset (nexthop, 0, 33 * sizeof (struct ROUTE_ENTRY));
+	for (i = 0; i <= 32; i++)
+		nexthop[i].prefixlen = i;
+
+	/* fill the table */
+	for (i = 0; i < num_prefixes; i++) {
+		route_bench_prefix (i, num_blocks, &network, &len);
+		if (!route_fib_insert (&fib, network, len, &nexthop[len])) {
+			kprintf ("out of memory after %u prefixes\n", i);
+			route_fib_destroy (&fib);
+			kfree (addr); kfree (nexthop);
+			return 0;
+		}
+	}
+
+	/*
+	 * Make up the addresses to look up beforehand, so the timing is about the
+	 * FIB only: most are within some prefix, the rest anywhere at all.
+	 */
+	for (i = 0; i < ROUTE_BENCH_ADDRS; i++) {
+		h = route_hash (~i);
+		if ((h & 3) == 0) {
+			addr[i] = route_hash (h);
+			continue;
+		}
+		route_bench_prefix (h % num_prefixes, num_blocks, &network, &len);
+		addr[i] = network | (route_hash (h) & ~(0xffffffff << (32 - len)));
+	}
+
+	start = arch_tsc_read();
+	for (i = 0; i < num_lookups; i++)
+		if (route_fib_lookup (&fib, addr[i & (ROUTE_BENCH_ADDRS - 1)]) != NULL)
+			hits++;
+	cycles = arch_tsc_read() - start;
+
+	kprintf ("%u prefixes, %u nodes (%u bytes)\n", num_prefixes, fib.num_nodes,
+	         fib.num_nodes * sizeof (struct ROUTE_NODE));
+	kprintf ("%u lookups, %u hits, %u cycles per lookup", num_lookups, hits,
+	         (num_lookups > 0) ? prof_div (cycles, num_lookups) : 0);
+	ms = (arch_tsc_khz != 0) ? prof_div (cycles, arch_tsc_khz) : 0;
+	if (ms > 0)
+		kprintf (", %u lookups/second", prof_div ((unsigned long long)num_lookups * 1000, ms));
+	kprintf ("\n");
+
+	/* all done */
+	route_fib_destroy (&fib);
+	kfree (addr);
+	kfree (nexthop);
+	return 1;
 }
 
 /*
@@ -138,9 +636,14 @@ route_flush() {
  */
 void
 route_init() {
-	/* allocate memory for the routing table */
-	routes = (struct ROUTE_ENTRY*)kmalloc (NULL, sizeof (struct ROUTE_ENTRY) * ROUTE_MAX_ENTRIES, 0);
-	kmemset (routes, 0, sizeof (struct ROUTE_ENTRY) * ROUTE_MAX_ENTRIES);
+	/* create the route cache */
+	route_cache = kmem_cache_create ("route", sizeof (struct ROUTE_ENTRY), sizeof (uint32_t), NULL);
+	if (route_cache == NULL)
+		panic ("route_init(): cannot create the route cache");
+
+	/* initialize the FIB; it grows as routes are added */
+	if (!route_fib_init (&route_fib))
+		panic ("route_init(): cannot allocate the FIB");
 }
 
 /* vim:set ts=2 sw=2 tw=78: */
@@ -21,32 +21,10 @@
 /*
  * This will calculate the TCP checksum of TCP packet with header [tcphdr]
  * and IP header [iphdr] spanning a total of [len] bytes.
- *
- * This is taken from tcpdump.
  */
 uint32_t
 tcp_cksum (uint8_t* tcphdr, uint32_t source, uint32_t dest, uint32_t len) {
-	union phu {
-		struct phdr {
-			uint32_t src;
-			uint32_t dst;
-			uint8_t  mbz;
-			uint8_t  proto;
-			uint16_t len;
-		} ph;
-		uint16_t pa[6];
-	} phu;
-	uint16_t* sp;
-
-	/* build the pseudo-header */
-	phu.ph.len = htons (len);
-	phu.ph.mbz = 0;
-	phu.ph.proto = IP_PROTO_TCP;
-	phu.ph.src = htonl (source);
-	phu.ph.dst = htonl (dest);
-
-	sp = &phu.pa[0];
-	return ipv4_cksum ((void*)tcphdr, len, sp[0] + sp[1] + sp[2] + sp[3] + sp[4] + sp[5]);
+	return ipv4_cksum ((void*)tcphdr, len, ipv4_cksum_pseudo (htonl (source), htonl (dest), IP_PROTO_TCP, len));
 }
 
 /*
@@ -128,6 +106,7 @@ tcp_handle_packet (struct NETPACKET* np) {
 	if (s == NULL) {
 		/* no. send ICMP unreachable port message */
 		icmp_send_unreachable (addr, ICMP_CODE_PORTUNREACHABLE, (uint8_t*)iphdr, sizeof (struct IP_HEADER), (uint8_t*)tcphdr, 8);
+		network_drop (np->device, NETWORK_DROP_NOPORT);
 		return 0;
 	}
 
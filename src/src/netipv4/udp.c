@@ -10,6 +10,7 @@
 #include <sys/network.h>
 #include <lib/lib.h>
 #include <md/timer.h>
+#include <netipv4/adj.h>
 #include <netipv4/arp.h>
 #include <netipv4/cksum.h>
 #include <netipv4/icmp.h>
@@ -26,11 +27,26 @@
 int
 udp_handle_packet (struct NETPACKET* np) {
 	struct IP_HEADER* iphdr = (struct IP_HEADER*)(np->data);
-	struct UDP_HEADER* udphdr = (struct UDP_HEADER*)(np->data + sizeof (struct IP_HEADER));
+	int hlen = (iphdr->version_ihl & 0x0f) * 4;
+	struct UDP_HEADER* udphdr = (struct UDP_HEADER*)(np->data + hlen);
 	uint32_t addr = ipv4_conv_addr (iphdr->source);
 	uint16_t dest_port = (udphdr->dest[0] << 8) | udphdr->dest[1];
 	uint16_t len = (udphdr->length[0] << 8) | udphdr->length[1];
-	struct SOCKET* s = socket_find (SOCKET_TYPE_UDP4, dest_port);
+	struct SOCKET* s;
+
+	/* does the length fit the IP packet? */
+	if ((len < sizeof (struct UDP_HEADER)) || (len > ntohs (iphdr->len) - hlen)) {
+		/* no. drop it */
+		network_drop (np->device, NETWORK_DROP_HEADER);
+		return 0;
+	}
+
+	/* if there is a checksum, is it correct? */
+	if ((udphdr->cksum[0] | udphdr->cksum[1]) && ipv4_cksum_transport (np, IP_PROTO_UDP, len) != 0) {
+		/* no. drop it */
+		network_drop (np->device, NETWORK_DROP_CKSUM);
+		return 0;
+	}
 
 	/*
 	kprintf ("UDP incoming from %I to %I: src port %u dest %u\n",
@@ -39,9 +55,11 @@ udp_handle_packet (struct NETPACKET* np) {
 	*/
 
 	/* do we have a socket bound to this? */
+	s = socket_find (SOCKET_TYPE_UDP4, dest_port);
 	if (s == NULL) {
 		/* no. send ICMP unreachable port message */
 		icmp_send_unreachable (addr, ICMP_CODE_PORTUNREACHABLE, (uint8_t*)iphdr, sizeof (struct IP_HEADER), (uint8_t*)udphdr, 8);
+		network_drop (np->device, NETWORK_DROP_NOPORT);
 		return 0;
 	}
 
@@ -61,40 +79,22 @@ udp_handle_packet (struct NETPACKET* np) {
  */
 int
 udp_xmit_packet (struct SOCKET* s, uint32_t dest, uint16_t port, uint8_t* data, uint32_t len) {
-	struct DEVICE* dev = route_find_device (dest);
 	struct IPV4_ADDR* addr;
-	struct ARP_RECORD* ar;
-
-	/* do we have a device to route ? */
-	if (dev == NULL)
-		/* no. drop the packet */
-		return 0;
+	struct ADJACENCY* adj;
 
-	/* fetch the IP address to route */
-	addr = route_find_ip (dev, dest);
-	if (addr == NULL)
-		/* this failed. drop the packet */
-		return 0;
-
-	/* fetch the address of the destination */
-	ar = arp_fetch_address (dest);
-	if (ar == NULL)
-		/* it's not yet in the cache. bail out */
+	/* can we reach the destination? */
+	adj = ip_resolve (dest, NULL);
+	if (adj == NULL)
+		/* no (or not yet). drop the packet */
 		return 0;
 
-	/* fetch the IP address to route */
-	addr = route_find_ip (dev, dest);
+	/* fetch the IP address from which we can reach the next hop */
+	addr = route_find_ip (adj->device, adj->address);
 	if (addr == NULL)
 		/* this failed. drop the packet */
 		return 0;
 
-	/* fetch the address of the destination */
-	ar = arp_fetch_address (dest);
-	if (ar == NULL)
-		/* it's not yet in the cache. bail out */
-		return 0;
-
-	return udp_xmit_packet_ex (dev, ar->hw_addr, addr->addr, dest, s->port, port, data, len);
+	return udp_xmit_packet_ex (adj->device, adj->header.dest, addr->addr, dest, s->port, port, data, len);
 }
 
 /*
@@ -109,6 +109,7 @@ udp_xmit_packet_ex (struct DEVICE* dev, uint8_t* hwaddr, uint32_t source, uint32
 	struct UDP_HEADER* udphdr;
 	uint16_t pktlen = (sizeof (struct IP_HEADER) + sizeof (struct UDP_HEADER) + len);
 	uint16_t cksum;
+	uint32_t sum;
 
 	/* allocate a network packet */
 	pkt = network_alloc_packet (dev);
@@ -116,8 +117,8 @@ udp_xmit_packet_ex (struct DEVICE* dev, uint8_t* hwaddr, uint32_t source, uint32
 		/* out of network packets. drop the packet */
 		return 0;
 
-	/* copy the data */
-	kmemcpy ((uint8_t*)(pkt->data + sizeof (struct IP_HEADER) + sizeof (struct UDP_HEADER)), data, len);
+	/* copy the data, checksumming it on the way */
+	sum = ipv4_cksum_copy ((uint8_t*)(pkt->data + sizeof (struct IP_HEADER) + sizeof (struct UDP_HEADER)), data, len, 0);
 
 	/* build the IP header */
 	iphdr = (struct IP_HEADER*)pkt->data;
@@ -147,10 +148,15 @@ udp_xmit_packet_ex (struct DEVICE* dev, uint8_t* hwaddr, uint32_t source, uint32
 	udphdr->length[0] = ((len + sizeof (struct UDP_HEADER)) >> 8) & 0xff;
 	udphdr->length[1] = ((len + sizeof (struct UDP_HEADER))       & 0xff);
 	udphdr->cksum[0] = 0; udphdr->cksum[1] = 0;
-#if 0
-	cksum = ipv4_cksum ((void*)pkt->data, pktlen);
-	iphdr->cksum = cksum;
-#endif
+
+	/* add the header and pseudo header to the checksum of the data */
+	sum = ipv4_cksum_partial (udphdr, sizeof (struct UDP_HEADER), sum);
+	sum = ipv4_cksum_combine (sum, ipv4_cksum_pseudo (htonl (source), htonl (dest), IP_PROTO_UDP, len + sizeof (struct UDP_HEADER)), 0);
+	cksum = ~ipv4_cksum_fold (sum);
+	if (cksum == 0)
+		/* zero means no checksum; send the other zero instead */
+		cksum = 0xffff;
+	kmemcpy (udphdr->cksum, &cksum, 2);
 
 	/* off it goes! */
 	pkt->len = pktlen;
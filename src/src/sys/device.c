@@ -9,6 +9,8 @@
 #include <sys/kmalloc.h>
 #include <sys/device.h>
 #include <sys/network.h>
+#include <sys/qdisc.h>
+#include <sys/shaper.h>
 #include <sys/tty.h>
 #include <lib/lib.h>
 #include <md/interrupts.h>
@@ -23,11 +25,47 @@ struct DEVICE*
 device_register (struct DEVICE* dev) {
 	struct DEVICE* device = coredevice;
 	struct DEVICE* newdevice;
+	uint32_t limit;
 
 	/* initialize the new device */
 	newdevice = (struct DEVICE*)kmalloc (NULL, sizeof (struct DEVICE), 0);
+	if (newdevice == NULL)
+		return NULL;
 	kmemcpy (newdevice, dev, sizeof (struct DEVICE));
 
+	/* set up the queues between the device and the main loop */
+	newdevice->rx_ring.slot = NULL; newdevice->tx_ring.slot = NULL;
+	if ((!network_ring_init (&newdevice->rx_ring, NETWORK_RX_RING_SIZE)) ||
+	    (!network_ring_init (&newdevice->tx_ring, NETWORK_TX_RING_SIZE))) {
+		network_ring_destroy (&newdevice->rx_ring);
+		kfree (newdevice);
+		return NULL;
+	}
+
+	/* the transmit queue may hold a quarter of all buffers, within limits */
+	limit = network_maxbuffers / 4;
+	if (limit > QDISC_LIMIT)
+		limit = QDISC_LIMIT;
+	if (limit < 16)
+		limit = 16;
+	newdevice->qdisc = qdisc_create (limit);
+	newdevice->shaper = NULL;
+	if (newdevice->qdisc == NULL) {
+		network_ring_destroy (&newdevice->rx_ring);
+		network_ring_destroy (&newdevice->tx_ring);
+		kfree (newdevice);
+		return NULL;
+	}
+
+	/* give it buffers of its own */
+	if (!network_pool_attach (newdevice)) {
+		network_ring_destroy (&newdevice->rx_ring);
+		network_ring_destroy (&newdevice->tx_ring);
+		qdisc_destroy (newdevice->qdisc);
+		kfree (newdevice);
+		return NULL;
+	}
+
 	/* duplicate the name */
 	newdevice->name = kstrdup (dev->name);
 
@@ -90,6 +128,11 @@ device_unregister (struct DEVICE* dev) {
 	}
 
 	/* free the device structures */
+	network_ring_destroy (&dev->rx_ring);
+	network_ring_destroy (&dev->tx_ring);
+	shaper_set_rate (dev, 0);
+	qdisc_destroy (dev->qdisc);
+	network_pool_detach (dev);
 	kfree (dev->name);
 
 	/* free the device itself */
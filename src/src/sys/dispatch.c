@@ -0,0 +1,134 @@
+/*
+ * dispatch.c - ILIOS Processor Specific Routine Selection
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * Routines like kmemcpy() come in several flavours, each of which is the
+ * fastest on some processors. This code times the ones the processor can run
+ * and picks the winner.
+ *
+ */
+#include <sys/types.h>
+#include <sys/dispatch.h>
+#include <lib/lib.h>
+#include <md/cpu.h>
+#include <md/timer.h>
+
+/* DISPATCH_BENCH_ROUNDS is the number of times each routine is timed */
+#define DISPATCH_BENCH_ROUNDS	32
+
+/* dispatch_buf is what the routines are timed on */
+static uint8_t dispatch_buf[2][DISPATCH_BENCH_LEN + 2];
+
+/* dispatch_memcpy are the kmemcpy() flavours, from oldest to newest */
+static struct DISPATCH_IMPL dispatch_memcpy[] = {
+	{ "generic", 0, kmemcpy_generic },
+	{ "mmx", CPU_FEATURE_MMX, kmemcpy_mmx },
+	{ "sse2", CPU_FEATURE_SSE2, kmemcpy_sse2 },
+	{ "erms", CPU_FEATURE_ERMS, kmemcpy_erms },
+	{ NULL, 0, NULL }
+};
+
+/* dispatch_memset are the kmemset() flavours, from oldest to newest */
+static struct DISPATCH_IMPL dispatch_memset[] = {
+	{ "generic", 0, kmemset_generic },
+	{ "sse2", CPU_FEATURE_SSE2, kmemset_sse2 },
+	{ "erms", CPU_FEATURE_ERMS, kmemset_erms },
+	{ NULL, 0, NULL }
+};
+
+/*
+ * This will run kmemcpy() flavour [fn].
+ */
+static void
+dispatch_run_memcpy (void* fn, void* dst, void* src, int len) {
+	((void (*)(void*, const void*, size_t))fn) (dst, src, len);
+}
+
+/*
+ * This will run kmemset() flavour [fn].
+ */
+static void
+dispatch_run_memset (void* fn, void* dst, void* src, int len) {
+	((void (*)(void*, const char, size_t))fn) (dst, 0, len);
+}
+
+/*
+ * This will return the number of cycles the quickest of a number of runs of
+ * routine [fn] took.
+ */
+static uint32_t
+dispatch_time (void* fn, DISPATCH_RUN run) {
+	uint32_t start, t, best = 0xffffffff;
+	int i;
+
+	for (i = 0; i < DISPATCH_BENCH_ROUNDS; i++) {
+		start = arch_tsc_read32();
+		run (fn, dispatch_buf[0], dispatch_buf[1], DISPATCH_BENCH_LEN);
+		t = arch_tsc_read32() - start;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+/*
+ * This will pick the quickest of the implementations [impl] of routine
+ * [what] the processor can run, timing them with [run]. Without a time stamp
+ * counter, the newest one is assumed to be the quickest. The choice is
+ * reported, and the implementation returned.
+ */
+struct DISPATCH_IMPL*
+dispatch_select (char* what, struct DISPATCH_IMPL* impl, DISPATCH_RUN run) {
+	struct DISPATCH_IMPL* best = impl;
+	uint32_t t, best_t = 0xffffffff;
+	int timed = (arch_cpu_features & CPU_FEATURE_TSC) ? 1 : 0;
+
+	kprintf ("%s:", what);
+	for (; impl->name != NULL; impl++) {
+		if ((impl->features & arch_cpu_features) != impl->features)
+			/* can't run this one */
+			continue;
+
+		if (!timed) {
+			kprintf (" %s", impl->name);
+			best = impl;
+			continue;
+		}
+
+		t = dispatch_time (impl->fn, run);
+		kprintf (" %s %u", impl->name, t);
+		if (t < best_t) {
+			best_t = t;
+			best = impl;
+		}
+	}
+	if (timed)
+		kprintf (" cycles per %u bytes", DISPATCH_BENCH_LEN);
+	kprintf ("; using %s\n", best->name);
+	return best;
+}
+
+/*
+ * This will report the processor features and pick the kmemcpy() and
+ * kmemset() that suit it best. The processor features and time stamp counter
+ * must be known already.
+ */
+void
+dispatch_init() {
+	struct DISPATCH_IMPL* impl;
+
+	kprintf ("CPU features:%s%s%s%s%s\n",
+	 (arch_cpu_features & CPU_FEATURE_TSC)  ? " tsc"  : "",
+	 (arch_cpu_features & CPU_FEATURE_MMX)  ? " mmx"  : "",
+	 (arch_cpu_features & CPU_FEATURE_SSE)  ? " sse"  : "",
+	 (arch_cpu_features & CPU_FEATURE_SSE2) ? " sse2" : "",
+	 (arch_cpu_features & CPU_FEATURE_ERMS) ? " erms" : "");
+
+	impl = dispatch_select ("kmemcpy", dispatch_memcpy, dispatch_run_memcpy);
+	kmemcpy_fn = impl->fn;
+	impl = dispatch_select ("kmemset", dispatch_memset, dispatch_run_memset);
+	kmemset_fn = impl->fn;
+	kprintf ("large copies: %s\n", (arch_cpu_features & CPU_FEATURE_SSE2) ? "non-temporal" : "kmemcpy");
+}
+
+/* vim:set ts=2 sw=2: */
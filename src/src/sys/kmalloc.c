@@ -3,19 +3,33 @@
  *
  * This code is inspired by Yoctix, (c) 1999 Anders Gavare.
  *
+ * Pages are handed out by a binary buddy allocator: every region keeps lists
+ * of free blocks of 2^n pages, and a block is split to get a smaller one or
+ * merged with its buddy once both are free. Allocations which aren't a power
+ * of two in size give the pages they don't need back right away.
+ *
  */
 #include <sys/types.h>
 #include <sys/kmalloc.h>
 #include <md/memory.h>
 #include <lib/lib.h>
+#include <lib/list.h>
 #include <assert.h>
 
 #define xKMALLOC_DEBUG
-#define xKMALLOC_DEBUG_BITMAP
+
+/* KMALLOC_BITMAP_HDR is the number of entries taken by the bitmaps */
+#define KMALLOC_BITMAP_HDR	((sizeof (struct KMALLOC_BITMAP) + KMALLOC_BITMAPSIZE - 1) / KMALLOC_BITMAPSIZE)
+
+/* KMALLOC_BITMAP_MAX is the largest allocation a bitmap chunk can hold */
+#define KMALLOC_BITMAP_MAX	((KMALLOC_BITMAP_SLOTS - KMALLOC_BITMAP_HDR) * KMALLOC_BITMAPSIZE)
 
 struct KMALLOC_REGION* root_region;
 #define FIX_ADDR(x) ((x))
 
+/* kmalloc_bitmaps are the chunks holding bitmaps */
+static struct KMALLOC_CHUNK* kmalloc_bitmaps = NULL;
+
 /*
  * This will initialize the kernel-side memory allocator.
  */
@@ -23,12 +37,82 @@ void
 kmalloc_init() {
 	/* no root region yet */
 	root_region = NULL;
+	kmalloc_bitmaps = NULL;
 
 	/* ensure PAGESIZE is a multiple of KMALLOC_BITMAPSIZE. the memory manager
 	 * needs this */
 	ASSERT ((PAGESIZE % KMALLOC_BITMAPSIZE) == 0);
 }
 
+/*
+ * This will return the order of the smallest block holding [size] pages.
+ */
+static size_t
+kmalloc_order (size_t size) {
+	size_t order = 0;
+
+	while (((size_t)1 << order) < size)
+		order++;
+	return order;
+}
+
+/*
+ * This will put the block of order [order] starting at chunk number [i] of
+ * region [reg] on the free lists, merging it with its buddy for as long as
+ * that one is free too.
+ */
+static void
+kmalloc_free_block (struct KMALLOC_REGION* reg, size_t i, size_t order) {
+	struct KMALLOC_CHUNK* buddy;
+	size_t j;
+
+	while (order < KMALLOC_MAX_ORDER) {
+		/* is the buddy there, and free as a whole? */
+		j = (i + reg->pad) ^ ((size_t)1 << order);
+		if (j < reg->pad)
+			break;
+		j -= reg->pad;
+		if (j + ((size_t)1 << order) > reg->numchunks)
+			break;
+		buddy = &reg->chunk[j];
+		if (!(buddy->flags & KMALLOC_CFLAGS_FREE) || (buddy->chain_bitmap.order != order))
+			break;
+
+		/* yes. take it off its list and merge */
+		KLIST_UNLINK (&reg->free[order], buddy);
+		buddy->flags = 0;
+		if (j < i)
+			i = j;
+		order++;
+	}
+
+	reg->chunk[i].flags = KMALLOC_CFLAGS_FREE;
+	reg->chunk[i].chain_bitmap.order = order;
+	KLIST_LINK (&reg->free[order], &reg->chunk[i]);
+}
+
+/*
+ * This will free the [size] pages starting at chunk number [i] of region
+ * [reg], as the fewest possible aligned blocks.
+ */
+static void
+kmalloc_free_range (struct KMALLOC_REGION* reg, size_t i, size_t size) {
+	size_t order, end = i + size;
+
+	while (i < end) {
+		/* find the largest block which starts here and fits */
+		order = 0;
+		while ((order < KMALLOC_MAX_ORDER) &&
+		       (((i + reg->pad) & ((size_t)1 << order)) == 0) &&
+		       (i + ((size_t)2 << order) <= end))
+			order++;
+
+		kmalloc_free_block (reg, i, order);
+		reg->avail += (size_t)1 << order;
+		i += (size_t)1 << order;
+	}
+}
+
 /*
  * This will add [size] bytes of memory, starting at address [addr] with flags
  * [flags] to the region map.
@@ -46,31 +130,31 @@ kmalloc_addregion (addr_t addr, size_t size, uint32_t flags) {
 		/* no. complain! */
 		panic ("kmalloc_addregion(): address 0x%x isn't page aligned!", addr);
 
-	/* calculate the size in pages */
-	size /= PAGESIZE;
+	/* the administration comes first; every page after it needs a chunk */
+	if (size < 2 * PAGESIZE)
+		return;
+	size -= sizeof (struct KMALLOC_REGION);
 
 	/* place the new region at the very beginning of the memory */
 	reg = (struct KMALLOC_REGION*)FIX_ADDR (addr);
+	kmemset (reg, 0, sizeof (struct KMALLOC_REGION));
 	reg->address = addr;
-	reg->size = size;
-	reg->avail = size;
+	reg->numchunks = size / (PAGESIZE + sizeof (struct KMALLOC_CHUNK));
+	reg->size = reg->numchunks;
+	reg->avail = 0;
 	reg->flags = flags;
-	reg->numchunks = size;
+	reg->chunk = (struct KMALLOC_CHUNK*)FIX_ADDR (addr + sizeof (struct KMALLOC_REGION));
+	reg->pad = -reg->numchunks & (((size_t)1 << KMALLOC_MAX_ORDER) - 1);
 	reg->next = NULL;
 
-	/* determine the new address */
+	/* determine the new address, rounded up at pages */
 	xaddr = addr + sizeof (struct KMALLOC_REGION) +
 	        reg->numchunks * sizeof (struct KMALLOC_CHUNK);
-
-	/* round it at pages */
-	xaddr += (PAGESIZE - (xaddr % PAGESIZE));
+	xaddr = (xaddr + PAGESIZE - 1) & ~(PAGESIZE - 1);
 
 	/* build the chunks */
-	for (i = 0; i < reg->numchunks; i++) {
+	for (i = 0, chunk = reg->chunk; i < reg->numchunks; i++, chunk++) {
 		/* set the chunk up */
-		chunk = (struct KMALLOC_CHUNK*)FIX_ADDR (addr +
-                                             sizeof (struct KMALLOC_REGION) +
-		                                         (i * sizeof (struct KMALLOC_CHUNK)));
 		chunk->address = xaddr;
 		chunk->thread = (struct THREAD*)NULL;
 		chunk->flags = 0;
@@ -79,6 +163,9 @@ kmalloc_addregion (addr_t addr, size_t size, uint32_t flags) {
 		xaddr += PAGESIZE;
 	}
 
+	/* hand all pages to the buddy allocator */
+	kmalloc_free_range (reg, 0, reg->numchunks);
+
 	/* do we have a root region? */
 	if (root_region) {
 		/* yes. find the final region */
@@ -94,10 +181,10 @@ kmalloc_addregion (addr_t addr, size_t size, uint32_t flags) {
 	}
 
 #ifdef KMALLOC_DEBUG
-	if (size > ((1024 * 1024) / PAGESIZE))
-		kprintf ("kmalloc_addregion(): addr=0x%x size=%u MB flags=0x%x\n", addr, (size * PAGESIZE) / (1024 * 1024), flags);
+	if (size > (1024 * 1024))
+		kprintf ("kmalloc_addregion(): addr=0x%x size=%u MB flags=0x%x\n", addr, (reg->size * PAGESIZE) / (1024 * 1024), flags);
 	else
-		kprintf ("kmalloc_addregion(): addr=0x%x size=%u KB flags=0x%x\n", addr, (size * PAGESIZE) / 1024, flags);
+		kprintf ("kmalloc_addregion(): addr=0x%x size=%u KB flags=0x%x\n", addr, (reg->size * PAGESIZE) / 1024, flags);
 #endif /* KMALLOC_DEBUG */
 }
 
@@ -127,210 +214,289 @@ kmemstats(size_t* total, size_t* avail) {
 }
 
 /*
- * kmalloc_check_best_fit (size_t size)
- *
- * This will return the region of memory which has the best fit for [size]
- * pages, or NULL if there isn't any room left.
- *
- * FIXME: make this truly best fit, not first fit.
- *
+ * This will store the number of free blocks of every order in [blocks],
+ * which must have room for KMALLOC_MAX_ORDER + 1 entries, and the size of
+ * the largest free block in [largest], in bytes. The further the largest
+ * block falls short of the available memory, the more fragmented it is.
  */
-struct KMALLOC_REGION*
-kmalloc_check_best_fit (size_t size) {
-	struct KMALLOC_REGION* reg = root_region;
+void
+kmemfrag (size_t* blocks, size_t* largest) {
+	struct KMALLOC_REGION* reg;
+	struct KMALLOC_CHUNK* chunk;
+	size_t order;
+
+	*largest = 0;
+	for (order = 0; order <= KMALLOC_MAX_ORDER; order++) {
+		blocks[order] = 0;
+		for (reg = root_region; reg != NULL; reg = reg->next)
+			for (chunk = reg->free[order]; chunk != NULL; chunk = chunk->next)
+				blocks[order]++;
+		if (blocks[order] > 0)
+			*largest = ((size_t)1 << order) * PAGESIZE;
+	}
+}
 
-	/* wade through all regions */
-	while (reg) {
-		/* enough space here? */
-		if (reg->avail >= size)
-			/* yes. return it */
-			return reg;
+/*
+ * This will take the [size] pages starting at chunk number [i] of region
+ * [reg] off the free lists. The pages must be free and [i] must start a free
+ * block.
+ */
+static void
+kmalloc_take_run (struct KMALLOC_REGION* reg, size_t i, size_t size) {
+	struct KMALLOC_CHUNK* chunk;
+	size_t n, end = i + size;
 
-		/* next */
-		reg = reg->next;
-	}
+	while (i < end) {
+		chunk = &reg->chunk[i];
+		ASSERT ((chunk->flags & KMALLOC_CFLAGS_FREE) != 0);
+		n = (size_t)1 << chunk->chain_bitmap.order;
+		KLIST_UNLINK (&reg->free[chunk->chain_bitmap.order], chunk);
+		chunk->flags = 0;
+		reg->avail -= n;
 
-	/* no space today... */
-	return NULL;
+		/* give back what sticks out */
+		if (i + n > end)
+			kmalloc_free_range (reg, end, i + n - end);
+		i += n;
+	}
 }
 
 /*
- * This will return the chunk of memory which has the best fit for [size]
- * _BYTES_ for thread [t], or NULL if there are no bitmaps with that much
- * space left.
- *
- * FIXME: make this truly best fit, not first fit.
- *
+ * This will look for [size] free pages in a row in region [reg], by walking
+ * the blocks in address order. This is only needed if there isn't a free
+ * block large enough, which means the request is too large for the buddy
+ * allocator. It will return the first chunk number or -1 if there is none.
  */
-struct KMALLOC_CHUNK*
-kmalloc_bitmap_check_best_fit (struct THREAD* t, size_t size) {
-	struct KMALLOC_REGION* reg = root_region;
+static size_t
+kmalloc_find_run (struct KMALLOC_REGION* reg, size_t size) {
 	struct KMALLOC_CHUNK* chunk;
-	addr_t i;
-
-	/* wade through all regions */
-	while (reg) {
-		/* scan all chunks */
-		for (i = 0; i < reg->numchunks; i++) {
-			/* fetch the chunk */
-			chunk = (struct KMALLOC_CHUNK*)FIX_ADDR (reg->address +
-																							 sizeof (struct KMALLOC_REGION) +
-																							 (i * sizeof (struct KMALLOC_CHUNK)));
-
-			/* is this a bitmap chunk and in our thread? */
-			if ((chunk->thread == t) && (chunk->flags & KMALLOC_CFLAGS_BITMAP)) {
-				/* yes. got enough space left? */
-				if (chunk->chain_bitmap.bitmap_left >= size) {
-					/* yes. return this chunk */
-					return chunk;
-				}
-			}
+	size_t i = 0, start = 0;
+
+	while (i < reg->numchunks) {
+		chunk = &reg->chunk[i];
+		if (chunk->flags & KMALLOC_CFLAGS_FREE) {
+			/* free block; does the run reach far enough now? */
+			i += (size_t)1 << chunk->chain_bitmap.order;
+			if (i - start >= size)
+				return start;
+			continue;
 		}
 
-		/* next */
-		reg = reg->next;
+		/* in use; skip the allocation */
+		if ((chunk->flags & KMALLOC_CFLAGS_USED) && !(chunk->flags & KMALLOC_CFLAGS_BITMAP))
+			i += chunk->chain_bitmap.chain;
+		else
+			i++;
+		start = i;
 	}
-
-	/* no space today... */
-	return NULL;
+	return (size_t)-1;
 }
 
 /*
- * This will allocate [size] bytes for thread [t] with flags [flags]. It will
- * return a pointer to the memory on success or NULL on failure.
+ * This will allocate [size] pages in a row for thread [t]. It will return the
+ * first chunk on success or NULL on failure.
  */
-void*
-kmalloc_bitmap (struct THREAD* t, size_t size, uint32_t flags) {
+static struct KMALLOC_CHUNK*
+kmalloc_pages (struct THREAD* t, size_t size) {
 	struct KMALLOC_REGION* reg;
-	struct KMALLOC_CHUNK* chunk;
-	addr_t i, numavail, j;
-	size_t sz;
-	uint8_t* ptr;
-	uint8_t* tmptr;
-
-	/* ensure we have less than a page */
-	ASSERT (size <= PAGESIZE);
+	struct KMALLOC_CHUNK* chunk = NULL;
+	size_t order = kmalloc_order (size), i = 0, o;
+
+	/* find the smallest free block which is large enough */
+	for (o = order; (chunk == NULL) && (o <= KMALLOC_MAX_ORDER); o++)
+		for (reg = root_region; reg != NULL; reg = reg->next)
+			if (reg->free[o] != NULL) {
+				chunk = reg->free[o];
+				break;
+			}
 
-	/* calculate space in bitmap-chunks */
-	sz = (size / KMALLOC_BITMAPSIZE);
-	if (size % KMALLOC_BITMAPSIZE)
-		sz++;
+	if (chunk != NULL) {
+		/* got one; take what we need, the rest goes back */
+		i = chunk - reg->chunk;
+	} else {
+		/* no single block will do; maybe some adjacent ones will */
+		for (reg = root_region; reg != NULL; reg = reg->next)
+			if (reg->avail >= size) {
+				i = kmalloc_find_run (reg, size);
+				if (i != (size_t)-1)
+					break;
+			}
+		if (reg == NULL)
+			/* out of memory */
+			return NULL;
+	}
+	kmalloc_take_run (reg, i, size);
 
-#ifdef KMALLOC_DEBUG_BITMAP
-	kprintf ("kmalloc_bitmap(): size=%u sz=%u\n", size, sz);
-#endif /* KMALLOC_DEBUG_BITMAP */
+	/* mark the head chunk */
+	chunk = &reg->chunk[i];
+	chunk->flags = KMALLOC_CFLAGS_USED;
+	chunk->thread = t;
+	chunk->chain_bitmap.chain = size;
+	return chunk;
+}
 
-	/* scan for a bitmap with enough space */
-	chunk = kmalloc_bitmap_check_best_fit (t, sz);
-	if (chunk == NULL) {
-		/* no chunk. build a new one */
-		reg = kmalloc_check_best_fit (1);
-		if (reg == NULL) {
-			/* out of memory! */
-			return NULL;
-		}
+/*
+ * This will return the first entry from [pos] on whose bit in [map] is set
+ * if [value] is non-zero or clear if it is zero. It will return
+ * KMALLOC_BITMAP_SLOTS if there is no such entry.
+ */
+static int
+kmalloc_bitmap_scan (uint32_t* map, int pos, int value) {
+	uint32_t flip = value ? 0 : 0xffffffff;
+	uint32_t word;
+	int w = pos >> 5;
+
+	/* past the end? */
+	if (pos >= KMALLOC_BITMAP_SLOTS)
+		/* yes. nothing there */
+		return KMALLOC_BITMAP_SLOTS;
+
+	/* look at the first word, ignoring the entries before [pos] */
+	word = (map[w] ^ flip) & (0xffffffff << (pos & 31));
+
+	/* skip words without a match */
+	while (word == 0) {
+		if (++w == KMALLOC_BITMAP_WORDS)
+			return KMALLOC_BITMAP_SLOTS;
+		word = map[w] ^ flip;
+	}
 
-		/* scan for a free chunk
-		 * TODO: make this best-fit too! */
-		for (i = 0; i < reg->numchunks; i++) {
-			/* fetch the chunk */
-			chunk = (struct KMALLOC_CHUNK*)FIX_ADDR (reg->address +
-																							 sizeof (struct KMALLOC_REGION) +
-																							 (i * sizeof (struct KMALLOC_CHUNK)));
-
-			/* available chunk? */
-			if (!(chunk->flags & KMALLOC_CFLAGS_USED))
-				/* yes. got it */
-				break;
-		}
+	return (w << 5) + klowbit (word);
+}
 
-		/* ensure the chunk is unused */
-		ASSERT ((chunk->flags & KMALLOC_CFLAGS_USED) == 0);
+/*
+ * This will return non-zero if the bit of entry [pos] in [map] is set.
+ */
+static int
+kmalloc_bitmap_test (uint32_t* map, int pos) {
+	return (map[pos >> 5] >> (pos & 31)) & 1;
+}
 
-		/* set the chunk up */
-		chunk->flags = KMALLOC_CFLAGS_USED | KMALLOC_CFLAGS_BITMAP;
-		chunk->thread = t;
-		chunk->chain_bitmap.bitmap_left  =  (PAGESIZE / KMALLOC_BITMAPSIZE);
-		chunk->chain_bitmap.bitmap_left -=  (PAGESIZE / KMALLOC_BITMAPSIZE) / KMALLOC_BITMAPSIZE;
+/*
+ * This will set the bits of [count] entries from [pos] on in [map] if
+ * [value] is non-zero, or clear them if it is zero.
+ */
+static void
+kmalloc_bitmap_mark (uint32_t* map, int pos, int count, int value) {
+	uint32_t mask;
+	int n;
+
+	while (count > 0) {
+		/* handle as much as fits in this word */
+		n = 32 - (pos & 31);
+		if (n > count)
+			n = count;
+		mask = (n == 32) ? 0xffffffff : (((1U << n) - 1) << (pos & 31));
+
+		if (value)
+			map[pos >> 5] |= mask;
+		else
+			map[pos >> 5] &= ~mask;
+
+		pos += n; count -= n;
+	}
+}
 
-		/* zap the chunk contents, so the bitmap is nuked */
-		kmemset ((void*)FIX_ADDR (chunk->address), 0, PAGESIZE);
+/*
+ * This will find the smallest run of at least [size] free entries in bitmap
+ * [bm]. It will return the first entry of the run and store its length in
+ * [len], or return -1 if there is no such run.
+ */
+static int
+kmalloc_bitmap_fit (struct KMALLOC_BITMAP* bm, size_t size, size_t* len) {
+	int pos = 0, end, best = -1;
+	size_t bestlen = 0;
+
+	/* walk all runs of free entries */
+	while ((pos = kmalloc_bitmap_scan (bm->used, pos, 0)) < KMALLOC_BITMAP_SLOTS) {
+		end = kmalloc_bitmap_scan (bm->used, pos, 1);
+
+		/* large enough, and better than what we have? */
+		if (((size_t)(end - pos) >= size) && ((best < 0) || ((size_t)(end - pos) < bestlen))) {
+			/* yes. remember it */
+			best = pos;
+			bestlen = end - pos;
+
+			/* can't do better than an exact fit */
+			if (bestlen == size)
+				break;
+		}
 
-		/* update the statistics */
-		reg->avail--;
-	} else {
-#ifdef KMALLOC_DEBUG_BITMAP
-		kprintf ("kmalloc_bitmap(): appending to chunk 0x%x!\n", chunk);
-#endif /* KMALLOC_DEBUG_BITMAP */
+		pos = end;
 	}
 
-	/* the current chunk has space left for us. find it
-	 * TODO: make this a best-fit, not first-fit */
-	for (i = 0; i < ((PAGESIZE / KMALLOC_BITMAPSIZE) - sz); i++) {
-		/* build a pointer */
-		ptr = (uint8_t*)FIX_ADDR (chunk->address + i);
-
-		/* got space here? */
-		if (!*ptr) {
-			/* yes. check for more space */
-			numavail = 1;
-			for (j = 1; j < sz; j++) {
-				/* build a pointer */
-				tmptr = (uint8_t*)FIX_ADDR (chunk->address + i + (j / 8));
-
-				/* available? */
-				if (!*tmptr)
-					/* yes. increment the count */
-					numavail++;
-			}
+	*len = bestlen;
+	return best;
+}
 
-			/* got enough space? */
-			if (numavail == sz)
-				/* yes. use it */
+/*
+ * This will allocate [size] bytes for thread [t] with flags [flags]. It will
+ * return a pointer to the memory on success or NULL on failure.
+ *
+ * The allocation is placed in the smallest free run of entries which will
+ * hold it, over all bitmap chunks of [t]; a new chunk is only taken if none
+ * of them has such a run.
+ */
+void*
+kmalloc_bitmap (struct THREAD* t, size_t size, uint32_t flags) {
+	struct KMALLOC_CHUNK* chunk;
+	struct KMALLOC_CHUNK* best = NULL;
+	struct KMALLOC_BITMAP* bm;
+	size_t sz, len, bestlen = 0;
+	int pos, bestpos = 0;
+
+	/* ensure it fits in a bitmap chunk */
+	ASSERT (size <= KMALLOC_BITMAP_MAX);
+
+	/* calculate space in bitmap entries */
+	sz = (size + KMALLOC_BITMAPSIZE - 1) / KMALLOC_BITMAPSIZE;
+
+	/* wade through all bitmap chunks of this thread */
+	for (chunk = kmalloc_bitmaps; chunk != NULL; chunk = chunk->next) {
+		/* can this one possibly hold it? */
+		if ((chunk->thread != t) || (chunk->chain_bitmap.bitmap_left < sz))
+			/* no. skip it */
+			continue;
+
+		/* does it have a better run? */
+		pos = kmalloc_bitmap_fit ((struct KMALLOC_BITMAP*)FIX_ADDR (chunk->address), sz, &len);
+		if ((pos >= 0) && ((best == NULL) || (len < bestlen))) {
+			/* yes. remember it */
+			best = chunk; bestpos = pos; bestlen = len;
+
+			/* can't do better than an exact fit */
+			if (len == sz)
 				break;
 		}
 	}
 
-	/* found a match? */
-	if (numavail != sz) {
-		/* no. too bad XXX: shouldn't panic? */
-		panic ("kmalloc_bitmap(): out of memory!\n");
-	}
+	/* got a spot? */
+	if (best == NULL) {
+		/* no. build a new chunk */
+		best = kmalloc_pages (t, 1);
+		if (best == NULL)
+			/* out of memory! */
+			return NULL;
 
-	/* mark all pages as used */
-	tmptr = ptr;
-#ifdef KMALLOC_DEBUG_BITMAP
-	kprintf ("kmalloc_bitmap(): placing at chunk 0x%x, pos %x\n", chunk, i);
-#endif /* KMALLOC_DEBUG_BITMAP */
-	for (j = 0; j < sz; j++) {
-		/* build a pointer */
-		ptr = (uint8_t*)FIX_ADDR (chunk->address + i);
+		/* set the chunk up */
+		best->flags = KMALLOC_CFLAGS_USED | KMALLOC_CFLAGS_BITMAP;
+		best->chain_bitmap.bitmap_left = KMALLOC_BITMAP_SLOTS - KMALLOC_BITMAP_HDR;
+		KLIST_LINK (&kmalloc_bitmaps, best);
+
+		/* clear the bitmaps, and keep the entries they occupy */
+		bm = (struct KMALLOC_BITMAP*)FIX_ADDR (best->address);
+		kmemset (bm, 0, sizeof (struct KMALLOC_BITMAP));
+		kmalloc_bitmap_mark (bm->used, 0, KMALLOC_BITMAP_HDR, 1);
+		bestpos = KMALLOC_BITMAP_HDR;
+	}
 
-		/* mark it as used */
-		*ptr = (sz - j);
+	/* claim the entries */
+	bm = (struct KMALLOC_BITMAP*)FIX_ADDR (best->address);
+	kmalloc_bitmap_mark (bm->used, bestpos, sz, 1);
+	kmalloc_bitmap_mark (bm->last, bestpos + sz - 1, 1, 1);
+	best->chain_bitmap.bitmap_left -= sz;
 
-		/* next */
-		i++;
-	}
-	i -= j;
-
-	/* update statistics */
-	chunk->chain_bitmap.bitmap_left -= sz;
-
-	/* return the pointer */
-#ifdef KMALLOC_DEBUG_BITMAP
-	kprintf ("kmalloc_bitmap(): size=%u sz=%u -> 0x%x\n", size, sz,
-	         FIX_ADDR (chunk->address +
-	                   (PAGESIZE / KMALLOC_BITMAPSIZE) + (i * KMALLOC_BITMAPSIZE)
-						        ));
-#endif /* KMALLOC_DEBUG_BITMAP */
-	return (void*) FIX_ADDR (chunk->address +
-	                   (PAGESIZE / KMALLOC_BITMAPSIZE) + (i * KMALLOC_BITMAPSIZE)
-						        );
-	
-/* XXX?
-		FIX_ADDR (chunk->address + ((1 + i - sz) * KMALLOC_BITMAPSIZE));
-		*/
+	return (void*)FIX_ADDR (best->address + (bestpos * KMALLOC_BITMAPSIZE));
 }
 
 /*
@@ -339,18 +505,16 @@ kmalloc_bitmap (struct THREAD* t, size_t size, uint32_t flags) {
  */
 void*
 kmalloc (struct THREAD* t, size_t size, uint32_t flags) {
-	struct KMALLOC_REGION* reg;
 	struct KMALLOC_CHUNK* chunk;
-	struct KMALLOC_CHUNK* tmpchunk;
-	size_t sz, i, j, numavail;
+	size_t sz;
 
 	/* need to allocate zero bytes? */
 	if (!size)
 		/* yes. return a NULL pointer, it has room for 0 bytes :) */
 		return NULL;
 
-	/* do we have at least a full page? */
-	if (size < PAGESIZE) {
+	/* does it fit in a bitmap chunk? */
+	if (size <= KMALLOC_BITMAP_MAX) {
 		/* yes. handle it */
 		return kmalloc_bitmap (t, size, flags);
 	}
@@ -360,70 +524,12 @@ kmalloc (struct THREAD* t, size_t size, uint32_t flags) {
 	if (size % PAGESIZE)
 		sz++;
 
-	/* find the best fit region */
-	reg = kmalloc_check_best_fit (sz);
-	if (reg == NULL)
+	/* fetch them */
+	chunk = kmalloc_pages (t, sz);
+	if (chunk == NULL)
 		/* no space. return */
 		return NULL;
 
-	/* there is space here. wade through the chunks */
-	for (i = 0; i < (reg->numchunks - sz); i++) {
-		/* fetch the chunk */
-		chunk = (struct KMALLOC_CHUNK*)FIX_ADDR (reg->address +
-                                             sizeof (struct KMALLOC_REGION) +
-		                                         (i * sizeof (struct KMALLOC_CHUNK)));
-
-		/* available chunk? */
-		if (!(chunk->flags & KMALLOC_CFLAGS_USED)) {
-			/* yes. ensure the chunk fits here */
-			tmpchunk = chunk; tmpchunk++; numavail = 1;
-			for (j = 0; j < (sz - 1); j++) {
-				/* count the number of chunks needed */
-				if (!(tmpchunk->flags & KMALLOC_CFLAGS_USED))
-					numavail++;
-
-				/* next chunk */
-				tmpchunk++;
-			}
-			
-			/* enough available chunks? */
-			if (numavail == sz)
-				/* yes. bail out */
-				break;
-		}
-	}
-
-	/* got a row of chunks? */
-	if (numavail != sz) {
-		/* no. too bad */
-		/* XXX */ panic ("kmalloc(): out of memory\n"); /* XXX */
-		return NULL;
-	}
-
-	/* mark the head chunk */
-	chunk->flags = KMALLOC_CFLAGS_USED;
-	chunk->thread = t;
-	chunk->chain_bitmap.chain = sz;
-
-	/* mark other blocks as used too */
-	tmpchunk = chunk; tmpchunk++;
-	for (i = 0; i < sz; i++) {
-#ifdef KMALLOC_DEBUG
-		/*kprintf ("kmalloc(): got chunk 0x%x\n", tmpchunk);*/
-#endif /* KMALLOC_DEBUG */
-
-		/* mark this block as used */
-		tmpchunk->flags = KMALLOC_CFLAGS_USED;
-		tmpchunk->thread = t;
-		tmpchunk->chain_bitmap.chain = -1;
-
-		/* next */
-		tmpchunk++;
-	}
-
-	/* update statistics */
-	reg->avail -= sz;
-
 	/* return the address of the first block */
 #ifdef KMALLOC_DEBUG
 	kprintf ("kmalloc(): size=0x%x, sz=0x%x -> %x\n", size, sz, FIX_ADDR (chunk->address));
@@ -438,31 +544,19 @@ kmalloc (struct THREAD* t, size_t size, uint32_t flags) {
  */
 int
 kfindptr (addr_t addr, struct KMALLOC_CHUNK** ochunk, struct KMALLOC_REGION** oreg) {
-	struct KMALLOC_CHUNK* chunk;
-	struct KMALLOC_REGION* region = root_region;
-	size_t i;
+	struct KMALLOC_REGION* region;
+	addr_t first;
 
 	/* scan all regions */
-	while (region) {
-		/* fetch the chunk */
-		for (i = 0; i < region->numchunks; i++) {
-			/* build a pointer */
-			chunk = (struct KMALLOC_CHUNK*)FIX_ADDR (region->address +
-																							 sizeof (struct KMALLOC_REGION) +
-																							 (i * sizeof (struct KMALLOC_CHUNK)));
-
-			/* is the memory within this chunk? */
-			if ((addr >= FIX_ADDR (chunk->address)) && (addr <= (FIX_ADDR (chunk->address) + PAGESIZE - 1))) {
-				/* yes. return the region and chunk */
-				*oreg = region;
-				*ochunk = chunk;
-				return 1;
-			}
+	for (region = root_region; region != NULL; region = region->next) {
+		/* is the memory within this region? */
+		first = FIX_ADDR (region->chunk->address);
+		if ((addr >= first) && ((addr - first) / PAGESIZE < region->numchunks)) {
+			/* yes. return the region and chunk */
+			*oreg = region;
+			*ochunk = &region->chunk[(addr - first) / PAGESIZE];
+			return 1;
 		}
-
-		/* next */
-		region = region->next;
-		return 0;
 	}
 
 	/* sorry */
@@ -474,47 +568,33 @@ kfindptr (addr_t addr, struct KMALLOC_CHUNK** ochunk, struct KMALLOC_REGION** or
  */
 void
 kfree_bitmap (addr_t addr, struct KMALLOC_REGION* region, struct KMALLOC_CHUNK* chunk) {
-	addr_t bitmap_no = (addr - FIX_ADDR (chunk->address) - (PAGESIZE / KMALLOC_BITMAPSIZE)) / KMALLOC_BITMAPSIZE;
-	size_t count = 1;
-	uint8_t* ptr;
-
-#ifdef KMALLOC_DEBUG_BITMAP
-	kprintf ("kfree_bitmap(): addr = %x, chunk->addr = 0x%x, bitmap_no = %x\n", addr, chunk->address, bitmap_no);
-#endif /* KMALLOC_DEBUG_BITMAP */
-
-	/* walk through the bitmap */
-	while (1) {
-		/* build a pointer */
-		ptr = (uint8_t*)FIX_ADDR (chunk->address + bitmap_no);
-
-		/* final one? */
-		if (*ptr == 1)
-			/* yes. leave */
-			break;
-
-		/* clear it */
-		*ptr = 0;
-
-		/* next */
-		count++; bitmap_no++;
+	struct KMALLOC_BITMAP* bm = (struct KMALLOC_BITMAP*)FIX_ADDR (chunk->address);
+	int pos = (addr - FIX_ADDR (chunk->address)) / KMALLOC_BITMAPSIZE;
+	int last;
+
+	/* is this the start of an allocation? */
+	if (((addr - FIX_ADDR (chunk->address)) % KMALLOC_BITMAPSIZE) ||
+			(pos < KMALLOC_BITMAP_HDR) || !kmalloc_bitmap_test (bm->used, pos) ||
+			((pos > KMALLOC_BITMAP_HDR) && kmalloc_bitmap_test (bm->used, pos - 1) &&
+			 !kmalloc_bitmap_test (bm->last, pos - 1))) {
+		/* no. moan */
+		kprintf ("kfree(): warning: attempt to free unallocated address 0x%x\n", addr);
+		return;
 	}
 
-	/* zap the final one */
-	*ptr = 0;
+	/* release everything up to the final entry */
+	last = kmalloc_bitmap_scan (bm->last, pos, 1);
+	kmalloc_bitmap_mark (bm->used, pos, last - pos + 1, 0);
+	kmalloc_bitmap_mark (bm->last, last, 1, 0);
 
 	/* update the statistics */
-	chunk->chain_bitmap.bitmap_left += count;
+	chunk->chain_bitmap.bitmap_left += last - pos + 1;
 
 	/* freed an entire chunk? */
-	if (chunk->chain_bitmap.bitmap_left == (PAGESIZE / KMALLOC_BITMAPSIZE) - ((PAGESIZE / KMALLOC_BITMAPSIZE) / KMALLOC_BITMAPSIZE)) {
+	if (chunk->chain_bitmap.bitmap_left == KMALLOC_BITMAP_SLOTS - KMALLOC_BITMAP_HDR) {
 		/* yes. free the chunk as well */
-#ifdef KMALLOC_DEBUG_BITMAP
-	kprintf ("kfree_bitmap(): chunk %x is unused, freeing\n", chunk);
-#endif /* KMALLOC_DEBUG_BITMAP */
-		chunk->flags = 0;
-
-		/* update the statistics */
-		region->avail++;
+		KLIST_UNLINK (&kmalloc_bitmaps, chunk);
+		kmalloc_free_range (region, chunk - region->chunk, 1);
 	}
 }
 
@@ -526,7 +606,6 @@ kfree (void* ptr) {
 	addr_t addr = (addr_t)ptr;
 	struct KMALLOC_CHUNK* chunk;
 	struct KMALLOC_REGION* region;
-	size_t numleft;
 
 	/* scan for the region in which this block resides */
 	if (!kfindptr (addr, &chunk, &region)) {
@@ -549,31 +628,18 @@ kfree (void* ptr) {
 	}
 	
 #ifdef KMALLOC_DEBUG
-	kprintf ("kfree(): freeing chunk %x, %x total\n", chunk, chunk->chain);
+	kprintf ("kfree(): freeing chunk %x, %x total\n", chunk, chunk->chain_bitmap.chain);
 #endif /* KMALLOC_DEBUG */
-	
+
 	/* is this the first block in the chain? */
-	if (chunk->chain_bitmap.chain == -1) {
+	if (addr != FIX_ADDR (chunk->address)) {
 		/* no. complain */
 		kprintf ("kfree(): attempt to free chained block %x!\n", addr);
 		return;
 	}
 
-	/* just free this chunk and all linked blocks */
-	numleft = chunk->chain_bitmap.chain;
-	while (numleft--) {
-		/* ensure this chunk is allocated */
-		ASSERT ((chunk->flags & KMALLOC_CFLAGS_USED) != 0);
-
-		/* mark it as available */
-		chunk->flags = 0;
-
-		/* update the statistics */
-		region->avail++;
-
-		/* next */
-		chunk++;
-	}
+	/* hand the pages back */
+	kmalloc_free_range (region, chunk - region->chunk, chunk->chain_bitmap.chain);
 }
 
 /* vim:set ts=2 sw=2: */
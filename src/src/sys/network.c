@@ -6,105 +6,444 @@
  *
  */
 #include <sys/network.h>
+#include <sys/device.h>
 #include <sys/tty.h>
 #include <sys/kmalloc.h>
+#include <sys/prof.h>
+#include <sys/qdisc.h>
+#include <sys/shaper.h>
 #include <lib/lib.h>
 #include <md/interrupts.h>
+#include <net/bench.h>
+#include <netipv4/cksum.h>
+#include <netipv4/route.h>
 #include <assert.h>
 #include <config.h>
 
 struct NETPACKET* network_netpacket;
-struct NETPACKET* netpacket_first_avail;
-struct NETPACKET* netpacket_last_avail;
-struct NETPACKET* netpacket_todo_first;
-struct NETPACKET* netpacket_todo_last;
+char* network_payload;
+struct NETPOOL network_pool[NETWORK_MAX_POOLS];
 
-int ipv4_handle_packet (struct NETPACKET* np);
+/* network_frames is the first frame, aligned to a cache line */
+static char* network_frames;
 
+int ipv4_handle_packet (struct NETPACKET* np);
+static void network_pool_put (struct NETPOOL* pool, struct NETPACKET* pkt);
+static void network_xmit_run (struct DEVICE* dev);
+
+/* packets dropped for which no device is known */
+uint32_t network_drops[NETWORK_DROP_MAX];
+
+/* network_drop_reason describes every NETWORK_DROP_xxx reason */
+char* network_drop_reason[NETWORK_DROP_MAX] = {
+	"out of buffers",
+	"receive queue full",
+	"transmit queue full",
+	"receive error",
+	"unsupported protocol",
+	"malformed header",
+	"bad checksum",
+	"not for us",
+	"ttl expired",
+	"no route",
+	"next hop unresolved",
+	"port unreachable",
+	"queueing delay too long",
+	"filtered"
+};
+
+/* network_numbuffers buffers are set up, out of network_maxbuffers */
 int network_numbuffers = 0;
+int network_maxbuffers = 0;
+int network_poll_budget = NETWORK_POLL_BUDGET;
+
+/*
+ * This will set up to [num] more packet buffers. Short reservations are
+ * topped up first; the rest goes to the shared pool.
+ */
+static void
+network_pool_add (uint32_t num) {
+	struct NETPACKET* pkt;
+	char* frame;
+	uint32_t i;
+	int oldints;
+
+	if (num > network_maxbuffers - network_numbuffers)
+		num = network_maxbuffers - network_numbuffers;
+
+	/*
+	 * Hand every packet its frame. As the stride isn't a multiple of the page
+	 * size, successive frames start in different cache sets instead of all
+	 * competing for the same few. Only the fields network_alloc_packet()
+	 * doesn't set up need a value; the frames aren't touched at all.
+	 */
+	pkt = &network_netpacket[network_numbuffers];
+	frame = network_frames + (network_numbuffers * NETWORK_FRAME_STRIDE);
+	for (i = 0; i < num; i++, pkt++, frame += NETWORK_FRAME_STRIDE) {
+		pkt->frame = frame;
+		pkt->device = NULL;
+		pkt->pool = NULL;
+		pkt->type = NETPACKET_TYPE_RECV;
+	}
+
+	/*
+	 * Put them on the stack of shared packets. The first packets are pushed
+	 * last, so they will be used first.
+	 */
+	oldints = arch_interrupts (DISABLE);
+	for (i = num; i > 0; i--)
+		network_pool_put (NETWORK_SHARED_POOL, &network_netpacket[network_numbuffers + i - 1]);
+	network_numbuffers += num;
+	arch_interrupts (oldints);
+
+	/* let the reservations have their share */
+	for (i = 1; i < NETWORK_MAX_POOLS; i++)
+		if ((network_pool[i].device != NULL) &&
+				(network_pool[i].avail < network_pool[i].reserve))
+			network_pool_reserve (&network_pool[i], network_pool[i].reserve);
+}
+
+/*
+ * This will set up more packet buffers if the shared pool is running low and
+ * there is room for them. It is called from the main loop, so the work of
+ * setting up the pool is spread out instead of delaying the boot.
+ */
+void
+network_pool_grow() {
+	/* anything to do? */
+	if ((NETWORK_SHARED_POOL->avail >= NETWORK_POOL_LOW) ||
+			(network_numbuffers == network_maxbuffers))
+		/* no. leave */
+		return;
+
+	network_pool_add (NETWORK_POOL_GROW);
+}
 
 /*
- * This will initialize the networking system.
+ * This will initialize the networking system. Room is made for as many
+ * buffers as memory allows, but only NETWORK_POOL_INITIAL of them are set up
+ * right away; network_pool_grow() takes care of the rest once they are
+ * needed.
  */
 void
 network_init() {
-	uint32_t i;
 	size_t total, avail;
-	struct NETPACKET* pkt;
-	struct NETPACKET* pkt_next;
 
 	/* figure out how much memory we have left */
 	kmemstats (&total, &avail);
 
-	/* do we have loads of free memory (> 2MB)? */
-	if (avail > (2048 * 1024))
+	/*
+	 * Do we have loads of free memory? The FIB only grows once routes are
+	 * added, so its budget has to be kept apart as well.
+	 */
+	if (avail > (NETWORK_RESERVE + ROUTE_FIB_BUDGET))
 		/* yes. use most of the memory for packet buffers */
-		network_numbuffers = (avail - (2048 * 1024)) / sizeof (struct NETPACKET);
+		network_maxbuffers = (avail - (NETWORK_RESERVE + ROUTE_FIB_BUDGET)) / (sizeof (struct NETPACKET) + NETWORK_FRAME_STRIDE);
 	else
 		/*  no. economy mode: use only 64 buffers */
-		network_numbuffers = 64;
+		network_maxbuffers = 64;
 
-	/* allocate memory */
-	network_netpacket = (struct NETPACKET*)kmalloc (NULL, (sizeof (struct NETPACKET) * network_numbuffers), 0);
+	/*
+	 * Allocate memory. The packet administration is kept apart from the
+	 * frames, so that walking it doesn't push the headers out of the cache.
+	 */
+	for (;;) {
+		network_netpacket = (struct NETPACKET*)kmalloc (NULL, (sizeof (struct NETPACKET) * network_maxbuffers), 0);
+		network_payload = (char*)kmalloc (NULL, (NETWORK_FRAME_STRIDE * network_maxbuffers) + NETWORK_CACHE_LINE, 0);
+		if ((network_netpacket != NULL) && (network_payload != NULL))
+			break;
+
+		/* tone network buffers down */
+		if (network_netpacket != NULL)
+			kfree (network_netpacket);
+		if (network_payload != NULL)
+			kfree (network_payload);
 
-	/* tone network buffers down if needed */
-	while (network_netpacket == NULL) {
 		/* got buffers? */
-		if (network_numbuffers < 16)
+		if (network_maxbuffers < 16)
 			/* barely. complain */
 			panic ("Unable to allocate reasonable amount of packet buffers");
 	
 		/* halve them */	
-		network_numbuffers /= 2;
-
-		/* give this a try */
-		network_netpacket = (struct NETPACKET*)kmalloc (NULL, (sizeof (struct NETPACKET) * network_numbuffers), 0);
+		network_maxbuffers /= 2;
 	}
+	network_frames = (char*)(((addr_t)network_payload + NETWORK_CACHE_LINE - 1) & ~(NETWORK_CACHE_LINE - 1));
+
+	/* no pools are in use yet */
+	kmemset (network_pool, 0, sizeof (struct NETPOOL) * NETWORK_MAX_POOLS);
+
+	/* set up the first buffers; they all start out as shared */
+	network_numbuffers = 0;
+	network_pool_add (NETWORK_POOL_INITIAL);
+}
 
-	/* zero them out */
-	kmemset (network_netpacket, 0, (sizeof (struct NETPACKET) * network_numbuffers));
+/*
+ * This will fetch the most recently freed packet from pool [pool], or return
+ * NULL if it is empty. Interrupts must be disabled.
+ */
+static struct NETPACKET*
+network_pool_get (struct NETPOOL* pool) {
+	struct NETPACKET* pkt = pool->first;
 
-	/* set the pointer to the first available netpacket */
-	netpacket_first_avail = network_netpacket;
+	if (pkt == NULL)
+		return NULL;
 
-	/* build the chain of network packets */
-	pkt = network_netpacket; pkt_next = pkt; pkt_next++;
-	for (i = 0; i < network_numbuffers - 1; i++, pkt++, pkt_next++)
-		pkt->next = pkt_next;
-	netpacket_last_avail = pkt;
+	pool->first = pkt->next;
+	pool->avail--;
 	pkt->next = NULL;
+	return pkt;
+}
+
+/*
+ * This will return packet [pkt] to pool [pool]. It goes on top, as its frame
+ * is the most likely to still be cached. Interrupts must be disabled.
+ */
+static void
+network_pool_put (struct NETPOOL* pool, struct NETPACKET* pkt) {
+	pkt->next = pool->first;
+	pool->first = pkt;
+	pool->avail++;
+}
+
+/*
+ * This will give packet [pkt] back to the pool it belongs to: if the
+ * reservation of the pool it was allocated for is short, it is returned
+ * there, otherwise it goes to the shared pool. Interrupts must be disabled.
+ */
+static void
+network_pool_release (struct NETPACKET* pkt) {
+	struct NETPOOL* pool = pkt->pool;
+
+	if ((pool == NULL) || (pool->avail >= pool->reserve))
+		pool = NETWORK_SHARED_POOL;
+
+	pkt->device = NULL;
+	network_pool_put (pool, pkt);
+}
+
+/*
+ * This will set the reservation of pool [pool] to [num] packets, moving
+ * buffers between the shared pool and [pool] as needed. If the shared pool
+ * cannot supply them all right now, the reservation is filled as packets are
+ * freed.
+ */
+void
+network_pool_reserve (struct NETPOOL* pool, uint32_t num) {
+	struct NETPACKET* pkt;
+	int oldints = arch_interrupts (DISABLE);
+
+	pool->reserve = num;
+
+	/* return any excess buffers */
+	while (pool->avail > pool->reserve) {
+		pkt = network_pool_get (pool);
+		network_pool_put (NETWORK_SHARED_POOL, pkt);
+	}
+
+	/* take what we are missing */
+	while (pool->avail < pool->reserve) {
+		pkt = network_pool_get (NETWORK_SHARED_POOL);
+		if (pkt == NULL)
+			break;
+		network_pool_put (pool, pkt);
+	}
+
+	arch_interrupts (oldints);
+}
+
+/*
+ * This will hand device [dev] a pool with the default reservation. It will
+ * return zero on failure or non-zero on success.
+ */
+int
+network_pool_attach (struct DEVICE* dev) {
+	struct NETPOOL* pool;
+	uint32_t num;
+	int i;
+
+	/* find an unused pool; the shared pool is never handed out */
+	for (i = 1; i < NETWORK_MAX_POOLS; i++)
+		if (network_pool[i].device == NULL)
+			break;
+	if (i == NETWORK_MAX_POOLS)
+		return 0;
+	pool = &network_pool[i];
+
+	/* don't let the reservations take more than their share */
+	num = network_maxbuffers / NETWORK_MAX_POOLS;
+	if (num > NETWORK_POOL_RESERVE)
+		num = NETWORK_POOL_RESERVE;
+
+	pool->device = dev;
+	pool->failures = 0;
+	dev->pool = pool;
+	network_pool_reserve (pool, num);
+	return 1;
+}
+
+/*
+ * This will take the pool away from device [dev], returning its buffers to
+ * the shared pool. Packets still in flight will be freed to the shared pool.
+ */
+void
+network_pool_detach (struct DEVICE* dev) {
+	struct NETPOOL* pool = dev->pool;
+
+	if (pool == NULL)
+		return;
+
+	network_pool_reserve (pool, 0);
+	pool->device = NULL;
+	dev->pool = NULL;
+}
+
+/*
+ * This will account for a packet of device [dev] being dropped because of
+ * [reason]. [dev] may be NULL if the device isn't known.
+ */
+void
+network_drop (struct DEVICE* dev, int reason) {
+	if (dev != NULL)
+		dev->drops[reason]++;
+	else
+		network_drops[reason]++;
+}
+
+/*
+ * This will reset all drop counters.
+ */
+void
+network_drop_reset() {
+	struct DEVICE* dev;
+
+	kmemset (network_drops, 0, sizeof (network_drops));
+	for (dev = coredevice; dev != NULL; dev = dev->next)
+		kmemset (dev->drops, 0, sizeof (dev->drops));
+}
+
+/*
+ * This will initialize ring [ring] to hold [size] packets, which must be a
+ * power of two. It will return zero on failure or non-zero on success.
+ */
+int
+network_ring_init (struct NETRING* ring, uint32_t size) {
+	ring->slot = (struct NETPACKET**)kmalloc (NULL, sizeof (struct NETPACKET*) * size, 0);
+	if (ring->slot == NULL)
+		return 0;
+
+	ring->head = 0; ring->tail = 0;
+	ring->mask = size - 1;
+	ring->drops = 0;
+	return 1;
+}
+
+/*
+ * This will free ring [ring], along with any packets still on it.
+ */
+void
+network_ring_destroy (struct NETRING* ring) {
+	struct NETPACKET* pkt;
+
+	if (ring->slot == NULL)
+		return;
+
+	while ((pkt = network_ring_get (ring)) != NULL)
+		network_free_packet (pkt);
 
-	/* nothing to do, yet */
-	netpacket_todo_first = NULL;
-	netpacket_todo_last = NULL;
+	kfree (ring->slot);
+	ring->slot = NULL;
 }
 
 /*
- * This will return a pointer to a new NETPACKET for device [dev]. It will
+ * This will add packet [pkt] to ring [ring]. This may only be called by the
+ * producer of the ring. It will return zero if the ring is full, in which
+ * case the caller still owns the packet, or non-zero on success.
+ */
+int
+network_ring_put (struct NETRING* ring, struct NETPACKET* pkt) {
+	uint32_t head = ring->head;
+
+	/* room left? */
+	if (head - ring->tail > ring->mask) {
+		/* no. too bad */
+		ring->drops++;
+		return 0;
+	}
+
+	/* store the packet before the consumer can see it */
+	ring->slot[head & ring->mask] = pkt;
+	arch_barrier();
+	ring->head = head + 1;
+	return 1;
+}
+
+/*
+ * This will remove the oldest packet from ring [ring] and return it, or NULL
+ * if the ring is empty. This may only be called by the consumer of the ring.
+ */
+struct NETPACKET*
+network_ring_get (struct NETRING* ring) {
+	uint32_t tail = ring->tail;
+	struct NETPACKET* pkt;
+
+	/* anything there? */
+	if (tail == ring->head)
+		return NULL;
+
+	/* fetch the packet before the producer can reuse the slot */
+	arch_barrier();
+	pkt = ring->slot[tail & ring->mask];
+	arch_barrier();
+	ring->tail = tail + 1;
+	return pkt;
+}
+
+/*
+ * This will return the number of packets on ring [ring].
+ */
+uint32_t
+network_ring_count (struct NETRING* ring) {
+	return ring->head - ring->tail;
+}
+
+/*
+ * This will return a pointer to a new NETPACKET for device [dev]. The
+ * device's reservation is used first, and the shared pool after that. It will
  * return a pointer to it on success or NULL on failure.
  */
 struct NETPACKET*
 network_alloc_packet (struct DEVICE* dev) {
-	struct NETPACKET* pkt;
+	struct NETPACKET* pkt = NULL;
+	struct NETPOOL* pool = (dev != NULL) ? dev->pool : NULL;
 	int old_ints = arch_interrupts (DISABLE);
-	
+
+	/* try our own reservation first */
+	if (pool != NULL)
+		pkt = network_pool_get (pool);
+
 	/* got an available network packet? */
-	if (netpacket_first_avail == NULL) {
-		/* no. restore interrupts and bail out */
+	if (pkt == NULL)
+		pkt = network_pool_get (NETWORK_SHARED_POOL);
+	if (pkt == NULL) {
+		/* no. account for this, restore interrupts and bail out */
+		if (pool == NULL)
+			pool = NETWORK_SHARED_POOL;
+		pool->failures++;
+		network_drop (dev, NETWORK_DROP_NOBUF);
 		arch_interrupts (old_ints);
 		return NULL;
 	}
 
-	/* use this network packet */
-	pkt = netpacket_first_avail;
-	netpacket_first_avail = pkt->next;
-	pkt->next = NULL;
+	/* use this network packet; it will refill our reservation once freed */
 	pkt->device = dev;
+	pkt->pool = pool;
 
 	/* set up internal pointers in this packet */
 	pkt->data = pkt->frame + sizeof (ETHERNET_HEADER);
 	pkt->header_len = sizeof (ETHERNET_HEADER);
 	pkt->len = 0;
+	pkt->cksum = 0;
+	pkt->cksum_len = 0;
 
 	/* restore the interrupts */
 	arch_interrupts (old_ints);
@@ -113,6 +452,35 @@ network_alloc_packet (struct DEVICE* dev) {
 	return pkt;
 }
 
+/*
+ * This will copy [len] bytes of a received frame from [src] to [offset] in
+ * the frame of packet [pkt]. Everything past the ethernet header is
+ * checksummed while being copied, so the protocols need not walk the data
+ * again to verify it. Frames may be copied in pieces, as long as they are
+ * copied in order.
+ */
+void
+network_copy_frame (struct NETPACKET* pkt, int offset, const void* src, int len) {
+	const char* s = (const char*)src;
+	int n;
+
+	/* the ethernet header isn't covered by any checksum */
+	if (offset < sizeof (ETHERNET_HEADER)) {
+		n = sizeof (ETHERNET_HEADER) - offset;
+		if (n > len)
+			n = len;
+		kmemcpy (pkt->frame + offset, s, n);
+		offset += n; s += n; len -= n;
+		pkt->cksum = 0;
+		pkt->cksum_len = 0;
+	}
+	if (len <= 0)
+		return;
+
+	pkt->cksum = ipv4_cksum_combine (pkt->cksum, ipv4_cksum_copy (pkt->frame + offset, s, len, 0), offset - sizeof (ETHERNET_HEADER));
+	pkt->cksum_len += len;
+}
+
 /*
  * This will free packet [pkt].
  */
@@ -120,43 +488,49 @@ void
 network_free_packet (struct NETPACKET* pkt) {
 	int old_ints = arch_interrupts (DISABLE);
 
-	/* put this packet as first in the chain of free netpackets */
-	netpacket_last_avail->next = pkt;
-	pkt->device = NULL;
-	pkt->next = NULL;
-
-	/* we got a new last packet */
-	netpacket_last_avail = pkt;
+	/* hand it back */
+	network_pool_release (pkt);
 
 	/* restore interrupts */
 	arch_interrupts (old_ints);
 }
 
 /*
- * This will enqueue packet [pkt] for handling.
+ * This will free the chain of packets from [first] up to and including
+ * [last], which must be linked using their [next] fields.
  */
 void
-network_queue_packet (struct NETPACKET* pkt) {
-	int old_ints = arch_interrupts (DISABLE);
+network_free_chain (struct NETPACKET* first, struct NETPACKET* last) {
+	struct NETPACKET* pkt;
+	struct NETPACKET* next;
+	int old_ints;
+
+	/* hand them all back in one go */
+	old_ints = arch_interrupts (DISABLE);
+	last->next = NULL;
+	for (pkt = first; pkt != NULL; pkt = next) {
+		next = pkt->next;
+		network_pool_release (pkt);
+	}
+	arch_interrupts (old_ints);
+}
 
+/*
+ * This will enqueue packet [pkt], received by device [dev], for handling. If
+ * the device's queue is full, the packet is dropped. Every device must call
+ * this from a single context only.
+ */
+void
+network_queue_packet (struct DEVICE* dev, struct NETPACKET* pkt) {
 	/* update the header and data pointers */
 	pkt->header_len = sizeof (ETHERNET_HEADER);
 	pkt->data = (pkt->frame + sizeof (ETHERNET_HEADER));
 
-	/* got anything in the todo list ? */
-	if (netpacket_todo_first == NULL)
-		/* no. now, we do */
-		netpacket_todo_first = pkt;
-	else
-		/* yes. append it to the chain */
-		netpacket_todo_last->next = pkt;
-
-	/* build the chain ending */
-	netpacket_todo_last = pkt;
-	pkt->next = NULL;
-
-	/* restore interrupts */
-	arch_interrupts (old_ints);
+	/* hand it to the main loop */
+	if (!network_ring_put (&dev->rx_ring, pkt)) {
+		network_drop (dev, NETWORK_DROP_RXQUEUE);
+		network_free_packet (pkt);
+	}
 }
 
 /*
@@ -173,8 +547,15 @@ network_handle_packet (struct NETPACKET* pkt) {
 	 *
 	 * IF a handler returns NON-ZERO, it has handeled the packet. The packet
 	 * MUST be freed by the handler in such a case!
+	 *
+	 * Handlers account for the packets they drop using network_drop();
+	 * returning ZERO does not imply the packet was dropped.
 	 */
 
+	/* benchmark test frames are taken out first */
+	if ((bench_rxdev != NULL) && (bench_receive (pkt)))
+		return;
+
 	/* ipv4 it */
 	if (ipv4_handle_packet (pkt))
 		return;
@@ -184,27 +565,102 @@ network_handle_packet (struct NETPACKET* pkt) {
 }
 
 /*
- * This will handle all networking packets queue.
+ * This will do a single pass over the network: all devices in polling mode
+ * may fetch frames, after which up to [network_poll_budget] queued packets
+ * are handled, taking turns between the devices. Finally, devices with
+ * packets waiting for transmission are kicked. It will return the amount of
+ * work done, which is zero if there was nothing to do.
  */
-void
+int
 network_handle_queue() {
+	struct DEVICE* dev;
 	struct NETPACKET* pkt;
-	int oldints = arch_interrupts (DISABLE);
+	int left, busy, polling, share, done = 0;
 
-	/* got packets to do? */
-	if (netpacket_todo_first == NULL) {
-		/* no. bail out */
-		arch_interrupts (oldints);
-		return;
+	/* handle periodic protocol work */
+	ipv4_timers();
+	shaper_timers();
+
+	/* set up more buffers if we're running low */
+	network_pool_grow();
+
+	/*
+	 * Let the polling devices fetch their frames. Every device gets an equal
+	 * share of what is left of the budget, so a busy device can't starve the
+	 * ones after it; what a quiet device doesn't use goes to the next ones.
+	 */
+	polling = 0;
+	for (dev = coredevice; dev != NULL; dev = dev->next)
+		if ((dev->flags & DEVICE_FLAG_POLLING) && (dev->poll != NULL))
+			polling++;
+	left = network_poll_budget;
+	for (dev = coredevice; (dev != NULL) && (left > 0); dev = dev->next)
+		if ((dev->flags & DEVICE_FLAG_POLLING) && (dev->poll != NULL)) {
+			share = (left + polling - 1) / polling;
+			left -= dev->poll (dev, share);
+			polling--;
+		}
+	done = network_poll_budget - left;
+
+	/* handle a packet of every device in turn, up to our budget */
+	left = network_poll_budget;
+	do {
+		busy = 0;
+		for (dev = coredevice; (dev != NULL) && (left > 0); dev = dev->next) {
+			pkt = network_ring_get (&dev->rx_ring);
+			if (pkt == NULL)
+				continue;
+
+			/* handle this packet */
+			PROF (PROF_NET_HANDLE, network_handle_packet (pkt));
+			busy = 1; left--; done++;
+		}
+	} while (busy && (left > 0));
+
+	/* have the devices send what they can */
+	for (dev = coredevice; dev != NULL; dev = dev->next)
+		if (network_xmit_backlog (dev) != 0)
+			network_xmit_run (dev);
+
+	return done;
+}
+
+/*
+ * This will move packets from the queue of device [dev] to its transmit ring
+ * and have the device send them. Only a few packets are kept on the ring, so
+ * the queue decides the order in which flows get to send. The transmit
+ * functions are only called from the main loop, which makes it the sole
+ * producer of the transmit rings.
+ */
+static void
+network_xmit_run (struct DEVICE* dev) {
+	struct NETPACKET* pkt;
+
+	while (network_ring_count (&dev->tx_ring) < QDISC_TX_FILL) {
+		/* packets queued before the shaper was set up go first */
+		pkt = qdisc_dequeue (dev, dev->qdisc);
+		if ((pkt == NULL) && (dev->shaper != NULL))
+			pkt = shaper_dequeue (dev);
+		if (pkt == NULL)
+			break;
+		network_ring_put (&dev->tx_ring, pkt);
 	}
 
-	/* fetch the next packet */
-	pkt = netpacket_todo_first;
-	netpacket_todo_first = pkt->next;
-	arch_interrupts (oldints);
+	/* send */
+	if (network_ring_count (&dev->tx_ring) != 0)
+		PROF (PROF_DRV_TX, dev->xmit (dev));
+}
+
+/*
+ * This will return the number of packets device [dev] has waiting to be sent.
+ */
+uint32_t
+network_xmit_backlog (struct DEVICE* dev) {
+	uint32_t backlog = dev->qdisc->backlog + network_ring_count (&dev->tx_ring);
 
-	/* handle this packet */
-	network_handle_packet (pkt);
+	if (dev->shaper != NULL)
+		backlog += dev->shaper->backlog;
+	return backlog;
 }
 
 /*
@@ -213,25 +669,14 @@ network_handle_queue() {
  */
 void
 network_xmit_frame (struct DEVICE* dev, struct NETPACKET* pkt) {
-	int old_ints = arch_interrupts (DISABLE);
-
-	/* got anything in the todo list ? */
-	if (dev->xmit_packet_first == NULL)
-		/* no. now, we do */
-		dev->xmit_packet_first = pkt;
+	/* queue it; if the queue is full, some packet is dropped */
+	if (dev->shaper != NULL)
+		PROF (PROF_NET_XMIT, shaper_enqueue (dev, pkt));
 	else
-		/* yes. append it to the chain */
-		dev->xmit_packet_last->next = pkt;
-
-	/* build the chain ending */
-	dev->xmit_packet_last = pkt;
-	pkt->next = NULL;
-
-	/* restore interrupts */
-	arch_interrupts (old_ints);
+		PROF (PROF_NET_XMIT, qdisc_enqueue (dev, dev->qdisc, pkt));
 
 	/* send */
-	dev->xmit (dev);
+	network_xmit_run (dev);
 }
 
 /*
@@ -262,22 +707,7 @@ network_xmit_packet (struct DEVICE* dev, struct NETPACKET* pkt, void* addr) {
  */
 struct NETPACKET*
 network_get_next_txbuf (struct DEVICE* dev) {
-	int oldints = arch_interrupts (DISABLE);
-	struct NETPACKET* pkt = dev->xmit_packet_first;
-	
-	/* got a packet to transmit? */
-	if (pkt == NULL) {
-		/* no. too bad */
-		arch_interrupts (oldints);
-		return NULL;
-	}
-
-	/* change the pointer */
-	dev->xmit_packet_first = pkt->next;
-
-	/* return the packet */
-	arch_interrupts (oldints);
-	return pkt;
+	return network_ring_get (&dev->tx_ring);
 }
 
 /* vim:set ts=2 sw=2: */
@@ -0,0 +1,73 @@
+/*
+ * prof.c - ILIOS Packet Path Profiling
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This code will account the cycles spent in the stages of the packet path.
+ *
+ */
+#include <sys/types.h>
+#include <sys/prof.h>
+#include <lib/lib.h>
+#include <md/timer.h>
+
+struct PROF_STAGE prof_stage[PROF_MAX] = {
+	{ "driver receive", 0, 0 },
+	{ "network handling", 0, 0 },
+	{ "ip handling", 0, 0 },
+	{ "route lookup", 0, 0 },
+	{ "arp", 0, 0 },
+	{ "network transmit", 0, 0 },
+	{ "driver transmit", 0, 0 },
+	{ "packet filter", 0, 0 }
+};
+
+/*
+ * This will account the cycles since time stamp [start] to stage [stage].
+ */
+void
+prof_account (int stage, uint32_t start) {
+	struct PROF_STAGE* ps = &prof_stage[stage];
+
+	ps->cycles += (uint32_t)(arch_tsc_read32() - start);
+	ps->count++;
+}
+
+/*
+ * This will reset the accounting of all stages.
+ */
+void
+prof_reset() {
+	int i;
+
+	for (i = 0; i < PROF_MAX; i++) {
+		prof_stage[i].count = 0;
+		prof_stage[i].cycles = 0;
+	}
+}
+
+/*
+ * This will return [n] divided by [d], or 0xffffffff if the result doesn't
+ * fit. We have no 64 bit division, so do it the long way.
+ */
+uint32_t
+prof_div (unsigned long long n, uint32_t d) {
+	unsigned long long rem = 0;
+	uint32_t q = 0;
+	int i;
+
+	/* would it overflow? */
+	if ((d == 0) || ((n >> 32) >= d))
+		return 0xffffffff;
+
+	for (i = 63; i >= 0; i--) {
+		rem = (rem << 1) | ((n >> i) & 1);
+		q <<= 1;
+		if (rem >= d) {
+			rem -= d;
+			q |= 1;
+		}
+	}
+	return q;
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,378 @@
+/*
+ * qdisc.c - ILIOS Transmit Queueing
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This implements FQ-CoDel (RFC 8290) for the transmit side of the devices.
+ * Packets are spread over flow queues by a hash of their addresses and
+ * ports, and the flows take turns sending a quantum of bytes each. Within
+ * every flow, CoDel (RFC 8289) watches how long packets have waited, and
+ * starts dropping from the head once the delay has been above target for an
+ * entire interval. Drops then come faster and faster, with the square root
+ * of their number, until the delay is under control again.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/kmalloc.h>
+#include <sys/network.h>
+#include <sys/qdisc.h>
+#include <lib/lib.h>
+#include <md/timer.h>
+
+/*
+ * This will return the current time, in units of 1024 TSC cycles.
+ */
+static uint32_t
+qdisc_now() {
+	return (uint32_t)(arch_tsc_read() >> 10);
+}
+
+/*
+ * This will return non-zero if time [a] is at or after time [b].
+ */
+static int
+qdisc_after_eq (uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) >= 0;
+}
+
+/*
+ * This will return the integer square root of [x].
+ */
+static uint32_t
+qdisc_sqrt (uint32_t x) {
+	uint32_t root = 0, bit = 1 << 30;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit != 0) {
+		if (x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		} else
+			root >>= 1;
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+/*
+ * This will return when the drop after the one at time [t] is due for flow
+ * [f] of [qd]: the interval shrinks with the square root of the drop count.
+ */
+static uint32_t
+qdisc_control_law (struct QDISC* qd, struct QDISC_FLOW* f, uint32_t t) {
+	uint32_t count = (f->count < 0xffff) ? f->count : 0xffff;
+
+	/* the root of (count << 16) is that of [count] with 8 fraction bits */
+	return t + (qd->interval << 8) / qdisc_sqrt (count << 16);
+}
+
+/*
+ * This will append flow [f] to the list from [first] to [last].
+ */
+static void
+qdisc_list_append (struct QDISC_FLOW** first, struct QDISC_FLOW** last, struct QDISC_FLOW* f) {
+	f->next = NULL;
+	if (*first == NULL)
+		*first = f;
+	else
+		(*last)->next = f;
+	*last = f;
+}
+
+/*
+ * This will remove the first flow of the list from [first] to [last].
+ */
+static void
+qdisc_list_pop (struct QDISC_FLOW** first, struct QDISC_FLOW** last) {
+	*first = (*first)->next;
+	if (*first == NULL)
+		*last = NULL;
+}
+
+/*
+ * This will return the flow of [qd] packet [pkt] belongs to. IPv4 packets
+ * are told apart by addresses, protocol and, for TCP and UDP, ports; anything
+ * else only by its ethernet type.
+ */
+static struct QDISC_FLOW*
+qdisc_classify (struct QDISC* qd, struct NETPACKET* pkt) {
+	ETHERNET_HEADER* eh = (ETHERNET_HEADER*)pkt->frame;
+	uint8_t* ip = (uint8_t*)pkt->frame + pkt->header_len;
+	uint32_t h = qd->perturb ^ (eh->type[0] << 8) ^ eh->type[1];
+	uint32_t hlen;
+
+	/* IPv4 with a complete header? */
+	if ((eh->type[0] == 0x08) && (eh->type[1] == 0x00) && (pkt->len >= 20)) {
+		/* yes. mix in the addresses and the protocol */
+		h = (h ^ *(uint32_t*)(ip + 12)) * 2654435761U;
+		h = (h ^ *(uint32_t*)(ip + 16)) * 2654435761U;
+		h ^= ip[9];
+
+		/* first fragment of TCP or UDP? */
+		hlen = (ip[0] & 0xf) * 4;
+		if (((ip[9] == 6) || (ip[9] == 17)) && !(ip[6] & 0x1f) && !ip[7] &&
+				(pkt->len >= hlen + 4))
+			/* yes. mix in the ports */
+			h = (h * 2654435761U) ^ *(uint32_t*)(ip + hlen);
+	}
+
+	return &qd->flow[(h * 2654435761U) >> (32 - QDISC_FLOW_BITS)];
+}
+
+/*
+ * This will remove the first packet from flow [f] of [qd], or return NULL if
+ * the flow is empty.
+ */
+static struct NETPACKET*
+qdisc_pop (struct QDISC* qd, struct QDISC_FLOW* f) {
+	struct NETPACKET* pkt = f->first;
+
+	if (pkt == NULL)
+		return NULL;
+
+	f->first = pkt->next;
+	f->backlog -= pkt->len + pkt->header_len;
+	qd->backlog--;
+	pkt->next = NULL;
+	return pkt;
+}
+
+/*
+ * This will remove the first packet from flow [f] of [qd], and set
+ * [ok_to_drop] if the delay has been above target for long enough. It will
+ * return NULL if the flow is empty.
+ */
+static struct NETPACKET*
+qdisc_codel_pop (struct QDISC* qd, struct QDISC_FLOW* f, uint32_t now, int* ok_to_drop) {
+	struct NETPACKET* pkt = qdisc_pop (qd, f);
+
+	*ok_to_drop = 0;
+	if (pkt == NULL) {
+		/* nothing queued, so no delay either */
+		f->first_above = 0;
+		return NULL;
+	}
+
+	/* below target, or too little queued to be worth dropping? */
+	if ((now - pkt->tstamp < qd->target) || (f->backlog <= QDISC_QUANTUM))
+		/* yes. all is well */
+		f->first_above = 0;
+	else if (f->first_above == 0)
+		/* just went above target. see if it lasts an interval */
+		f->first_above = now + qd->interval;
+	else if (qdisc_after_eq (now, f->first_above))
+		/* it did. time to drop */
+		*ok_to_drop = 1;
+
+	return pkt;
+}
+
+/*
+ * This will drop packet [pkt] of queue [qd] of device [dev] because it waited
+ * too long.
+ */
+static void
+qdisc_drop_delay (struct DEVICE* dev, struct QDISC* qd, struct NETPACKET* pkt) {
+	qd->delay_drops++;
+	network_drop (dev, NETWORK_DROP_DELAY);
+	network_free_packet (pkt);
+}
+
+/*
+ * This will fetch the next packet of flow [f] of queue [qd] of device [dev]
+ * according to CoDel, dropping what waited too long. It will return NULL if
+ * nothing is left.
+ */
+static struct NETPACKET*
+qdisc_codel_dequeue (struct DEVICE* dev, struct QDISC* qd, struct QDISC_FLOW* f) {
+	uint32_t now = qdisc_now();
+	uint32_t delta;
+	struct NETPACKET* pkt;
+	int ok_to_drop;
+
+	pkt = qdisc_codel_pop (qd, f, now, &ok_to_drop);
+	if (f->dropping) {
+		/* dropping. stop if the delay is under control */
+		if (!ok_to_drop)
+			f->dropping = 0;
+
+		/* drop everything that is due */
+		while (f->dropping && qdisc_after_eq (now, f->drop_next)) {
+			qdisc_drop_delay (dev, qd, pkt);
+			f->count++;
+			pkt = qdisc_codel_pop (qd, f, now, &ok_to_drop);
+			if (!ok_to_drop)
+				f->dropping = 0;
+			else
+				f->drop_next = qdisc_control_law (qd, f, f->drop_next);
+		}
+	} else if (ok_to_drop) {
+		/* start dropping */
+		qdisc_drop_delay (dev, qd, pkt);
+		pkt = qdisc_codel_pop (qd, f, now, &ok_to_drop);
+		f->dropping = 1;
+
+		/* if we were dropping recently, pick up where we left off */
+		delta = f->count - f->lastcount;
+		if ((delta > 1) && ((int32_t)(now - f->drop_next) < (int32_t)(16 * qd->interval)))
+			f->count = delta;
+		else
+			f->count = 1;
+		f->lastcount = f->count;
+		f->drop_next = qdisc_control_law (qd, f, now);
+	}
+
+	return pkt;
+}
+
+/*
+ * This will create a transmit queue which holds at most [limit] packets. It
+ * will return NULL on failure.
+ */
+struct QDISC*
+qdisc_create (uint32_t limit) {
+	struct QDISC* qd = (struct QDISC*)kmalloc (NULL, sizeof (struct QDISC), 0);
+
+	if (qd == NULL)
+		return NULL;
+
+	kmemset (qd, 0, sizeof (struct QDISC));
+	qd->limit = limit;
+	qd->target = (QDISC_TARGET * arch_tsc_khz) >> 10;
+	qd->interval = (QDISC_INTERVAL * arch_tsc_khz) >> 10;
+	qd->perturb = (uint32_t)arch_tsc_read();
+
+	/* without a clock to go by, never drop because of the delay */
+	if (qd->target == 0)
+		qd->target = 0xffffffff;
+
+	return qd;
+}
+
+/*
+ * This will free transmit queue [qd], along with any packets still in it.
+ */
+void
+qdisc_destroy (struct QDISC* qd) {
+	struct NETPACKET* pkt;
+	int i;
+
+	if (qd == NULL)
+		return;
+
+	for (i = 0; i < QDISC_FLOWS; i++)
+		while ((pkt = qdisc_pop (qd, &qd->flow[i])) != NULL)
+			network_free_packet (pkt);
+
+	kfree (qd);
+}
+
+/*
+ * This will add packet [pkt] to queue [qd] of device [dev]. If the queue is
+ * full, a packet of the flow with the most bytes queued is dropped.
+ */
+void
+qdisc_enqueue (struct DEVICE* dev, struct QDISC* qd, struct NETPACKET* pkt) {
+	struct QDISC_FLOW* f = qdisc_classify (qd, pkt);
+	struct QDISC_FLOW* fat;
+	int i;
+
+	/* append it to its flow */
+	pkt->tstamp = qdisc_now();
+	pkt->next = NULL;
+	if (f->first == NULL)
+		f->first = pkt;
+	else
+		f->last->next = pkt;
+	f->last = pkt;
+	f->backlog += pkt->len + pkt->header_len;
+
+	qd->backlog++;
+	if (qd->backlog > qd->max_backlog)
+		qd->max_backlog = qd->backlog;
+
+	/* a flow that wasn't sending is new, and gets served first */
+	if (!f->active) {
+		f->active = 1;
+		f->deficit = QDISC_QUANTUM;
+		qdisc_list_append (&qd->new_first, &qd->new_last, f);
+	}
+
+	/* over the limit? */
+	if (qd->backlog > qd->limit) {
+		/* yes. punish whoever is queueing the most */
+		fat = &qd->flow[0];
+		for (i = 1; i < QDISC_FLOWS; i++)
+			if (qd->flow[i].backlog > fat->backlog)
+				fat = &qd->flow[i];
+
+		pkt = qdisc_pop (qd, fat);
+		qd->limit_drops++;
+		network_drop (dev, NETWORK_DROP_TXQUEUE);
+		network_free_packet (pkt);
+	}
+}
+
+/*
+ * This will return the next packet of queue [qd] that device [dev] should send,
+ * or NULL if there is nothing to send.
+ */
+struct NETPACKET*
+qdisc_dequeue (struct DEVICE* dev, struct QDISC* qd) {
+	struct QDISC_FLOW* f;
+	struct NETPACKET* pkt;
+	int new_flow;
+
+	for (;;) {
+		/* new flows go first */
+		if (qd->new_first != NULL) {
+			f = qd->new_first;
+			new_flow = 1;
+		} else if (qd->old_first != NULL) {
+			f = qd->old_first;
+			new_flow = 0;
+		} else
+			/* nothing to send */
+			return NULL;
+
+		/* used up its quantum? */
+		if (f->deficit <= 0) {
+			/* yes. it gets a new one, but has to wait its turn */
+			f->deficit += QDISC_QUANTUM;
+			if (new_flow)
+				qdisc_list_pop (&qd->new_first, &qd->new_last);
+			else
+				qdisc_list_pop (&qd->old_first, &qd->old_last);
+			qdisc_list_append (&qd->old_first, &qd->old_last, f);
+			continue;
+		}
+
+		/* got a packet? */
+		pkt = qdisc_codel_dequeue (dev, qd, f);
+		if (pkt != NULL) {
+			/* yes. send it */
+			f->deficit -= pkt->len + pkt->header_len;
+			return pkt;
+		}
+
+		/*
+		 * The flow ran dry. A new flow goes to the old flows once, so it cannot
+		 * stay ahead of the others by sending in bursts.
+		 */
+		if (new_flow) {
+			qdisc_list_pop (&qd->new_first, &qd->new_last);
+			if (qd->old_first != NULL)
+				qdisc_list_append (&qd->old_first, &qd->old_last, f);
+			else
+				f->active = 0;
+		} else {
+			qdisc_list_pop (&qd->old_first, &qd->old_last);
+			f->active = 0;
+		}
+	}
+}
+
+/* vim:set ts=2 sw=2: */
@@ -0,0 +1,437 @@
+/*
+ * shaper.c - ILIOS Transmit Shaping
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * This implements a token bucket shaper along the lines of HTB. Packets are
+ * sorted into classes by their DSCP; every class has a guaranteed rate and a
+ * ceiling up to which it may borrow what the device has left. Classes within
+ * their rate go first, by strict priority; classes of the same priority share
+ * by weight. Every class queues its packets with FQ-CoDel.
+ *
+ * The buckets are filled by the timer, so sending a packet only costs a few
+ * subtractions and no clock is read per packet.
+ *
+ */
+#include <sys/types.h>
+#include <sys/device.h>
+#include <sys/kmalloc.h>
+#include <sys/network.h>
+#include <sys/qdisc.h>
+#include <sys/shaper.h>
+#include <netipv4/ip.h>
+#include <lib/lib.h>
+#include <md/config.h>
+
+/* shaper_ticks is bumped by the timer, shaper_ticks_done by shaper_timers() */
+volatile uint32_t shaper_ticks = 0;
+uint32_t shaper_ticks_done = 0;
+
+/*
+ * This will set bucket [b] up to fill at [rate] kbit/s, and fill it.
+ */
+static void
+shaper_bucket_init (struct SHAPER_BUCKET* b, uint32_t rate) {
+	/* a kbit/s is 125 bytes per second */
+	b->rate = rate;
+	b->step = (rate * 125) / HZ;
+	b->frac = (rate * 125) % HZ;
+	b->credit = 0;
+
+	/* hold a few ticks worth, but at least a couple of frames */
+	b->burst = b->step * SHAPER_BURST_TICKS;
+	if (b->burst < SHAPER_MIN_BURST)
+		b->burst = SHAPER_MIN_BURST;
+	b->tokens = b->burst;
+}
+
+/*
+ * This will add the tokens of [ticks] timer ticks to bucket [b].
+ */
+static void
+shaper_bucket_fill (struct SHAPER_BUCKET* b, uint32_t ticks) {
+	uint32_t add;
+
+	b->credit += b->frac * ticks;
+	add = (b->step * ticks) + (b->credit / HZ);
+	b->credit %= HZ;
+
+	/* never hold more than a burst */
+	if (add >= (uint32_t)((int32_t)b->burst - b->tokens))
+		b->tokens = b->burst;
+	else
+		b->tokens += add;
+}
+
+/*
+ * This will take [len] bytes worth of tokens from bucket [b]. The debt is
+ * limited to a burst, so a class that borrowed a lot is not silenced forever.
+ */
+static void
+shaper_bucket_charge (struct SHAPER_BUCKET* b, uint32_t len) {
+	b->tokens -= len;
+	if (b->tokens < -(int32_t)b->burst)
+		b->tokens = -(int32_t)b->burst;
+}
+
+/*
+ * This will return the mode class [cl] is in, based on its buckets.
+ */
+static int
+shaper_mode (struct SHAPER_CLASS* cl) {
+	if (cl->ceil.tokens <= 0)
+		return SHAPER_MODE_HOLD;
+	if (cl->rate.tokens <= 0)
+		return SHAPER_MODE_BORROW;
+	return SHAPER_MODE_SEND;
+}
+
+/*
+ * This will add class [cl] of shaper [s] to the tail of the list of its
+ * current mode and priority. Classes on hold aren't listed.
+ */
+static void
+shaper_link (struct SHAPER* s, struct SHAPER_CLASS* cl) {
+	struct SHAPER_CLASS** head;
+
+	cl->mode = shaper_mode (cl);
+	if (cl->mode == SHAPER_MODE_HOLD)
+		return;
+
+	head = &s->list[cl->mode][cl->prio];
+	if (*head == NULL) {
+		/* first one. the list is a ring */
+		cl->next = cl; cl->prev = cl;
+		*head = cl;
+		s->mask[cl->mode] |= (1 << cl->prio);
+	} else {
+		/* add it before the head, which is the tail of the ring */
+		cl->next = *head;
+		cl->prev = (*head)->prev;
+		cl->prev->next = cl;
+		(*head)->prev = cl;
+	}
+	cl->listed = 1;
+}
+
+/*
+ * This will remove class [cl] of shaper [s] from its list, if it is on one.
+ */
+static void
+shaper_unlink (struct SHAPER* s, struct SHAPER_CLASS* cl) {
+	struct SHAPER_CLASS** head;
+
+	if (!cl->listed)
+		return;
+
+	head = &s->list[cl->mode][cl->prio];
+	if (cl->next == cl) {
+		/* the only one. the list is empty now */
+		*head = NULL;
+		s->mask[cl->mode] &= ~(1 << cl->prio);
+	} else {
+		cl->prev->next = cl->next;
+		cl->next->prev = cl->prev;
+		if (*head == cl)
+			*head = cl->next;
+	}
+	cl->listed = 0;
+}
+
+/*
+ * This will put class [cl] of shaper [s] on the right list, after its
+ * buckets changed. Classes without packets aren't listed.
+ */
+static void
+shaper_update (struct SHAPER* s, struct SHAPER_CLASS* cl) {
+	if (cl->qdisc->backlog == 0) {
+		shaper_unlink (s, cl);
+		return;
+	}
+
+	if (cl->listed && (cl->mode == shaper_mode (cl)))
+		return;
+
+	shaper_unlink (s, cl);
+	shaper_link (s, cl);
+}
+
+/*
+ * This will set the buckets of class [cl] of shaper [s] up for the rate and
+ * ceiling it was given, but never above the rate of the device.
+ */
+static void
+shaper_class_rates (struct SHAPER* s, struct SHAPER_CLASS* cl) {
+	uint32_t rate = cl->want_rate, ceil = cl->want_ceil;
+
+	if ((rate == 0) || (rate > s->root.rate))
+		rate = s->root.rate;
+	if ((ceil == 0) || (ceil > s->root.rate))
+		ceil = s->root.rate;
+
+	/* the class may have to move to another list */
+	shaper_unlink (s, cl);
+	shaper_bucket_init (&cl->rate, rate);
+	shaper_bucket_init (&cl->ceil, ceil);
+	shaper_update (s, cl);
+}
+
+/*
+ * This will free class [cl] of the shaper of device [dev]. Its packets are
+ * moved to queue [qd].
+ */
+static void
+shaper_free_class (struct DEVICE* dev, struct SHAPER_CLASS* cl, struct QDISC* qd) {
+	struct SHAPER* s = dev->shaper;
+	struct NETPACKET* pkt;
+
+	if (cl->qdisc == NULL)
+		return;
+
+	shaper_unlink (s, cl);
+	while ((pkt = qdisc_dequeue (dev, cl->qdisc)) != NULL)
+		qdisc_enqueue (dev, qd, pkt);
+	qdisc_destroy (cl->qdisc);
+	kmemset (cl, 0, sizeof (struct SHAPER_CLASS));
+}
+
+/*
+ * This will set the rate of device [dev] to [rate] kbit/s, setting up a
+ * shaper if the device doesn't have one yet. A rate of zero removes the
+ * shaper; any packets waiting in it are sent unshaped. It will return zero on
+ * failure or non-zero on success.
+ */
+int
+shaper_set_rate (struct DEVICE* dev, uint32_t rate) {
+	struct SHAPER* s = dev->shaper;
+	int i;
+
+	/* removing it? */
+	if (rate == 0) {
+		/* yes. do so */
+		if (s == NULL)
+			return 1;
+		for (i = 0; i < SHAPER_CLASSES; i++)
+			shaper_free_class (dev, &s->class[i], dev->qdisc);
+		dev->shaper = NULL;
+		kfree (s);
+		return 1;
+	}
+
+	/* got a shaper already? */
+	if (s != NULL) {
+		/* yes. change the rate; the classes must fit within it */
+		shaper_bucket_init (&s->root, rate);
+		for (i = 0; i < SHAPER_CLASSES; i++)
+			if (s->class[i].qdisc != NULL)
+				shaper_class_rates (s, &s->class[i]);
+		return 1;
+	}
+
+	/* set a new one up */
+	s = (struct SHAPER*)kmalloc (NULL, sizeof (struct SHAPER), 0);
+	if (s == NULL)
+		return 0;
+	kmemset (s, 0, sizeof (struct SHAPER));
+	kmemset (s->dscp, SHAPER_DSCP_DEFAULT, SHAPER_DSCPS);
+	shaper_bucket_init (&s->root, rate);
+
+	/* everything goes to class 0, at the device rate, until told otherwise */
+	dev->shaper = s;
+	if (!shaper_set_class (dev, 0, 0, 0, SHAPER_PRIOS - 1, 1)) {
+		dev->shaper = NULL;
+		kfree (s);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * This will set class [num] of the shaper of device [dev] up to send at
+ * [rate] kbit/s, borrowing up to [ceil] kbit/s, with priority [prio] and
+ * weight [weight]. A rate or ceiling of zero, or one above the rate of the
+ * device, means the device rate. It will return zero on failure or non-zero
+ * on success.
+ */
+int
+shaper_set_class (struct DEVICE* dev, int num, uint32_t rate, uint32_t ceil, int prio, int weight) {
+	struct SHAPER* s = dev->shaper;
+	struct SHAPER_CLASS* cl = &s->class[num];
+
+	/* new class? */
+	if (cl->qdisc == NULL) {
+		/* yes. it needs a queue */
+		cl->qdisc = qdisc_create (dev->qdisc->limit);
+		if (cl->qdisc == NULL)
+			return 0;
+	}
+
+	/* the class may have to move to another list */
+	shaper_unlink (s, cl);
+	cl->want_rate = rate;
+	cl->want_ceil = ceil;
+	cl->prio = prio;
+	cl->quantum = weight * SHAPER_QUANTUM;
+	cl->deficit = cl->quantum;
+	shaper_class_rates (s, cl);
+	return 1;
+}
+
+/*
+ * This will remove class [num] of the shaper of device [dev], which must not
+ * be the default class. Its code points and any packets waiting in it go to
+ * the default class.
+ */
+void
+shaper_remove_class (struct DEVICE* dev, int num) {
+	struct SHAPER* s = dev->shaper;
+	struct SHAPER_CLASS* def = &s->class[s->defclass];
+	uint32_t backlog = s->class[num].qdisc->backlog + def->qdisc->backlog;
+	int i;
+
+	for (i = 0; i < SHAPER_DSCPS; i++)
+		if (s->dscp[i] == num)
+			s->dscp[i] = SHAPER_DSCP_DEFAULT;
+
+	shaper_free_class (dev, &s->class[num], def->qdisc);
+	s->backlog -= backlog - def->qdisc->backlog;
+	shaper_update (s, def);
+}
+
+/*
+ * This will queue packet [pkt] for transmission by the shaper of device [dev].
+ */
+void
+shaper_enqueue (struct DEVICE* dev, struct NETPACKET* pkt) {
+	struct SHAPER* s = dev->shaper;
+	ETHERNET_HEADER* eh = (ETHERNET_HEADER*)pkt->frame;
+	struct IP_HEADER* iphdr = (struct IP_HEADER*)(pkt->frame + pkt->header_len);
+	struct SHAPER_CLASS* cl;
+	uint32_t backlog;
+	int num = SHAPER_DSCP_DEFAULT;
+
+	/* pick the class by the DSCP of IPv4 packets */
+	if ((eh->type[0] == (ETHERTYPE_IP >> 8)) && (eh->type[1] == (ETHERTYPE_IP & 0xff)) &&
+	    (pkt->len >= sizeof (struct IP_HEADER)))
+		num = s->dscp[iphdr->tos >> 2];
+	if (num == SHAPER_DSCP_DEFAULT)
+		num = s->defclass;
+	cl = &s->class[num];
+
+	/* queue it; this may drop a packet if the class is full */
+	backlog = cl->qdisc->backlog;
+	qdisc_enqueue (dev, cl->qdisc, pkt);
+	s->backlog += cl->qdisc->backlog - backlog;
+
+	/* if the class was idle, it gets a fresh round */
+	if (!cl->listed && (backlog == 0))
+		cl->deficit = cl->quantum;
+	shaper_update (s, cl);
+}
+
+/*
+ * This will return the next packet the shaper of device [dev] allows to be
+ * sent, or NULL if there is none.
+ */
+struct NETPACKET*
+shaper_dequeue (struct DEVICE* dev) {
+	struct SHAPER* s = dev->shaper;
+	struct SHAPER_CLASS* cl;
+	struct NETPACKET* pkt;
+	uint32_t backlog, len;
+	int mode;
+
+	for (;;) {
+		/* nothing goes out faster than the device rate */
+		if (s->root.tokens <= 0)
+			/* wait for the timer to give us tokens */
+			return NULL;
+
+		/* anyone within their rate? */
+		if (s->mask[SHAPER_MODE_SEND] != 0)
+			mode = SHAPER_MODE_SEND;
+		else if (s->mask[SHAPER_MODE_BORROW] != 0)
+			/* no, but someone may borrow */
+			mode = SHAPER_MODE_BORROW;
+		else
+			/* no. nothing to send */
+			return NULL;
+		cl = s->list[mode][klowbit (s->mask[mode])];
+
+		/* fetch a packet; FQ-CoDel may drop some on the way */
+		backlog = cl->qdisc->backlog;
+		pkt = qdisc_dequeue (dev, cl->qdisc);
+		s->backlog -= backlog - cl->qdisc->backlog;
+		if (pkt != NULL)
+			break;
+
+		/* it ran dry */
+		shaper_unlink (s, cl);
+	}
+
+	/* charge it */
+	len = pkt->len + pkt->header_len;
+	shaper_bucket_charge (&cl->rate, len);
+	shaper_bucket_charge (&cl->ceil, len);
+	shaper_bucket_charge (&s->root, len);
+	cl->deficit -= len;
+	cl->frames++; cl->bytes += len;
+	if (mode == SHAPER_MODE_BORROW)
+		cl->borrowed++;
+
+	/* used up its round? */
+	if ((cl->deficit <= 0) && cl->listed) {
+		/* yes. the next class of this priority gets a turn */
+		cl->deficit += cl->quantum;
+		s->list[mode][cl->prio] = cl->next;
+	}
+	shaper_update (s, cl);
+	return pkt;
+}
+
+/*
+ * This will be called from the timer interrupt on every tick.
+ */
+void
+shaper_tick() {
+	shaper_ticks++;
+}
+
+/*
+ * This will be called from the main loop, and refill the buckets of all
+ * shapers for the ticks that passed.
+ */
+void
+shaper_timers() {
+	struct DEVICE* dev;
+	struct SHAPER* s;
+	uint32_t ticks;
+	int i;
+
+	/* did we tick since the last time? */
+	ticks = shaper_ticks - shaper_ticks_done;
+	if (ticks == 0)
+		/* no. nothing to do */
+		return;
+	shaper_ticks_done += ticks;
+
+	/* a second fills any bucket; don't overflow after a long wait */
+	if (ticks > HZ)
+		ticks = HZ;
+
+	for (dev = coredevice; dev != NULL; dev = dev->next) {
+		s = dev->shaper;
+		if (s == NULL)
+			continue;
+
+		shaper_bucket_fill (&s->root, ticks);
+		for (i = 0; i < SHAPER_CLASSES; i++) {
+			if (s->class[i].qdisc == NULL)
+				continue;
+			shaper_bucket_fill (&s->class[i].rate, ticks);
+			shaper_bucket_fill (&s->class[i].ceil, ticks);
+			shaper_update (s, &s->class[i]);
+		}
+	}
+}
+
+/* vim:set ts=2 sw=2: */
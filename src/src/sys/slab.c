@@ -0,0 +1,165 @@
+/*
+ * slab.c - ILIOS Kernel Object Caches
+ * (c) 2003 Rink Springer, BSD licensed
+ *
+ * Fixed size objects, like sockets and ARP records, come from caches which
+ * carve pages into objects of a single size. Allocating and freeing is a
+ * matter of taking an object off or putting it back on the free list of its
+ * page.
+ *
+ * Objects are constructed once, when their page is set up, and must be given
+ * back in the state the constructor leaves them in; without a constructor,
+ * that is all zeroes. The free list link is kept right behind every object,
+ * so it doesn't disturb that state.
+ *
+ */
+#include <sys/types.h>
+#include <sys/kmalloc.h>
+#include <sys/slab.h>
+#include <lib/lib.h>
+#include <lib/list.h>
+#include <md/config.h>
+
+/* KMEM_LINK(cache,obj) is the free list link of object [obj] */
+#define KMEM_LINK(cache,obj) (*(void**)((addr_t)(obj) + (cache)->size))
+
+/* kmem_caches are all caches */
+struct KMEM_CACHE* kmem_caches = NULL;
+
+/*
+ * This will create a cache of objects of [size] bytes, aligned at [align]
+ * bytes, which must be a power of two. Every object is passed to [ctor], if
+ * given, when it is first set up; otherwise, it starts out zeroed. It will
+ * return the cache on success or NULL on failure.
+ */
+struct KMEM_CACHE*
+kmem_cache_create (char* name, size_t size, size_t align, void (*ctor)(void* obj)) {
+	struct KMEM_CACHE* cache;
+	size_t stride, first;
+
+	/* leave room for the link, and keep it aligned */
+	if (align < sizeof (void*))
+		align = sizeof (void*);
+	size = (size + sizeof (void*) - 1) & ~(sizeof (void*) - 1);
+	stride = (size + sizeof (void*) + align - 1) & ~(align - 1);
+	first = (sizeof (struct KMEM_SLAB) + align - 1) & ~(align - 1);
+
+	/* will at least one object fit in a page? */
+	if (first + stride > PAGESIZE)
+		/* no. use kmalloc() for such large objects */
+		return NULL;
+
+	cache = (struct KMEM_CACHE*)kmalloc (NULL, sizeof (struct KMEM_CACHE), 0);
+	if (cache == NULL)
+		return NULL;
+	kmemset (cache, 0, sizeof (struct KMEM_CACHE));
+	cache->name = name;
+	cache->size = size;
+	cache->stride = stride;
+	cache->offset = first;
+	cache->perslab = (PAGESIZE - first) / stride;
+	cache->ctor = ctor;
+
+	/* hook it in the list */
+	cache->next = kmem_caches;
+	kmem_caches = cache;
+	return cache;
+}
+
+/*
+ * This will set up a new slab for cache [cache] and put it on the partial
+ * list. It will return zero on failure or non-zero on success.
+ */
+static int
+kmem_cache_grow (struct KMEM_CACHE* cache) {
+	struct KMEM_SLAB* slab;
+	addr_t obj;
+	uint32_t i;
+
+	/* whole pages come page aligned */
+	slab = (struct KMEM_SLAB*)kmalloc (NULL, PAGESIZE, 0);
+	if (slab == NULL)
+		return 0;
+	kmemset (slab, 0, PAGESIZE);
+	slab->cache = cache;
+
+	/* construct all objects and chain them, lowest address first */
+	obj = (addr_t)slab + cache->offset + (cache->perslab - 1) * cache->stride;
+	for (i = 0; i < cache->perslab; i++, obj -= cache->stride) {
+		if (cache->ctor != NULL)
+			cache->ctor ((void*)obj);
+		KMEM_LINK (cache, obj) = slab->free;
+		slab->free = (void*)obj;
+	}
+
+	KLIST_LINK (&cache->partial, slab);
+	cache->slabs++;
+	cache->avail += cache->perslab;
+	return 1;
+}
+
+/*
+ * This will return an object from cache [cache], or NULL if we're out of
+ * memory.
+ */
+void*
+kmem_cache_alloc (struct KMEM_CACHE* cache) {
+	struct KMEM_SLAB* slab;
+	void* obj;
+
+	/* need a fresh slab? */
+	if ((cache->partial == NULL) && !kmem_cache_grow (cache))
+		/* yes, but there's no memory left */
+		return NULL;
+
+	/* take the first free object */
+	slab = cache->partial;
+	obj = slab->free;
+	slab->free = KMEM_LINK (cache, obj);
+	slab->inuse++;
+	cache->inuse++; cache->avail--;
+
+	/* was that the last one? */
+	if (slab->free == NULL) {
+		/* yes. the slab is full now */
+		KLIST_UNLINK (&cache->partial, slab);
+		KLIST_LINK (&cache->full, slab);
+	}
+	return obj;
+}
+
+/*
+ * This will give object [obj] back to cache [cache].
+ */
+void
+kmem_cache_free (struct KMEM_CACHE* cache, void* obj) {
+	struct KMEM_SLAB* slab = (struct KMEM_SLAB*)((addr_t)obj & ~(PAGESIZE - 1));
+
+	/* is this ours? */
+	if (slab->cache != cache)
+		panic ("kmem_cache_free(): 0x%x isn't in cache %s\n", obj, cache->name);
+
+	/* was the slab full? */
+	if (slab->free == NULL) {
+		/* yes. it isn't anymore */
+		KLIST_UNLINK (&cache->full, slab);
+		KLIST_LINK (&cache->partial, slab);
+	}
+
+	/* put the object back */
+	KMEM_LINK (cache, obj) = slab->free;
+	slab->free = obj;
+	slab->inuse--;
+	cache->inuse--; cache->avail++;
+
+	/* give the page back if the slab is unused and there are enough free
+	 * objects elsewhere */
+	if ((slab->inuse == 0) && (cache->avail - cache->perslab >= cache->perslab)) {
+		KLIST_UNLINK (&cache->partial, slab);
+		cache->slabs--;
+		cache->avail -= cache->perslab;
+		kfree (slab);
+	}
+}
+
+/* vim:set ts=2 sw=2: */
@@ -27,7 +27,7 @@ timeout 2
 
 # normal bootup
 title ILIOS
-kernel --type=netbsd /boot/ilios
+kernel /boot/ilios
 ' > /mnt/boot/grub/grub.cfg
 umount /mnt
 echo 'root (fd0)